@@ -0,0 +1,458 @@
+/*
+ * ProFTPD - mod_loiter agent
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "agent.h"
+#include "cluster.h"
+
+#include <sys/un.h>
+
+/* How long, in seconds, the agent waits in select(2) before checking that
+ * the daemon is still around.
+ */
+#define LOITER_AGENT_POLL_INTERVAL	1
+
+static pid_t agent_pid = 0;
+static const char *agent_path = NULL;
+
+static const char *check_addr = NULL;
+static loiter_agent_status_cb check_cb = NULL;
+
+static const char *cluster_addr = NULL;
+static array_header *cluster_peers = NULL;
+static int cluster_interval = 0;
+static const unsigned char *cluster_key = NULL;
+static unsigned int cluster_max_count = 0;
+
+static const char *trace_channel = "loiter.agent";
+
+int loiter_agent_resolve(pool *p, const char *addr, int socktype,
+    struct sockaddr_storage *ss, socklen_t *sslen) {
+  int res;
+  char *host, *ptr;
+  struct addrinfo hints, *info = NULL;
+
+  if (p == NULL ||
+      addr == NULL ||
+      ss == NULL ||
+      sslen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  host = pstrdup(p, addr);
+
+  /* Allow for IPv6 addresses, e.g. "[::1]:9999". */
+  ptr = strrchr(host, ':');
+  if (ptr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *ptr++ = '\0';
+  if (*host == '[') {
+    size_t hostlen;
+
+    host++;
+    hostlen = strlen(host);
+    if (hostlen > 0 &&
+        host[hostlen-1] == ']') {
+      host[hostlen-1] = '\0';
+    }
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = socktype;
+  hints.ai_flags = AI_PASSIVE|AI_NUMERICHOST;
+
+  res = getaddrinfo(*host ? host : NULL, ptr, &hints, &info);
+  if (res != 0) {
+    pr_trace_msg(trace_channel, 1, "error resolving '%s': %s", addr,
+      gai_strerror(res));
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(ss, 0, sizeof(struct sockaddr_storage));
+  memcpy(ss, info->ai_addr, info->ai_addrlen);
+  *sslen = info->ai_addrlen;
+  freeaddrinfo(info);
+
+  return 0;
+}
+
+static int agent_listen_unix(pool *p, const char *path) {
+  int fd, res, xerrno;
+  struct sockaddr_un sock;
+
+  if (strlen(path) >= sizeof(sock.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&sock, 0, sizeof(sock));
+  sock.sun_family = AF_UNIX;
+  sstrncpy(sock.sun_path, path, sizeof(sock.sun_path));
+
+  PRIVS_ROOT
+  (void) unlink(path);
+  res = bind(fd, (struct sockaddr *) &sock, sizeof(sock));
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  agent_path = pstrdup(p, path);
+  return fd;
+}
+
+static int agent_listen_tcp(pool *p, const char *addr) {
+  int fd, res, xerrno, on = 1;
+  struct sockaddr_storage ss;
+  socklen_t sslen;
+
+  if (loiter_agent_resolve(p, addr, SOCK_STREAM, &ss, &sslen) < 0) {
+    return -1;
+  }
+
+  fd = socket(ss.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on));
+
+  PRIVS_ROOT
+  res = bind(fd, (struct sockaddr *) &ss, sslen);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  return fd;
+}
+
+static void agent_handle_check(pool *p, int listen_fd) {
+  int fd;
+  pool *tmp_pool;
+  const char *status;
+
+  fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    pr_trace_msg(trace_channel, 3, "error accepting connection: %s",
+      strerror(errno));
+    return;
+  }
+
+  tmp_pool = make_sub_pool(p);
+  status = (check_cb)(tmp_pool);
+  if (status != NULL) {
+    pr_trace_msg(trace_channel, 17, "sending agent status: %s", status);
+
+    if (write(fd, status, strlen(status)) < 0 ||
+        write(fd, "\n", 1) < 0) {
+      pr_trace_msg(trace_channel, 3, "error sending agent status: %s",
+        strerror(errno));
+    }
+  }
+
+  destroy_pool(tmp_pool);
+  (void) close(fd);
+}
+
+static void agent_loop(pool *p, int check_fd, loiter_cluster_t *cluster,
+    pid_t daemon_pid) {
+  int cluster_fd = -1;
+
+  if (cluster != NULL) {
+    cluster_fd = loiter_cluster_get_fd(cluster);
+  }
+
+  while (TRUE) {
+    int maxfd = -1, res;
+    fd_set rfds;
+    struct timeval tv;
+    time_t now;
+
+    /* If the daemon went away without stopping us, so should we. */
+    if (getppid() != daemon_pid) {
+      pr_trace_msg(trace_channel, 3, "daemon process %lu gone, exiting",
+        (unsigned long) daemon_pid);
+      break;
+    }
+
+    FD_ZERO(&rfds);
+
+    if (check_fd >= 0) {
+      FD_SET(check_fd, &rfds);
+      maxfd = check_fd;
+    }
+
+    if (cluster_fd >= 0) {
+      FD_SET(cluster_fd, &rfds);
+      if (cluster_fd > maxfd) {
+        maxfd = cluster_fd;
+      }
+    }
+
+    tv.tv_sec = LOITER_AGENT_POLL_INTERVAL;
+    tv.tv_usec = 0;
+
+    res = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+    now = time(NULL);
+
+    if (res > 0) {
+      if (check_fd >= 0 &&
+          FD_ISSET(check_fd, &rfds)) {
+        agent_handle_check(p, check_fd);
+      }
+
+      if (cluster_fd >= 0 &&
+          FD_ISSET(cluster_fd, &rfds)) {
+        /* Drain all of the pending reports. */
+        while (loiter_cluster_recv(p, cluster, now) == 0 ||
+               errno == EPERM) {
+        }
+      }
+    }
+
+    if (cluster != NULL) {
+      (void) loiter_cluster_send(p, cluster, now);
+
+      if (loiter_cluster_publish(p, cluster, now) < 0) {
+        pr_trace_msg(trace_channel, 3, "error publishing cluster counts: %s",
+          strerror(errno));
+      }
+    }
+  }
+}
+
+int loiter_agent_set_check(pool *p, const char *addr,
+    loiter_agent_status_cb cb) {
+  if (p == NULL ||
+      addr == NULL ||
+      cb == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  check_addr = pstrdup(p, addr);
+  check_cb = cb;
+  return 0;
+}
+
+int loiter_agent_set_cluster(pool *p, const char *addr, array_header *peers,
+    int interval, const unsigned char *key, unsigned int max_count) {
+  if (p == NULL ||
+      addr == NULL ||
+      peers == NULL ||
+      interval < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  cluster_addr = pstrdup(p, addr);
+  cluster_peers = peers;
+  cluster_interval = interval;
+  cluster_key = NULL;
+  cluster_max_count = max_count;
+
+  if (key != NULL) {
+    unsigned char *buf;
+
+    buf = palloc(p, LOITER_CLUSTER_KEY_SIZE);
+    memcpy(buf, key, LOITER_CLUSTER_KEY_SIZE);
+    cluster_key = buf;
+  }
+
+  return 0;
+}
+
+int loiter_agent_start(pool *p) {
+  int check_fd = -1, xerrno;
+  loiter_cluster_t *cluster = NULL;
+  pid_t pid, daemon_pid;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (agent_pid != 0) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  if (check_addr == NULL &&
+      cluster_addr == NULL) {
+    /* Nothing for an agent to do. */
+    return 0;
+  }
+
+  /* Set up the sockets here, so that any errors are reported by the
+   * daemon.
+   */
+  if (check_addr != NULL) {
+    if (*check_addr == '/') {
+      check_fd = agent_listen_unix(p, check_addr);
+
+    } else {
+      check_fd = agent_listen_tcp(p, check_addr);
+    }
+
+    if (check_fd < 0 ||
+        listen(check_fd, 32) < 0) {
+      xerrno = errno;
+
+      if (check_fd >= 0) {
+        (void) close(check_fd);
+      }
+
+      pr_trace_msg(trace_channel, 1, "unable to listen on '%s': %s",
+        check_addr, strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  if (cluster_addr != NULL) {
+    cluster = loiter_cluster_open(p, cluster_addr, cluster_peers,
+      cluster_interval, cluster_key, cluster_max_count);
+    if (cluster == NULL) {
+      xerrno = errno;
+
+      if (check_fd >= 0) {
+        (void) close(check_fd);
+      }
+
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  daemon_pid = getpid();
+
+  pid = fork();
+  switch (pid) {
+    case -1:
+      xerrno = errno;
+
+      if (check_fd >= 0) {
+        (void) close(check_fd);
+      }
+
+      if (cluster != NULL) {
+        (void) loiter_cluster_close(cluster);
+      }
+
+      errno = xerrno;
+      return -1;
+
+    case 0:
+      /* We're the agent; ignore the signals meant for the daemon. */
+      signal(SIGHUP, SIG_IGN);
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+
+      pr_trace_msg(trace_channel, 7, "agent process %lu started",
+        (unsigned long) getpid());
+
+      agent_loop(p, check_fd, cluster, daemon_pid);
+      _exit(0);
+
+    default:
+      break;
+  }
+
+  if (check_fd >= 0) {
+    (void) close(check_fd);
+  }
+
+  if (cluster != NULL) {
+    (void) loiter_cluster_close(cluster);
+  }
+
+  agent_pid = pid;
+
+  pr_trace_msg(trace_channel, 9, "started agent process %lu",
+    (unsigned long) agent_pid);
+  return 0;
+}
+
+int loiter_agent_stop(void) {
+  check_addr = NULL;
+  check_cb = NULL;
+  cluster_addr = NULL;
+  cluster_peers = NULL;
+  cluster_interval = 0;
+  cluster_key = NULL;
+  cluster_max_count = 0;
+
+  if (agent_pid == 0) {
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 9, "stopping agent process %lu",
+    (unsigned long) agent_pid);
+
+  if (kill(agent_pid, SIGTERM) < 0) {
+    pr_trace_msg(trace_channel, 3, "error sending SIGTERM to agent %lu: %s",
+      (unsigned long) agent_pid, strerror(errno));
+
+  } else {
+    int status;
+
+    /* The daemon's SIGCHLD handler may already have reaped it. */
+    while (waitpid(agent_pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        break;
+      }
+    }
+  }
+
+  if (agent_path != NULL) {
+    PRIVS_ROOT
+    (void) unlink(agent_path);
+    PRIVS_RELINQUISH
+    agent_path = NULL;
+  }
+
+  agent_pid = 0;
+  return 0;
+}
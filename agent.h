@@ -0,0 +1,60 @@
+/*
+ * ProFTPD - mod_loiter agent
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_AGENT_H
+#define MOD_LOITER_AGENT_H
+
+#include "mod_loiter.h"
+
+/* The agent is a process forked from the daemon, so that work such as
+ * answering load balancer checks and exchanging counts with cluster peers
+ * never happens in the daemon or session processes.
+ */
+
+/* Answer load balancer "agent checks", e.g. HAProxy's agent-check, with the
+ * status returned by the given callback.  The address is either an absolute
+ * path, for a Unix domain socket, or an "address:port" for a TCP socket.
+ */
+typedef const char *(*loiter_agent_status_cb)(pool *p);
+int loiter_agent_set_check(pool *p, const char *addr,
+  loiter_agent_status_cb cb);
+
+/* Exchange counts with the given cluster peers (an array of "address:port"
+ * strings), using a UDP socket on the given "address:port"; see
+ * loiter_cluster_open() for the key and max_count.
+ */
+int loiter_agent_set_cluster(pool *p, const char *addr, array_header *peers,
+  int interval, const unsigned char *key, unsigned int max_count);
+
+/* Start the agent process, if there is any work configured for it. */
+int loiter_agent_start(pool *p);
+
+/* Stop the agent process, and clear its configured work. */
+int loiter_agent_stop(void);
+
+/* Resolve an "address:port" (or "[address]:port" for IPv6) string. */
+int loiter_agent_resolve(pool *p, const char *addr, int socktype,
+  struct sockaddr_storage *ss, socklen_t *sslen);
+
+#endif /* MOD_LOITER_AGENT_H */
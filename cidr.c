@@ -0,0 +1,439 @@
+/*
+ * ProFTPD - mod_loiter CIDR prefix table
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "cidr.h"
+
+#define LOITER_CIDR_IDX_IPV4		0
+#define LOITER_CIDR_IDX_IPV6		1
+
+struct loiter_cidr_node {
+  /* The prefix, with any bits past bitlen cleared. */
+  unsigned char addr[16];
+  unsigned int bitlen;
+
+  /* Nodes which only join two subtries have no weight of their own. */
+  int has_weight;
+  unsigned int weight;
+
+  struct loiter_cidr_node *children[2];
+};
+
+struct loiter_cidr_table {
+  pool *pool;
+  struct loiter_cidr_node *roots[2];
+  unsigned int count;
+};
+
+static const char *trace_channel = "loiter.cidr";
+
+static unsigned int get_bit(const unsigned char *addr, unsigned int bit) {
+  return (addr[bit / 8] >> (7 - (bit % 8))) & 0x01;
+}
+
+/* Returns the number of leading bits, up to maxbits, that the two
+ * addresses have in common.
+ */
+static unsigned int common_bits(const unsigned char *a, const unsigned char *b,
+    unsigned int maxbits) {
+  unsigned int bits = 0;
+
+  while (bits < maxbits) {
+    unsigned char diff;
+
+    diff = a[bits / 8] ^ b[bits / 8];
+    if (diff == 0) {
+      bits += 8;
+      continue;
+    }
+
+    while ((diff & 0x80) == 0) {
+      diff <<= 1;
+      bits++;
+    }
+
+    break;
+  }
+
+  return bits < maxbits ? bits : maxbits;
+}
+
+static struct loiter_cidr_node *new_node(pool *p, const unsigned char *addr,
+    unsigned int bitlen) {
+  struct loiter_cidr_node *node;
+  unsigned int nbytes;
+
+  node = pcalloc(p, sizeof(struct loiter_cidr_node));
+  node->bitlen = bitlen;
+
+  nbytes = (bitlen + 7) / 8;
+  memcpy(node->addr, addr, nbytes);
+  if (bitlen % 8 != 0) {
+    node->addr[nbytes - 1] &= (unsigned char) (0xff << (8 - (bitlen % 8)));
+  }
+
+  return node;
+}
+
+struct loiter_cidr_table *loiter_cidr_create(pool *p) {
+  struct loiter_cidr_table *tab;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  tab = pcalloc(p, sizeof(struct loiter_cidr_table));
+  tab->pool = p;
+  return tab;
+}
+
+int loiter_cidr_add(struct loiter_cidr_table *tab, int family,
+    const unsigned char *addr, unsigned int bitlen, unsigned int weight) {
+  struct loiter_cidr_node **link, *node;
+  unsigned int maxbits;
+
+  if (tab == NULL ||
+      addr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  switch (family) {
+    case AF_INET:
+      link = &(tab->roots[LOITER_CIDR_IDX_IPV4]);
+      maxbits = 32;
+      break;
+
+    case AF_INET6:
+      link = &(tab->roots[LOITER_CIDR_IDX_IPV6]);
+      maxbits = 128;
+      break;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (bitlen > maxbits) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (TRUE) {
+    struct loiter_cidr_node *leaf, *glue;
+    unsigned int common;
+
+    node = *link;
+    if (node == NULL) {
+      leaf = new_node(tab->pool, addr, bitlen);
+      leaf->has_weight = TRUE;
+      leaf->weight = weight;
+      *link = leaf;
+      break;
+    }
+
+    common = common_bits(addr, node->addr,
+      bitlen < node->bitlen ? bitlen : node->bitlen);
+
+    if (common == node->bitlen &&
+        common == bitlen) {
+      /* The same prefix. */
+      if (node->has_weight == FALSE) {
+        node->has_weight = TRUE;
+        tab->count++;
+      }
+
+      node->weight = weight;
+      return 0;
+    }
+
+    if (common == node->bitlen) {
+      /* This node's prefix covers ours; keep going. */
+      link = &(node->children[get_bit(addr, node->bitlen)]);
+      continue;
+    }
+
+    leaf = new_node(tab->pool, addr, bitlen);
+    leaf->has_weight = TRUE;
+    leaf->weight = weight;
+
+    if (common == bitlen) {
+      /* Our prefix covers this node's. */
+      leaf->children[get_bit(node->addr, bitlen)] = node;
+      *link = leaf;
+      break;
+    }
+
+    /* The prefixes diverge; join them under a new node. */
+    glue = new_node(tab->pool, addr, common);
+    glue->children[get_bit(addr, common)] = leaf;
+    glue->children[get_bit(node->addr, common)] = node;
+    *link = glue;
+    break;
+  }
+
+  tab->count++;
+  return 0;
+}
+
+int loiter_cidr_add_text(struct loiter_cidr_table *tab, const char *text) {
+  char *buf, *ptr, *cidr, *weight_str;
+  unsigned char addr[16];
+  unsigned int bitlen, weight;
+  int family = AF_INET;
+  pool *tmp_pool;
+
+  if (tab == NULL ||
+      text == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  tmp_pool = make_sub_pool(tab->pool);
+  buf = pstrdup(tmp_pool, text);
+
+  /* Strip any comment, and surrounding whitespace. */
+  ptr = strchr(buf, '#');
+  if (ptr != NULL) {
+    *ptr = '\0';
+  }
+
+  cidr = buf;
+  while (isspace((int) *cidr)) {
+    cidr++;
+  }
+
+  if (*cidr == '\0') {
+    destroy_pool(tmp_pool);
+    return 0;
+  }
+
+  weight_str = cidr;
+  while (*weight_str != '\0' &&
+         !isspace((int) *weight_str)) {
+    weight_str++;
+  }
+
+  if (*weight_str != '\0') {
+    *weight_str++ = '\0';
+  }
+
+  while (isspace((int) *weight_str)) {
+    weight_str++;
+  }
+
+  ptr = weight_str;
+  while (*ptr != '\0' &&
+         !isspace((int) *ptr)) {
+    ptr++;
+  }
+
+  if (*ptr != '\0') {
+    *ptr++ = '\0';
+    while (isspace((int) *ptr)) {
+      ptr++;
+    }
+  }
+
+  if (*weight_str == '\0' ||
+      *ptr != '\0') {
+    destroy_pool(tmp_pool);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (strcasecmp(weight_str, "allow") == 0) {
+    weight = 0;
+
+  } else if (strcasecmp(weight_str, "deny") == 0) {
+    weight = LOITER_CIDR_WEIGHT_DENY;
+
+  } else {
+    char *endp = NULL;
+    long v;
+
+    v = strtol(weight_str, &endp, 10);
+    if ((endp && *endp) ||
+        v < 0 ||
+        v > LOITER_CIDR_MAX_WEIGHT) {
+      destroy_pool(tmp_pool);
+      errno = EINVAL;
+      return -1;
+    }
+
+    weight = (unsigned int) v;
+  }
+
+  if (strchr(cidr, ':') != NULL) {
+    family = AF_INET6;
+  }
+
+  bitlen = family == AF_INET ? 32 : 128;
+
+  ptr = strchr(cidr, '/');
+  if (ptr != NULL) {
+    char *endp = NULL;
+    long v;
+
+    *ptr++ = '\0';
+
+    v = strtol(ptr, &endp, 10);
+    if ((endp && *endp) ||
+        *ptr == '\0' ||
+        v < 0 ||
+        v > (long) bitlen) {
+      destroy_pool(tmp_pool);
+      errno = EINVAL;
+      return -1;
+    }
+
+    bitlen = (unsigned int) v;
+  }
+
+  memset(addr, 0, sizeof(addr));
+  if (pr_inet_pton(family, cidr, addr) != 1) {
+    destroy_pool(tmp_pool);
+    errno = EINVAL;
+    return -1;
+  }
+
+  destroy_pool(tmp_pool);
+  return loiter_cidr_add(tab, family, addr, bitlen, weight);
+}
+
+int loiter_cidr_load(struct loiter_cidr_table *tab, const char *path) {
+  pr_fh_t *fh;
+  char buf[512];
+  unsigned int lineno = 0, nbad = 0;
+  int xerrno;
+
+  if (tab == NULL ||
+      path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fh = pr_fsio_open(path, O_RDONLY);
+  if (fh == NULL) {
+    xerrno = errno;
+    pr_trace_msg(trace_channel, 3, "error opening '%s': %s", path,
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  memset(buf, '\0', sizeof(buf));
+  while (pr_fsio_gets(buf, sizeof(buf)-1, fh) != NULL) {
+    pr_signals_handle();
+
+    lineno++;
+    if (loiter_cidr_add_text(tab, buf) < 0) {
+      nbad++;
+      pr_trace_msg(trace_channel, 3, "malformed line %u of '%s': %s", lineno,
+        path, buf);
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "ignoring malformed line %u of '%s'", lineno, path);
+    }
+
+    memset(buf, '\0', sizeof(buf));
+  }
+
+  (void) pr_fsio_close(fh);
+
+  pr_trace_msg(trace_channel, 7,
+    "loaded %u %s from '%s' (%u malformed %s)", tab->count,
+    tab->count != 1 ? "prefixes" : "prefix", path, nbad,
+    nbad != 1 ? "lines" : "line");
+  return 0;
+}
+
+int loiter_cidr_match(const struct loiter_cidr_table *tab, int family,
+    const unsigned char *addr, unsigned int *weight) {
+  static const unsigned char v4mapped[12] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff
+  };
+  const struct loiter_cidr_node *node, *best = NULL;
+  unsigned int maxbits;
+
+  if (tab == NULL ||
+      addr == NULL ||
+      weight == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  switch (family) {
+    case AF_INET:
+      node = tab->roots[LOITER_CIDR_IDX_IPV4];
+      maxbits = 32;
+      break;
+
+    case AF_INET6:
+      if (memcmp(addr, v4mapped, sizeof(v4mapped)) == 0) {
+        return loiter_cidr_match(tab, AF_INET, addr + sizeof(v4mapped),
+          weight);
+      }
+
+      node = tab->roots[LOITER_CIDR_IDX_IPV6];
+      maxbits = 128;
+      break;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  while (node != NULL) {
+    if (common_bits(addr, node->addr, node->bitlen) < node->bitlen) {
+      break;
+    }
+
+    if (node->has_weight == TRUE) {
+      best = node;
+    }
+
+    if (node->bitlen >= maxbits) {
+      break;
+    }
+
+    node = node->children[get_bit(addr, node->bitlen)];
+  }
+
+  if (best == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  *weight = best->weight;
+  return 0;
+}
+
+unsigned int loiter_cidr_count(const struct loiter_cidr_table *tab) {
+  if (tab == NULL) {
+    return 0;
+  }
+
+  return tab->count;
+}
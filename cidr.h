@@ -0,0 +1,70 @@
+/*
+ * ProFTPD - mod_loiter CIDR prefix table
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_CIDR_H
+#define MOD_LOITER_CIDR_H
+
+#include "mod_loiter.h"
+
+/* The weight for networks whose connections are always dropped. */
+#define LOITER_CIDR_WEIGHT_DENY		((unsigned int) -1)
+
+/* The largest weight, as a percentage, that may be given. */
+#define LOITER_CIDR_MAX_WEIGHT		10000
+
+/* A table of CIDR prefixes, each with a weight, held in a path-compressed
+ * binary (radix) trie per address family.  Lookups are longest-prefix
+ * matches, visiting at most one node per bit of the address.
+ */
+struct loiter_cidr_table;
+
+struct loiter_cidr_table *loiter_cidr_create(pool *p);
+
+/* Add the prefix of the given length, in bits, of the given address
+ * (4 bytes for AF_INET, 16 bytes for AF_INET6).  Re-adding a prefix replaces
+ * its weight.
+ */
+int loiter_cidr_add(struct loiter_cidr_table *tab, int family,
+  const unsigned char *addr, unsigned int bitlen, unsigned int weight);
+
+/* Add a prefix as given in a line of a table file, i.e. "cidr weight", where
+ * the weight is a percentage, or "allow" (0), or "deny".  Blank lines and
+ * comments are ignored, returning 0; malformed lines fail with EINVAL.
+ */
+int loiter_cidr_add_text(struct loiter_cidr_table *tab, const char *text);
+
+/* Add the prefixes listed in the given file, logging any malformed lines. */
+int loiter_cidr_load(struct loiter_cidr_table *tab, const char *path);
+
+/* Find the weight of the longest prefix matching the given address.  IPv4
+ * addresses mapped into IPv6 match the IPv4 prefixes.  Fails with ENOENT if
+ * no prefix matches.
+ */
+int loiter_cidr_match(const struct loiter_cidr_table *tab, int family,
+  const unsigned char *addr, unsigned int *weight);
+
+/* Returns the number of prefixes in the table. */
+unsigned int loiter_cidr_count(const struct loiter_cidr_table *tab);
+
+#endif /* MOD_LOITER_CIDR_H */
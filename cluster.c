@@ -0,0 +1,526 @@
+/*
+ * ProFTPD - mod_loiter cluster
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "agent.h"
+#include "cluster.h"
+
+/* "LTR1" */
+#define LOITER_CLUSTER_MSG_MAGIC	0x4c545231
+#define LOITER_CLUSTER_MSG_VERSION	2
+
+/* The MAC tag, after the fields of the report. */
+#define LOITER_CLUSTER_TAG_OFFSET	20
+
+struct loiter_cluster_peer {
+  const char *name;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  uint32_t seqno;
+  unsigned int conn_count;
+  unsigned int authd_count;
+  time_t last_seen;
+};
+
+struct loiter_cluster_rec {
+  pool *pool;
+  int fd;
+  int interval;
+  time_t next_send;
+  uint32_t seqno;
+
+  unsigned char key[LOITER_CLUSTER_KEY_SIZE];
+  unsigned int max_count;
+
+  struct loiter_cluster_peer *peers;
+  unsigned int npeers;
+
+  /* What we last wrote to the shm, to avoid needlessly locking it. */
+  int published;
+  unsigned int published_unauthd_count;
+  unsigned int published_npeers;
+};
+
+static const char *trace_channel = "loiter.cluster";
+
+static void write_uint32(unsigned char *buf, uint32_t v) {
+  v = htonl(v);
+  memcpy(buf, &v, sizeof(uint32_t));
+}
+
+static uint32_t read_uint32(const unsigned char *buf) {
+  uint32_t v;
+
+  memcpy(&v, buf, sizeof(uint32_t));
+  return ntohl(v);
+}
+
+static uint64_t read_uint64_le(const unsigned char *buf) {
+  register unsigned int i;
+  uint64_t v = 0;
+
+  for (i = 0; i < 8; i++) {
+    v |= ((uint64_t) buf[i]) << (8 * i);
+  }
+
+  return v;
+}
+
+#define SIP_ROTL(x, b)	(uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) \
+  do { \
+    v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+    v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+  } while (0)
+
+/* SipHash-2-4, a MAC designed for short messages such as our reports; no
+ * crypto library is needed for it.
+ */
+static uint64_t get_tag(const unsigned char *key, const unsigned char *data,
+    size_t datalen) {
+  register size_t i;
+  uint64_t k0, k1, v0, v1, v2, v3, m, last;
+  size_t nblocks;
+
+  k0 = read_uint64_le(key);
+  k1 = read_uint64_le(key + 8);
+
+  v0 = k0 ^ 0x736f6d6570736575ULL;
+  v1 = k1 ^ 0x646f72616e646f6dULL;
+  v2 = k0 ^ 0x6c7967656e657261ULL;
+  v3 = k1 ^ 0x7465646279746573ULL;
+
+  nblocks = datalen / 8;
+  for (i = 0; i < nblocks; i++) {
+    m = read_uint64_le(data + (i * 8));
+
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  last = ((uint64_t) (datalen & 0xff)) << 56;
+  for (i = 0; i < datalen % 8; i++) {
+    last |= ((uint64_t) data[(nblocks * 8) + i]) << (8 * i);
+  }
+
+  v3 ^= last;
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+  v0 ^= last;
+
+  v2 ^= 0xff;
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void write_tag(unsigned char *buf, const unsigned char *key) {
+  static const unsigned char zero_key[LOITER_CLUSTER_KEY_SIZE];
+  uint64_t tag;
+
+  tag = get_tag(key != NULL ? key : zero_key, buf, LOITER_CLUSTER_TAG_OFFSET);
+  write_uint32(buf + LOITER_CLUSTER_TAG_OFFSET, (uint32_t) (tag >> 32));
+  write_uint32(buf + LOITER_CLUSTER_TAG_OFFSET + 4, (uint32_t) tag);
+}
+
+int loiter_cluster_encode(unsigned char *buf, size_t bufsz,
+    const unsigned char *key, uint32_t seqno, unsigned int conn_count,
+    unsigned int authd_count) {
+  if (buf == NULL ||
+      bufsz < LOITER_CLUSTER_MSG_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  write_uint32(buf, LOITER_CLUSTER_MSG_MAGIC);
+  write_uint32(buf + 4, LOITER_CLUSTER_MSG_VERSION);
+  write_uint32(buf + 8, seqno);
+  write_uint32(buf + 12, conn_count);
+  write_uint32(buf + 16, authd_count);
+  write_tag(buf, key);
+
+  return LOITER_CLUSTER_MSG_SIZE;
+}
+
+int loiter_cluster_decode(const unsigned char *buf, size_t buflen,
+    const unsigned char *key, uint32_t *seqno, unsigned int *conn_count,
+    unsigned int *authd_count) {
+  register unsigned int i;
+  unsigned char expected[LOITER_CLUSTER_MSG_SIZE];
+  unsigned char diff = 0;
+
+  if (buf == NULL ||
+      seqno == NULL ||
+      conn_count == NULL ||
+      authd_count == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (buflen != LOITER_CLUSTER_MSG_SIZE ||
+      read_uint32(buf) != LOITER_CLUSTER_MSG_MAGIC ||
+      read_uint32(buf + 4) != LOITER_CLUSTER_MSG_VERSION) {
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Compare the whole tag, however early it differs, so that its timing
+   * says nothing about how much of a forged tag was right.
+   */
+  memcpy(expected, buf, LOITER_CLUSTER_TAG_OFFSET);
+  write_tag(expected, key);
+
+  for (i = LOITER_CLUSTER_TAG_OFFSET; i < LOITER_CLUSTER_MSG_SIZE; i++) {
+    diff |= expected[i] ^ buf[i];
+  }
+
+  if (diff != 0) {
+    errno = EPERM;
+    return -1;
+  }
+
+  *seqno = read_uint32(buf + 8);
+  *conn_count = read_uint32(buf + 12);
+  *authd_count = read_uint32(buf + 16);
+
+  return 0;
+}
+
+loiter_cluster_t *loiter_cluster_open(pool *p, const char *addr,
+    array_header *peers, int interval, const unsigned char *key,
+    unsigned int max_count) {
+  register int i;
+  int fd, res, xerrno;
+  struct sockaddr_storage ss;
+  socklen_t sslen;
+  loiter_cluster_t *cluster;
+  char **names;
+
+  if (p == NULL ||
+      addr == NULL ||
+      peers == NULL ||
+      interval < 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  cluster = pcalloc(p, sizeof(loiter_cluster_t));
+  cluster->pool = p;
+  cluster->interval = interval;
+  cluster->max_count = max_count;
+
+  if (key != NULL) {
+    memcpy(cluster->key, key, LOITER_CLUSTER_KEY_SIZE);
+  }
+  cluster->peers = pcalloc(p,
+    sizeof(struct loiter_cluster_peer) * peers->nelts);
+
+  names = peers->elts;
+  for (i = 0; i < peers->nelts; i++) {
+    struct loiter_cluster_peer *peer;
+
+    peer = &(cluster->peers[cluster->npeers]);
+    if (loiter_agent_resolve(p, names[i], SOCK_DGRAM, &(peer->addr),
+        &(peer->addrlen)) < 0) {
+      pr_trace_msg(trace_channel, 1, "error resolving peer '%s': %s", names[i],
+        strerror(errno));
+      continue;
+    }
+
+    peer->name = names[i];
+    cluster->npeers++;
+  }
+
+  if (loiter_agent_resolve(p, addr, SOCK_DGRAM, &ss, &sslen) < 0) {
+    xerrno = errno;
+
+    pr_trace_msg(trace_channel, 1, "error resolving '%s': %s", addr,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  fd = socket(ss.ss_family, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  PRIVS_ROOT
+  res = bind(fd, (struct sockaddr *) &ss, sslen);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    (void) close(fd);
+
+    pr_trace_msg(trace_channel, 1, "unable to bind to '%s': %s", addr,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  /* Never let a slow or missing peer block the agent. */
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    pr_trace_msg(trace_channel, 3, "error setting O_NONBLOCK on fd %d: %s",
+      fd, strerror(errno));
+  }
+
+  cluster->fd = fd;
+  pr_trace_msg(trace_channel, 7, "exchanging counts with %u %s via '%s'",
+    cluster->npeers, cluster->npeers != 1 ? "peers" : "peer", addr);
+
+  return cluster;
+}
+
+int loiter_cluster_close(loiter_cluster_t *cluster) {
+  if (cluster == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  (void) close(cluster->fd);
+  cluster->fd = -1;
+  return 0;
+}
+
+int loiter_cluster_get_fd(loiter_cluster_t *cluster) {
+  if (cluster == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return cluster->fd;
+}
+
+int loiter_cluster_send(pool *p, loiter_cluster_t *cluster, time_t now) {
+  register unsigned int i;
+  unsigned char buf[LOITER_CLUSTER_MSG_SIZE];
+  struct loiter_shm_stats stats;
+  int buflen;
+
+  if (p == NULL ||
+      cluster == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (now < cluster->next_send) {
+    return 0;
+  }
+
+  cluster->next_send = now + cluster->interval;
+
+  if (loiter_shm_get_snapshot(p, &stats) < 0) {
+    return -1;
+  }
+
+  buflen = loiter_cluster_encode(buf, sizeof(buf), cluster->key,
+    ++cluster->seqno, stats.conn_count, stats.authd_count);
+  if (buflen < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < cluster->npeers; i++) {
+    struct loiter_cluster_peer *peer;
+
+    peer = &(cluster->peers[i]);
+    if (sendto(cluster->fd, buf, buflen, 0, (struct sockaddr *) &(peer->addr),
+        peer->addrlen) < 0) {
+      pr_trace_msg(trace_channel, 5, "error sending to peer '%s': %s",
+        peer->name, strerror(errno));
+    }
+  }
+
+  return 0;
+}
+
+static int same_addr(const struct sockaddr_storage *a,
+    const struct sockaddr_storage *b) {
+  if (a->ss_family != b->ss_family) {
+    return FALSE;
+  }
+
+  switch (a->ss_family) {
+    case AF_INET: {
+      const struct sockaddr_in *a4, *b4;
+
+      a4 = (const struct sockaddr_in *) a;
+      b4 = (const struct sockaddr_in *) b;
+      return (a4->sin_port == b4->sin_port &&
+        a4->sin_addr.s_addr == b4->sin_addr.s_addr);
+    }
+
+#if defined(PR_USE_IPV6)
+    case AF_INET6: {
+      const struct sockaddr_in6 *a6, *b6;
+
+      a6 = (const struct sockaddr_in6 *) a;
+      b6 = (const struct sockaddr_in6 *) b;
+      return (a6->sin6_port == b6->sin6_port &&
+        memcmp(&(a6->sin6_addr), &(b6->sin6_addr),
+          sizeof(struct in6_addr)) == 0);
+    }
+#endif /* PR_USE_IPV6 */
+  }
+
+  return FALSE;
+}
+
+int loiter_cluster_recv(pool *p, loiter_cluster_t *cluster, time_t now) {
+  register unsigned int i;
+  unsigned char buf[LOITER_CLUSTER_MSG_SIZE + 1];
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+  ssize_t buflen;
+  uint32_t seqno;
+  unsigned int conn_count, authd_count;
+
+  if (p == NULL ||
+      cluster == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fromlen = sizeof(from);
+  buflen = recvfrom(cluster->fd, buf, sizeof(buf), 0,
+    (struct sockaddr *) &from, &fromlen);
+  if (buflen < 0) {
+    return -1;
+  }
+
+  if (loiter_cluster_decode(buf, (size_t) buflen, cluster->key, &seqno,
+      &conn_count, &authd_count) < 0) {
+    pr_trace_msg(trace_channel, 5,
+      "ignoring malformed or unauthenticated report (%ld bytes)",
+      (long) buflen);
+    errno = EPERM;
+    return -1;
+  }
+
+  /* No peer could have more connections than it is allowed; such a report
+   * could only inflate our counts, and drop our legitimate connections.
+   */
+  if (cluster->max_count > 0 &&
+      (conn_count > cluster->max_count ||
+       authd_count > cluster->max_count)) {
+    pr_trace_msg(trace_channel, 5,
+      "ignoring report of conn_count %u, authd_count %u, exceeding %u",
+      conn_count, authd_count, cluster->max_count);
+    errno = EPERM;
+    return -1;
+  }
+
+  /* We only accept reports from configured peers. */
+  for (i = 0; i < cluster->npeers; i++) {
+    struct loiter_cluster_peer *peer;
+
+    peer = &(cluster->peers[i]);
+    if (same_addr(&(peer->addr), &from) == FALSE) {
+      continue;
+    }
+
+    /* Ignore reordered reports, allowing for a restarted peer. */
+    if (peer->last_seen > 0 &&
+        seqno <= peer->seqno &&
+        seqno > 1) {
+      pr_trace_msg(trace_channel, 9, "ignoring stale report #%lu from '%s'",
+        (unsigned long) seqno, peer->name);
+      return 0;
+    }
+
+    peer->seqno = seqno;
+    peer->conn_count = conn_count;
+    peer->authd_count = authd_count;
+    peer->last_seen = now;
+
+    pr_trace_msg(trace_channel, 17,
+      "peer '%s' reports conn_count %u, authd_count %u", peer->name,
+      conn_count, authd_count);
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 5, "ignoring report from unknown peer");
+  errno = EPERM;
+  return -1;
+}
+
+int loiter_cluster_publish(pool *p, loiter_cluster_t *cluster, time_t now) {
+  register unsigned int i;
+  unsigned int unauthd_count = 0, npeers = 0;
+  uint64_t total = 0;
+  time_t ttl;
+
+  if (p == NULL ||
+      cluster == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ttl = cluster->interval * LOITER_CLUSTER_PEER_TTL_INTERVALS;
+
+  for (i = 0; i < cluster->npeers; i++) {
+    struct loiter_cluster_peer *peer;
+
+    peer = &(cluster->peers[i]);
+    if (peer->last_seen == 0 ||
+        now - peer->last_seen > ttl) {
+      continue;
+    }
+
+    if (peer->conn_count > peer->authd_count) {
+      total += (peer->conn_count - peer->authd_count);
+    }
+
+    npeers++;
+  }
+
+  /* Many peers, each near its limit, could wrap an unsigned int. */
+  unauthd_count = total > UINT_MAX ? UINT_MAX : (unsigned int) total;
+
+  if (cluster->published == TRUE &&
+      cluster->published_unauthd_count == unauthd_count &&
+      cluster->published_npeers == npeers) {
+    return 0;
+  }
+
+  if (loiter_shm_set_cluster(p, unauthd_count, npeers) < 0) {
+    return -1;
+  }
+
+  cluster->published = TRUE;
+  cluster->published_unauthd_count = unauthd_count;
+  cluster->published_npeers = npeers;
+  return 0;
+}
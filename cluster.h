@@ -0,0 +1,80 @@
+/*
+ * ProFTPD - mod_loiter cluster
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_CLUSTER_H
+#define MOD_LOITER_CLUSTER_H
+
+#include "mod_loiter.h"
+#include "shm.h"
+
+/* Default interval, in seconds, between reports to the cluster peers. */
+#define LOITER_CLUSTER_DEFAULT_INTERVAL		2
+
+/* A peer's report is ignored after this many missed intervals. */
+#define LOITER_CLUSTER_PEER_TTL_INTERVALS	3
+
+/* The size of an encoded report, in bytes, including its tag. */
+#define LOITER_CLUSTER_MSG_SIZE			28
+
+/* The size of the secret key shared by the peers; see LoiterClusterSecret. */
+#define LOITER_CLUSTER_KEY_SIZE			16
+
+typedef struct loiter_cluster_rec loiter_cluster_t;
+
+/* Encode/decode a report of the local counts.  Reports carry absolute
+ * counts rather than deltas, so that a lost datagram is simply superseded
+ * by the next one.  Each report is tagged with a MAC (SipHash-2-4) keyed
+ * with the given LOITER_CLUSTER_KEY_SIZE key, or with an all-zero key if
+ * NULL; decoding fails with EPERM if the tag does not match.
+ */
+int loiter_cluster_encode(unsigned char *buf, size_t bufsz,
+  const unsigned char *key, uint32_t seqno, unsigned int conn_count,
+  unsigned int authd_count);
+int loiter_cluster_decode(const unsigned char *buf, size_t buflen,
+  const unsigned char *key, uint32_t *seqno, unsigned int *conn_count,
+  unsigned int *authd_count);
+
+/* Open the UDP socket bound to the given "address:port", for exchanging
+ * reports with the given peers (an array of "address:port" strings), keyed
+ * as above.  Reports claiming more than max_count connections (if not zero)
+ * are dropped.
+ */
+loiter_cluster_t *loiter_cluster_open(pool *p, const char *addr,
+  array_header *peers, int interval, const unsigned char *key,
+  unsigned int max_count);
+int loiter_cluster_close(loiter_cluster_t *cluster);
+int loiter_cluster_get_fd(loiter_cluster_t *cluster);
+
+/* Send our local counts to each peer, if the interval has elapsed. */
+int loiter_cluster_send(pool *p, loiter_cluster_t *cluster, time_t now);
+
+/* Read a pending report from a peer. */
+int loiter_cluster_recv(pool *p, loiter_cluster_t *cluster, time_t now);
+
+/* Publish the sum of the peers' current unauthenticated counts to the shm,
+ * ignoring peers whose reports are too old.
+ */
+int loiter_cluster_publish(pool *p, loiter_cluster_t *cluster, time_t now);
+
+#endif /* MOD_LOITER_CLUSTER_H */
@@ -0,0 +1,86 @@
+/*
+ * ProFTPD - mod_loiter feedback controller
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "controller.h"
+
+static const char *trace_channel = "loiter.controller";
+
+int loiter_controller_init(struct loiter_controller *ctl,
+    unsigned int setpoint, double kp, double ki, unsigned int drop_pct) {
+  if (ctl == NULL ||
+      setpoint == 0 ||
+      kp < 0.0 ||
+      ki < 0.0 ||
+      drop_pct > 100) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ctl->setpoint = setpoint;
+  ctl->kp = kp;
+  ctl->ki = ki;
+  ctl->integral = ki > 0.0 ? (double) drop_pct : 0.0;
+
+  return 0;
+}
+
+int loiter_controller_step(struct loiter_controller *ctl,
+    unsigned int measured, unsigned int elapsed, unsigned int *drop_pct) {
+  double error, integral, output;
+
+  if (ctl == NULL ||
+      drop_pct == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  error = (double) measured - (double) ctl->setpoint;
+
+  integral = ctl->integral + (ctl->ki * error * elapsed);
+  if (integral < 0.0) {
+    integral = 0.0;
+
+  } else if (integral > 100.0) {
+    integral = 100.0;
+  }
+
+  ctl->integral = integral;
+
+  output = (ctl->kp * error) + integral;
+  if (output < 0.0) {
+    output = 0.0;
+
+  } else if (output > 100.0) {
+    output = 100.0;
+  }
+
+  *drop_pct = (unsigned int) (output + 0.5);
+
+  pr_trace_msg(trace_channel, 17,
+    "unauthenticated count %u, setpoint %u: error %.0f, integral %.2f, "
+    "drop probability %u", measured, ctl->setpoint, error, integral,
+    *drop_pct);
+  return 0;
+}
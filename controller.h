@@ -0,0 +1,71 @@
+/*
+ * ProFTPD - mod_loiter feedback controller
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_CONTROLLER_H
+#define MOD_LOITER_CONTROLLER_H
+
+#include "mod_loiter.h"
+
+/* Default interval, in seconds, between controller updates. */
+#define LOITER_CONTROLLER_DEFAULT_INTERVAL	1
+
+/* Default proportional gain: drop percentage per unauthenticated connection
+ * over the setpoint.
+ */
+#define LOITER_CONTROLLER_DEFAULT_KP		2.0
+
+/* Default integral gain: drop percentage per unauthenticated connection over
+ * the setpoint, per second.
+ */
+#define LOITER_CONTROLLER_DEFAULT_KI		0.5
+
+/* A proportional-integral controller, driving the count of unauthenticated
+ * connections towards the setpoint by adjusting the drop probability.
+ */
+struct loiter_controller {
+  unsigned int setpoint;
+  double kp;
+  double ki;
+
+  /* The accumulated integral term, as a percentage.  It is clamped to
+   * 0-100, so that it does not wind up while the output is saturated.
+   */
+  double integral;
+};
+
+/* Initialize the controller.  The integral term is seeded with the given
+ * drop probability, e.g. as last published, so that restarting the
+ * controller does not cause a step in its output.
+ */
+int loiter_controller_init(struct loiter_controller *ctl,
+  unsigned int setpoint, double kp, double ki, unsigned int drop_pct);
+
+/* Update the controller with the measured count of unauthenticated
+ * connections, given the number of seconds since the last update, and
+ * provide the new drop probability, as a percentage.
+ */
+int loiter_controller_step(struct loiter_controller *ctl,
+  unsigned int measured, unsigned int elapsed, unsigned int *drop_pct);
+
+#endif /* MOD_LOITER_CONTROLLER_H */
@@ -0,0 +1,315 @@
+/*
+ * ProFTPD - mod_loiter drop curves
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "curve.h"
+
+/* The steepness of LOITER_CURVE_EXPONENTIAL: the probability rises by a
+ * factor of e^k across the watermarks.
+ */
+#define LOITER_CURVE_EXP_K		4.0
+
+static const char *trace_channel = "loiter.curve";
+
+static struct {
+  const char *name;
+  int type;
+} curve_names[] = {
+  { "linear",		LOITER_CURVE_LINEAR },
+  { "quadratic",	LOITER_CURVE_QUADRATIC },
+  { "exponential",	LOITER_CURVE_EXPONENTIAL },
+  { "step",		LOITER_CURVE_STEP },
+  { "points",		LOITER_CURVE_POINTS },
+  { NULL, -1 }
+};
+
+int loiter_curve_get_type(const char *name) {
+  register unsigned int i;
+
+  if (name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; curve_names[i].name != NULL; i++) {
+    if (strcasecmp(name, curve_names[i].name) == 0) {
+      return curve_names[i].type;
+    }
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+/* e^x, for 0 <= x <= LOITER_CURVE_EXP_K, without needing libm. */
+static double curve_exp(double x) {
+  register unsigned int i;
+  double sum = 1.0, term = 1.0;
+
+  for (i = 1; i < 64; i++) {
+    term *= x / i;
+    sum += term;
+
+    if (term < 1e-12) {
+      break;
+    }
+  }
+
+  return sum;
+}
+
+int loiter_curve_parse_points(pool *p, struct loiter_curve *curve,
+    const char *text) {
+  char *buf, *ptr, *point;
+  unsigned int npoints = 1, i = 0;
+
+  if (p == NULL ||
+      curve == NULL ||
+      text == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (ptr = (char *) text; *ptr; ptr++) {
+    if (*ptr == ',') {
+      npoints++;
+    }
+  }
+
+  curve->counts = pcalloc(p, sizeof(unsigned int) * npoints);
+  curve->pcts = pcalloc(p, sizeof(unsigned int) * npoints);
+
+  buf = pstrdup(p, text);
+  while ((point = strsep(&buf, ",")) != NULL) {
+    char *endp = NULL;
+    long count, pct;
+
+    count = strtol(point, &endp, 10);
+    if (endp == point ||
+        *endp != ':' ||
+        count < 1) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    ptr = endp + 1;
+    pct = strtol(ptr, &endp, 10);
+    if (endp == ptr ||
+        *endp != '\0' ||
+        pct < 0 ||
+        pct > 100) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (i > 0 &&
+        ((unsigned int) count <= curve->counts[i-1] ||
+         (unsigned int) pct < curve->pcts[i-1])) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    curve->counts[i] = (unsigned int) count;
+    curve->pcts[i] = (unsigned int) pct;
+    i++;
+  }
+
+  if (curve->pcts[npoints-1] != 100) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  curve->type = LOITER_CURVE_POINTS;
+  curve->npoints = npoints;
+  curve->low = curve->counts[0];
+  curve->high = curve->counts[npoints-1];
+  curve->rate = curve->pcts[0];
+
+  return 0;
+}
+
+/* Interpolates between the points, for a count between the first and last
+ * points.
+ */
+static double curve_points_pct(const struct loiter_curve *curve,
+    double count) {
+  register unsigned int i;
+
+  for (i = 1; i < curve->npoints; i++) {
+    double x0, x1, y0, y1;
+
+    if (count >= curve->counts[i]) {
+      continue;
+    }
+
+    x0 = curve->counts[i-1];
+    x1 = curve->counts[i];
+    y0 = curve->pcts[i-1];
+    y1 = curve->pcts[i];
+
+    return y0 + ((y1 - y0) * (count - x0) / (x1 - x0));
+  }
+
+  return 100.0;
+}
+
+static unsigned int compute_pct(const struct loiter_curve *curve,
+    unsigned int count, unsigned int low, unsigned int high,
+    unsigned int rate) {
+  double x, p;
+
+  if (count < low) {
+    return 0;
+  }
+
+  if (count >= high) {
+    return 100;
+  }
+
+  if (curve->type == LOITER_CURVE_POINTS) {
+    unsigned int first, last;
+
+    /* Map the count onto the points, in case the watermarks were changed. */
+    first = curve->counts[0];
+    last = curve->counts[curve->npoints - 1];
+    x = first + ((double) (count - low) * (last - first) / (high - low));
+    p = curve_points_pct(curve, x);
+    return (unsigned int) p;
+  }
+
+  if (rate >= 100) {
+    return 100;
+  }
+
+  switch (curve->type) {
+    case LOITER_CURVE_QUADRATIC:
+      x = (double) (count - low) / (high - low);
+      p = rate + ((100 - rate) * x * x);
+      break;
+
+    case LOITER_CURVE_EXPONENTIAL:
+      x = (double) (count - low) / (high - low);
+      p = rate + ((100 - rate) * (curve_exp(LOITER_CURVE_EXP_K * x) - 1.0) /
+        (curve_exp(LOITER_CURVE_EXP_K) - 1.0));
+      break;
+
+    case LOITER_CURVE_STEP:
+      p = rate;
+      break;
+
+    case LOITER_CURVE_LINEAR:
+    default: {
+      unsigned int v;
+
+      /* As for OpenSSH's MaxStartups. */
+      v = 100 - rate;
+      v *= count - low;
+      v /= high - low;
+      v += rate;
+      return v;
+    }
+  }
+
+  return (unsigned int) p;
+}
+
+int loiter_curve_compile(pool *p, struct loiter_curve *curve) {
+  register unsigned int i;
+
+  if (p == NULL ||
+      curve == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  curve->table = NULL;
+  curve->tablesz = 0;
+
+  if (curve->high >= LOITER_CURVE_MAX_TABLESZ) {
+    pr_trace_msg(trace_channel, 9,
+      "high watermark %u too large to tabulate; computing as needed",
+      curve->high);
+    return 0;
+  }
+
+  curve->tablesz = curve->high + 1;
+  curve->table = palloc(p, curve->tablesz);
+
+  for (i = 0; i < curve->tablesz; i++) {
+    curve->table[i] = (unsigned char) compute_pct(curve, i, curve->low,
+      curve->high, curve->rate);
+  }
+
+  return 0;
+}
+
+const struct loiter_curve *loiter_curve_for_rules(pool *p,
+    const struct loiter_curve *curve, unsigned int low, unsigned int high,
+    unsigned int rate) {
+  struct loiter_curve *copy;
+
+  if (p == NULL ||
+      curve == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (curve->low == low &&
+      curve->high == high &&
+      curve->rate == rate) {
+    return curve;
+  }
+
+  /* The points, if any, are shared; only the table differs. */
+  copy = pcalloc(p, sizeof(struct loiter_curve));
+  memcpy(copy, curve, sizeof(struct loiter_curve));
+  copy->low = low;
+  copy->high = high;
+  copy->rate = rate;
+
+  if (loiter_curve_compile(p, copy) < 0) {
+    return NULL;
+  }
+
+  pr_trace_msg(trace_channel, 17,
+    "tabulated curve for low %u, high %u, rate %u", low, high, rate);
+  return copy;
+}
+
+unsigned int loiter_curve_pct(const struct loiter_curve *curve,
+    unsigned int count, unsigned int low, unsigned int high,
+    unsigned int rate) {
+  if (curve == NULL) {
+    return 0;
+  }
+
+  if (curve->table != NULL &&
+      low == curve->low &&
+      high == curve->high &&
+      rate == curve->rate) {
+    return count < curve->tablesz ? curve->table[count] : 100;
+  }
+
+  return compute_pct(curve, count, low, high, rate);
+}
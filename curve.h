@@ -0,0 +1,96 @@
+/*
+ * ProFTPD - mod_loiter drop curves
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_CURVE_H
+#define MOD_LOITER_CURVE_H
+
+#include "mod_loiter.h"
+
+/* How the drop probability rises from the rate, at the low watermark, to
+ * 100%, at the high watermark.
+ */
+#define LOITER_CURVE_LINEAR		0
+#define LOITER_CURVE_QUADRATIC		1
+#define LOITER_CURVE_EXPONENTIAL	2
+#define LOITER_CURVE_STEP		3
+#define LOITER_CURVE_POINTS		4
+
+/* The largest high watermark for which the probabilities are tabulated;
+ * beyond that, they are computed as needed.
+ */
+#define LOITER_CURVE_MAX_TABLESZ	65536
+
+struct loiter_curve {
+  int type;
+
+  /* The rules for which the table was built. */
+  unsigned int low;
+  unsigned int high;
+  unsigned int rate;
+
+  /* For LOITER_CURVE_POINTS, the counts, in increasing order, and the drop
+   * probabilities at those counts.
+   */
+  unsigned int npoints;
+  unsigned int *counts;
+  unsigned int *pcts;
+
+  /* The drop probability for each count, from 0 to the high watermark. */
+  unsigned char *table;
+  unsigned int tablesz;
+};
+
+/* Returns the curve type of the given name, or -1 if unknown. */
+int loiter_curve_get_type(const char *name);
+
+/* Parse points of the form "count:percent[,count:percent...]", where the
+ * counts increase, the percentages do not decrease, and the last percentage
+ * is 100.  The low and high watermarks of the curve are those of the first
+ * and last points.
+ */
+int loiter_curve_parse_points(pool *p, struct loiter_curve *curve,
+  const char *text);
+
+/* Tabulate the drop probabilities for the curve's rules, and type (and
+ * points).
+ */
+int loiter_curve_compile(pool *p, struct loiter_curve *curve);
+
+/* Returns the curve tabulated for the given rules, e.g. once they have been
+ * scaled to MaxInstances or changed via ftpdctl: the curve itself, if it was
+ * compiled for them, otherwise a copy allocated from the given pool.
+ */
+const struct loiter_curve *loiter_curve_for_rules(pool *p,
+  const struct loiter_curve *curve, unsigned int low, unsigned int high,
+  unsigned int rate);
+
+/* Returns the drop probability, as a percentage, for the given count of
+ * unauthenticated connections.  For the rules the curve was compiled for,
+ * this is a single table lookup; any other rules are computed along the same
+ * curve, until it is tabulated for them via loiter_curve_for_rules().
+ */
+unsigned int loiter_curve_pct(const struct loiter_curve *curve,
+  unsigned int count, unsigned int low, unsigned int high, unsigned int rate);
+
+#endif /* MOD_LOITER_CURVE_H */
@@ -0,0 +1,201 @@
+/*
+ * ProFTPD - mod_loiter metrics
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "metrics.h"
+
+#define LOITER_METRICS_PREFIX		"proftpd_loiter_"
+
+static const char *trace_channel = "loiter.metrics";
+
+static const char *add_metric(pool *p, const char *text, const char *name,
+    const char *type, const char *help, const char *value) {
+  return pstrcat(p, text,
+    "# HELP " LOITER_METRICS_PREFIX, name, " ", help, "\n",
+    "# TYPE " LOITER_METRICS_PREFIX, name, " ", type, "\n",
+    LOITER_METRICS_PREFIX, name, " ", value, "\n", NULL);
+}
+
+static const char *add_uint_metric(pool *p, const char *text,
+    const char *name, const char *type, const char *help, unsigned int v) {
+  char value[32];
+
+  memset(value, '\0', sizeof(value));
+  snprintf(value, sizeof(value)-1, "%u", v);
+  return add_metric(p, text, name, type, help, value);
+}
+
+const char *loiter_metrics_text(pool *p, const struct loiter_shm_stats *stats,
+    unsigned int drop_pct) {
+  const char *text = "";
+  unsigned int unauthd_count = 0;
+  char value[32];
+
+  if (p == NULL ||
+      stats == NULL ||
+      drop_pct > 100) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (stats->conn_count > stats->authd_count) {
+    unauthd_count = stats->conn_count - stats->authd_count;
+  }
+
+  text = add_uint_metric(p, text, "conn_count", "gauge",
+    "Current number of connections.", stats->conn_count);
+  text = add_uint_metric(p, text, "authd_count", "gauge",
+    "Current number of authenticated connections.", stats->authd_count);
+  text = add_uint_metric(p, text, "unauthd_count", "gauge",
+    "Current number of unauthenticated connections.", unauthd_count);
+  text = add_uint_metric(p, text, "dropped_total", "counter",
+    "Total number of connections dropped for loitering.", stats->nejects);
+  text = add_uint_metric(p, text, "failed_login_weight", "gauge",
+    "Current weight of failed logins by unauthenticated connections.",
+    stats->failed_count);
+  text = add_uint_metric(p, text, "system_pressure", "gauge",
+    "Current system pressure, as a percentage, applied to drop decisions.",
+    stats->pressure);
+  text = add_uint_metric(p, text, "cluster_unauthd_count", "gauge",
+    "Current number of unauthenticated connections reported by cluster peers.",
+    stats->cluster_unauthd_count);
+  text = add_uint_metric(p, text, "cluster_peers", "gauge",
+    "Current number of cluster peers reporting counts.",
+    stats->cluster_npeers);
+
+  text = add_uint_metric(p, text, "distinct_sources", "gauge",
+    "Estimated number of distinct sources connecting in the last complete "
+    "window.", stats->distinct_sources);
+
+  if (stats->host_npartitions > 0) {
+    unsigned int host_unauthd_count = 0;
+
+    if (stats->host_conn_count > stats->host_authd_count) {
+      host_unauthd_count = stats->host_conn_count - stats->host_authd_count;
+    }
+
+    text = add_uint_metric(p, text, "host_unauthd_count", "gauge",
+      "Current number of unauthenticated connections, across all daemons "
+      "sharing the LoiterTable.", host_unauthd_count);
+    text = add_uint_metric(p, text, "host_partitions", "gauge",
+      "Current number of daemons sharing the LoiterTable.",
+      stats->host_npartitions);
+  }
+
+  memset(value, '\0', sizeof(value));
+  snprintf(value, sizeof(value)-1, "%u.%02u", drop_pct / 100, drop_pct % 100);
+  text = add_metric(p, text, "drop_probability", "gauge",
+    "Probability of dropping a new connection, given the current counts.",
+    value);
+
+  return text;
+}
+
+int loiter_metrics_write(pool *p, const char *path,
+    const struct loiter_shm_stats *stats, unsigned int drop_pct) {
+  int flags, res, xerrno;
+  const char *text, *tmp_path;
+  pr_fh_t *fh;
+  size_t text_len;
+
+  if (path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  text = loiter_metrics_text(p, stats, drop_pct);
+  if (text == NULL) {
+    return -1;
+  }
+
+  text_len = strlen(text);
+
+  /* Write to a temporary file, then rename it into place, so that scrapers
+   * never see a partially written file.
+   */
+  tmp_path = pstrcat(p, path, ".tmp", NULL);
+
+  /* We write as root, so never through a link planted at the temporary
+   * path: remove whatever is left there, e.g. by an interrupted write, and
+   * insist on creating the file anew.
+   */
+  flags = O_WRONLY|O_CREAT|O_EXCL;
+#if defined(O_NOFOLLOW)
+  flags |= O_NOFOLLOW;
+#endif /* O_NOFOLLOW */
+
+  PRIVS_ROOT
+  (void) pr_fsio_unlink(tmp_path);
+  fh = pr_fsio_open(tmp_path, flags);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (fh == NULL) {
+    pr_trace_msg(trace_channel, 3, "error opening '%s': %s", tmp_path,
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  res = pr_fsio_write(fh, text, text_len);
+  xerrno = errno;
+
+  if (pr_fsio_close(fh) < 0 &&
+      res >= 0) {
+    res = -1;
+    xerrno = errno;
+  }
+
+  if (res < 0 ||
+      (size_t) res != text_len) {
+    pr_trace_msg(trace_channel, 3, "error writing '%s': %s", tmp_path,
+      strerror(xerrno));
+    PRIVS_ROOT
+    (void) pr_fsio_unlink(tmp_path);
+    PRIVS_RELINQUISH
+
+    errno = xerrno;
+    return -1;
+  }
+
+  PRIVS_ROOT
+  res = pr_fsio_rename(tmp_path, path);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 3, "error renaming '%s' to '%s': %s",
+      tmp_path, path, strerror(xerrno));
+    PRIVS_ROOT
+    (void) pr_fsio_unlink(tmp_path);
+    PRIVS_RELINQUISH
+
+    errno = xerrno;
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 17, "wrote %lu bytes of metrics to '%s'",
+    (unsigned long) text_len, path);
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * ProFTPD - mod_loiter metrics
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_METRICS_H
+#define MOD_LOITER_METRICS_H
+
+#include "mod_loiter.h"
+#include "shm.h"
+
+/* Default interval, in seconds, for rewriting the LoiterMetricsFile. */
+#define LOITER_METRICS_DEFAULT_INTERVAL		15
+
+/* Format the given stats, and the current drop probability (as a
+ * percentage), in the Prometheus text exposition format.
+ */
+const char *loiter_metrics_text(pool *p, const struct loiter_shm_stats *stats,
+  unsigned int drop_pct);
+
+/* Atomically replace the file at the given path with the formatted metrics,
+ * e.g. for use with the node_exporter textfile collector.
+ */
+int loiter_metrics_write(pool *p, const char *path,
+  const struct loiter_shm_stats *stats, unsigned int drop_pct);
+
+#endif /* MOD_LOITER_METRICS_H */
@@ -27,6 +27,15 @@
 
 #include "mod_loiter.h"
 #include "shm.h"
+#include "agent.h"
+#include "cidr.h"
+#include "cluster.h"
+#include "controller.h"
+#include "curve.h"
+#include "metrics.h"
+#include "policy.h"
+#include "pressure.h"
+#include "prng.h"
 
 #if PROFTPD_VERSION_NUMBER >= 0x0001030602
 extern unsigned long ServerMaxInstances;
@@ -40,282 +49,3088 @@ module loiter_module;
 int loiter_logfd = -1;
 pool *loiter_pool = NULL;
 
+static int loiter_banfd = -1;
 static int loiter_engine = FALSE;
 static int loiter_has_authenticated = FALSE;
+static int loiter_metrics_timerno = -1;
+static int loiter_pressure_timerno = -1;
+static int loiter_controller_timerno = -1;
+static int loiter_started = FALSE;
+
+/* The LoiterPrefixTable, built by the daemon and inherited by sessions, and
+ * the weight of this session's source in it, if any.
+ */
+static pool *loiter_cidr_pool = NULL;
+static struct loiter_cidr_table *loiter_cidr_tab = NULL;
+static int loiter_cidr_matched = FALSE;
+static unsigned int loiter_cidr_weight = 0;
+
+/* The LoiterTable entries of our policy's LoiterShadowRules, if any; -1 for
+ * those which could not be claimed.
+ */
+static int *loiter_shadow_idx = NULL;
+
+/* The policies compiled by the daemon for each server, and the policy in
+ * effect: the main server's, in the daemon, or that of the session's server.
+ */
+static pool *loiter_policy_pool = NULL;
+static struct loiter_policy *loiter_policies = NULL;
+static const struct loiter_policy *loiter_policy = NULL;
+
+/* The curve tabulated for the rules set via ftpdctl, kept until they change,
+ * and the compiled curve it was copied from.
+ */
+static pool *loiter_runtime_curve_pool = NULL;
+static const struct loiter_curve *loiter_runtime_curve_base = NULL;
+static const struct loiter_curve *loiter_runtime_curve = NULL;
+
+/* The LoiterClassRules for this session's <Class>, if any. */
+static const struct loiter_rules *loiter_class_rules = NULL;
+
+/* The LoiterLog currently open, if any. */
+static const char *loiter_log_path = NULL;
+
+/* The daemon's feedback controller; see LoiterController. */
+static struct loiter_controller loiter_ctl;
+static time_t loiter_ctl_updated = 0;
+
+/* This session's source, and its counts per the heavy hitter sketches. */
+static struct loiter_shm_source *loiter_source = NULL;
+static unsigned int loiter_source_count = 0;
+static unsigned int loiter_prefix_count = 0;
+
+/* This session's failed logins, and their weight in the LoiterTable, per
+ * LoiterAuthFailures.
+ */
+static unsigned int loiter_failed_count = 0;
+static unsigned int loiter_failed_weight = 0;
+
+/* This session's slot in the LoiterTable, once authenticated, per
+ * LoiterIdleSessions.
+ */
+static int loiter_slot = -1;
+
+/* The user name this session is counted against, per LoiterUserRules. */
+static uint64_t loiter_user_key = 0;
+static int loiter_user_counted = FALSE;
+
+/* Why this session's connection was dropped. */
+static const char *loiter_drop_reason = LOITER_DROP_REASON_LOITERING;
+
+/* The time spent in each part of loiter_sess_init(), in nsecs, as accounted
+ * by loiter_timing_switch(), along with the part being accounted now (-1 for
+ * none), and when it started.  Only while loiter_sess_init_start is set.
+ */
+static uint64_t loiter_timings[LOITER_SHM_NTIMINGS];
+static int loiter_timing_id = -1;
+static uint64_t loiter_timing_mark = 0;
+static uint64_t loiter_sess_init_start = 0;
+static uint64_t loiter_sess_init_lock_nsecs = 0;
 static const char *trace_channel = "loiter";
 
-/* Default values for the low/high watermarks and rate. */
-#define LOITER_RULES_DEFAULT_LOW	20
-#define LOITER_RULES_DEFAULT_HIGH	100
-#define LOITER_RULES_DEFAULT_RATE	30
+/* By default, the agent reports "drain" once all connections are dropped. */
+#define LOITER_AGENT_DEFAULT_DRAIN_PCT	100
 
-static int loiter_openlog(void) {
-  int res = 0;
-  config_rec *c;
+/* By default, heavy hitters are sources making more than 30 connections, or
+ * prefixes making more than 100, per minute.
+ */
+#define LOITER_HEAVY_DEFAULT_WINDOW		60
+#define LOITER_HEAVY_DEFAULT_THRESHOLD		30
+#define LOITER_HEAVY_DEFAULT_PREFIX_THRESHOLD	100
+
+/* By default, each source may connect 30 times per minute, in bursts of up
+ * to 10; prefixes are not limited.
+ */
+#define LOITER_RATELIMIT_DEFAULT_RATE		30
+#define LOITER_RATELIMIT_DEFAULT_BURST		10
+#define LOITER_RATELIMIT_DEFAULT_PREFIX_RATE	0
+#define LOITER_RATELIMIT_DEFAULT_PREFIX_BURST	50
 
-  c = find_config(main_server->conf, CONF_PARAM, "LoiterLog", FALSE);
-  if (c) {
-    char *path;
+/* By default, distinct sources are estimated per minute, without switching
+ * modes.
+ */
+#define LOITER_DISTINCT_DEFAULT_WINDOW		60
+#define LOITER_DISTINCT_DEFAULT_THRESHOLD	0
 
-    path = c->argv[0];
+/* The prefix lengths used for grouping sources. */
+#define LOITER_PREFIX_LEN_IPV4			24
+#define LOITER_PREFIX_LEN_IPV6			48
 
-    if (strncasecmp(path, "none", 5) != 0) {
-      int xerrno;
+/* By default, each failed login counts as two more unauthenticated
+ * connections, and failed logins per source are remembered for 10 minutes.
+ */
+#define LOITER_AUTHFAIL_DEFAULT_WEIGHT		2
+#define LOITER_AUTHFAIL_DEFAULT_WINDOW		600
+#define LOITER_AUTHFAIL_DEFAULT_EVICT		0
 
-      pr_signals_block();
-      PRIVS_ROOT
-      res = pr_log_openfile(path, &loiter_logfd, 0600);
-      xerrno = errno;
-      PRIVS_RELINQUISH
-      pr_signals_unblock();
+/* By default, once within 5 sessions of MaxInstances, authenticated sessions
+ * idle for 10 minutes or more are shed.
+ */
+#define LOITER_IDLE_DEFAULT_HEADROOM		5
+#define LOITER_IDLE_DEFAULT_MIN_IDLE		600
 
-      if (res < 0) {
-        if (res == -1) {
-          pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
-            ": notice: unable to open LoiterLog '%s': %s", path,
-            strerror(xerrno));
+/* By default, a source dropped 5 times within 10 minutes is banned. */
+#define LOITER_BAN_DEFAULT_COUNT		5
+#define LOITER_BAN_DEFAULT_WINDOW		600
 
-        } else if (res == PR_LOG_WRITABLE_DIR) {
-          pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
-            ": notice: unable to open LoiterLog '%s': parent directory is "
-            "world-writable", path);
+/* By default, sources which authenticated within the last hour are exempt. */
+#define LOITER_REPUTATION_DEFAULT_TTL		3600
+#define LOITER_REPUTATION_DEFAULT_FACTOR	0
 
-        } else if (res == PR_LOG_SYMLINK) {
-          pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
-            ": notice: unable to open LoiterLog '%s': cannot log to a symlink",
-            path);
-        }
-      }
+#if defined(PR_USE_CTRLS)
+# include "mod_ctrls.h"
+
+static ctrls_acttab_t loiter_acttab[];
+#endif /* PR_USE_CTRLS */
+
+/* Opens the given LoiterLog, unless it is already open, e.g. as inherited
+ * from the daemon.
+ */
+static int loiter_openlog(const char *path) {
+  int res = 0, xerrno;
+
+  if (path == NULL) {
+    return 0;
+  }
+
+  if (loiter_logfd >= 0) {
+    if (loiter_log_path != NULL &&
+        strcmp(loiter_log_path, path) == 0) {
+      return 0;
+    }
+
+    (void) close(loiter_logfd);
+    loiter_logfd = -1;
+    loiter_log_path = NULL;
+  }
+
+  pr_signals_block();
+  PRIVS_ROOT
+  res = pr_log_openfile(path, &loiter_logfd, 0600);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+  pr_signals_unblock();
+
+  if (res < 0) {
+    if (res == -1) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": notice: unable to open LoiterLog '%s': %s", path,
+        strerror(xerrno));
+
+    } else if (res == PR_LOG_WRITABLE_DIR) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": notice: unable to open LoiterLog '%s': parent directory is "
+        "world-writable", path);
+
+    } else if (res == PR_LOG_SYMLINK) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": notice: unable to open LoiterLog '%s': cannot log to a symlink",
+        path);
     }
+
+    return res;
   }
 
+  loiter_log_path = path;
   return res;
 }
 
-/* Returns TRUE if the connection should be dropped, FALSE otherwise.
- *
- * Query the database (shared memory segment) to find the count of connections,
- * and how many of those have authenticated; the difference gives us the
- * number of unauthenticated connections.  We want to keep that count from
- * getting too high; such loitering connections should be dropped.
- *
- * If the loiterering count is below the low watermark, we do nothing.  If
- * if it above the high watermark, we drop this connection.  If the configured
- * dropout rate is at 100%, we drop this connection.  Otherwise, the dropout
- * rate is calculated to linearly increase from the low to the high watermarks;
- * we roll the dice to see, then, whether the dropout rate should apply, and
- * thus drop this connection.
- */
-static int loiter_drop_conn(unsigned int low, unsigned int high,
-    unsigned int rate) {
-  unsigned int authd_count = 0, conn_count = 0, unauthd_count = 0;
-  unsigned int p, r;
-
-  if (loiter_shm_get(loiter_pool, &conn_count, &authd_count) < 0) {
-    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
-      "error getting connection counts: %s", strerror(errno));
-    return FALSE;
+/* Rules set at runtime, via ftpdctl, take precedence. */
+static void loiter_apply_runtime_rules(const struct loiter_shm_stats *stats,
+    struct loiter_rules *rules) {
+  if (stats->rules_low > 0) {
+    rules->low = stats->rules_low;
   }
 
-  /* Sanity check. */
-  if (authd_count > conn_count) {
-    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
-      "count of authenticated connections (%u) exceeds total connections (%u); "
-      "mod_loiter bug?", authd_count, conn_count);
-    return FALSE;
+  if (stats->rules_high > 0) {
+    rules->high = stats->rules_high;
+  }
+
+  if (stats->rules_rate > 0) {
+    rules->rate = stats->rules_rate;
+  }
+
+  if (rules->curve == NULL ||
+      (rules->curve->low == rules->low &&
+       rules->curve->high == rules->high &&
+       rules->curve->rate == rules->rate)) {
+    return;
+  }
+
+  if (loiter_runtime_curve == NULL ||
+      loiter_runtime_curve_base != rules->curve ||
+      loiter_runtime_curve->low != rules->low ||
+      loiter_runtime_curve->high != rules->high ||
+      loiter_runtime_curve->rate != rules->rate) {
+    const struct loiter_curve *curve;
+
+    if (loiter_runtime_curve_pool != NULL) {
+      destroy_pool(loiter_runtime_curve_pool);
+    }
+
+    loiter_runtime_curve_pool = make_sub_pool(loiter_policy_pool);
+    pr_pool_tag(loiter_runtime_curve_pool, "Loiter runtime curve pool");
+    loiter_runtime_curve_base = rules->curve;
+    loiter_runtime_curve = NULL;
+
+    curve = loiter_curve_for_rules(loiter_runtime_curve_pool, rules->curve,
+      rules->low, rules->high, rules->rate);
+    if (curve == NULL) {
+      /* Computed along the compiled curve instead. */
+      return;
+    }
+
+    loiter_runtime_curve = curve;
+  }
+
+  rules->curve = loiter_runtime_curve;
+}
+
+/* Returns the count of unauthenticated connections to use for our
+ * decisions: ours, weighted by their failed logins (see LoiterAuthFailures),
+ * plus those of any cluster peers.
+ */
+static unsigned int loiter_get_unauthd_count(
+    const struct loiter_shm_stats *stats) {
+  uint64_t unauthd_count = 0;
+
+  if (stats->conn_count > stats->authd_count) {
+    unauthd_count = stats->conn_count - stats->authd_count;
+  }
+
+  /* The failed login weights and the peers' counts can be large enough to
+   * wrap an unsigned int; saturate instead.
+   */
+  unauthd_count += (uint64_t) stats->failed_count +
+    (uint64_t) stats->cluster_unauthd_count;
+  return unauthd_count > UINT_MAX ? UINT_MAX : (unsigned int) unauthd_count;
+}
+
+/* Returns the drop probability per the LoiterHostRules, if any, given the
+ * host-wide count of unauthenticated connections.
+ */
+static unsigned int loiter_host_drop_pct(const struct loiter_shm_stats *stats) {
+  unsigned int unauthd_count = 0;
+
+  if (loiter_policy->use_host_rules == FALSE) {
+    return 0;
+  }
+
+  if (stats->host_conn_count > stats->host_authd_count) {
+    unauthd_count = stats->host_conn_count - stats->host_authd_count;
+  }
+
+  return loiter_policy_drop_pct(&(loiter_policy->host_rules), unauthd_count);
+}
+
+/* Returns the probability, as a percentage, that a new connection would now
+ * be dropped, before any adjustments for its source; this is what the agent
+ * check and the LoiterMetricsFile report.
+ */
+static unsigned int loiter_get_effective_drop_pct(
+    const struct loiter_shm_stats *stats, const struct loiter_rules *rules,
+    unsigned int unauthd_count) {
+  return loiter_policy_effective_pct(loiter_policy, rules, unauthd_count,
+    stats->control_pct, loiter_host_drop_pct(stats), stats->pressure);
+}
+
+/* Returns a key identifying the given address bytes, for the LoiterTable's
+ * per-source caches and sketches (FNV-1a).
+ */
+static uint64_t loiter_get_key(const unsigned char *data, size_t datasz) {
+  register unsigned int i;
+  uint64_t key = (uint64_t) 14695981039346656037ULL;
+
+  for (i = 0; i < datasz; i++) {
+    key ^= data[i];
+    key *= (uint64_t) 1099511628211ULL;
+  }
+
+  return key;
+}
+
+static uint64_t loiter_get_addr_key(const pr_netaddr_t *addr) {
+  const unsigned char *data;
+  size_t datasz = sizeof(struct in_addr);
+
+  data = pr_netaddr_get_inaddr(addr);
+  if (data == NULL) {
+    return loiter_get_key(NULL, 0);
+  }
+
+#if defined(PR_USE_IPV6)
+  if (pr_netaddr_get_family(addr) == AF_INET6) {
+    datasz = sizeof(struct in6_addr);
+  }
+#endif /* PR_USE_IPV6 */
+
+  return loiter_get_key(data, datasz);
+}
+
+/* Describes the given source, and the prefix containing it. */
+static struct loiter_shm_source *loiter_get_source(pool *p,
+    const pr_netaddr_t *addr) {
+  struct loiter_shm_source *src;
+  const unsigned char *data;
+  unsigned char prefix[16];
+  size_t datasz = sizeof(struct in_addr);
+  unsigned int prefix_len = LOITER_PREFIX_LEN_IPV4;
+  int family = AF_INET;
+  char prefix_str[LOITER_SKETCH_NAMESZ];
+
+  data = pr_netaddr_get_inaddr(addr);
+  if (data == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+#if defined(PR_USE_IPV6)
+  if (pr_netaddr_get_family(addr) == AF_INET6) {
+    family = AF_INET6;
+    datasz = sizeof(struct in6_addr);
+    prefix_len = LOITER_PREFIX_LEN_IPV6;
+  }
+#endif /* PR_USE_IPV6 */
+
+  memset(prefix, 0, sizeof(prefix));
+  memcpy(prefix, data, prefix_len / 8);
+
+  memset(prefix_str, '\0', sizeof(prefix_str));
+  if (pr_inet_ntop(family, prefix, prefix_str, sizeof(prefix_str)-5) == NULL) {
+    return NULL;
+  }
+
+  snprintf(prefix_str + strlen(prefix_str), 5, "/%u", prefix_len);
+
+  src = pcalloc(p, sizeof(struct loiter_shm_source));
+  src->key = loiter_get_key(data, datasz);
+  src->name = pstrdup(p, pr_netaddr_get_ipstr(addr));
+  src->prefix_key = loiter_get_key(prefix, datasz);
+  src->prefix_name = pstrdup(p, prefix_str);
+
+  return src;
+}
+
+/* A flood from a few sources is better handled per source than by global
+ * RED, which sheds the innocent along with the guilty.  When fewer distinct
+ * sources than the LoiterDistinctSources threshold are connecting, the
+ * sources making more than their fair share of the connections (per the
+ * LoiterHeavyHitters estimates) are always shed.
+ */
+static unsigned int loiter_apply_distinct_sources(unsigned int drop_pct) {
+  unsigned int window, threshold, distinct = 0, nconns = 0, p;
+
+  if (drop_pct == 0 ||
+      loiter_source == NULL ||
+      loiter_source_count == 0 ||
+      loiter_policy->distinct_window == 0) {
+    return drop_pct;
   }
 
-  unauthd_count = conn_count - authd_count;
+  window = loiter_policy->distinct_window;
+  threshold = loiter_policy->distinct_threshold;
 
-  if (unauthd_count < low) {
+  if (threshold == 0) {
+    return drop_pct;
+  }
+
+  if (loiter_shm_distinct_get(loiter_pool, (uint32_t) (time(NULL) / window),
+      &distinct, &nconns) < 0 ||
+      distinct == 0 ||
+      distinct >= threshold) {
+    return drop_pct;
+  }
+
+  p = loiter_policy_distinct_pct(drop_pct, distinct, threshold, nconns,
+    loiter_source_count);
+  if (p > drop_pct) {
     pr_trace_msg(trace_channel, 5,
-      "unauthenticated connection count (%u) < low watermark (%u)",
-      unauthd_count, low);
-    return FALSE;
+      "~%u distinct sources < %u, source %s exceeds its share (~%u of %u "
+      "connections), dropping", distinct, threshold, loiter_source->name,
+      loiter_source_count, nconns);
+    loiter_drop_reason = LOITER_DROP_REASON_PER_SOURCE;
+    return p;
+  }
+
+  pr_trace_msg(trace_channel, 5,
+    "~%u distinct sources < %u, source %s within its share (~%u of %u "
+    "connections)", distinct, threshold, loiter_source->name,
+    loiter_source_count, nconns);
+  return drop_pct;
+}
+
+/* Once we are shedding connections at all, the heaviest sources and prefixes
+ * (per the LoiterHeavyHitters) are shed first.
+ */
+static unsigned int loiter_apply_heavy_hitters(unsigned int drop_pct) {
+  unsigned int threshold, prefix_threshold;
+
+  if (drop_pct == 0 ||
+      loiter_source == NULL ||
+      loiter_policy->heavy_window == 0) {
+    return drop_pct;
   }
 
-  if (unauthd_count >= high) {
+  threshold = loiter_policy->heavy_threshold;
+  prefix_threshold = loiter_policy->heavy_prefix_threshold;
+
+  if (loiter_source_count >= threshold) {
     pr_trace_msg(trace_channel, 5,
-      "unauthenticated connection count (%u) >= high watermark (%u)",
-      unauthd_count, high);
-    return TRUE;
+      "source %s is a heavy hitter (~%u connections >= %u), dropping",
+      loiter_source->name, loiter_source_count, threshold);
+    loiter_drop_reason = LOITER_DROP_REASON_HEAVY_HITTER;
+    return 100;
   }
 
-  if (rate == 100) {
-    pr_trace_msg(trace_channel, 5, "drop connection rate (%u) == 100", rate);
-    return TRUE;
+  if (loiter_prefix_count >= prefix_threshold) {
+    pr_trace_msg(trace_channel, 5,
+      "prefix %s is a heavy hitter (~%u connections >= %u), dropping",
+      loiter_source->prefix_name, loiter_prefix_count, prefix_threshold);
+    loiter_drop_reason = LOITER_DROP_REASON_HEAVY_HITTER;
+    return 100;
   }
 
-  p = 100 - rate;
-  p *= unauthd_count - low;
-  p /= high - low;
-  p += rate;
-#if defined(HAVE_RANDOM)
-  r = (unsigned int) ((1 + random()) / (RAND_MAX / 100) + 1);
-#else
-  r = (unsigned int) ((1 + rand()) / (RAND_MAX / 100) + 1);
-#endif /* HAVE_RANDOM */
+  return drop_pct;
+}
 
-  pr_trace_msg(trace_channel, 4,
-    "drop connection? probability %u, rate %u", p, r);
-  return (r < p) ? TRUE : FALSE;
+/* Under system pressure, per the LoiterPressure, the drop probability is
+ * raised towards 100 in proportion to that pressure.
+ */
+static unsigned int loiter_apply_pressure(unsigned int drop_pct,
+    unsigned int pressure) {
+  unsigned int p;
+
+  if (pressure == 0 ||
+      drop_pct >= 100) {
+    return drop_pct;
+  }
+
+  p = loiter_policy_pressure_pct(drop_pct, pressure);
+  pr_trace_msg(trace_channel, 5,
+    "system pressure %u%% raises drop probability %u to %u", pressure,
+    drop_pct, p);
+  return p;
 }
 
-/* Command handlers
+/* Accounts the time since the last switch to the part of session setup
+ * being timed, and starts timing the given part instead (-1 for none).
+ * Returns the previous part, for switching back to.
  */
+static int loiter_timing_switch(int timing_id) {
+  uint64_t now;
+  int prev_id;
 
-MODRET loiter_post_pass(cmd_rec *cmd) {
-  if (loiter_engine == FALSE) {
-    return PR_DECLINED(cmd);
+  if (loiter_sess_init_start == 0) {
+    return -1;
   }
 
-  if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_AUTHD_COUNT, 1) < 0) {
-    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
-      "error incrementing authenticated connection count: %s", strerror(errno));
+  now = loiter_monotonic_now();
+  prev_id = loiter_timing_id;
+  if (prev_id >= 0) {
+    loiter_timings[prev_id] += now - loiter_timing_mark;
+  }
 
-  } else {
-    loiter_has_authenticated = TRUE;
+  loiter_timing_id = timing_id;
+  loiter_timing_mark = now;
+  return prev_id;
+}
+
+static void loiter_timing_start(void) {
+  struct loiter_shm_lock_stats lock_stats;
+
+  memset(loiter_timings, 0, sizeof(loiter_timings));
+  loiter_timing_id = -1;
+
+  memset(&lock_stats, 0, sizeof(lock_stats));
+  (void) loiter_shm_get_lock_stats(loiter_pool, &lock_stats);
+  loiter_sess_init_lock_nsecs = lock_stats.wait_nsecs;
+
+  loiter_sess_init_start = loiter_monotonic_now();
+}
+
+/* Records how long this session's setup took, and its parts, in the
+ * LoiterTable.  The lock wait overlaps the shm reads and writes.
+ */
+static void loiter_timing_record(void) {
+  register unsigned int i;
+  struct loiter_shm_lock_stats lock_stats;
+
+  if (loiter_sess_init_start == 0) {
+    return;
   }
 
-  return PR_DECLINED(cmd);
+  (void) loiter_timing_switch(-1);
+
+  loiter_timings[LOITER_SHM_TIMING_SESS_INIT] = loiter_monotonic_now() -
+    loiter_sess_init_start;
+  loiter_sess_init_start = 0;
+
+  if (loiter_shm_get_lock_stats(loiter_pool, &lock_stats) == 0) {
+    loiter_timings[LOITER_SHM_TIMING_SHM_LOCK] = lock_stats.wait_nsecs -
+      loiter_sess_init_lock_nsecs;
+  }
+
+  for (i = 0; i < LOITER_SHM_NTIMINGS; i++) {
+    (void) loiter_shm_timing_add(loiter_pool, i, loiter_timings[i]);
+  }
+
+  pr_trace_msg(trace_channel, 12,
+    "session setup took %llu usecs (shm lock %llu, read %llu, write %llu, "
+    "policy %llu, log %llu)",
+    (unsigned long long) loiter_timings[LOITER_SHM_TIMING_SESS_INIT] / 1000,
+    (unsigned long long) loiter_timings[LOITER_SHM_TIMING_SHM_LOCK] / 1000,
+    (unsigned long long) loiter_timings[LOITER_SHM_TIMING_SHM_READ] / 1000,
+    (unsigned long long) loiter_timings[LOITER_SHM_TIMING_SHM_WRITE] / 1000,
+    (unsigned long long) loiter_timings[LOITER_SHM_TIMING_POLICY] / 1000,
+    (unsigned long long) loiter_timings[LOITER_SHM_TIMING_LOG] / 1000);
 }
 
-/* Configuration handlers
+/* Sources which recently failed to login are more likely hostile; per the
+ * LoiterAuthFailures, such sources are dropped with an increased
+ * probability.
  */
+static unsigned int loiter_apply_auth_failures(unsigned int drop_pct) {
+  unsigned int weight, window;
+  int nfailed, timing_id;
+  uint64_t factor, scaled_pct;
+
+  if (drop_pct == 0 ||
+      loiter_source == NULL ||
+      loiter_policy->authfail_window == 0) {
+    return drop_pct;
+  }
 
-/* usage: LoiterEngine on|off */
-MODRET set_loiterengine(cmd_rec *cmd) {
-  int engine = 1;
-  config_rec *c;
+  weight = loiter_policy->authfail_weight;
+  window = loiter_policy->authfail_window;
 
-  CHECK_ARGS(cmd, 1);
-  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+  timing_id = loiter_timing_switch(LOITER_SHM_TIMING_SHM_READ);
+  nfailed = loiter_shm_failure_get(loiter_pool, loiter_source, window);
+  (void) loiter_timing_switch(timing_id);
+  if (nfailed <= 0) {
+    return drop_pct;
+  }
 
-  engine = get_boolean(cmd, 1);
-  if (engine == -1) {
-    CONF_ERROR(cmd, "expected Boolean parameter");
+  /* The weight may be up to 65535, so the scaled probability would overflow
+   * an unsigned int after a few hundred failed logins.
+   */
+  factor = 1 + ((uint64_t) weight * (uint64_t) nfailed);
+
+  pr_trace_msg(trace_channel, 5,
+    "source %s failed %d %s recently, scaling drop probability %u by %llu",
+    loiter_source->name, nfailed, nfailed != 1 ? "logins" : "login", drop_pct,
+    (unsigned long long) factor);
+
+  scaled_pct = (uint64_t) drop_pct * factor;
+  return scaled_pct > 100 ? 100 : (unsigned int) scaled_pct;
+}
+
+/* Sources which recently authenticated are most likely legitimate; per the
+ * LoiterReputation, such sources are dropped with a reduced probability, if
+ * at all.
+ */
+static unsigned int loiter_apply_reputation(unsigned int drop_pct) {
+  const pr_netaddr_t *addr;
+  unsigned int factor, ttl;
+  int res, timing_id;
+
+  if (drop_pct == 0) {
+    return 0;
   }
 
-  c = add_config_param(cmd->argv[0], 1, NULL);
-  c->argv[0] = pcalloc(c->pool, sizeof(int));
-  *((int *) c->argv[0]) = engine;
+  if (loiter_policy->reputation_ttl == 0) {
+    return drop_pct;
+  }
 
-  return PR_HANDLED(cmd);
+  ttl = loiter_policy->reputation_ttl;
+  factor = loiter_policy->reputation_factor;
+
+  addr = pr_netaddr_get_sess_remote_addr();
+  if (addr == NULL) {
+    return drop_pct;
+  }
+
+  timing_id = loiter_timing_switch(LOITER_SHM_TIMING_SHM_READ);
+  res = loiter_shm_reputation_check(loiter_pool, loiter_get_addr_key(addr),
+    time(NULL), ttl);
+  (void) loiter_timing_switch(timing_id);
+
+  if (res != TRUE) {
+    return drop_pct;
+  }
+
+  pr_trace_msg(trace_channel, 5,
+    "%s recently authenticated, scaling drop probability %u by %u%%",
+    pr_netaddr_get_ipstr(addr), drop_pct, factor);
+  return (drop_pct * factor) / 100;
 }
 
-/* usage: LoiterLog path|"none" */
-MODRET set_loiterlog(cmd_rec *cmd) {
-  CHECK_ARGS(cmd, 1);
-  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+/* Sources in the LoiterPrefixTable have the drop probability scaled by
+ * their weight, as a percentage.  The result is in hundredths of a percent,
+ * so that e.g. a weight of 10% of a 5% probability is not rounded away.
+ */
+static unsigned int loiter_apply_prefix_weight(unsigned int drop_pct) {
+  unsigned int prob;
 
-  (void) add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
-  return PR_HANDLED(cmd);
+  if (loiter_cidr_matched == FALSE) {
+    return drop_pct * LOITER_PRNG_PCT;
+  }
+
+  prob = drop_pct * loiter_cidr_weight;
+  if (prob > LOITER_PRNG_SCALE) {
+    prob = LOITER_PRNG_SCALE;
+  }
+
+  pr_trace_msg(trace_channel, 5,
+    "LoiterPrefixTable weight %u%% for source scales drop probability %u%% to "
+    "%u.%02u%%", loiter_cidr_weight, drop_pct, prob / LOITER_PRNG_PCT,
+    prob % LOITER_PRNG_PCT);
+  return prob;
 }
 
-/* usage: LoiterMessage msg */
-MODRET set_loitermessage(cmd_rec *cmd) {
-  CHECK_ARGS(cmd, 1);
-  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+/* Returns TRUE if a connection should be dropped, given the drop
+ * probability, in hundredths of a percent, FALSE otherwise.
+ */
+static int loiter_roll(unsigned int prob) {
+  int res;
 
-  (void) add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
-  return PR_HANDLED(cmd);
+  if (prob == 0) {
+    return FALSE;
+  }
+
+  res = loiter_prng_chance(prob);
+  pr_trace_msg(trace_channel, 4,
+    "drop connection? probability %u.%02u%%, %s", prob / LOITER_PRNG_PCT,
+    prob % LOITER_PRNG_PCT, res == TRUE ? "dropping" : "not dropping");
+  return res;
 }
 
-/* usage: LoiterRules [low ...] [high ...] [rate ...] */
-MODRET set_loiterrules(cmd_rec *cmd) {
-  register unsigned int i;
-  config_rec *c;
-  unsigned int low = LOITER_RULES_DEFAULT_LOW;
-  unsigned int high = LOITER_RULES_DEFAULT_HIGH;
-  unsigned int rate = LOITER_RULES_DEFAULT_RATE;
+/* Applies the host-wide rules, system pressure, and the adjustments for the
+ * connection's source to the given drop probability, as a percentage.  The
+ * result is in hundredths of a percent.
+ */
+static unsigned int loiter_adjust_drop_pct(unsigned int p,
+    unsigned int host_pct, unsigned int pressure) {
+  if (host_pct > p) {
+    p = host_pct;
+  }
 
-  if (cmd->argc < 3 ||
-      ((cmd->argc-1) % 2) != 0) {
-    CONF_ERROR(cmd, "wrong number of parameters");
+  p = loiter_apply_pressure(p, pressure);
+  p = loiter_apply_distinct_sources(p);
+  p = loiter_apply_heavy_hitters(p);
+  p = loiter_apply_auth_failures(p);
+  p = loiter_apply_reputation(p);
+
+  return loiter_apply_prefix_weight(p);
+}
+
+/* Returns the probability, in hundredths of a percent, that the connection
+ * should be dropped, per the active rules.
+ *
+ * The difference between the count of connections, and how many of those
+ * have authenticated, gives us the number of unauthenticated connections.
+ * We want to keep that count from getting too high; such loitering
+ * connections should be dropped.
+ *
+ * Connections reserved for our class are never dropped; beyond them, our
+ * class is subject to its own rules.  Otherwise, with a LoiterController, the
+ * probability published by the daemon's controller is used.  Failing that,
+ * below the low watermark we do nothing, and at or above the high watermark
+ * we drop this connection; in between, the probability is looked up in the
+ * table compiled for the LoiterRules curve (e.g. linear from the dropout rate
+ * at the low watermark, or the configured points).
+ *
+ * The probability is then raised for the host-wide rules and system pressure,
+ * and adjusted for the connection's source; see loiter_adjust_drop_pct().
+ * The caller rolls the dice, with our PRNG, to see whether to drop this
+ * connection.
+ */
+static unsigned int loiter_get_drop_prob(const struct loiter_shm_stats *stats,
+    unsigned int unauthd_count, unsigned int host_pct, unsigned int pressure) {
+  unsigned int class_unauthd_count = 0, p;
+  struct loiter_rules rules;
+
+  rules = loiter_policy->rules;
+  loiter_apply_runtime_rules(stats, &rules);
+
+  if (loiter_class_rules != NULL) {
+    if (stats->class_conn_count > stats->class_authd_count) {
+      class_unauthd_count = stats->class_conn_count -
+        stats->class_authd_count;
+    }
+
+    /* The connections reserved for our class are never dropped. */
+    if (class_unauthd_count <= stats->class_reserve) {
+      pr_trace_msg(trace_channel, 5,
+        "class unauthenticated connection count (%u) within reserved %u",
+        class_unauthd_count, stats->class_reserve);
+      return 0;
+    }
+  }
+
+  /* Nor may the connections outside of those reservations use them up. */
+  if (stats->reserve_total > 0) {
+    unsigned int shared_count = 0, shared_high = 0;
+
+    if (stats->conn_count - stats->authd_count > stats->reserve_used) {
+      shared_count = stats->conn_count - stats->authd_count -
+        stats->reserve_used;
+    }
+
+    if (rules.high > stats->reserve_total) {
+      shared_high = rules.high - stats->reserve_total;
+    }
+
+    if (shared_count >= shared_high) {
+      pr_trace_msg(trace_channel, 5,
+        "unreserved unauthenticated connection count (%u) >= high watermark "
+        "(%u) less reserved connections (%u)", shared_count, rules.high,
+        stats->reserve_total);
+      return LOITER_PRNG_SCALE;
+    }
+  }
+
+  /* Beyond its reservation, our class is subject to its own rules, against
+   * its own counts.
+   */
+  if (loiter_class_rules != NULL) {
+    unauthd_count = class_unauthd_count;
+    rules = *loiter_class_rules;
+  }
+
+  if (loiter_class_rules == NULL &&
+      loiter_policy->use_controller == TRUE) {
+    /* The daemon's controller publishes the drop probability for us. */
+    p = stats->control_pct;
+    if (p == 0 &&
+        host_pct == 0 &&
+        pressure == 0) {
+      pr_trace_msg(trace_channel, 5,
+        "unauthenticated connection count (%u) within LoiterController "
+        "setpoint", unauthd_count);
+      return 0;
+    }
+
+    pr_trace_msg(trace_channel, 5,
+      "LoiterController gives drop probability %u (unauthenticated "
+      "connection count %u)", p, unauthd_count);
+
+  } else {
+    if (unauthd_count < rules.low &&
+        host_pct == 0 &&
+        pressure == 0) {
+      pr_trace_msg(trace_channel, 5,
+        "unauthenticated connection count (%u) < low watermark (%u)",
+        unauthd_count, rules.low);
+      return 0;
+    }
+
+    p = loiter_policy_drop_pct(&rules, unauthd_count);
+    if (unauthd_count >= rules.high) {
+      pr_trace_msg(trace_channel, 5,
+        "unauthenticated connection count (%u) >= high watermark (%u)",
+        unauthd_count, rules.high);
+
+    } else if (unauthd_count >= rules.low &&
+               rules.rate == 100) {
+      pr_trace_msg(trace_channel, 5, "drop connection rate (%u) == 100",
+        rules.rate);
+    }
+  }
+
+  return loiter_adjust_drop_pct(p, host_pct, pressure);
+}
+
+/* Evaluates each of the LoiterShadowRules against the same counts, source,
+ * and roll of the dice as the active rules, and counts what it would have
+ * decided.  Only the active decision, given its drop probability, is
+ * returned; the shadow decisions are never enforced.
+ */
+static int loiter_roll_shadows(unsigned int prob, unsigned int unauthd_count,
+    unsigned int host_pct, unsigned int pressure) {
+  register unsigned int i;
+  unsigned int roll;
+  const char *drop_reason;
+  int dropped;
+
+  /* Rolled even when the outcome is certain, so that every shadow is
+   * compared against the same roll.
+   */
+  roll = loiter_prng_uniform(LOITER_PRNG_SCALE);
+  dropped = roll < prob ? TRUE : FALSE;
+
+  pr_trace_msg(trace_channel, 4,
+    "drop connection? probability %u.%02u%%, %s", prob / LOITER_PRNG_PCT,
+    prob % LOITER_PRNG_PCT, dropped == TRUE ? "dropping" : "not dropping");
+
+  /* The per-source adjustments set the reason for the active decision. */
+  drop_reason = loiter_drop_reason;
+
+  for (i = 0; i < loiter_policy->nshadows; i++) {
+    const struct loiter_policy_shadow *shadow;
+    unsigned int shadow_prob = 0;
+    int would_drop;
+
+    shadow = &(loiter_policy->shadows[i]);
+
+    if (unauthd_count >= shadow->rules.low ||
+        host_pct > 0 ||
+        pressure > 0) {
+      shadow_prob = loiter_adjust_drop_pct(
+        loiter_policy_drop_pct(&(shadow->rules), unauthd_count), host_pct,
+        pressure);
+    }
+
+    would_drop = roll < shadow_prob ? TRUE : FALSE;
+
+    pr_trace_msg(trace_channel, 5,
+      "LoiterShadowRules %s: probability %u.%02u%%, would %s (%s)",
+      shadow->name, shadow_prob / LOITER_PRNG_PCT,
+      shadow_prob % LOITER_PRNG_PCT, would_drop == TRUE ? "drop" : "not drop",
+      would_drop == dropped ? "agrees" : "disagrees");
+
+    if (loiter_shadow_idx != NULL &&
+        loiter_shadow_idx[i] >= 0) {
+      int timing_id;
+
+      timing_id = loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
+      (void) loiter_shm_shadow_incr(loiter_pool, loiter_shadow_idx[i],
+        would_drop, dropped);
+      (void) loiter_timing_switch(timing_id);
+    }
+  }
+
+  loiter_drop_reason = drop_reason;
+  return dropped;
+}
+
+/* Returns TRUE if the connection should be dropped, FALSE otherwise. */
+static int loiter_drop_conn(void) {
+  unsigned int unauthd_count, host_pct, pressure, prob;
+  struct loiter_shm_stats stats;
+  int res, timing_id;
+
+  timing_id = loiter_timing_switch(LOITER_SHM_TIMING_SHM_READ);
+  res = loiter_shm_get_stats(loiter_pool, &stats);
+  (void) loiter_timing_switch(timing_id);
+
+  if (res < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error getting connection counts: %s", strerror(errno));
+    return FALSE;
+  }
+
+  /* Sanity check. */
+  if (stats.authd_count > stats.conn_count) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "count of authenticated connections (%u) exceeds total connections (%u); "
+      "mod_loiter bug?", stats.authd_count, stats.conn_count);
+    return FALSE;
+  }
+
+  /* If the host as a whole is overloaded, it does not matter which of the
+   * daemons sharing the LoiterTable is being flooded.
+   */
+  host_pct = loiter_host_drop_pct(&stats);
+  if (host_pct > 0) {
+    pr_trace_msg(trace_channel, 5,
+      "host-wide unauthenticated connection count (%u) gives drop "
+      "probability %u", stats.host_conn_count - stats.host_authd_count,
+      host_pct);
+  }
+
+  unauthd_count = loiter_get_unauthd_count(&stats);
+  if (stats.cluster_npeers > 0) {
+    pr_trace_msg(trace_channel, 9,
+      "including %u unauthenticated connections from %u cluster %s",
+      stats.cluster_unauthd_count, stats.cluster_npeers,
+      stats.cluster_npeers != 1 ? "peers" : "peer");
+  }
+
+  /* The daemon samples the system pressure for us; see LoiterPressure. */
+  timing_id = loiter_timing_switch(LOITER_SHM_TIMING_SHM_READ);
+  pressure = loiter_shm_get_pressure(loiter_pool);
+  (void) loiter_timing_switch(timing_id);
+
+  prob = loiter_get_drop_prob(&stats, unauthd_count, host_pct, pressure);
+
+  if (loiter_policy->nshadows > 0) {
+    return loiter_roll_shadows(prob, unauthd_count, host_pct, pressure);
+  }
+
+  return loiter_roll(prob);
+}
+
+/* Records the ban of this session's source in the LoiterBan file, for
+ * e.g. a firewall to pick up.
+ */
+static void loiter_write_ban(const char *path) {
+  int res, xerrno;
+  char buf[128];
+  size_t buflen;
+
+  if (loiter_banfd < 0) {
+    pr_signals_block();
+    PRIVS_ROOT
+    res = pr_log_openfile(path, &loiter_banfd, 0600);
+    xerrno = errno;
+    PRIVS_RELINQUISH
+    pr_signals_unblock();
+
+    if (res < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "unable to open LoiterBan file '%s': %s", path,
+        res == -1 ? strerror(xerrno) : "unsafe path");
+      return;
+    }
+  }
+
+  memset(buf, '\0', sizeof(buf));
+  buflen = snprintf(buf, sizeof(buf)-1, "%s\n", loiter_source->name);
+  if (write(loiter_banfd, buf, buflen) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error writing to LoiterBan file '%s': %s", path, strerror(errno));
+  }
+}
+
+/* Counts this session's dropped connection against its source, and returns
+ * the number dropped within the LoiterBan window; once that reaches the
+ * LoiterBan count, the source is announced as a repeat offender.
+ */
+static unsigned int loiter_count_drop(struct loiter_dropped_event *dropped) {
+  unsigned int count, window;
+  int res;
+
+  if (loiter_source == NULL ||
+      loiter_policy->ban_window == 0) {
+    return 0;
+  }
+
+  count = loiter_policy->ban_count;
+  window = loiter_policy->ban_window;
+
+  res = loiter_shm_offender_incr(loiter_pool, loiter_source, window);
+  if (res < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error counting dropped connection for %s: %s", loiter_source->name,
+      strerror(errno));
+    return 0;
+  }
+
+  /* Only announce the source once per window, when it reaches the count,
+   * rather than for every connection after that.
+   */
+  if ((unsigned int) res == count) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "banning %s: %u connections dropped within %u secs",
+      loiter_source->name, count, window);
+    pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+      ": banning %s: %u connections dropped within %u secs",
+      loiter_source->name, count, window);
+
+    if (loiter_policy->ban_path != NULL) {
+      loiter_write_ban(loiter_policy->ban_path);
+    }
+
+    dropped->drop_count = (unsigned int) res;
+    pr_event_generate("mod_loiter.repeat-offender", dropped);
+  }
+
+  return (unsigned int) res;
+}
+
+/* Drop this session's connection, for the loiter_drop_reason. */
+static void loiter_drop_session(void) {
+  struct loiter_dropped_event dropped;
+
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_LOG);
+
+  if (loiter_policy->message != NULL) {
+    /* XXX Should we support %a, %c variables? */
+    pr_response_send_async(R_530, "%s", loiter_policy->message);
+  }
+
+  (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+    "dropping connection (%s)", loiter_drop_reason);
+  pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION ": dropping connection (%s)",
+    loiter_drop_reason);
+
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
+
+  if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_NEJECTS, 1) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error incrementing dropped connection count: %s", strerror(errno));
+  }
+
+  memset(&dropped, 0, sizeof(dropped));
+  dropped.addr = pr_netaddr_get_sess_remote_addr();
+  dropped.server = main_server;
+  dropped.reason = loiter_drop_reason;
+  dropped.source_count = loiter_source_count;
+  dropped.prefix_count = loiter_prefix_count;
+  dropped.drop_count = loiter_count_drop(&dropped);
+
+  (void) loiter_timing_switch(-1);
+  pr_event_generate("mod_loiter.connection-dropped", &dropped);
+
+  /* We do not return to loiter_sess_init(), to record there. */
+  loiter_timing_record();
+
+  pr_session_disconnect(&loiter_module, PR_SESS_DISCONNECT_MODULE_ACL,
+    "Too many loitering connections");
+}
+
+#if defined(PR_USE_CTRLS)
+/* Controls handlers
+ */
+
+static int loiter_handle_rules(pr_ctrls_t *ctrl, int reqargc,
+    char **reqargv) {
+  register int i;
+  int adjusted;
+  unsigned int low, high, rate, config_low, config_high, config_rate;
+  struct loiter_rules rules;
+  struct loiter_shm_stats stats;
+
+  config_low = loiter_policy->rules.low;
+  config_high = loiter_policy->rules.high;
+  config_rate = loiter_policy->rules.rate;
+
+  if (loiter_shm_get_stats(loiter_pool, &stats) < 0) {
+    pr_ctrls_add_response(ctrl, "error reading LoiterTable: %s",
+      strerror(errno));
+    return -1;
+  }
+
+  low = stats.rules_low > 0 ? stats.rules_low : config_low;
+  high = stats.rules_high > 0 ? stats.rules_high : config_high;
+  rate = stats.rules_rate > 0 ? stats.rules_rate : config_rate;
+
+  /* Without any parameters, we simply report the current rules. */
+  if (reqargc == 1) {
+    pr_ctrls_add_response(ctrl, "LoiterRules low %u high %u rate %u (%s)",
+      low, high, rate,
+      (stats.rules_low > 0 || stats.rules_high > 0 || stats.rules_rate > 0) ?
+        "set via ftpdctl" : "configured");
+
+    for (i = 0; i < (int) loiter_policy->nshadows; i++) {
+      const struct loiter_policy_shadow *shadow;
+
+      shadow = &(loiter_policy->shadows[i]);
+      pr_ctrls_add_response(ctrl,
+        "LoiterShadowRules %s low %u high %u rate %u (not enforced)",
+        shadow->name, shadow->rules.low, shadow->rules.high,
+        shadow->rules.rate);
+    }
+
+    return 0;
+  }
+
+  if (reqargc == 2 &&
+      strcasecmp(reqargv[1], "reset") == 0) {
+    if (loiter_shm_set_rules(loiter_pool, 0, 0, 0) < 0) {
+      pr_ctrls_add_response(ctrl, "error resetting rules: %s",
+        strerror(errno));
+      return -1;
+    }
+
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "rules reset to configured values via ftpdctl");
+    pr_ctrls_add_response(ctrl,
+      "LoiterRules reset to low %u high %u rate %u", config_low, config_high,
+      config_rate);
+    return 0;
+  }
+
+  if (((reqargc - 1) % 2) != 0) {
+    pr_ctrls_add_response(ctrl,
+      "usage: loiter rules [reset|[low num] [high num] [rate num]]");
+    return -1;
+  }
+
+  for (i = 1; i < reqargc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(reqargv[i+1], &ptr, 10);
+    if (ptr && *ptr) {
+      pr_ctrls_add_response(ctrl, "invalid %s value: %s", reqargv[i],
+        reqargv[i+1]);
+      return -1;
+    }
+
+    if (strcasecmp(reqargv[i], "low") == 0) {
+      if (v < 1) {
+        pr_ctrls_add_response(ctrl, "low watermark must be >= 1");
+        return -1;
+      }
+
+      low = (unsigned int) v;
+
+    } else if (strcasecmp(reqargv[i], "high") == 0) {
+      if (v < 1) {
+        pr_ctrls_add_response(ctrl, "high watermark must be >= 1");
+        return -1;
+      }
+
+      high = (unsigned int) v;
+
+    } else if (strcasecmp(reqargv[i], "rate") == 0) {
+      if (v < 1 ||
+          v > 100) {
+        pr_ctrls_add_response(ctrl, "rate must be 1 <= r <= 100");
+        return -1;
+      }
+
+      rate = (unsigned int) v;
+
+    } else {
+      pr_ctrls_add_response(ctrl, "unknown keyword: %s", reqargv[i]);
+      return -1;
+    }
+  }
+
+  if (low >= high) {
+    pr_ctrls_add_response(ctrl,
+      "low watermark (%u) must be less than high watermark (%u)", low, high);
+    return -1;
+  }
+
+  /* Like configured rules, a high watermark above MaxInstances could never
+   * be reached, and so would never drop every connection.
+   */
+  rules.low = low;
+  rules.high = high;
+  rules.rate = rate;
+  rules.curve = NULL;
+
+  adjusted = loiter_policy_adjust_rules(&rules,
+    (unsigned long) ServerMaxInstances);
+  if (adjusted == TRUE) {
+    high = rules.high;
+
+    /* A zero low watermark in the LoiterTable means "as configured". */
+    low = rules.low > 0 ? rules.low : 1;
+  }
+
+  if (loiter_shm_set_rules(loiter_pool, low, high, rate) < 0) {
+    pr_ctrls_add_response(ctrl, "error setting rules: %s", strerror(errno));
+    return -1;
+  }
+
+  (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+    "rules set via ftpdctl: low %u high %u rate %u%s", low, high, rate,
+    adjusted ? " (adjusted for MaxInstances)" : "");
+  pr_ctrls_add_response(ctrl, "LoiterRules set to low %u high %u rate %u",
+    low, high, rate);
+
+  if (adjusted == TRUE) {
+    pr_ctrls_add_response(ctrl,
+      "(adjusted for MaxInstances %lu, keeping the ratio of low to high)",
+      (unsigned long) ServerMaxInstances);
+  }
+
+  return 0;
+}
+
+static int loiter_handle_shm(pr_ctrls_t *ctrl, int reqargc,
+    char **reqargv) {
+  const char *path;
+  int res;
+
+  if (reqargc != 2) {
+    pr_ctrls_add_response(ctrl, "usage: loiter shm remove|resize");
+    return -1;
+  }
+
+  if (loiter_policy == NULL ||
+      loiter_policy->table_path == NULL) {
+    pr_ctrls_add_response(ctrl, "no LoiterTable configured");
+    return -1;
+  }
+
+  path = loiter_policy->table_path;
+
+  if (strcasecmp(reqargv[1], "remove") == 0) {
+    res = loiter_shm_remove(loiter_pool, path);
+
+  } else if (strcasecmp(reqargv[1], "resize") == 0) {
+    res = loiter_shm_resize(loiter_pool, path);
+
+  } else {
+    pr_ctrls_add_response(ctrl, "unknown shm action: %s", reqargv[1]);
+    return -1;
+  }
+
+  if (res < 0) {
+    pr_ctrls_add_response(ctrl, "error handling shm %s for '%s': %s",
+      reqargv[1], path, strerror(errno));
+    return -1;
+  }
+
+  (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+    "LoiterTable '%s' shm %s via ftpdctl", path, reqargv[1]);
+  pr_ctrls_add_response(ctrl, "LoiterTable '%s' shm %s done", path,
+    reqargv[1]);
+  return 0;
+}
+
+/* Adds the latencies of session setup, by part, in usecs. */
+static void loiter_add_timing_responses(pr_ctrls_t *ctrl) {
+  register int i;
+
+  for (i = 0; i < LOITER_SHM_NTIMINGS; i++) {
+    struct loiter_histogram hist;
+
+    if (loiter_shm_get_timing(loiter_pool, i, &hist) < 0 ||
+        hist.count == 0) {
+      continue;
+    }
+
+    pr_ctrls_add_response(ctrl,
+      "latency %s: count %llu, mean_usecs %.1f, p50_usecs %.1f, "
+      "p90_usecs %.1f, p99_usecs %.1f, max_usecs %.1f",
+      loiter_shm_get_timing_name(i), (unsigned long long) hist.count,
+      ((double) hist.sum / hist.count) / 1000.0,
+      loiter_histogram_percentile(&hist, 50.0) / 1000.0,
+      loiter_histogram_percentile(&hist, 90.0) / 1000.0,
+      loiter_histogram_percentile(&hist, 99.0) / 1000.0,
+      hist.max / 1000.0);
+  }
+}
+
+static int loiter_handle_stats(pr_ctrls_t *ctrl, int reqargc,
+    char **reqargv) {
+  struct loiter_shm_stats stats;
+
+  if (loiter_shm_get_stats(loiter_pool, &stats) < 0) {
+    pr_ctrls_add_response(ctrl, "error reading LoiterTable: %s",
+      strerror(errno));
+    return -1;
+  }
+
+  pr_ctrls_add_response(ctrl, "conn_count: %u", stats.conn_count);
+  pr_ctrls_add_response(ctrl, "authd_count: %u", stats.authd_count);
+  pr_ctrls_add_response(ctrl, "unauthd_count: %u",
+    stats.conn_count >= stats.authd_count ?
+      stats.conn_count - stats.authd_count : 0);
+  pr_ctrls_add_response(ctrl, "dropped_count: %u", stats.nejects);
+  pr_ctrls_add_response(ctrl, "failed_login_weight: %u", stats.failed_count);
+  pr_ctrls_add_response(ctrl, "system_pressure: %u%%", stats.pressure);
+
+  if (loiter_policy->use_controller == TRUE) {
+    pr_ctrls_add_response(ctrl, "controller_drop_pct: %u%% (setpoint %u)",
+      stats.control_pct, loiter_policy->controller_setpoint);
+  }
+
+  pr_ctrls_add_response(ctrl, "cluster_unauthd_count: %u (%u %s)",
+    stats.cluster_unauthd_count, stats.cluster_npeers,
+    stats.cluster_npeers != 1 ? "peers" : "peer");
+
+  if (loiter_policy->distinct_window > 0) {
+    unsigned int window, distinct = 0, nconns = 0;
+
+    window = loiter_policy->distinct_window;
+    (void) loiter_shm_distinct_get(loiter_pool,
+      (uint32_t) (time(NULL) / window), &distinct, &nconns);
+
+    pr_ctrls_add_response(ctrl,
+      "distinct_sources: ~%u (%u connections, current %us window)", distinct,
+      nconns, window);
+    pr_ctrls_add_response(ctrl,
+      "distinct_sources_prev: ~%u (%u connections, previous window)",
+      stats.distinct_sources, stats.distinct_conns);
+  }
+
+  if (loiter_policy->nclasses > 0) {
+    register unsigned int i;
+    struct loiter_shm_class_stats *classes = NULL;
+    unsigned int nclasses = 0;
+    pool *tmp_pool;
+
+    tmp_pool = make_sub_pool(loiter_pool);
+    if (loiter_shm_get_classes(tmp_pool, &classes, &nclasses) == 0) {
+      for (i = 0; i < nclasses; i++) {
+        pr_ctrls_add_response(ctrl,
+          "class %s: conn_count %u, authd_count %u, dropped_count %u, "
+          "reserve %u", classes[i].name, classes[i].conn_count,
+          classes[i].authd_count, classes[i].nejects, classes[i].reserve);
+      }
+    }
+
+    destroy_pool(tmp_pool);
+  }
+
+  if (loiter_policy != NULL &&
+      loiter_policy->nshadows > 0) {
+    register unsigned int i;
+    struct loiter_shm_shadow_stats *shadows = NULL;
+    unsigned int nshadows = 0;
+    pool *tmp_pool;
+
+    tmp_pool = make_sub_pool(loiter_pool);
+    if (loiter_shm_get_shadows(tmp_pool, &shadows, &nshadows) == 0) {
+      for (i = 0; i < nshadows; i++) {
+        pr_ctrls_add_response(ctrl,
+          "shadow %s: evaluated_count %u, would_drop_count %u, "
+          "extra_drop_count %u, spared_count %u", shadows[i].name,
+          shadows[i].nevals, shadows[i].ndrops, shadows[i].nextra,
+          shadows[i].nspared);
+      }
+    }
+
+    destroy_pool(tmp_pool);
+  }
+
+  pr_ctrls_add_response(ctrl, "lock_retry_count: %u", stats.lock_nretries);
+  pr_ctrls_add_response(ctrl, "lock_failed_count: %u", stats.lock_nfailures);
+  pr_ctrls_add_response(ctrl, "lock_backoff_msecs: %.3f",
+    (double) stats.lock_backoff_nsecs / 1000000.0);
+
+  loiter_add_timing_responses(ctrl);
+
+  if (stats.host_npartitions > 0) {
+    pr_ctrls_add_response(ctrl, "host_conn_count: %u (%u %s)",
+      stats.host_conn_count, stats.host_npartitions,
+      stats.host_npartitions != 1 ? "partitions" : "partition");
+    pr_ctrls_add_response(ctrl, "host_authd_count: %u",
+      stats.host_authd_count);
+    pr_ctrls_add_response(ctrl, "host_unauthd_count: %u",
+      stats.host_conn_count >= stats.host_authd_count ?
+        stats.host_conn_count - stats.host_authd_count : 0);
+    pr_ctrls_add_response(ctrl, "host_dropped_count: %u", stats.host_nejects);
+  }
+
+  return 0;
+}
+
+static int loiter_heavy_cmp(const void *a, const void *b) {
+  const struct loiter_sketch_heavy *ha = a, *hb = b;
+
+  if (ha->count == hb->count) {
+    return 0;
+  }
+
+  return ha->count > hb->count ? -1 : 1;
+}
+
+static int loiter_handle_top(pr_ctrls_t *ctrl, int reqargc,
+    char **reqargv) {
+  register unsigned int i;
+  struct loiter_sketch_heavy top[LOITER_SKETCH_TOPK];
+  struct loiter_sketch_heavy prefix_top[LOITER_SKETCH_TOPK];
+
+  if (loiter_shm_sketch_get_top(loiter_pool, top, prefix_top) < 0) {
+    pr_ctrls_add_response(ctrl, "error reading LoiterTable: %s",
+      strerror(errno));
+    return -1;
+  }
+
+  qsort(top, LOITER_SKETCH_TOPK, sizeof(struct loiter_sketch_heavy),
+    loiter_heavy_cmp);
+  qsort(prefix_top, LOITER_SKETCH_TOPK, sizeof(struct loiter_sketch_heavy),
+    loiter_heavy_cmp);
+
+  for (i = 0; i < LOITER_SKETCH_TOPK; i++) {
+    if (top[i].name[0] != '\0') {
+      pr_ctrls_add_response(ctrl, "source %s: ~%u connections", top[i].name,
+        top[i].count);
+    }
+  }
+
+  for (i = 0; i < LOITER_SKETCH_TOPK; i++) {
+    if (prefix_top[i].name[0] != '\0') {
+      pr_ctrls_add_response(ctrl, "prefix %s: ~%u connections",
+        prefix_top[i].name, prefix_top[i].count);
+    }
+  }
+
+  return 0;
+}
+
+/* usage: loiter stats
+ *        loiter top
+ *        loiter shm remove|resize
+ *        loiter rules [reset|[low num] [high num] [rate num]]
+ */
+static int loiter_handle_loiter(pr_ctrls_t *ctrl, int reqargc,
+    char **reqargv) {
+
+  if (!pr_ctrls_check_acl(ctrl, loiter_acttab, "loiter")) {
+    pr_ctrls_add_response(ctrl, "access denied");
+    return -1;
+  }
+
+  if (reqargc == 0 ||
+      reqargv == NULL) {
+    pr_ctrls_add_response(ctrl, "loiter: missing required parameters");
+    return -1;
+  }
+
+  if (strcasecmp(reqargv[0], "stats") == 0) {
+    return loiter_handle_stats(ctrl, reqargc, reqargv);
+  }
+
+  if (strcasecmp(reqargv[0], "top") == 0) {
+    return loiter_handle_top(ctrl, reqargc, reqargv);
+  }
+
+  if (strcasecmp(reqargv[0], "shm") == 0) {
+    return loiter_handle_shm(ctrl, reqargc, reqargv);
+  }
+
+  if (strcasecmp(reqargv[0], "rules") == 0) {
+    return loiter_handle_rules(ctrl, reqargc, reqargv);
+  }
+
+  pr_ctrls_add_response(ctrl, "loiter: unknown action: '%s'", reqargv[0]);
+  return -1;
+}
+#endif /* PR_USE_CTRLS */
+
+/* Command handlers
+ */
+
+/* Another session, needing our process slot, may ask us to shed if we are
+ * idle; see LoiterIdleSessions.
+ */
+static void loiter_sig_usr2_ev(const void *event_data, void *user_data) {
+  if (loiter_slot < 0 ||
+      loiter_shm_slot_is_shed(loiter_pool, loiter_slot, getpid()) != TRUE) {
+    /* Not for us; SIGUSR2 is shared with other modules. */
+    return;
+  }
+
+  if (session.sf_flags & SF_XFER) {
+    /* A transfer is activity, even if no commands are being sent. */
+    pr_trace_msg(trace_channel, 5,
+      "asked to shed idle session, but transferring data; ignoring");
+    (void) loiter_shm_slot_touch(loiter_pool, loiter_slot, getpid());
+    return;
+  }
+
+  (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+    "shedding idle session to admit new connections");
+  pr_response_send_async(R_421,
+    "Idle session closed, to make room for other users");
+  pr_session_disconnect(&loiter_module, PR_SESS_DISCONNECT_MODULE_ACL,
+    "Idle session shed by mod_loiter");
+}
+
+/* Returns TRUE if the given PID is that of a session of this daemon, per the
+ * ScoreboardFile, FALSE otherwise.  A session which died without releasing
+ * its slot, e.g. when killed, leaves its PID there to be reused by any other
+ * process.
+ */
+static int loiter_is_session_pid(pid_t pid) {
+  pr_scoreboard_entry_t *score;
+  int found = FALSE;
+
+  if (pr_rewind_scoreboard() < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error rewinding scoreboard: %s", strerror(errno));
+    return FALSE;
+  }
+
+  while ((score = pr_scoreboard_entry_read()) != NULL) {
+    pr_signals_handle();
+
+    if (score->sce_pid == pid) {
+      found = TRUE;
+      break;
+    }
+  }
+
+  if (pr_restore_scoreboard() < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error restoring scoreboard: %s", strerror(errno));
+  }
+
+  return found;
+}
+
+/* Once near MaxInstances, ask the idlest authenticated session to shed, so
+ * that new logins can be admitted; see LoiterIdleSessions.
+ */
+static void loiter_shed_idle_session(void) {
+  unsigned int headroom, min_idle, idle = 0;
+  struct loiter_shm_stats stats;
+  pid_t pid = 0;
+  int idx, res, xerrno;
+
+  if (loiter_policy->use_idle == FALSE ||
+      ServerMaxInstances == 0) {
+    return;
+  }
+
+  headroom = loiter_policy->idle_headroom;
+  min_idle = loiter_policy->idle_min_idle;
+
+  if (loiter_shm_get_snapshot(loiter_pool, &stats) < 0 ||
+      stats.conn_count + headroom < ServerMaxInstances) {
+    return;
+  }
+
+  idx = loiter_shm_slot_shed_idlest(loiter_pool, min_idle, &pid, &idle);
+  if (idx < 0) {
+    pr_trace_msg(trace_channel, 9,
+      "%u of MaxInstances %lu connections, but no sessions idle for %u secs",
+      stats.conn_count, (unsigned long) ServerMaxInstances, min_idle);
+    return;
+  }
+
+  pr_trace_msg(trace_channel, 5,
+    "%u of MaxInstances %lu connections, asking PID %lu (idle %u secs) "
+    "to shed", stats.conn_count, (unsigned long) ServerMaxInstances,
+    (unsigned long) pid, idle);
+
+  /* SIGUSR2 terminates any process not expecting it; never send it, as
+   * root, to whichever process now has a dead session's PID.
+   */
+  if (loiter_is_session_pid(pid) == FALSE) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "idle session PID %lu is no longer a session, releasing its slot",
+      (unsigned long) pid);
+    (void) loiter_shm_slot_release(loiter_pool, idx, pid);
+    return;
+  }
+
+  PRIVS_ROOT
+  res = kill(pid, SIGUSR2);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error signalling idle session PID %lu: %s", (unsigned long) pid,
+      strerror(xerrno));
+
+    if (xerrno == ESRCH) {
+      /* That session is long gone, without releasing its slot. */
+      (void) loiter_shm_slot_release(loiter_pool, idx, pid);
+    }
+  }
+}
+
+/* Take this session's failed logins out of the LoiterTable, e.g. once it
+ * has authenticated.
+ */
+static void loiter_uncount_failures(void) {
+  if (loiter_failed_weight == 0) {
+    return;
+  }
+
+  if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_FAILED_COUNT,
+      -((int) loiter_failed_weight)) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error decrementing failed login count: %s", strerror(errno));
+  }
+
+  loiter_failed_weight = 0;
+}
+
+/* Stop counting this session against the user name it last attempted, if
+ * any.
+ */
+static void loiter_uncount_user(void) {
+  if (loiter_user_counted == FALSE) {
+    return;
+  }
+
+  if (loiter_shm_user_incr(loiter_pool, loiter_user_key, -1) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error decrementing user connection count: %s", strerror(errno));
+  }
+
+  loiter_user_counted = FALSE;
+}
+
+MODRET loiter_post_pass(cmd_rec *cmd) {
+  if (loiter_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  loiter_uncount_user();
+  loiter_uncount_failures();
+
+  if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_AUTHD_COUNT, 1) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error incrementing authenticated connection count: %s", strerror(errno));
+
+  } else {
+    loiter_has_authenticated = TRUE;
+  }
+
+  if (loiter_policy->use_idle == TRUE) {
+    loiter_slot = loiter_shm_slot_claim(loiter_pool, getpid());
+    if (loiter_slot < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "error claiming session slot: %s", strerror(errno));
+
+    } else {
+      pr_event_register(&loiter_module, "core.signal.USR2", loiter_sig_usr2_ev,
+        NULL);
+    }
+  }
+
+  if (loiter_policy->reputation_ttl > 0) {
+    const pr_netaddr_t *addr;
+
+    addr = pr_netaddr_get_sess_remote_addr();
+    if (addr != NULL &&
+        loiter_shm_reputation_add(loiter_pool, loiter_get_addr_key(addr),
+          time(NULL)) < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "error recording authenticated source %s: %s",
+        pr_netaddr_get_ipstr(addr), strerror(errno));
+    }
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET loiter_log_any(cmd_rec *cmd) {
+  if (loiter_slot >= 0) {
+    (void) loiter_shm_slot_touch(loiter_pool, loiter_slot, getpid());
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET loiter_post_pass_err(cmd_rec *cmd) {
+  unsigned int weight, window, evict;
+  struct loiter_shm_stats stats;
+
+  if (loiter_engine == FALSE ||
+      loiter_policy->authfail_window == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  weight = loiter_policy->authfail_weight;
+  window = loiter_policy->authfail_window;
+  evict = loiter_policy->authfail_evict;
+
+  loiter_failed_count++;
+
+  if (weight > 0) {
+    if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_FAILED_COUNT,
+        (int) weight) < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "error incrementing failed login count: %s", strerror(errno));
+
+    } else {
+      loiter_failed_weight += weight;
+    }
+  }
+
+  if (loiter_source != NULL &&
+      loiter_shm_failure_incr(loiter_pool, loiter_source, window) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error recording failed login for %s: %s", loiter_source->name,
+      strerror(errno));
+  }
+
+  if (evict == 0 ||
+      loiter_failed_count < evict) {
+    return PR_DECLINED(cmd);
+  }
+
+  /* This session is among the worst offenders; if we are loitering at all,
+   * make room for others by evicting it.
+   */
+  if (loiter_shm_get_stats(loiter_pool, &stats) == 0) {
+    struct loiter_rules rules;
+
+    rules = loiter_policy->rules;
+    loiter_apply_runtime_rules(&stats, &rules);
+
+    if (loiter_get_unauthd_count(&stats) >= rules.low) {
+      pr_trace_msg(trace_channel, 5,
+        "session failed %u logins, evicting", loiter_failed_count);
+      loiter_drop_reason = LOITER_DROP_REASON_AUTH_FAILURES;
+      loiter_drop_session();
+    }
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET loiter_pre_user(cmd_rec *cmd) {
+  const char *user;
+  uint64_t key;
+  int count;
+  unsigned int p;
+
+  if (loiter_engine == FALSE ||
+      loiter_policy->use_user_rules == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  user = cmd->arg;
+  key = loiter_get_key((const unsigned char *) user, strlen(user));
+
+  if (loiter_user_counted == TRUE) {
+    if (key == loiter_user_key) {
+      /* Already counted, e.g. for a repeated USER command. */
+      return PR_DECLINED(cmd);
+    }
+
+    loiter_uncount_user();
+  }
+
+  count = loiter_shm_user_incr(loiter_pool, key, 1);
+  if (count < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error incrementing connection count for user '%s': %s", user,
+      strerror(errno));
+    return PR_DECLINED(cmd);
+  }
+
+  loiter_user_key = key;
+  loiter_user_counted = TRUE;
+
+  p = loiter_policy_drop_pct(&(loiter_policy->user_rules),
+    (unsigned int) count);
+  if (p > 0) {
+    pr_trace_msg(trace_channel, 5,
+      "unauthenticated connection count for user '%s' (%d) gives drop "
+      "probability %u", user, count, p);
+  }
+
+  if (loiter_roll(p * LOITER_PRNG_PCT) == TRUE) {
+    loiter_drop_reason = LOITER_DROP_REASON_PER_USER;
+    loiter_drop_session();
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+/* Configuration handlers
+ */
+
+/* usage: LoiterAgentCheck address [drain percent] */
+MODRET set_loiteragentcheck(cmd_rec *cmd) {
+  config_rec *c;
+  unsigned int drain_pct = LOITER_AGENT_DEFAULT_DRAIN_PCT;
+  const char *addr;
+
+  if (cmd->argc != 2 &&
+      cmd->argc != 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  addr = cmd->argv[1];
+  if (*addr != '/' &&
+      strrchr(addr, ':') == NULL) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+      "address must be an absolute path or address:port: ", addr, NULL));
+  }
+
+  if (cmd->argc == 4) {
+    char *ptr = NULL;
+    long v;
+
+    if (strcasecmp(cmd->argv[2], "drain") != 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ",
+        cmd->argv[2], NULL));
+    }
+
+    v = strtol(cmd->argv[3], &ptr, 10);
+    if ((ptr && *ptr) ||
+        v < 1 ||
+        v > 100) {
+      CONF_ERROR(cmd, "drain percentage must be 1 <= p <= 100");
+    }
+
+    drain_pct = (unsigned int) v;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, addr);
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = drain_pct;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterAuthFailures [weight num] [window secs] [evict count] */
+MODRET set_loiterauthfailures(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int weight = LOITER_AUTHFAIL_DEFAULT_WEIGHT;
+  unsigned int window = LOITER_AUTHFAIL_DEFAULT_WINDOW;
+  unsigned int evict = LOITER_AUTHFAIL_DEFAULT_EVICT;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(cmd->argv[i+1], &ptr, 10);
+    if ((ptr && *ptr) ||
+        v < 0 ||
+        v > 65535) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+        " value: ", cmd->argv[i+1], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "weight") == 0) {
+      weight = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "window") == 0) {
+      if (v < 1) {
+        CONF_ERROR(cmd, "window must be >= 1");
+      }
+
+      window = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "evict") == 0) {
+      evict = (unsigned int) v;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = weight;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = window;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = evict;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterBan [count num] [within secs] [file path] */
+MODRET set_loiterban(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int count = LOITER_BAN_DEFAULT_COUNT;
+  unsigned int window = LOITER_BAN_DEFAULT_WINDOW;
+  char *path = NULL;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    if (strcasecmp(cmd->argv[i], "file") == 0) {
+      if (pr_fs_valid_path(cmd->argv[i+1]) < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+          "file must be an absolute path: ", cmd->argv[i+1], NULL));
+      }
+
+      path = cmd->argv[i+1];
+
+    } else if (strcasecmp(cmd->argv[i], "count") == 0 ||
+               strcasecmp(cmd->argv[i], "within") == 0) {
+      char *ptr = NULL;
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if ((ptr && *ptr) ||
+          v < 1 ||
+          v > 65535) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+          " value: ", cmd->argv[i+1], NULL));
+      }
+
+      if (strcasecmp(cmd->argv[i], "count") == 0) {
+        count = (unsigned int) v;
+
+      } else {
+        window = (unsigned int) v;
+      }
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = count;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = window;
+  if (path != NULL) {
+    c->argv[2] = pstrdup(c->pool, path);
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterClusterListen address:port [interval] */
+MODRET set_loiterclusterlisten(cmd_rec *cmd) {
+  config_rec *c;
+  int interval = LOITER_CLUSTER_DEFAULT_INTERVAL;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (strrchr(cmd->argv[1], ':') == NULL) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "address must be address:port: ",
+      cmd->argv[1], NULL));
+  }
+
+  if (cmd->argc == 3) {
+    char *ptr = NULL;
+
+    interval = (int) strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr && *ptr) ||
+        interval < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid interval: ",
+        cmd->argv[2], NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = interval;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterClusterPeer address:port ... */
+MODRET set_loiterclusterpeer(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+
+  if (cmd->argc < 2) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  c = add_config_param(cmd->argv[0], cmd->argc-1, NULL);
+  for (i = 1; i < cmd->argc; i++) {
+    if (strrchr(cmd->argv[i], ':') == NULL) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "peer must be address:port: ",
+        cmd->argv[i], NULL));
+    }
+
+    c->argv[i-1] = pstrdup(c->pool, cmd->argv[i]);
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterClusterSecret key */
+MODRET set_loiterclustersecret(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned char *key;
+  const char *hex;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  hex = cmd->argv[1];
+  for (i = 0; hex[i] != '\0'; i++) {
+    if (!isxdigit((int) hex[i])) {
+      break;
+    }
+  }
+
+  if (hex[i] != '\0' ||
+      i != LOITER_CLUSTER_KEY_SIZE * 2) {
+    CONF_ERROR(cmd, "key must be 32 hex digits, e.g. from "
+      "'openssl rand -hex 16'");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  key = palloc(c->pool, LOITER_CLUSTER_KEY_SIZE);
+
+  for (i = 0; i < LOITER_CLUSTER_KEY_SIZE; i++) {
+    char digits[3];
+
+    digits[0] = hex[i * 2];
+    digits[1] = hex[(i * 2) + 1];
+    digits[2] = '\0';
+    key[i] = (unsigned char) strtoul(digits, NULL, 16);
+  }
+
+  c->argv[0] = key;
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterController setpoint count [interval secs] [kp gain]
+ *          [ki gain]
+ */
+MODRET set_loitercontroller(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int setpoint = 0, interval = LOITER_CONTROLLER_DEFAULT_INTERVAL;
+  double kp = LOITER_CONTROLLER_DEFAULT_KP, ki = LOITER_CONTROLLER_DEFAULT_KI;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+
+    if (strcasecmp(cmd->argv[i], "setpoint") == 0 ||
+        strcasecmp(cmd->argv[i], "interval") == 0) {
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if ((ptr && *ptr) ||
+          v < 1) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+          " value: ", cmd->argv[i+1], NULL));
+      }
+
+      if (strcasecmp(cmd->argv[i], "setpoint") == 0) {
+        setpoint = (unsigned int) v;
+
+      } else {
+        interval = (unsigned int) v;
+      }
+
+    } else if (strcasecmp(cmd->argv[i], "kp") == 0 ||
+               strcasecmp(cmd->argv[i], "ki") == 0) {
+      double v;
+
+      v = strtod(cmd->argv[i+1], &ptr);
+      if ((ptr && *ptr) ||
+          v < 0.0 ||
+          v > 100.0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+          " value: ", cmd->argv[i+1], NULL));
+      }
+
+      if (strcasecmp(cmd->argv[i], "kp") == 0) {
+        kp = v;
+
+      } else {
+        ki = v;
+      }
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  if (setpoint == 0) {
+    CONF_ERROR(cmd, "missing required setpoint");
+  }
+
+  if (kp == 0.0 &&
+      ki == 0.0) {
+    CONF_ERROR(cmd, "kp and ki cannot both be zero");
+  }
+
+  c = add_config_param(cmd->argv[0], 4, NULL, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = setpoint;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = interval;
+  c->argv[2] = palloc(c->pool, sizeof(double));
+  *((double *) c->argv[2]) = kp;
+  c->argv[3] = palloc(c->pool, sizeof(double));
+  *((double *) c->argv[3]) = ki;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterControlsACLs actions|all allow|deny user|group list */
+MODRET set_loiterctrlsacls(cmd_rec *cmd) {
+#if defined(PR_USE_CTRLS)
+  char **actions = NULL;
+  const char *bad_action = NULL;
+  int res;
+
+  CHECK_ARGS(cmd, 4);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  /* We can cheat here, and use the ctrls_parse_acl() routine to
+   * separate the given string...
+   */
+  actions = ctrls_parse_acl(cmd->tmp_pool, cmd->argv[1]);
+
+  /* Check the second parameter to make sure it is "allow" or "deny" */
+  if (strcasecmp(cmd->argv[2], "allow") != 0 &&
+      strcasecmp(cmd->argv[2], "deny") != 0) {
+    CONF_ERROR(cmd, "second parameter must be 'allow' or 'deny'");
+  }
+
+  /* Check the third parameter to make sure it is "user" or "group" */
+  if (strcasecmp(cmd->argv[3], "user") != 0 &&
+      strcasecmp(cmd->argv[3], "group") != 0) {
+    CONF_ERROR(cmd, "third parameter must be 'user' or 'group'");
+  }
+
+  res = pr_ctrls_set_module_acls2(loiter_acttab, loiter_pool, actions,
+    cmd->argv[2], cmd->argv[3], cmd->argv[4], &bad_action);
+  if (res < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown action: '", bad_action,
+      "'", NULL));
+  }
+
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd, "requires Controls support (--enable-ctrls)");
+#endif /* PR_USE_CTRLS */
+}
+
+/* usage: LoiterDistinctSources [window secs] [threshold count] */
+MODRET set_loiterdistinctsources(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int window = LOITER_DISTINCT_DEFAULT_WINDOW;
+  unsigned int threshold = LOITER_DISTINCT_DEFAULT_THRESHOLD;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(cmd->argv[i+1], &ptr, 10);
+    if ((ptr && *ptr) ||
+        v < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+        " value: ", cmd->argv[i+1], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "window") == 0) {
+      if (v < 1) {
+        CONF_ERROR(cmd, "window must be >= 1");
+      }
+
+      window = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "threshold") == 0) {
+      threshold = (unsigned int) v;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = window;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = threshold;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterEngine on|off */
+MODRET set_loiterengine(cmd_rec *cmd) {
+  int engine = 1;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterHeavyHitters [window secs] [threshold count]
+ *          [prefix-threshold count]
+ */
+MODRET set_loiterheavyhitters(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int window = LOITER_HEAVY_DEFAULT_WINDOW;
+  unsigned int threshold = LOITER_HEAVY_DEFAULT_THRESHOLD;
+  unsigned int prefix_threshold = LOITER_HEAVY_DEFAULT_PREFIX_THRESHOLD;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(cmd->argv[i+1], &ptr, 10);
+    if ((ptr && *ptr) ||
+        v < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+        " value: ", cmd->argv[i+1], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "window") == 0) {
+      window = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "threshold") == 0) {
+      threshold = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "prefix-threshold") == 0) {
+      prefix_threshold = (unsigned int) v;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = window;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = threshold;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = prefix_threshold;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterIdleSessions [headroom count] [idle secs] */
+MODRET set_loiteridlesessions(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int headroom = LOITER_IDLE_DEFAULT_HEADROOM;
+  unsigned int min_idle = LOITER_IDLE_DEFAULT_MIN_IDLE;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(cmd->argv[i+1], &ptr, 10);
+    if ((ptr && *ptr) ||
+        v < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+        " value: ", cmd->argv[i+1], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "headroom") == 0) {
+      headroom = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "idle") == 0) {
+      if (v < 1) {
+        CONF_ERROR(cmd, "idle must be >= 1");
+      }
+
+      min_idle = (unsigned int) v;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = headroom;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = min_idle;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterLog path|"none" */
+MODRET set_loiterlog(cmd_rec *cmd) {
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  (void) add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterMessage msg */
+MODRET set_loitermessage(cmd_rec *cmd) {
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  (void) add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterMetricsFile path [interval] */
+MODRET set_loitermetricsfile(cmd_rec *cmd) {
+  config_rec *c;
+  int interval = LOITER_METRICS_DEFAULT_INTERVAL;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (pr_fs_valid_path(cmd->argv[1]) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "path must be an absolute path: ",
+      cmd->argv[1], NULL));
+  }
+
+  if (cmd->argc == 3) {
+    char *ptr = NULL;
+
+    interval = (int) strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr && *ptr) ||
+        interval < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid interval: ",
+        cmd->argv[2], NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = interval;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterPrefixTable path */
+MODRET set_loiterprefixtable(cmd_rec *cmd) {
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (pr_fs_valid_path(cmd->argv[1]) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "path must be an absolute path: ",
+      cmd->argv[1], NULL));
+  }
+
+  (void) add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterPressure [interval secs] [load per-cpu] [memory percent]
+ *          [psi percent] [procs count]
+ */
+MODRET set_loiterpressure(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int interval = LOITER_PRESSURE_DEFAULT_INTERVAL;
+  unsigned int load = 0, memory = 0, psi = 0, procs = 0;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+
+    if (strcasecmp(cmd->argv[i], "load") == 0) {
+      double v;
+
+      v = strtod(cmd->argv[i+1], &ptr);
+      if ((ptr && *ptr) ||
+          v <= 0.0 ||
+          v > 1000.0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid load value: ",
+          cmd->argv[i+1], NULL));
+      }
+
+      load = (unsigned int) ((v * 100) + 0.5);
+
+    } else if (strcasecmp(cmd->argv[i], "interval") == 0 ||
+               strcasecmp(cmd->argv[i], "memory") == 0 ||
+               strcasecmp(cmd->argv[i], "psi") == 0 ||
+               strcasecmp(cmd->argv[i], "procs") == 0) {
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if ((ptr && *ptr) ||
+          v < 1) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+          " value: ", cmd->argv[i+1], NULL));
+      }
+
+      if (strcasecmp(cmd->argv[i], "interval") == 0) {
+        interval = (unsigned int) v;
+
+      } else if (strcasecmp(cmd->argv[i], "procs") == 0) {
+        procs = (unsigned int) v;
+
+      } else {
+        if (v > 100) {
+          CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, cmd->argv[i],
+            " must be 1 <= p <= 100", NULL));
+        }
+
+        if (strcasecmp(cmd->argv[i], "memory") == 0) {
+          memory = (unsigned int) v;
+
+        } else {
+          psi = (unsigned int) v;
+        }
+      }
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  if (load == 0 &&
+      memory == 0 &&
+      psi == 0 &&
+      procs == 0) {
+    CONF_ERROR(cmd, "at least one of load, memory, psi, or procs is required");
+  }
+
+  c = add_config_param(cmd->argv[0], 5, NULL, NULL, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = interval;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = load;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = memory;
+  c->argv[3] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[3]) = psi;
+  c->argv[4] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[4]) = procs;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterRandomSeed seed */
+MODRET set_loiterrandomseed(cmd_rec *cmd) {
+  config_rec *c;
+  char *ptr = NULL;
+  unsigned long long seed;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  errno = 0;
+  seed = strtoull(cmd->argv[1], &ptr, 10);
+  if ((ptr && *ptr) ||
+      errno == ERANGE) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid seed: ", cmd->argv[1],
+      NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(uint64_t));
+  *((uint64_t *) c->argv[0]) = (uint64_t) seed;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterRateLimit [rate count] [burst count] [prefix-rate count]
+ *          [prefix-burst count]
+ */
+MODRET set_loiterratelimit(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int rate = LOITER_RATELIMIT_DEFAULT_RATE;
+  unsigned int burst = LOITER_RATELIMIT_DEFAULT_BURST;
+  unsigned int prefix_rate = LOITER_RATELIMIT_DEFAULT_PREFIX_RATE;
+  unsigned int prefix_burst = LOITER_RATELIMIT_DEFAULT_PREFIX_BURST;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(cmd->argv[i+1], &ptr, 10);
+    if ((ptr && *ptr) ||
+        v < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+        " value: ", cmd->argv[i+1], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "rate") == 0) {
+      rate = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "prefix-rate") == 0) {
+      prefix_rate = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "burst") == 0 ||
+               strcasecmp(cmd->argv[i], "prefix-burst") == 0) {
+      if (v < 1 ||
+          v > LOITER_BUCKET_MAX_BURST) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, cmd->argv[i],
+          " must be 1 <= b <= 1023", NULL));
+      }
+
+      if (strcasecmp(cmd->argv[i], "burst") == 0) {
+        burst = (unsigned int) v;
+
+      } else {
+        prefix_burst = (unsigned int) v;
+      }
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 4, NULL, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = rate;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = burst;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = prefix_rate;
+  c->argv[3] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[3]) = prefix_burst;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterReputation [ttl secs] [factor percent] */
+MODRET set_loiterreputation(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int ttl = LOITER_REPUTATION_DEFAULT_TTL;
+  unsigned int factor = LOITER_REPUTATION_DEFAULT_FACTOR;
+
+  if (cmd->argc < 3 ||
+      ((cmd->argc-1) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = 1; i < cmd->argc; i += 2) {
+    char *ptr = NULL;
+    long v;
+
+    v = strtol(cmd->argv[i+1], &ptr, 10);
+    if (ptr && *ptr) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid ", cmd->argv[i],
+        " value: ", cmd->argv[i+1], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "ttl") == 0) {
+      if (v < 1) {
+        CONF_ERROR(cmd, "ttl must be >= 1");
+      }
+
+      ttl = (unsigned int) v;
+
+    } else if (strcasecmp(cmd->argv[i], "factor") == 0) {
+      if (v < 0 ||
+          v > 100) {
+        CONF_ERROR(cmd, "factor must be 0 <= f <= 100");
+      }
+
+      factor = (unsigned int) v;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = ttl;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = factor;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterRules [low ...] [high ...] [rate ...] [curve ...]
+ *          [points ...]
+ *        LoiterHostRules [low ...] [high ...] [rate ...] [curve ...]
+ *          [points ...]
+ *        LoiterClassRules class [low ...] [high ...] [rate ...] [curve ...]
+ *          [points ...] [reserve ...]
+ *        LoiterShadowRules name [low ...] [high ...] [rate ...] [curve ...]
+ *          [points ...]
+ */
+MODRET set_loiterrules(cmd_rec *cmd) {
+  register unsigned int i;
+  config_rec *c;
+  unsigned int low = LOITER_RULES_DEFAULT_LOW;
+  unsigned int high = LOITER_RULES_DEFAULT_HIGH;
+  unsigned int rate = LOITER_RULES_DEFAULT_RATE;
+  unsigned int first = 1, reserve = 0;
+  int curve_type = LOITER_CURVE_LINEAR, have_rules = FALSE, have_curve = FALSE;
+  const char *class_name = NULL, *shadow_name = NULL, *points = NULL;
+  struct loiter_curve *curve;
+
+  /* LoiterClassRules takes the class name first; LoiterShadowRules, the name
+   * under which its decisions are counted.
+   */
+  if (strcasecmp(cmd->argv[0], "LoiterClassRules") == 0) {
+    if (cmd->argc < 2) {
+      CONF_ERROR(cmd, "wrong number of parameters");
+    }
+
+    class_name = cmd->argv[1];
+    first = 2;
+
+  } else if (strcasecmp(cmd->argv[0], "LoiterShadowRules") == 0) {
+    if (cmd->argc < 2) {
+      CONF_ERROR(cmd, "wrong number of parameters");
+    }
+
+    shadow_name = cmd->argv[1];
+    first = 2;
+  }
+
+  if (cmd->argc < first + 2 ||
+      ((cmd->argc - first) % 2) != 0) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  for (i = first; i < cmd->argc; i += 2) {
+    if (strcasecmp(cmd->argv[i], "low") == 0) {
+      char *ptr = NULL;
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if (ptr && *ptr) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid low watermark value: ",
+          cmd->argv[i+1], NULL));
+      }
+
+      if (v < 1) {
+        CONF_ERROR(cmd, "low watermark must be >= 1");
+      }
+
+      low = (unsigned int) v;
+      have_rules = TRUE;
+
+    } else if (strcasecmp(cmd->argv[i], "high") == 0) {
+      char *ptr = NULL;
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if (ptr && *ptr) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid high watermark value: ",
+          cmd->argv[i+1], NULL));
+      }
+
+      if (v < 1) {
+        CONF_ERROR(cmd, "high watermark must be >= 1");
+      }
+
+      high = (unsigned int) v;
+      have_rules = TRUE;
+
+    } else if (strcasecmp(cmd->argv[i], "rate") == 0) {
+      char *ptr = NULL;
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if (ptr && *ptr) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid rate value: ",
+          cmd->argv[i+1], NULL));
+      }
+
+      if (v < 1 ||
+          v > 100) {
+        CONF_ERROR(cmd, "rate must be 1 <= r <= 100");
+      }
+
+      rate = (unsigned int) v;
+      have_rules = TRUE;
+
+    } else if (strcasecmp(cmd->argv[i], "curve") == 0) {
+      curve_type = loiter_curve_get_type(cmd->argv[i+1]);
+      if (curve_type < 0 ||
+          curve_type == LOITER_CURVE_POINTS) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown curve: ",
+          cmd->argv[i+1], NULL));
+      }
+
+      have_curve = TRUE;
+
+    } else if (strcasecmp(cmd->argv[i], "points") == 0) {
+      points = cmd->argv[i+1];
+
+    } else if (class_name != NULL &&
+               strcasecmp(cmd->argv[i], "reserve") == 0) {
+      char *ptr = NULL;
+      long v;
+
+      v = strtol(cmd->argv[i+1], &ptr, 10);
+      if ((ptr && *ptr) ||
+          v < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid reserve value: ",
+          cmd->argv[i+1], NULL));
+      }
+
+      reserve = (unsigned int) v;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
+        NULL));
+    }
+  }
+
+  if (points != NULL &&
+      have_rules == TRUE) {
+    CONF_ERROR(cmd, "points cannot be used with low, high, or rate");
+  }
+
+  if (points != NULL &&
+      have_curve == TRUE) {
+    CONF_ERROR(cmd, "points cannot be used with curve");
+  }
+
+  /* The points give their own watermarks, checked when they are parsed. */
+  if (points == NULL &&
+      low >= high) {
+    CONF_ERROR(cmd, "low watermark must be less than high watermark");
+  }
+
+  if (class_name != NULL &&
+      strlen(class_name) >= LOITER_SHM_PARTITION_NAMESZ) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "class name too long: ",
+      class_name, NULL));
+  }
+
+  if (shadow_name != NULL &&
+      strlen(shadow_name) >= LOITER_SHM_PARTITION_NAMESZ) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "shadow rules name too long: ",
+      shadow_name, NULL));
+  }
+
+  if (shadow_name != NULL) {
+    c = add_config_param(cmd->argv[0], 5, NULL, NULL, NULL, NULL, NULL);
+    c->argv[4] = pstrdup(c->pool, shadow_name);
+
+  } else if (class_name == NULL) {
+    c = add_config_param(cmd->argv[0], 4, NULL, NULL, NULL, NULL);
+
+  } else {
+    c = add_config_param(cmd->argv[0], 6, NULL, NULL, NULL, NULL, NULL, NULL);
+    c->argv[4] = pstrdup(c->pool, class_name);
+    c->argv[5] = palloc(c->pool, sizeof(unsigned int));
+    *((unsigned int *) c->argv[5]) = reserve;
+  }
+
+  /* Tabulate the drop probabilities now, so that the per-connection check
+   * is a lookup.
+   */
+  curve = pcalloc(c->pool, sizeof(struct loiter_curve));
+  curve->type = curve_type;
+  curve->low = low;
+  curve->high = high;
+  curve->rate = rate;
+
+  if (points != NULL) {
+    if (loiter_curve_parse_points(c->pool, curve, points) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid points '", points,
+        "': expected increasing count:percent pairs, ending at 100 percent",
+        NULL));
+    }
+
+    low = curve->low;
+    high = curve->high;
+    rate = curve->rate;
+  }
+
+  if (loiter_curve_compile(c->pool, curve) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error compiling curve: ",
+      strerror(errno), NULL));
+  }
+
+  c->argv[3] = curve;
+
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = low;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = high;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = rate;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: LoiterTable path [partition name] */
+MODRET set_loitertable(cmd_rec *cmd) {
+  char *partition = NULL;
+
+  if (cmd->argc != 2 &&
+      cmd->argc != 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (cmd->argc == 4) {
+    if (strcasecmp(cmd->argv[2], "partition") != 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ",
+        cmd->argv[2], NULL));
+    }
+
+    partition = cmd->argv[3];
+    if (strlen(partition) >= LOITER_SHM_PARTITION_NAMESZ) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "partition name too long: ",
+        partition, NULL));
+    }
+  }
+
+  (void) add_config_param_str(cmd->argv[0], 2, cmd->argv[1], partition);
+  return PR_HANDLED(cmd);
+}
+
+/* Agent checks
+ */
+
+/* Reports the weight for this server, for load balancers; the weight falls
+ * as the count of unauthenticated connections approaches the high watermark.
+ * Once the drop probability reaches the configured percentage, we ask to be
+ * drained of new connections altogether.
+ */
+static const char *loiter_agent_status(pool *p) {
+  unsigned int drop_pct, drain_pct, unauthd_count, weight;
+  struct loiter_rules rules;
+  struct loiter_shm_stats stats;
+  char status[32];
+
+  if (loiter_shm_get_snapshot(loiter_pool, &stats) < 0) {
+    pr_trace_msg(trace_channel, 3, "error reading LoiterTable: %s",
+      strerror(errno));
+
+    /* Let the load balancer use its own health checks. */
+    return NULL;
+  }
+
+  rules = loiter_policy->rules;
+  loiter_apply_runtime_rules(&stats, &rules);
+
+  unauthd_count = loiter_get_unauthd_count(&stats);
+
+  drain_pct = LOITER_AGENT_DEFAULT_DRAIN_PCT;
+  if (loiter_policy->agent_check != NULL) {
+    drain_pct = loiter_policy->agent_drain_pct;
+  }
+
+  drop_pct = loiter_get_effective_drop_pct(&stats, &rules, unauthd_count);
+  if (drop_pct >= drain_pct) {
+    return "drain";
+  }
+
+  weight = 1;
+  if (unauthd_count < rules.high) {
+    weight = 100 - ((unauthd_count * 100) / rules.high);
+    if (weight < 1) {
+      weight = 1;
+    }
+  }
+
+  memset(status, '\0', sizeof(status));
+  snprintf(status, sizeof(status)-1, "ready %u%%", weight);
+  return pstrdup(p, status);
+}
+
+static void loiter_start_agent(void) {
+  (void) loiter_agent_stop();
+
+  /* The agent serves the daemon's LoiterTable. */
+  if (ServerType != SERVER_STANDALONE) {
+    return;
+  }
+
+  if (loiter_policy == NULL ||
+      loiter_policy->engine == FALSE) {
+    return;
+  }
+
+  if (loiter_policy->agent_check != NULL) {
+    (void) loiter_agent_set_check(loiter_pool, loiter_policy->agent_check,
+      loiter_agent_status);
+  }
+
+  if (loiter_policy->cluster_listen != NULL) {
+    if (loiter_policy->cluster_peers->nelts == 0) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": LoiterClusterListen configured without any LoiterClusterPeer, "
+        "ignoring");
+
+    } else {
+      if (loiter_policy->cluster_secret == NULL) {
+        pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+          ": no LoiterClusterSecret configured, cluster reports will not be "
+          "authenticated");
+      }
+
+      (void) loiter_agent_set_cluster(loiter_pool,
+        loiter_policy->cluster_listen, loiter_policy->cluster_peers,
+        loiter_policy->cluster_interval, loiter_policy->cluster_secret,
+        (unsigned int) ServerMaxInstances);
+    }
+  }
+
+  if (loiter_agent_start(loiter_pool) < 0) {
+    pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+      ": unable to start agent process: %s", strerror(errno));
+  }
+}
+
+/* Timers
+ */
+
+static int loiter_pressure_timer_cb(CALLBACK_FRAME) {
+  struct loiter_pressure_limits limits;
+  unsigned int pressure;
+
+  if (loiter_policy == NULL ||
+      loiter_policy->use_pressure == FALSE) {
+    loiter_pressure_timerno = -1;
+    return 0;
+  }
+
+  memset(&limits, 0, sizeof(limits));
+  limits.load = loiter_policy->pressure_load;
+  limits.memory = loiter_policy->pressure_memory;
+  limits.psi = loiter_policy->pressure_psi;
+  limits.procs = loiter_policy->pressure_procs;
+
+  pressure = loiter_pressure_sample(loiter_pool, &limits);
+  if (loiter_shm_set_pressure(loiter_pool, pressure) < 0) {
+    pr_trace_msg(trace_channel, 3, "error publishing system pressure: %s",
+      strerror(errno));
+
+  } else {
+    pr_trace_msg(trace_channel, 17, "system pressure: %u%%", pressure);
   }
 
-  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
-
-  for (i = 1; i < cmd->argc; i += 2) {
-    if (strcasecmp(cmd->argv[i], "low") == 0) {
-      char *ptr = NULL;
-      long v;
+  return 1;
+}
 
-      v = strtol(cmd->argv[i+1], &ptr, 10);
-      if (ptr && *ptr) {
-        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid low watermark value: ",
-          cmd->argv[i+1], NULL));
-      }
+static int loiter_controller_timer_cb(CALLBACK_FRAME) {
+  unsigned int drop_pct, elapsed;
+  struct loiter_shm_stats stats;
+  time_t now;
 
-      if (v < 1) {
-        CONF_ERROR(cmd, "low watermark must be >= 1");
-      }
+  if (loiter_shm_get_snapshot(loiter_pool, &stats) < 0) {
+    pr_trace_msg(trace_channel, 3, "error reading LoiterTable: %s",
+      strerror(errno));
 
-      low = (unsigned int) v;
+    /* Try again at the next interval. */
+    return 1;
+  }
 
-    } else if (strcasecmp(cmd->argv[i], "high") == 0) {
-      char *ptr = NULL;
-      long v;
+  now = time(NULL);
+  elapsed = now > loiter_ctl_updated ?
+    (unsigned int) (now - loiter_ctl_updated) : 0;
+  loiter_ctl_updated = now;
 
-      v = strtol(cmd->argv[i+1], &ptr, 10);
-      if (ptr && *ptr) {
-        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid high watermark value: ",
-          cmd->argv[i+1], NULL));
-      }
+  if (loiter_controller_step(&loiter_ctl, loiter_get_unauthd_count(&stats),
+      elapsed, &drop_pct) < 0) {
+    return 1;
+  }
 
-      if (v < 1) {
-        CONF_ERROR(cmd, "high watermark must be >= 1");
-      }
+  if (loiter_shm_set_control(loiter_pool, drop_pct) < 0) {
+    pr_trace_msg(trace_channel, 3, "error publishing drop probability: %s",
+      strerror(errno));
+  }
 
-      high = (unsigned int) v;
+  return 1;
+}
 
-    } else if (strcasecmp(cmd->argv[i], "rate") == 0) {
-      char *ptr = NULL;
-      long v;
+static int loiter_metrics_timer_cb(CALLBACK_FRAME) {
+  const char *path;
+  unsigned int drop_pct, unauthd_count;
+  struct loiter_rules rules;
+  struct loiter_shm_stats stats;
+  pool *tmp_pool;
 
-      v = strtol(cmd->argv[i+1], &ptr, 10);
-      if (ptr && *ptr) {
-        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid rate value: ",
-          cmd->argv[i+1], NULL));
-      }
+  if (loiter_policy == NULL ||
+      loiter_policy->metrics_path == NULL) {
+    loiter_metrics_timerno = -1;
+    return 0;
+  }
 
-      if (v < 1 ||
-          v > 100) {
-        CONF_ERROR(cmd, "rate must be 1 <= r <= 100");
-      }
+  path = loiter_policy->metrics_path;
 
-      rate = (unsigned int) v;
+  if (loiter_shm_get_snapshot(loiter_pool, &stats) < 0) {
+    pr_trace_msg(trace_channel, 3, "error reading LoiterTable: %s",
+      strerror(errno));
 
-    } else {
-      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown keyword: ", cmd->argv[i],
-        NULL));
-    }
+    /* Try again at the next interval. */
+    return 1;
   }
 
-  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
-  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
-  *((unsigned int *) c->argv[0]) = low;
-  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
-  *((unsigned int *) c->argv[1]) = high;
-  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
-  *((unsigned int *) c->argv[2]) = rate;
+  rules = loiter_policy->rules;
+  loiter_apply_runtime_rules(&stats, &rules);
 
-  return PR_HANDLED(cmd);
-}
+  unauthd_count = loiter_get_unauthd_count(&stats);
 
-/* usage: LoiterTable path */
-MODRET set_loitertable(cmd_rec *cmd) {
-  CHECK_ARGS(cmd, 1);
-  CHECK_CONF(cmd, CONF_ROOT);
+  drop_pct = loiter_get_effective_drop_pct(&stats, &rules, unauthd_count);
 
-  (void) add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
-  return PR_HANDLED(cmd);
+  tmp_pool = make_sub_pool(loiter_pool);
+  pr_pool_tag(tmp_pool, "LoiterMetricsFile pool");
+
+  if (loiter_metrics_write(tmp_pool, path, &stats, drop_pct) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error writing LoiterMetricsFile '%s': %s", path, strerror(errno));
+  }
+
+  destroy_pool(tmp_pool);
+
+  /* Restart the timer. */
+  return 1;
 }
 
 /* Event listeners
  */
 
 static void loiter_exit_ev(const void *event_data, void *user_data) {
+  loiter_uncount_user();
+  loiter_uncount_failures();
+
+  if (loiter_slot >= 0) {
+    (void) loiter_shm_slot_release(loiter_pool, loiter_slot, getpid());
+    loiter_slot = -1;
+  }
+
   if (loiter_has_authenticated == TRUE) {
     if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_AUTHD_COUNT, -1) < 0) {
       (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
@@ -336,38 +3151,208 @@ static void loiter_mod_unload_ev(const void *event_data, void *user_data) {
     /* Unregister ourselves from all events. */
     pr_event_unregister(&loiter_module, NULL, NULL);
 
+    (void) loiter_agent_stop();
     (void) loiter_shm_destroy(loiter_pool);
 
     destroy_pool(loiter_pool);
     loiter_pool = NULL;
+    loiter_cidr_pool = NULL;
+    loiter_cidr_tab = NULL;
   }
 }
 #endif
 
-static void loiter_restart_ev(const void *event_data, void *user_data) {
-  /* Seed the random(3) generator. */
-#if defined(HAVE_RANDOM)
-  srandom((unsigned int) (time(NULL) * getpid()));
-#else
-  srand((unsigned int) (time(NULL) * getpid()));
-#endif /* HAVE_RANDOM */
+/* Compile the policy for each server, once, for sessions to inherit. */
+static void loiter_compile_policies(void) {
+  server_rec *s;
+  struct loiter_policy *last = NULL;
+
+  if (loiter_policy_pool != NULL) {
+    destroy_pool(loiter_policy_pool);
+  }
+
+  loiter_policy_pool = make_sub_pool(loiter_pool);
+  pr_pool_tag(loiter_policy_pool, "Loiter policy pool");
+  loiter_policies = NULL;
+
+  /* Destroyed along with the old policies. */
+  loiter_runtime_curve_pool = NULL;
+  loiter_runtime_curve_base = NULL;
+  loiter_runtime_curve = NULL;
+
+  for (s = (server_rec *) server_list->xas_list; s != NULL; s = s->next) {
+    struct loiter_policy *policy;
+
+    pr_signals_handle();
+
+    policy = loiter_policy_compile(loiter_policy_pool, s,
+      (unsigned long) ServerMaxInstances);
+    if (policy == NULL) {
+      continue;
+    }
+
+    if (last != NULL) {
+      last->next = policy;
+
+    } else {
+      loiter_policies = policy;
+    }
+
+    last = policy;
+  }
+
+  loiter_policy = loiter_policy_get(loiter_policies, main_server);
 }
 
-static void loiter_startup_ev(const void *event_data, void *user_data) {
-  config_rec *c;
-  int engine = FALSE;
+static void loiter_postparse_ev(const void *event_data, void *user_data) {
+  int engine = FALSE, interval;
+
+  /* The previous configuration, and so the LoiterLog path, is gone. */
+  if (loiter_logfd >= 0) {
+    (void) close(loiter_logfd);
+    loiter_logfd = -1;
+    loiter_log_path = NULL;
+  }
+
+  loiter_compile_policies();
+
+  /* On restarts, the agent picks up the new configuration.  At first
+   * startup, it is started once the LoiterTable exists.
+   */
+  if (loiter_started == TRUE) {
+    loiter_start_agent();
+  }
+
+  if (loiter_metrics_timerno > 0) {
+    (void) pr_timer_remove(loiter_metrics_timerno, &loiter_module);
+    loiter_metrics_timerno = -1;
+  }
+
+  if (loiter_pressure_timerno > 0) {
+    (void) pr_timer_remove(loiter_pressure_timerno, &loiter_module);
+    loiter_pressure_timerno = -1;
+  }
+
+  if (loiter_controller_timerno > 0) {
+    (void) pr_timer_remove(loiter_controller_timerno, &loiter_module);
+    loiter_controller_timerno = -1;
+  }
+
+  /* The prefix table is rebuilt from scratch on restart. */
+  if (loiter_cidr_pool != NULL) {
+    destroy_pool(loiter_cidr_pool);
+    loiter_cidr_pool = NULL;
+    loiter_cidr_tab = NULL;
+  }
+
+  if (loiter_policy != NULL &&
+      loiter_policy->prefix_table_path != NULL) {
+    const char *path;
+
+    path = loiter_policy->prefix_table_path;
+
+    loiter_cidr_pool = make_sub_pool(loiter_pool);
+    pr_pool_tag(loiter_cidr_pool, "LoiterPrefixTable pool");
+
+    loiter_cidr_tab = loiter_cidr_create(loiter_cidr_pool);
+    if (loiter_cidr_load(loiter_cidr_tab, path) < 0) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": error loading LoiterPrefixTable '%s': %s", path, strerror(errno));
+      destroy_pool(loiter_cidr_pool);
+      loiter_cidr_pool = NULL;
+      loiter_cidr_tab = NULL;
+
+    } else {
+      pr_trace_msg(trace_channel, 7,
+        "loaded %u prefixes from LoiterPrefixTable '%s'",
+        loiter_cidr_count(loiter_cidr_tab), path);
+    }
+  }
+
+  /* The metrics, system pressure, and controller are maintained by the
+   * daemon process.
+   */
+  if (ServerType != SERVER_STANDALONE) {
+    return;
+  }
+
+  if (loiter_policy != NULL) {
+    engine = loiter_policy->engine;
+  }
+
+  if (engine == FALSE) {
+    return;
+  }
+
+  /* Sessions inherit the daemon's LoiterLog, rather than reopening it. */
+  (void) loiter_openlog(loiter_policy->log_path);
+
+  if (loiter_policy->use_controller == TRUE) {
+    /* Carry on from the last published drop probability, e.g. across
+     * restarts.
+     */
+    if (loiter_controller_init(&loiter_ctl,
+        loiter_policy->controller_setpoint, loiter_policy->controller_kp,
+        loiter_policy->controller_ki,
+        loiter_shm_get_control(loiter_pool)) == 0) {
+      interval = (int) loiter_policy->controller_interval;
+      loiter_ctl_updated = time(NULL);
+
+      loiter_controller_timerno = pr_timer_add(interval, -1, &loiter_module,
+        loiter_controller_timer_cb, "LoiterController");
+      if (loiter_controller_timerno < 0) {
+        pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+          ": error adding LoiterController timer: %s", strerror(errno));
+      }
+    }
+  }
+
+  if (loiter_policy->use_pressure == TRUE) {
+    interval = (int) loiter_policy->pressure_interval;
+
+    loiter_pressure_timerno = pr_timer_add(interval, -1, &loiter_module,
+      loiter_pressure_timer_cb, "LoiterPressure");
+    if (loiter_pressure_timerno < 0) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": error adding LoiterPressure timer: %s", strerror(errno));
+    }
+  }
+
+  if (loiter_policy->metrics_path == NULL) {
+    return;
+  }
 
-  c = find_config(main_server->conf, CONF_PARAM, "LoiterEngine", FALSE);
-  if (c != NULL) {
-    engine = *((int *) c->argv[0]);
+  interval = loiter_policy->metrics_interval;
+
+  loiter_metrics_timerno = pr_timer_add(interval, -1, &loiter_module,
+    loiter_metrics_timer_cb, "LoiterMetricsFile");
+  if (loiter_metrics_timerno < 0) {
+    pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+      ": error adding LoiterMetricsFile timer: %s", strerror(errno));
+  }
+}
+
+static void loiter_restart_ev(const void *event_data, void *user_data) {
+#if defined(PR_USE_CTRLS)
+  register unsigned int i;
+
+  /* Reset the ACLs; they will be re-read from the configuration. */
+  for (i = 0; loiter_acttab[i].act_action; i++) {
+    loiter_acttab[i].act_acl = pcalloc(loiter_pool, sizeof(ctrls_acl_t));
+    pr_ctrls_init_acl(loiter_acttab[i].act_acl);
   }
+#endif /* PR_USE_CTRLS */
+
+  (void) loiter_prng_init();
+}
 
-  if (engine == TRUE) {
-    c = find_config(main_server->conf, CONF_PARAM, "LoiterTable", FALSE);
-    if (c != NULL) {
-      char *path;
+static void loiter_startup_ev(const void *event_data, void *user_data) {
+  if (loiter_policy != NULL &&
+      loiter_policy->engine == TRUE) {
+    if (loiter_policy->table_path != NULL) {
+      const char *path;
 
-      path = c->argv[0];
+      path = loiter_policy->table_path;
 
       if (loiter_shm_create(loiter_pool, path) < 0) {
         pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
@@ -375,11 +3360,29 @@ static void loiter_startup_ev(const void *event_data, void *user_data) {
           strerror(errno));
       }
 
+      /* Even without a segment, the partition is noted, for when the segment
+       * is replaced via 'ftpdctl loiter shm'.
+       */
+      if (loiter_policy->table_partition != NULL) {
+        const char *partition;
+
+        partition = loiter_policy->table_partition;
+        if (loiter_shm_set_partition(loiter_pool, partition) < 0 &&
+            errno != EPERM) {
+          pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+            ": unable to use partition '%s' of LoiterTable '%s': %s",
+            partition, path, strerror(errno));
+        }
+      }
+
     } else {
       pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
         ": missing required LoiterTable directive, module disabled");
     }
   }
+
+  loiter_started = TRUE;
+  loiter_start_agent();
 }
 
 static void loiter_shutdown_ev(const void *event_data, void *user_data) {
@@ -390,6 +3393,7 @@ static void loiter_shutdown_ev(const void *event_data, void *user_data) {
 
   if (getpid() == mpid &&
       ServerType == SERVER_STANDALONE) {
+    (void) loiter_agent_stop();
     (void) loiter_shm_destroy(loiter_pool);
   }
 }
@@ -405,132 +3409,360 @@ static int loiter_init(void) {
   pr_event_register(&loiter_module, "core.module-unload", loiter_mod_unload_ev,
     NULL);
 #endif
+  pr_event_register(&loiter_module, "core.postparse", loiter_postparse_ev,
+    NULL);
   pr_event_register(&loiter_module, "core.restart", loiter_restart_ev, NULL);
   pr_event_register(&loiter_module, "core.startup", loiter_startup_ev, NULL);
   pr_event_register(&loiter_module, "core.shutdown", loiter_shutdown_ev, NULL);
 
-  /* Seed the random(3) generator. */
-#if defined(HAVE_RANDOM)
-  srandom((unsigned int) (time(NULL) * getpid()));
-#else
-  srand((unsigned int) (time(NULL) * getpid()));
-#endif /* HAVE_RANDOM */
+#if defined(PR_USE_CTRLS)
+  if (pr_ctrls_register(&loiter_module, "loiter",
+      "manage mod_loiter shm, rules, and stats", loiter_handle_loiter) < 0) {
+    pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+      ": error registering 'loiter' control: %s", strerror(errno));
+
+  } else {
+    register unsigned int i;
+
+    for (i = 0; loiter_acttab[i].act_action; i++) {
+      loiter_acttab[i].act_acl = pcalloc(loiter_pool, sizeof(ctrls_acl_t));
+      pr_ctrls_init_acl(loiter_acttab[i].act_acl);
+    }
+  }
+#endif /* PR_USE_CTRLS */
+
+  (void) loiter_prng_init();
 
   return 0;
 }
 
+/* Looks up this session's source in the LoiterPrefixTable, if any.  Returns
+ * TRUE if the source is to be denied outright.
+ */
+static int loiter_match_prefix(void) {
+  const pr_netaddr_t *addr;
+  const unsigned char *data;
+
+  if (loiter_cidr_tab == NULL) {
+    return FALSE;
+  }
+
+  addr = pr_netaddr_get_sess_remote_addr();
+  data = pr_netaddr_get_inaddr(addr);
+  if (data == NULL) {
+    return FALSE;
+  }
+
+  if (loiter_cidr_match(loiter_cidr_tab, pr_netaddr_get_family(addr), data,
+      &loiter_cidr_weight) < 0) {
+    return FALSE;
+  }
+
+  if (loiter_cidr_weight == LOITER_CIDR_WEIGHT_DENY) {
+    pr_trace_msg(trace_channel, 5, "source %s denied by LoiterPrefixTable",
+      pr_netaddr_get_ipstr(addr));
+    return TRUE;
+  }
+
+  loiter_cidr_matched = TRUE;
+  pr_trace_msg(trace_channel, 9, "source %s has LoiterPrefixTable weight %u%%",
+    pr_netaddr_get_ipstr(addr), loiter_cidr_weight);
+  return FALSE;
+}
+
+/* Resolves the LoiterClassRules for this session's <Class>, if any, once
+ * for the session.
+ */
+static void loiter_set_class(void) {
+  const struct loiter_policy_class *class;
+  const char *name;
+
+  if (session.conn_class == NULL) {
+    return;
+  }
+
+  class = loiter_policy_get_class(loiter_policy, session.conn_class);
+  if (class == NULL) {
+    return;
+  }
+
+  name = session.conn_class->cls_name;
+  if (loiter_shm_set_class(loiter_pool, name, class->reserve) < 0) {
+    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+      "error counting connection for class '%s': %s", name, strerror(errno));
+    return;
+  }
+
+  loiter_class_rules = &(class->rules);
+
+  pr_trace_msg(trace_channel, 9,
+    "using LoiterClassRules for class '%s' (low %u high %u rate %u, "
+    "reserve %u)", name, loiter_class_rules->low, loiter_class_rules->high,
+    loiter_class_rules->rate, class->reserve);
+}
+
+static void loiter_set_shadows(void) {
+  register unsigned int i;
+
+  if (loiter_policy->nshadows == 0) {
+    return;
+  }
+
+  loiter_shadow_idx = palloc(session.pool,
+    sizeof(int) * loiter_policy->nshadows);
+
+  for (i = 0; i < loiter_policy->nshadows; i++) {
+    const char *name;
+
+    name = loiter_policy->shadows[i].name;
+    loiter_shadow_idx[i] = loiter_shm_set_shadow(loiter_pool, name);
+    if (loiter_shadow_idx[i] < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "error counting LoiterShadowRules '%s': %s", name, strerror(errno));
+    }
+  }
+}
+
+/* Returns TRUE if this session's source (or its prefix) is connecting faster
+ * than the LoiterRateLimit allows, FALSE otherwise.
+ */
+static int loiter_over_rate(void) {
+  unsigned int rate, burst, prefix_rate, prefix_burst;
+
+  if (loiter_source == NULL ||
+      loiter_policy->use_ratelimit == FALSE) {
+    return FALSE;
+  }
+
+  rate = loiter_policy->ratelimit_rate;
+  burst = loiter_policy->ratelimit_burst;
+  prefix_rate = loiter_policy->ratelimit_prefix_rate;
+  prefix_burst = loiter_policy->ratelimit_prefix_burst;
+
+  if (rate > 0 &&
+      loiter_shm_bucket_take(loiter_pool, loiter_source, FALSE, rate,
+        burst) == FALSE) {
+    pr_trace_msg(trace_channel, 5,
+      "source %s exceeded rate of %u connections/min (burst %u)",
+      loiter_source->name, rate, burst);
+    return TRUE;
+  }
+
+  if (prefix_rate > 0 &&
+      loiter_shm_bucket_take(loiter_pool, loiter_source, TRUE, prefix_rate,
+        prefix_burst) == FALSE) {
+    pr_trace_msg(trace_channel, 5,
+      "prefix %s exceeded rate of %u connections/min (burst %u)",
+      loiter_source->prefix_name, prefix_rate, prefix_burst);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 static int loiter_sess_init(void) {
-  config_rec *c;
-  unsigned int rules_low, rules_high, rules_rate;
-  int adjusted_rules = FALSE;
 
-  c = find_config(main_server->conf, CONF_PARAM, "LoiterEngine", FALSE);
-  if (c) {
-    loiter_engine = *((int *) c->argv[0]);
+  /* The daemon's timers are of no use to the session process. */
+  if (loiter_metrics_timerno > 0) {
+    (void) pr_timer_remove(loiter_metrics_timerno, &loiter_module);
+    loiter_metrics_timerno = -1;
+  }
+
+  if (loiter_pressure_timerno > 0) {
+    (void) pr_timer_remove(loiter_pressure_timerno, &loiter_module);
+    loiter_pressure_timerno = -1;
+  }
+
+  if (loiter_controller_timerno > 0) {
+    (void) pr_timer_remove(loiter_controller_timerno, &loiter_module);
+    loiter_controller_timerno = -1;
+  }
+
+  loiter_timing_start();
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_POLICY);
+
+  /* Everything we need was compiled by the daemon, for this server. */
+  loiter_policy = loiter_policy_get(loiter_policies, main_server);
+  if (loiter_policy == NULL) {
+    /* e.g. a server which was not in the configuration the daemon
+     * compiled; compile its policy now.
+     */
+    loiter_policy = loiter_policy_compile(session.pool, main_server,
+      (unsigned long) ServerMaxInstances);
+    if (loiter_policy == NULL) {
+      loiter_sess_init_start = 0;
+      return 0;
+    }
   }
 
+  loiter_engine = loiter_policy->engine;
   if (loiter_engine == FALSE) {
+    loiter_sess_init_start = 0;
     return 0;
   }
 
-  loiter_openlog();
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_LOG);
+
+  /* The daemon's LoiterLog is inherited, already open; only a server with a
+   * LoiterLog of its own need open one.
+   */
+  if (loiter_logfd < 0 ||
+      loiter_log_path != loiter_policy->log_path) {
+    (void) loiter_openlog(loiter_policy->log_path);
+  }
+
+  /* Our class must be known before we are counted. */
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
+  loiter_set_class();
 
   if (loiter_shm_incr(loiter_pool, LOITER_FIELD_ID_CONN_COUNT, 1) < 0) {
     (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
       "error incrementing connection count: %s", strerror(errno));
   }
 
+  (void) loiter_timing_switch(-1);
   pr_event_register(&loiter_module, "core.exit", loiter_exit_ev, NULL);
 
-  /* Reseed the random(3) generator. */
-#if defined(HAVE_RANDOM)
-  srandom((unsigned int) (time(NULL) ^ getpid()));
-#else
-  srand((unsigned int) (time(NULL) ^ getpid()));
-#endif /* HAVE_RANDOM */
+  loiter_source = loiter_get_source(session.pool,
+    pr_netaddr_get_sess_remote_addr());
 
-  c = find_config(main_server->conf, CONF_PARAM, "LoiterRules", FALSE);
-  if (c != NULL) {
-    rules_low = *((unsigned int *) c->argv[0]);
-    rules_high = *((unsigned int *) c->argv[1]);
-    rules_rate = *((unsigned int *) c->argv[2]);
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
 
-  } else {
-    rules_low = LOITER_RULES_DEFAULT_LOW;
-    rules_high = LOITER_RULES_DEFAULT_HIGH;
-    rules_rate = LOITER_RULES_DEFAULT_RATE;
+  if (loiter_policy->heavy_window > 0 &&
+      loiter_source != NULL) {
+    unsigned int window;
+
+    window = loiter_policy->heavy_window;
+    if (loiter_shm_sketch_add(loiter_pool, loiter_source,
+        (uint32_t) (time(NULL) / window), &loiter_source_count,
+        &loiter_prefix_count) < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "error counting source %s: %s", loiter_source->name, strerror(errno));
+
+    } else {
+      pr_trace_msg(trace_channel, 9,
+        "source %s: ~%u connections, prefix %s: ~%u connections",
+        loiter_source->name, loiter_source_count, loiter_source->prefix_name,
+        loiter_prefix_count);
+    }
   }
 
-  if (ServerMaxInstances > 0 &&
-      rules_high > ServerMaxInstances) {
-    float ratio;
+  if (loiter_policy->distinct_window > 0 &&
+      loiter_source != NULL) {
+    unsigned int window;
 
-    /* Adjust for MaxInstances.
-     *
-     * if (rules_high > ServerMaxInstances)
-     *   rules_high = ServerMaxInstances
-     *
-     * rules_low = %20 of rules_high
-     */
+    window = loiter_policy->distinct_window;
+    if (loiter_shm_distinct_add(loiter_pool, loiter_source->key,
+        (uint32_t) (time(NULL) / window)) < 0) {
+      (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
+        "error counting distinct source %s: %s", loiter_source->name,
+        strerror(errno));
+    }
+  }
+
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_POLICY);
+  if (loiter_match_prefix() == TRUE) {
+    loiter_drop_reason = LOITER_DROP_REASON_PREFIX_DENY;
+    loiter_drop_session();
+  }
+
+  /* Sources connecting too fast are dropped before any RED evaluation. */
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
+  if (loiter_over_rate() == TRUE) {
+    loiter_drop_reason = LOITER_DROP_REASON_RATE_LIMIT;
+    loiter_drop_session();
+  }
 
-    ratio = (float) rules_low / (float) rules_high;
+  /* Each session has its own random stream; otherwise, sessions forked from
+   * the daemon would all roll the same numbers.
+   */
+  if (loiter_policy->use_seed == TRUE) {
+    unsigned int seq;
 
-    rules_high = ServerMaxInstances;
-    rules_low = (unsigned int) (ratio * rules_high);
+    seq = loiter_shm_next_session(loiter_pool);
+    (void) loiter_timing_switch(-1);
+    (void) loiter_prng_seed(loiter_policy->seed, seq);
+    pr_trace_msg(trace_channel, 9,
+      "LoiterRandomSeed: using deterministic random stream %u", seq);
 
-    adjusted_rules = TRUE;
+  } else {
+    (void) loiter_timing_switch(-1);
+    (void) loiter_prng_init();
   }
 
-  if (c != NULL &&
-      adjusted_rules == TRUE) {
+  if (loiter_policy->rules_configured == TRUE &&
+      loiter_policy->rules_adjusted == TRUE) {
     /* If rules were explicitly configured, AND adjusted for MaxInstances,
      * log the new/adjusted rules.
      */
     pr_trace_msg(trace_channel, 6,
       "adjusted rules for MaxInstances %lu, now using "
       "'LoiterRules low %u high %u rate %u'",
-      (unsigned long) ServerMaxInstances, rules_low, rules_high, rules_rate);
+      (unsigned long) ServerMaxInstances, loiter_policy->rules.low,
+      loiter_policy->rules.high, loiter_policy->rules.rate);
   }
 
-  if (loiter_drop_conn(rules_low, rules_high, rules_rate) == TRUE) {
-    const char *msg = NULL;
-
-    c = find_config(main_server->conf, CONF_PARAM, "LoiterMessage", FALSE);
-    if (c != NULL) {
-      msg = c->argv[0];
-    }
-
-    if (msg != NULL) {
-      /* XXX Should we support %a, %c variables? */
-      pr_response_send_async(R_530, "%s", msg);
-    }
-
-    (void) pr_log_writefile(loiter_logfd, MOD_LOITER_VERSION,
-      "dropping connection");
-    pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION ": dropping connection");
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
+  loiter_set_shadows();
 
-    pr_event_generate("mod_loiter.connection-dropped", NULL);
-    pr_session_disconnect(&loiter_module, PR_SESS_DISCONNECT_MODULE_ACL,
-      "Too many loitering connections");
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_POLICY);
+  if (loiter_drop_conn() == TRUE) {
+    loiter_drop_session();
   }
 
+  (void) loiter_timing_switch(LOITER_SHM_TIMING_SHM_WRITE);
+  loiter_shed_idle_session();
+
+  loiter_timing_record();
   return 0;
 }
 
 /* Module API tables
  */
 
+#if defined(PR_USE_CTRLS)
+static ctrls_acttab_t loiter_acttab[] = {
+  { "loiter",	NULL, NULL, NULL },
+  { NULL,	NULL, NULL, NULL }
+};
+#endif /* PR_USE_CTRLS */
+
 static conftable loiter_conftab[] = {
+  { "LoiterAgentCheck",	set_loiteragentcheck,	NULL },
+  { "LoiterAuthFailures",set_loiterauthfailures,NULL },
+  { "LoiterBan",		set_loiterban,		NULL },
+  { "LoiterClusterListen",set_loiterclusterlisten,NULL },
+  { "LoiterClusterPeer",set_loiterclusterpeer,	NULL },
+  { "LoiterClusterSecret",set_loiterclustersecret,NULL },
+  { "LoiterClassRules",	set_loiterrules,	NULL },
+  { "LoiterController",	set_loitercontroller,	NULL },
+  { "LoiterControlsACLs",set_loiterctrlsacls,	NULL },
+  { "LoiterDistinctSources",set_loiterdistinctsources,NULL },
   { "LoiterEngine",	set_loiterengine,	NULL },
+  { "LoiterHeavyHitters",set_loiterheavyhitters,NULL },
+  { "LoiterHostRules",	set_loiterrules,	NULL },
+  { "LoiterIdleSessions",set_loiteridlesessions,NULL },
   { "LoiterLog",	set_loiterlog,		NULL },
   { "LoiterMessage",	set_loitermessage,	NULL },
+  { "LoiterMetricsFile",set_loitermetricsfile,	NULL },
+  { "LoiterPrefixTable",set_loiterprefixtable,	NULL },
+  { "LoiterPressure",	set_loiterpressure,	NULL },
+  { "LoiterRandomSeed",	set_loiterrandomseed,	NULL },
+  { "LoiterRateLimit",	set_loiterratelimit,	NULL },
+  { "LoiterReputation",	set_loiterreputation,	NULL },
   { "LoiterRules",	set_loiterrules,	NULL },
+  { "LoiterShadowRules",set_loiterrules,	NULL },
   { "LoiterTable",	set_loitertable,	NULL },
+  { "LoiterUserRules",	set_loiterrules,	NULL },
   { NULL }
 };
 
 static cmdtable loiter_cmdtab[] = {
+  { PRE_CMD,	C_USER,	G_NONE,	loiter_pre_user,	FALSE,	FALSE },
   { POST_CMD,	C_PASS,	G_NONE,	loiter_post_pass,	FALSE,	FALSE },
+  { POST_CMD_ERR,	C_PASS,	G_NONE,	loiter_post_pass_err,	FALSE,	FALSE },
+  { LOG_CMD,	C_ANY,	G_NONE,	loiter_log_any,		FALSE,	FALSE },
+  { LOG_CMD_ERR,	C_ANY,	G_NONE,	loiter_log_any,		FALSE,	FALSE },
   { 0, NULL }
 };
 
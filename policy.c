@@ -0,0 +1,475 @@
+/*
+ * ProFTPD - mod_loiter admission policy
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "policy.h"
+
+static const char *trace_channel = "loiter.policy";
+
+static void get_rules(config_rec *c, struct loiter_rules *rules) {
+  rules->low = *((unsigned int *) c->argv[0]);
+  rules->high = *((unsigned int *) c->argv[1]);
+  rules->rate = *((unsigned int *) c->argv[2]);
+  rules->curve = c->argv[3];
+}
+
+static void compile_classes(pool *p, const server_rec *s,
+    struct loiter_policy *policy) {
+  config_rec *c;
+  unsigned int nclasses = 0;
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterClassRules", FALSE);
+  while (c != NULL) {
+    nclasses++;
+    c = find_config_next(c, c->next, CONF_PARAM, "LoiterClassRules", FALSE);
+  }
+
+  if (nclasses == 0) {
+    return;
+  }
+
+  policy->classes = pcalloc(p, sizeof(struct loiter_policy_class) * nclasses);
+
+  /* Resolve each class by name now, so that sessions need only compare
+   * their class against ours.
+   */
+  c = find_config(s->conf, CONF_PARAM, "LoiterClassRules", FALSE);
+  while (c != NULL) {
+    const pr_class_t *cls;
+
+    pr_signals_handle();
+
+    cls = pr_class_find(c->argv[4]);
+    if (cls != NULL) {
+      struct loiter_policy_class *class;
+
+      class = &(policy->classes[policy->nclasses++]);
+      class->cls = cls;
+      get_rules(c, &(class->rules));
+      class->reserve = *((unsigned int *) c->argv[5]);
+
+    } else {
+      pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+        ": no <Class> named '%s' found, ignoring its LoiterClassRules",
+        (char *) c->argv[4]);
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "LoiterClassRules", FALSE);
+  }
+}
+
+static void compile_shadows(pool *p, const server_rec *s,
+    struct loiter_policy *policy, unsigned long max_instances) {
+  config_rec *c;
+  unsigned int nshadows = 0;
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterShadowRules", FALSE);
+  while (c != NULL) {
+    nshadows++;
+    c = find_config_next(c, c->next, CONF_PARAM, "LoiterShadowRules", FALSE);
+  }
+
+  if (nshadows == 0) {
+    return;
+  }
+
+  policy->shadows = pcalloc(p,
+    sizeof(struct loiter_policy_shadow) * nshadows);
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterShadowRules", FALSE);
+  while (c != NULL) {
+    struct loiter_policy_shadow *shadow;
+
+    pr_signals_handle();
+
+    shadow = &(policy->shadows[policy->nshadows++]);
+    shadow->name = c->argv[4];
+    get_rules(c, &(shadow->rules));
+
+    /* Adjusted like the active rules, so that they compare like for like. */
+    if (loiter_policy_adjust_rules(&(shadow->rules), max_instances)) {
+      (void) loiter_policy_compile_curve(p, &(shadow->rules));
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "LoiterShadowRules", FALSE);
+  }
+}
+
+static void compile_daemon(pool *p, const server_rec *s,
+    struct loiter_policy *policy) {
+  config_rec *c;
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterTable", FALSE);
+  if (c != NULL) {
+    policy->table_path = c->argv[0];
+    policy->table_partition = c->argv[1];
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterPrefixTable", FALSE);
+  if (c != NULL) {
+    policy->prefix_table_path = c->argv[0];
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterPressure", FALSE);
+  if (c != NULL) {
+    policy->use_pressure = TRUE;
+    policy->pressure_interval = *((unsigned int *) c->argv[0]);
+    policy->pressure_load = *((unsigned int *) c->argv[1]);
+    policy->pressure_memory = *((unsigned int *) c->argv[2]);
+    policy->pressure_psi = *((unsigned int *) c->argv[3]);
+    policy->pressure_procs = *((unsigned int *) c->argv[4]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterMetricsFile", FALSE);
+  if (c != NULL) {
+    policy->metrics_path = c->argv[0];
+    policy->metrics_interval = *((int *) c->argv[1]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterAgentCheck", FALSE);
+  if (c != NULL) {
+    policy->agent_check = c->argv[0];
+    policy->agent_drain_pct = *((unsigned int *) c->argv[1]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterClusterListen", FALSE);
+  if (c != NULL) {
+    policy->cluster_listen = c->argv[0];
+    policy->cluster_interval = *((int *) c->argv[1]);
+    policy->cluster_peers = make_array(p, 0, sizeof(char *));
+
+    c = find_config(s->conf, CONF_PARAM, "LoiterClusterPeer", FALSE);
+    while (c != NULL) {
+      register unsigned int i;
+
+      pr_signals_handle();
+
+      for (i = 0; i < c->argc; i++) {
+        *((char **) push_array(policy->cluster_peers)) = c->argv[i];
+      }
+
+      c = find_config_next(c, c->next, CONF_PARAM, "LoiterClusterPeer", FALSE);
+    }
+
+    c = find_config(s->conf, CONF_PARAM, "LoiterClusterSecret", FALSE);
+    if (c != NULL) {
+      policy->cluster_secret = c->argv[0];
+    }
+  }
+}
+
+struct loiter_policy *loiter_policy_compile(pool *p, const server_rec *s,
+    unsigned long max_instances) {
+  config_rec *c;
+  struct loiter_policy *policy;
+
+  if (p == NULL ||
+      s == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  policy = pcalloc(p, sizeof(struct loiter_policy));
+  policy->server = s;
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterEngine", FALSE);
+  if (c != NULL) {
+    policy->engine = *((int *) c->argv[0]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterLog", FALSE);
+  if (c != NULL &&
+      strncasecmp(c->argv[0], "none", 5) != 0) {
+    policy->log_path = c->argv[0];
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterMessage", FALSE);
+  if (c != NULL) {
+    policy->message = c->argv[0];
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterRules", FALSE);
+  if (c != NULL) {
+    get_rules(c, &(policy->rules));
+    policy->rules_configured = TRUE;
+
+  } else {
+    policy->rules.low = LOITER_RULES_DEFAULT_LOW;
+    policy->rules.high = LOITER_RULES_DEFAULT_HIGH;
+    policy->rules.rate = LOITER_RULES_DEFAULT_RATE;
+  }
+
+  policy->rules_adjusted = loiter_policy_adjust_rules(&(policy->rules),
+    max_instances);
+  if (policy->rules_adjusted) {
+    (void) loiter_policy_compile_curve(p, &(policy->rules));
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterHostRules", FALSE);
+  if (c != NULL) {
+    policy->use_host_rules = TRUE;
+    get_rules(c, &(policy->host_rules));
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterUserRules", FALSE);
+  if (c != NULL) {
+    policy->use_user_rules = TRUE;
+    get_rules(c, &(policy->user_rules));
+  }
+
+  compile_classes(p, s, policy);
+  compile_shadows(p, s, policy, max_instances);
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterController", FALSE);
+  if (c != NULL) {
+    policy->use_controller = TRUE;
+    policy->controller_setpoint = *((unsigned int *) c->argv[0]);
+    policy->controller_interval = *((unsigned int *) c->argv[1]);
+    policy->controller_kp = *((double *) c->argv[2]);
+    policy->controller_ki = *((double *) c->argv[3]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterHeavyHitters", FALSE);
+  if (c != NULL) {
+    policy->heavy_window = *((unsigned int *) c->argv[0]);
+    policy->heavy_threshold = *((unsigned int *) c->argv[1]);
+    policy->heavy_prefix_threshold = *((unsigned int *) c->argv[2]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterDistinctSources", FALSE);
+  if (c != NULL) {
+    policy->distinct_window = *((unsigned int *) c->argv[0]);
+    policy->distinct_threshold = *((unsigned int *) c->argv[1]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterAuthFailures", FALSE);
+  if (c != NULL) {
+    policy->authfail_weight = *((unsigned int *) c->argv[0]);
+    policy->authfail_window = *((unsigned int *) c->argv[1]);
+    policy->authfail_evict = *((unsigned int *) c->argv[2]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterReputation", FALSE);
+  if (c != NULL) {
+    policy->reputation_ttl = *((unsigned int *) c->argv[0]);
+    policy->reputation_factor = *((unsigned int *) c->argv[1]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterRateLimit", FALSE);
+  if (c != NULL) {
+    policy->use_ratelimit = TRUE;
+    policy->ratelimit_rate = *((unsigned int *) c->argv[0]);
+    policy->ratelimit_burst = *((unsigned int *) c->argv[1]);
+    policy->ratelimit_prefix_rate = *((unsigned int *) c->argv[2]);
+    policy->ratelimit_prefix_burst = *((unsigned int *) c->argv[3]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterBan", FALSE);
+  if (c != NULL) {
+    policy->ban_count = *((unsigned int *) c->argv[0]);
+    policy->ban_window = *((unsigned int *) c->argv[1]);
+    policy->ban_path = c->argv[2];
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterIdleSessions", FALSE);
+  if (c != NULL) {
+    policy->use_idle = TRUE;
+    policy->idle_headroom = *((unsigned int *) c->argv[0]);
+    policy->idle_min_idle = *((unsigned int *) c->argv[1]);
+  }
+
+  c = find_config(s->conf, CONF_PARAM, "LoiterRandomSeed", FALSE);
+  if (c != NULL) {
+    policy->use_seed = TRUE;
+    policy->seed = *((uint64_t *) c->argv[0]);
+  }
+
+  compile_daemon(p, s, policy);
+
+  pr_trace_msg(trace_channel, 9,
+    "compiled policy for server '%s': engine %s, rules low %u high %u rate %u%s"
+    ", %u %s, %u shadow %s", s->ServerName, policy->engine ? "on" : "off",
+    policy->rules.low, policy->rules.high, policy->rules.rate,
+    policy->rules_adjusted ? " (adjusted for MaxInstances)" : "",
+    policy->nclasses, policy->nclasses != 1 ? "classes" : "class",
+    policy->nshadows, policy->nshadows != 1 ? "rules" : "rule");
+  return policy;
+}
+
+const struct loiter_policy *loiter_policy_get(
+    const struct loiter_policy *policies, const server_rec *s) {
+  const struct loiter_policy *policy;
+
+  for (policy = policies; policy != NULL; policy = policy->next) {
+    if (policy->server == s) {
+      return policy;
+    }
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+const struct loiter_policy_class *loiter_policy_get_class(
+    const struct loiter_policy *policy, const pr_class_t *cls) {
+  register unsigned int i;
+
+  if (policy == NULL ||
+      cls == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  for (i = 0; i < policy->nclasses; i++) {
+    if (policy->classes[i].cls == cls) {
+      return &(policy->classes[i]);
+    }
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+int loiter_policy_adjust_rules(struct loiter_rules *rules,
+    unsigned long max_instances) {
+  if (max_instances == 0 ||
+      rules->high <= max_instances) {
+    return FALSE;
+  }
+
+  /* Keep the ratio of the low to high watermarks, e.g. a low watermark of
+   * 20% of the high watermark.
+   */
+  rules->low = (unsigned int) (((uint64_t) rules->low * max_instances) /
+    rules->high);
+  rules->high = (unsigned int) max_instances;
+
+  return TRUE;
+}
+
+int loiter_policy_compile_curve(pool *p, struct loiter_rules *rules) {
+  const struct loiter_curve *curve;
+
+  if (p == NULL ||
+      rules == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (rules->curve == NULL) {
+    return 0;
+  }
+
+  curve = loiter_curve_for_rules(p, rules->curve, rules->low, rules->high,
+    rules->rate);
+  if (curve == NULL) {
+    return -1;
+  }
+
+  rules->curve = curve;
+  return 0;
+}
+
+unsigned int loiter_policy_drop_pct(const struct loiter_rules *rules,
+    unsigned int unauthd_count) {
+  unsigned int p;
+
+  if (rules->curve != NULL) {
+    return loiter_curve_pct(rules->curve, unauthd_count, rules->low,
+      rules->high, rules->rate);
+  }
+
+  if (unauthd_count < rules->low) {
+    return 0;
+  }
+
+  if (unauthd_count >= rules->high ||
+      rules->rate == 100) {
+    return 100;
+  }
+
+  /* As for OpenSSH's MaxStartups. */
+  p = 100 - rules->rate;
+  p *= unauthd_count - rules->low;
+  p /= rules->high - rules->low;
+  p += rules->rate;
+
+  return p;
+}
+
+unsigned int loiter_policy_pressure_pct(unsigned int drop_pct,
+    unsigned int pressure) {
+  if (pressure == 0 ||
+      drop_pct >= 100) {
+    return drop_pct;
+  }
+
+  return drop_pct + (((100 - drop_pct) * pressure) / 100);
+}
+
+unsigned int loiter_policy_effective_pct(const struct loiter_policy *policy,
+    const struct loiter_rules *rules, unsigned int unauthd_count,
+    unsigned int control_pct, unsigned int host_pct, unsigned int pressure) {
+  unsigned int p;
+
+  if (policy->use_controller == TRUE) {
+    p = control_pct;
+
+  } else {
+    p = loiter_policy_drop_pct(rules, unauthd_count);
+  }
+
+  if (host_pct > p) {
+    p = host_pct;
+  }
+
+  return loiter_policy_pressure_pct(p, pressure);
+}
+
+unsigned int loiter_policy_distinct_pct(unsigned int drop_pct,
+    unsigned int distinct, unsigned int threshold, unsigned int nconns,
+    unsigned int source_count) {
+  unsigned int fair_share;
+
+  if (drop_pct == 0 ||
+      threshold == 0 ||
+      distinct == 0 ||
+      distinct >= threshold) {
+    return drop_pct;
+  }
+
+  fair_share = nconns / distinct;
+  if (fair_share == 0) {
+    fair_share = 1;
+  }
+
+  if (source_count > fair_share) {
+    return 100;
+  }
+
+  /* A flood spread evenly over a few sources is still a flood; such
+   * sources keep the usual probability.
+   */
+  return drop_pct;
+}
@@ -0,0 +1,216 @@
+/*
+ * ProFTPD - mod_loiter admission policy
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_POLICY_H
+#define MOD_LOITER_POLICY_H
+
+#include "mod_loiter.h"
+#include "curve.h"
+
+/* Default values for the low/high watermarks and rate. */
+#define LOITER_RULES_DEFAULT_LOW	20
+#define LOITER_RULES_DEFAULT_HIGH	100
+#define LOITER_RULES_DEFAULT_RATE	30
+
+/* The watermarks, rate, and curve of a LoiterRules (or LoiterHostRules,
+ * LoiterUserRules, LoiterClassRules) directive.
+ */
+struct loiter_rules {
+  unsigned int low;
+  unsigned int high;
+  unsigned int rate;
+
+  /* NULL for the default, linear, curve. */
+  const struct loiter_curve *curve;
+};
+
+struct loiter_policy_class {
+  const pr_class_t *cls;
+  struct loiter_rules rules;
+  unsigned int reserve;
+};
+
+/* Candidate rules, evaluated alongside the active rules but never
+ * enforced; see LoiterShadowRules.
+ */
+struct loiter_policy_shadow {
+  const char *name;
+  struct loiter_rules rules;
+};
+
+/* Everything a session needs to decide on its connection, compiled by the
+ * daemon from a server's configuration, at startup and on restart.  Sessions
+ * inherit the compiled policies when forked, and never modify them.
+ */
+struct loiter_policy {
+  struct loiter_policy *next;
+  const server_rec *server;
+
+  int engine;
+  const char *log_path;
+  const char *message;
+
+  /* The LoiterRules, already adjusted for MaxInstances. */
+  struct loiter_rules rules;
+  int rules_configured;
+  int rules_adjusted;
+
+  int use_host_rules;
+  struct loiter_rules host_rules;
+
+  int use_user_rules;
+  struct loiter_rules user_rules;
+
+  struct loiter_policy_class *classes;
+  unsigned int nclasses;
+
+  struct loiter_policy_shadow *shadows;
+  unsigned int nshadows;
+
+  int use_controller;
+  unsigned int controller_setpoint;
+  unsigned int controller_interval;
+  double controller_kp;
+  double controller_ki;
+
+  /* A zero window means that the feature is not configured. */
+  unsigned int heavy_window;
+  unsigned int heavy_threshold;
+  unsigned int heavy_prefix_threshold;
+
+  unsigned int distinct_window;
+  unsigned int distinct_threshold;
+
+  unsigned int authfail_window;
+  unsigned int authfail_weight;
+  unsigned int authfail_evict;
+
+  unsigned int reputation_ttl;
+  unsigned int reputation_factor;
+
+  int use_ratelimit;
+  unsigned int ratelimit_rate;
+  unsigned int ratelimit_burst;
+  unsigned int ratelimit_prefix_rate;
+  unsigned int ratelimit_prefix_burst;
+
+  unsigned int ban_window;
+  unsigned int ban_count;
+  const char *ban_path;
+
+  int use_idle;
+  unsigned int idle_headroom;
+  unsigned int idle_min_idle;
+
+  int use_seed;
+  uint64_t seed;
+
+  /* The settings of the daemon itself, used from the main server's policy
+   * only: its LoiterTable, timers, agent, and cluster.
+   */
+  const char *table_path;
+  const char *table_partition;
+  const char *prefix_table_path;
+
+  int use_pressure;
+  unsigned int pressure_interval;
+  unsigned int pressure_load;
+  unsigned int pressure_memory;
+  unsigned int pressure_psi;
+  unsigned int pressure_procs;
+
+  const char *metrics_path;
+  int metrics_interval;
+
+  const char *agent_check;
+  unsigned int agent_drain_pct;
+
+  /* The peers are NULL if LoiterClusterListen is not configured, and the
+   * secret NULL if LoiterClusterSecret is not.
+   */
+  const char *cluster_listen;
+  int cluster_interval;
+  array_header *cluster_peers;
+  const unsigned char *cluster_secret;
+};
+
+/* Compile the policy for the given server's configuration, given the
+ * MaxInstances in effect.  The policy refers to, and so must not outlive,
+ * that configuration.
+ */
+struct loiter_policy *loiter_policy_compile(pool *p, const server_rec *s,
+  unsigned long max_instances);
+
+/* Returns the policy compiled for the given server, or NULL if none. */
+const struct loiter_policy *loiter_policy_get(
+  const struct loiter_policy *policies, const server_rec *s);
+
+/* Returns the LoiterClassRules for the given class, or NULL if none. */
+const struct loiter_policy_class *loiter_policy_get_class(
+  const struct loiter_policy *policy, const pr_class_t *cls);
+
+/* Scale the watermarks down for MaxInstances, keeping their ratio.  Returns
+ * TRUE if they were adjusted, FALSE otherwise.
+ */
+int loiter_policy_adjust_rules(struct loiter_rules *rules,
+  unsigned long max_instances);
+
+/* Tabulate the rules' curve, if any, for their current watermarks and rate,
+ * e.g. once adjusted for MaxInstances; otherwise every drop probability
+ * would be computed rather than looked up.
+ */
+int loiter_policy_compile_curve(pool *p, struct loiter_rules *rules);
+
+/* Returns the probability, as a percentage, that a new connection should be
+ * dropped, given the count of unauthenticated connections.
+ */
+unsigned int loiter_policy_drop_pct(const struct loiter_rules *rules,
+  unsigned int unauthd_count);
+
+/* Returns the given drop probability, as a percentage, raised towards 100
+ * in proportion to the system pressure, per the LoiterPressure.
+ */
+unsigned int loiter_policy_pressure_pct(unsigned int drop_pct,
+  unsigned int pressure);
+
+/* Returns the probability, as a percentage, that a new connection would be
+ * dropped, before any adjustments for its source: the LoiterController's
+ * control_pct if the policy uses one, otherwise per the rules and the count
+ * of unauthenticated connections, at least host_pct, and then raised for
+ * the system pressure.
+ */
+unsigned int loiter_policy_effective_pct(const struct loiter_policy *policy,
+  const struct loiter_rules *rules, unsigned int unauthd_count,
+  unsigned int control_pct, unsigned int host_pct, unsigned int pressure);
+
+/* Returns the given drop probability, as a percentage, raised to 100 if
+ * fewer than threshold distinct sources are making the nconns connections,
+ * and this source is making more than its fair share (source_count) of
+ * them.  Otherwise, the probability is unchanged.
+ */
+unsigned int loiter_policy_distinct_pct(unsigned int drop_pct,
+  unsigned int distinct, unsigned int threshold, unsigned int nconns,
+  unsigned int source_count);
+
+#endif /* MOD_LOITER_POLICY_H */
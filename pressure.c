@@ -0,0 +1,306 @@
+/*
+ * ProFTPD - mod_loiter system pressure
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "pressure.h"
+
+#define LOITER_PRESSURE_PROC_LOADAVG	"/proc/loadavg"
+#define LOITER_PRESSURE_PROC_MEMINFO	"/proc/meminfo"
+#define LOITER_PRESSURE_PROC_PSI	"/proc/pressure/memory"
+
+static const char *trace_channel = "loiter.pressure";
+
+/* Parse a decimal such as "1.25" into hundredths, returning a pointer just
+ * past it, or NULL if there are no digits.
+ */
+static const char *parse_hundredths(const char *ptr, unsigned long *v) {
+  unsigned long n = 0;
+  unsigned int i;
+  int ndigits = 0;
+
+  while (isdigit((int) *ptr)) {
+    n = (n * 10) + (*ptr - '0');
+    ptr++;
+    ndigits++;
+  }
+
+  n *= 100;
+
+  if (*ptr == '.') {
+    unsigned long scale = 10;
+
+    ptr++;
+    for (i = 0; isdigit((int) *ptr); i++, ptr++) {
+      if (i < 2) {
+        n += (*ptr - '0') * scale;
+        scale /= 10;
+      }
+
+      ndigits++;
+    }
+  }
+
+  if (ndigits == 0) {
+    return NULL;
+  }
+
+  *v = n;
+  return ptr;
+}
+
+static const char *get_meminfo_kb(const char *text, const char *name,
+    unsigned long *kb) {
+  const char *ptr;
+  size_t namelen;
+
+  namelen = strlen(name);
+
+  for (ptr = text; ptr != NULL && *ptr != '\0'; ptr = strchr(ptr, '\n')) {
+    if (*ptr == '\n') {
+      ptr++;
+    }
+
+    if (strncmp(ptr, name, namelen) == 0 &&
+        ptr[namelen] == ':') {
+      char *end = NULL;
+
+      *kb = strtoul(ptr + namelen + 1, &end, 10);
+      return end != ptr + namelen + 1 ? end : NULL;
+    }
+  }
+
+  return NULL;
+}
+
+unsigned int loiter_pressure_scale(unsigned int value, unsigned int limit) {
+  unsigned long v;
+
+  if (limit == 0 ||
+      (unsigned long) value * 2 <= limit) {
+    return 0;
+  }
+
+  if (value >= limit) {
+    return 100;
+  }
+
+  v = (((unsigned long) value * 2) - limit) * 100;
+  return (unsigned int) (v / limit);
+}
+
+int loiter_pressure_parse_loadavg(const char *text, unsigned int *load,
+    unsigned int *nprocs) {
+  const char *ptr;
+  unsigned long v;
+  int i;
+
+  if (text == NULL ||
+      load == NULL ||
+      nprocs == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* e.g. "0.52 0.58 0.59 2/845 12345" */
+  ptr = parse_hundredths(text, &v);
+  if (ptr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *load = (unsigned int) v;
+
+  /* Skip the 5- and 15-minute averages, then the running count. */
+  for (i = 0; i < 3; i++) {
+    ptr = strchr(ptr, i < 2 ? ' ' : '/');
+    if (ptr == NULL) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    ptr++;
+  }
+
+  if (!isdigit((int) *ptr)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *nprocs = (unsigned int) strtoul(ptr, NULL, 10);
+  return 0;
+}
+
+int loiter_pressure_parse_meminfo(const char *text, unsigned int *used_pct) {
+  unsigned long total = 0, avail = 0;
+
+  if (text == NULL ||
+      used_pct == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (get_meminfo_kb(text, "MemTotal", &total) == NULL ||
+      get_meminfo_kb(text, "MemAvailable", &avail) == NULL ||
+      total == 0 ||
+      avail > total) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *used_pct = (unsigned int) (100 - ((avail * 100) / total));
+  return 0;
+}
+
+int loiter_pressure_parse_psi(const char *text, unsigned int *stall) {
+  const char *ptr;
+  unsigned long v;
+
+  if (text == NULL ||
+      stall == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* e.g. "some avg10=1.23 avg60=0.50 avg300=0.10 total=12345" */
+  if (strncmp(text, "some ", 5) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ptr = strstr(text, "avg10=");
+  if (ptr == NULL ||
+      parse_hundredths(ptr + 6, &v) == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *stall = (unsigned int) v;
+  return 0;
+}
+
+static const char *read_proc(pool *p, const char *path) {
+  pr_fh_t *fh;
+  char *buf;
+  size_t bufsz = 4096;
+  int res, xerrno;
+
+  fh = pr_fsio_open(path, O_RDONLY);
+  if (fh == NULL) {
+    xerrno = errno;
+    pr_trace_msg(trace_channel, 9, "error opening '%s': %s", path,
+      strerror(xerrno));
+    errno = xerrno;
+    return NULL;
+  }
+
+  buf = pcalloc(p, bufsz);
+  res = pr_fsio_read(fh, buf, bufsz-1);
+  xerrno = errno;
+  (void) pr_fsio_close(fh);
+
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 9, "error reading '%s': %s", path,
+      strerror(xerrno));
+    errno = xerrno;
+    return NULL;
+  }
+
+  return buf;
+}
+
+unsigned int loiter_pressure_sample(pool *p,
+    const struct loiter_pressure_limits *limits) {
+  const char *text;
+  unsigned int pressure = 0, v;
+  pool *tmp_pool;
+
+  if (p == NULL ||
+      limits == NULL) {
+    return 0;
+  }
+
+  tmp_pool = make_sub_pool(p);
+  pr_pool_tag(tmp_pool, "Loiter pressure pool");
+
+  if (limits->load > 0 ||
+      limits->procs > 0) {
+    text = read_proc(tmp_pool, LOITER_PRESSURE_PROC_LOADAVG);
+    if (text != NULL) {
+      unsigned int load, nprocs;
+
+      if (loiter_pressure_parse_loadavg(text, &load, &nprocs) == 0) {
+        long ncpus = 1;
+
+#if defined(_SC_NPROCESSORS_ONLN)
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpus < 1) {
+          ncpus = 1;
+        }
+#endif /* _SC_NPROCESSORS_ONLN */
+
+        v = loiter_pressure_scale(load / (unsigned int) ncpus, limits->load);
+        pr_trace_msg(trace_channel, 17,
+          "load %u.%02u over %ld CPUs: pressure %u", load / 100, load % 100,
+          ncpus, v);
+        pressure = v > pressure ? v : pressure;
+
+        v = loiter_pressure_scale(nprocs, limits->procs);
+        pr_trace_msg(trace_channel, 17, "%u processes: pressure %u", nprocs,
+          v);
+        pressure = v > pressure ? v : pressure;
+      }
+    }
+  }
+
+  if (limits->memory > 0) {
+    text = read_proc(tmp_pool, LOITER_PRESSURE_PROC_MEMINFO);
+    if (text != NULL) {
+      unsigned int used_pct;
+
+      if (loiter_pressure_parse_meminfo(text, &used_pct) == 0) {
+        v = loiter_pressure_scale(used_pct, limits->memory);
+        pr_trace_msg(trace_channel, 17, "memory %u%% used: pressure %u",
+          used_pct, v);
+        pressure = v > pressure ? v : pressure;
+      }
+    }
+  }
+
+  if (limits->psi > 0) {
+    text = read_proc(tmp_pool, LOITER_PRESSURE_PROC_PSI);
+    if (text != NULL) {
+      unsigned int stall;
+
+      if (loiter_pressure_parse_psi(text, &stall) == 0) {
+        v = loiter_pressure_scale(stall, limits->psi * 100);
+        pr_trace_msg(trace_channel, 17,
+          "memory stalled %u.%02u%%: pressure %u", stall / 100, stall % 100, v);
+        pressure = v > pressure ? v : pressure;
+      }
+    }
+  }
+
+  destroy_pool(tmp_pool);
+  return pressure;
+}
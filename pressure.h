@@ -0,0 +1,81 @@
+/*
+ * ProFTPD - mod_loiter system pressure
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_PRESSURE_H
+#define MOD_LOITER_PRESSURE_H
+
+#include "mod_loiter.h"
+
+/* Default interval, in seconds, for sampling the system pressure. */
+#define LOITER_PRESSURE_DEFAULT_INTERVAL	5
+
+/* The limits at which each input alone gives full pressure; zero disables
+ * that input.
+ */
+struct loiter_pressure_limits {
+  /* The 1-minute load average per CPU, in hundredths. */
+  unsigned int load;
+
+  /* The percentage of memory in use, i.e. not available. */
+  unsigned int memory;
+
+  /* The percentage of time some tasks stalled on memory, over the last
+   * 10 secs, per /proc/pressure/memory.
+   */
+  unsigned int psi;
+
+  /* The number of processes on the system. */
+  unsigned int procs;
+};
+
+/* Returns the pressure, as a percentage, given an input's value and its
+ * limit: none up to half the limit, then rising linearly to full pressure
+ * at the limit.
+ */
+unsigned int loiter_pressure_scale(unsigned int value, unsigned int limit);
+
+/* Parse the contents of /proc/loadavg, giving the 1-minute load average
+ * (in hundredths) and the number of processes.
+ */
+int loiter_pressure_parse_loadavg(const char *text, unsigned int *load,
+  unsigned int *nprocs);
+
+/* Parse the contents of /proc/meminfo, giving the percentage of memory in
+ * use.
+ */
+int loiter_pressure_parse_meminfo(const char *text, unsigned int *used_pct);
+
+/* Parse the contents of a /proc/pressure file, giving the "some avg10"
+ * stall percentage, in hundredths.
+ */
+int loiter_pressure_parse_psi(const char *text, unsigned int *stall);
+
+/* Sample the configured inputs, and return the composite pressure, as a
+ * percentage: that of the input under the most pressure.  Inputs which
+ * cannot be read, e.g. on systems without /proc, are ignored.
+ */
+unsigned int loiter_pressure_sample(pool *p,
+  const struct loiter_pressure_limits *limits);
+
+#endif /* MOD_LOITER_PRESSURE_H */
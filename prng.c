@@ -0,0 +1,206 @@
+/*
+ * ProFTPD - mod_loiter random numbers
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "prng.h"
+
+#if defined(HAVE_SYS_RANDOM_H)
+# include <sys/random.h>
+#endif /* HAVE_SYS_RANDOM_H */
+
+#define LOITER_PRNG_URANDOM		"/dev/urandom"
+
+static const char *trace_channel = "loiter.prng";
+
+/* The state of xoshiro256** (Blackman and Vigna), per process.  It is
+ * small, fast, and needs no lock, unlike random(3); each process seeds its
+ * own after forking.
+ */
+static uint64_t prng_state[4] = {
+  0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL,
+  0x94d049bb133111ebULL, 0x2545f4914f6cdd1dULL
+};
+
+static uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+/* SplitMix64, for expanding a seed into the generator state. */
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z;
+
+  *x += 0x9e3779b97f4a7c15ULL;
+  z = *x;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void set_state(uint64_t seed) {
+  register unsigned int i;
+
+  for (i = 0; i < 4; i++) {
+    prng_state[i] = splitmix64(&seed);
+  }
+}
+
+/* Fill the buffer from the operating system's entropy source. */
+static int read_entropy(unsigned char *buf, size_t bufsz) {
+#if defined(HAVE_GETRANDOM)
+  ssize_t res;
+
+  res = getrandom(buf, bufsz, GRND_NONBLOCK);
+  if (res == (ssize_t) bufsz) {
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 9, "getrandom(2) error: %s",
+    res < 0 ? strerror(errno) : "short read");
+#elif defined(HAVE_ARC4RANDOM_BUF)
+  arc4random_buf(buf, bufsz);
+  return 0;
+#endif /* HAVE_ARC4RANDOM_BUF */
+
+  {
+    pr_fh_t *fh;
+    int res, xerrno;
+
+    fh = pr_fsio_open(LOITER_PRNG_URANDOM, O_RDONLY);
+    if (fh == NULL) {
+      xerrno = errno;
+
+      pr_trace_msg(trace_channel, 9, "error opening %s: %s",
+        LOITER_PRNG_URANDOM, strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+
+    res = pr_fsio_read(fh, (char *) buf, bufsz);
+    xerrno = errno;
+    (void) pr_fsio_close(fh);
+
+    if (res != (int) bufsz) {
+      pr_trace_msg(trace_channel, 9, "error reading %s: %s",
+        LOITER_PRNG_URANDOM, res < 0 ? strerror(xerrno) : "short read");
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int loiter_prng_init(void) {
+  uint64_t seed[4];
+
+  if (read_entropy((unsigned char *) seed, sizeof(seed)) < 0) {
+    struct timeval tv;
+
+    /* Better than nothing; mix the time and PID, so that sessions forked in
+     * the same second still differ.
+     */
+    gettimeofday(&tv, NULL);
+    set_state(((uint64_t) tv.tv_sec << 20) ^ (uint64_t) tv.tv_usec ^
+      ((uint64_t) getpid() << 40));
+    return 0;
+  }
+
+  /* The all-zero state is the one state xoshiro cannot leave. */
+  if ((seed[0] | seed[1] | seed[2] | seed[3]) == 0) {
+    seed[0] = 1;
+  }
+
+  memcpy(prng_state, seed, sizeof(prng_state));
+  return 0;
+}
+
+int loiter_prng_seed(uint64_t seed, uint64_t stream) {
+  uint64_t x;
+
+  /* Give each stream its own, well-separated, starting point. */
+  x = stream;
+  set_state(seed ^ splitmix64(&x));
+
+  pr_trace_msg(trace_channel, 17,
+    "seeded generator with seed %llu, stream %llu", (unsigned long long) seed,
+    (unsigned long long) stream);
+  return 0;
+}
+
+uint64_t loiter_prng_next(void) {
+  uint64_t res, t;
+
+  res = rotl(prng_state[1] * 5, 7) * 9;
+  t = prng_state[1] << 17;
+
+  prng_state[2] ^= prng_state[0];
+  prng_state[3] ^= prng_state[1];
+  prng_state[1] ^= prng_state[2];
+  prng_state[0] ^= prng_state[3];
+
+  prng_state[2] ^= t;
+  prng_state[3] = rotl(prng_state[3], 45);
+
+  return res;
+}
+
+/* Lemire's multiply-and-reject method: one multiplication, and a division
+ * only in the rare case that a rejection is possible.
+ */
+uint32_t loiter_prng_uniform(uint32_t bound) {
+  uint64_t m;
+  uint32_t l;
+
+  if (bound < 2) {
+    return 0;
+  }
+
+  m = (loiter_prng_next() >> 32) * bound;
+  l = (uint32_t) m;
+
+  if (l < bound) {
+    uint32_t threshold;
+
+    threshold = -bound % bound;
+    while (l < threshold) {
+      m = (loiter_prng_next() >> 32) * bound;
+      l = (uint32_t) m;
+    }
+  }
+
+  return (uint32_t) (m >> 32);
+}
+
+int loiter_prng_chance(unsigned int prob) {
+  if (prob == 0) {
+    return FALSE;
+  }
+
+  if (prob >= LOITER_PRNG_SCALE) {
+    return TRUE;
+  }
+
+  return loiter_prng_uniform(LOITER_PRNG_SCALE) < prob ? TRUE : FALSE;
+}
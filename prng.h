@@ -0,0 +1,58 @@
+/*
+ * ProFTPD - mod_loiter random numbers
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_PRNG_H
+#define MOD_LOITER_PRNG_H
+
+#include "mod_loiter.h"
+
+/* Probabilities are rolled in hundredths of a percent. */
+#define LOITER_PRNG_SCALE		10000
+#define LOITER_PRNG_PCT			(LOITER_PRNG_SCALE / 100)
+
+/* Seed this process's generator from the operating system's entropy
+ * source, falling back to the time and PID if none is available.
+ */
+int loiter_prng_init(void);
+
+/* Seed this process's generator deterministically, e.g. for reproducible
+ * benchmarks.  Each stream (e.g. each session) given the same seed yields
+ * its own, repeatable, sequence.
+ */
+int loiter_prng_seed(uint64_t seed, uint64_t stream);
+
+/* Returns the next 64 random bits. */
+uint64_t loiter_prng_next(void);
+
+/* Returns a number uniformly distributed over [0, bound), without modulo
+ * bias.
+ */
+uint32_t loiter_prng_uniform(uint32_t bound);
+
+/* Returns TRUE with the given probability, in hundredths of a percent,
+ * FALSE otherwise.
+ */
+int loiter_prng_chance(unsigned int prob);
+
+#endif /* MOD_LOITER_PRNG_H */
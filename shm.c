@@ -25,13 +25,75 @@
 #include "mod_loiter.h"
 #include "shm.h"
 
+#include <stddef.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
 #define LOITER_SHM_PROJ_ID		4582
 
-struct loiter_shm_data {
-  /* Connection count. */
+/* Identifies the header at the start of every segment; the version is bumped
+ * whenever the layout of struct loiter_shm_header changes.
+ */
+#define LOITER_SHM_MAGIC		0x4c4f4954
+#define LOITER_SHM_VERSION		1
+
+/* How many times a lock-free reader retries before falling back to taking
+ * the lock.
+ */
+#define LOITER_SHM_SNAPSHOT_MAX_ATTEMPTS	8
+
+#if defined(LOITER_HAVE_ATOMICS)
+# define loiter_shm_barrier()		__sync_synchronize()
+#endif /* LOITER_HAVE_ATOMICS */
+
+struct loiter_shm_partition {
+  /* Empty for an unclaimed partition. */
+  char name[LOITER_SHM_PARTITION_NAMESZ];
+
+  unsigned int conn_count;
+  unsigned int authd_count;
+  unsigned int nejects;
+  unsigned int failed_count;
+};
+
+struct loiter_shm_class {
+  /* Empty for an unclaimed class. */
+  char name[LOITER_SHM_PARTITION_NAMESZ];
+
+  unsigned int conn_count;
+  unsigned int authd_count;
+  unsigned int nejects;
+
+  /* Unauthenticated connections reserved for this class. */
+  unsigned int reserve;
+};
+
+struct loiter_shm_shadow {
+  /* Empty for an unclaimed entry. */
+  char name[LOITER_SHM_PARTITION_NAMESZ];
+
+  /* Connections evaluated, and of those, how many the shadow rules would
+   * have dropped.  Of the disagreements with the active rules, how many the
+   * shadow rules would have dropped but the active rules kept (extra), and
+   * the other way around (spared).  Incremented atomically, without the
+   * lock.
+   */
+  volatile unsigned int nevals;
+  volatile unsigned int ndrops;
+  volatile unsigned int nextra;
+  volatile unsigned int nspared;
+};
+
+/* The host-wide counts and settings.  These come first in every segment,
+ * whatever its size, so that they can be carried over into a segment with a
+ * different layout; see migrate_shm().
+ */
+struct loiter_shm_header {
+  /* LOITER_SHM_MAGIC and LOITER_SHM_VERSION. */
+  uint32_t magic;
+  uint32_t version;
+
+  /* Connection count, across all partitions. */
   unsigned int conn_count;
 
   /* Count of authenticated connections. */
@@ -39,12 +101,159 @@ struct loiter_shm_data {
 
   /* Track number of ejected connections. */
   unsigned int nejects;
+
+  /* Failed logins by connections not (yet) authenticated, weighted; see
+   * LoiterAuthFailures.
+   */
+  unsigned int failed_count;
+
+  /* Rules set at runtime, via 'ftpdctl loiter rules'.  A value of zero
+   * means that the configured LoiterRules value is used.
+   */
+  unsigned int rules_low;
+  unsigned int rules_high;
+  unsigned int rules_rate;
+
+  /* Unauthenticated connections on other cluster nodes, as last reported
+   * by the agent process; see LoiterClusterPeer.
+   */
+  unsigned int cluster_unauthd_count;
+  unsigned int cluster_npeers;
+
+  /* The system pressure, as a percentage, as last sampled by the daemon;
+   * see LoiterPressure.  Written and read as a single word, without the lock.
+   */
+  volatile unsigned int pressure;
+
+  /* The drop probability, as a percentage, last computed by the daemon's
+   * feedback controller; see LoiterController.  Likewise lock-free.
+   */
+  volatile unsigned int control_pct;
+
+  /* Sessions started, for giving each session its own deterministic random
+   * stream; see LoiterRandomSeed.  Incremented atomically, without the lock.
+   */
+  volatile unsigned int session_seq;
+
+  /* Retries of, and failures to take, the lock, and the time spent backing
+   * off before retrying, in nsecs, by all processes; see lock_shm().
+   * Incremented atomically, without the lock.
+   */
+  volatile unsigned int lock_nretries;
+  volatile unsigned int lock_nfailures;
+  volatile uint64_t lock_backoff_nsecs;
+};
+
+struct loiter_shm_data {
+  struct loiter_shm_header hdr;
+
+  /* Latencies of session setup, by part; see loiter_shm_timing_add(). */
+  struct loiter_histogram timings[LOITER_SHM_NTIMINGS];
+
+  /* Per-daemon counts, for daemons sharing this table; see
+   * loiter_shm_set_partition().
+   */
+  struct loiter_shm_partition partitions[LOITER_SHM_MAX_PARTITIONS];
+
+  /* Per-class counts; see LoiterClassRules. */
+  struct loiter_shm_class classes[LOITER_SHM_MAX_CLASSES];
+
+  /* Decisions of the candidate rules, never enforced; see
+   * LoiterShadowRules.
+   */
+  struct loiter_shm_shadow shadows[LOITER_SHM_MAX_SHADOWS];
+
+  /* Recently authenticated sources; each entry packs the upper 32 bits of
+   * the source key with the time it last authenticated, so that an entry is
+   * read and written as a single word, without the lock.
+   */
+  uint64_t reputation[LOITER_SHM_REPUTATION_SIZE];
+
+  /* Heavy hitters, by source and by prefix; see LoiterHeavyHitters. */
+  struct loiter_sketch sources;
+  struct loiter_sketch prefixes;
+
+  /* Distinct sources, for the current and previous windows, alternately;
+   * see LoiterDistinctSources.
+   */
+  struct loiter_hll distinct[2];
+
+  /* The estimate for the last complete window, as of the start of the
+   * current window.
+   */
+  unsigned int distinct_prev_sources;
+  unsigned int distinct_prev_conns;
+
+  /* Rate limiting token buckets, by source and by prefix; see
+   * LoiterRateLimit.
+   */
+  uint64_t buckets[LOITER_SHM_BUCKETS_SIZE];
+  uint64_t prefix_buckets[LOITER_SHM_BUCKETS_SIZE];
+
+  /* Recent drops, by source; see LoiterBan. */
+  uint64_t offenders[LOITER_SHM_BUCKETS_SIZE];
+
+  /* Recent failed logins, by source; see LoiterAuthFailures. */
+  uint64_t failures[LOITER_SHM_BUCKETS_SIZE];
+
+  /* Unauthenticated connections, by attempted user name; see
+   * LoiterUserRules.
+   */
+  unsigned int users[LOITER_SHM_USERS_SIZE];
+
+  /* Authenticated sessions, each slot packing the session PID with the
+   * time of its last command; see LoiterIdleSessions.
+   */
+  uint64_t slots[LOITER_SHM_SLOTS_SIZE];
+
+  /* The partition, plus one, of each slot's daemon.  A newly claimed slot is
+   * never idle long enough to be shed before this is set.
+   */
+  unsigned char slot_partitions[LOITER_SHM_SLOTS_SIZE];
+
+  /* When each slot was marked for shedding, so that the marks of sessions
+   * which died without releasing their slots can be cleared.
+   */
+  uint32_t slot_marked[LOITER_SHM_SLOTS_SIZE];
+
+  /* Everything above is carried over by 'ftpdctl loiter shm resize'; the
+   * fields below belong to this segment alone.
+   *
+   * Set by the daemon when it replaces this segment, e.g. via
+   * 'ftpdctl loiter shm resize'; sessions still attached to this segment
+   * follow it to the next_shmid segment.
+   */
+  volatile int migrated;
+  volatile int next_shmid;
+
+  /* Bumped before and after every update, so that readers can take a
+   * consistent snapshot without taking the lock; see get_snapshot().
+   */
+  volatile unsigned int seqno;
 };
 
 static struct loiter_shm_data *loiter_data = NULL;
 static size_t loiter_datasz = 0;
 static int loiter_shmid = -1;
 static pr_fh_t *loiter_datafh = NULL;
+static unsigned int loiter_nlocks = 0;
+
+/* Locks of the shm file taken by this process; see lock_shm(). */
+static struct loiter_shm_lock_stats loiter_lock_stats;
+
+#if !defined(LOITER_HAVE_ATOMICS)
+/* How much of the above has been added to the LoiterTable's totals; without
+ * GCC atomics, that can only be done while holding the lock.
+ */
+static struct loiter_shm_lock_stats loiter_lock_stats_added;
+#endif /* LOITER_HAVE_ATOMICS */
+
+/* Index of our partition, or -1 if we are not using one. */
+static int loiter_partition = -1;
+static char loiter_partition_name[LOITER_SHM_PARTITION_NAMESZ];
+
+/* Index of our session's class, or -1 if it has none. */
+static int loiter_class = -1;
 static const char *trace_channel = "loiter.shm";
 
 static const char *get_lock_desc(int lock_type) {
@@ -70,11 +279,72 @@ static const char *get_lock_desc(int lock_type) {
   return lock_desc;
 }
 
+static void count_lock_failure(void) {
+  loiter_lock_stats.nfailures++;
+
+#if defined(LOITER_HAVE_ATOMICS)
+  if (loiter_data != NULL) {
+    (void) __sync_fetch_and_add(&(loiter_data->hdr.lock_nfailures), 1);
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+static void count_lock_retry(uint64_t backoff_nsecs) {
+  loiter_lock_stats.nretries++;
+  loiter_lock_stats.backoff_nsecs += backoff_nsecs;
+
+  /* Under contention, this backoff can dominate the cost of a session's
+   * setup; make it visible to the admin.
+   */
+#if defined(LOITER_HAVE_ATOMICS)
+  if (loiter_data != NULL) {
+    (void) __sync_fetch_and_add(&(loiter_data->hdr.lock_nretries), 1);
+    (void) __sync_fetch_and_add(&(loiter_data->hdr.lock_backoff_nsecs),
+      backoff_nsecs);
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+/* Called once the lock is held. */
+static void add_lock_stats(void) {
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (loiter_data == NULL) {
+    return;
+  }
+
+  loiter_data->hdr.lock_nretries += loiter_lock_stats.nretries -
+    loiter_lock_stats_added.nretries;
+  loiter_data->hdr.lock_nfailures += loiter_lock_stats.nfailures -
+    loiter_lock_stats_added.nfailures;
+  loiter_data->hdr.lock_backoff_nsecs += loiter_lock_stats.backoff_nsecs -
+    loiter_lock_stats_added.backoff_nsecs;
+
+  loiter_lock_stats_added = loiter_lock_stats;
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
 static int lock_shm(int lock_type) {
   const char *lock_desc;
   int fd;
   struct flock lock;
   unsigned int nattempts = 1;
+  uint64_t start_nsecs;
+
+  /* Locks may be nested, e.g. when migrating to a new segment; only the
+   * outermost lock/unlock actually touches the lock file.
+   */
+  if (lock_type == F_UNLCK) {
+    if (loiter_nlocks > 1) {
+      loiter_nlocks--;
+      return 0;
+    }
+
+  } else if (loiter_nlocks > 0) {
+    loiter_nlocks++;
+    return 0;
+  }
+
+  start_nsecs = loiter_monotonic_now();
 
   lock.l_type = lock_type;
   lock.l_whence = SEEK_SET;
@@ -97,7 +367,12 @@ static int lock_shm(int lock_type) {
 
     pr_trace_msg(trace_channel, 3, "%s of shm fd %d failed: %s",
       lock_desc, fd, strerror(xerrno));
-    if (xerrno == EACCES) {
+
+    /* POSIX allows either EACCES or EAGAIN for a lock held by another
+     * process; Linux uses EAGAIN.
+     */
+    if (xerrno == EACCES ||
+        xerrno == EAGAIN) {
       struct flock locker;
 
       /* Get the PID of the process blocking this lock. */
@@ -114,24 +389,257 @@ static int lock_shm(int lock_type) {
 
       nattempts++;
       if (nattempts <= 10) {
-        errno = EINTR;
+        uint64_t backoff_start, backoff_nsecs;
 
+        backoff_start = loiter_monotonic_now();
+        errno = EINTR;
         pr_signals_handle();
+        backoff_nsecs = loiter_monotonic_now() - backoff_start;
+
+        count_lock_retry(backoff_nsecs);
         continue;
       }
 
+      count_lock_failure();
       errno = xerrno;
       return -1;
     }
 
+    count_lock_failure();
     errno = xerrno;
     return -1;
   }
 
+  if (lock_type == F_UNLCK) {
+    loiter_nlocks = 0;
+
+  } else {
+    loiter_nlocks = 1;
+    loiter_lock_stats.nlocks++;
+    loiter_lock_stats.wait_nsecs += loiter_monotonic_now() - start_nsecs;
+    add_lock_stats();
+  }
+
   pr_trace_msg(trace_channel, 9, "%s of shm fd %d succeeded", lock_desc, fd);
   return 0;
 }
 
+static int detach_shm(struct loiter_shm_data *data) {
+  int res, xerrno;
+
+  PRIVS_ROOT
+#if !defined(_POSIX_SOURCE)
+  res = shmdt((char *) data);
+#else
+  res = shmdt((const char *) data);
+#endif
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  errno = xerrno;
+  return res;
+}
+
+/* If the daemon has replaced our segment with a new one, attach to the new
+ * segment.  This is also called without the lock, by the lock-free paths;
+ * the daemon sets next_shmid before setting migrated, and never changes
+ * either again.
+ */
+static int follow_shm(void) {
+  while (loiter_data->migrated == TRUE) {
+    int next_shmid, xerrno;
+    struct loiter_shm_data *data;
+
+#if defined(LOITER_HAVE_ATOMICS)
+    loiter_shm_barrier();
+#endif /* LOITER_HAVE_ATOMICS */
+    next_shmid = loiter_data->next_shmid;
+    pr_trace_msg(trace_channel, 9, "shm ID %d migrated to shm ID %d, following",
+      loiter_shmid, next_shmid);
+
+    PRIVS_ROOT
+    data = (struct loiter_shm_data *) shmat(next_shmid, NULL, 0);
+    xerrno = errno;
+    PRIVS_RELINQUISH
+
+    if (data == (struct loiter_shm_data *) -1) {
+      pr_trace_msg(trace_channel, 1,
+        "unable to attach to shm ID %d: %s", next_shmid, strerror(xerrno));
+      errno = xerrno;
+      return -1;
+    }
+
+    if (detach_shm(loiter_data) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error detaching shm ID %d: %s", loiter_shmid, strerror(errno));
+    }
+
+    loiter_data = data;
+    loiter_shmid = next_shmid;
+  }
+
+  return 0;
+}
+
+/* Writers wrap their changes in these calls.  They should hold the shm lock,
+ * but carry on without it if locking fails; the bumps are atomic so that two
+ * such writers cannot leave the seqno odd, which would force every snapshot
+ * reader onto the lock from then on.
+ */
+static void begin_update(void) {
+#if defined(LOITER_HAVE_ATOMICS)
+  (void) __sync_fetch_and_add(&(loiter_data->seqno), 1);
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+static void end_update(void) {
+#if defined(LOITER_HAVE_ATOMICS)
+  (void) __sync_fetch_and_add(&(loiter_data->seqno), 1);
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+/* Compare-and-swap of a count shared between sessions.  Without GCC atomics,
+ * the caller must hold the lock instead.
+ */
+static int cas_count(unsigned int *count, unsigned int prev,
+    unsigned int next) {
+#if defined(LOITER_HAVE_ATOMICS)
+  return __sync_bool_compare_and_swap(count, prev, next);
+#else
+  if (*count != prev) {
+    return FALSE;
+  }
+
+  *count = next;
+  return TRUE;
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+/* As cas_count(), for a session slot. */
+static int cas_slot(uint64_t *slot, uint64_t prev, uint64_t next) {
+#if defined(LOITER_HAVE_ATOMICS)
+  return __sync_bool_compare_and_swap(slot, prev, next);
+#else
+  if (*slot != prev) {
+    return FALSE;
+  }
+
+  *slot = next;
+  return TRUE;
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+static void copy_stats(struct loiter_shm_stats *stats) {
+  register unsigned int i;
+
+  stats->host_conn_count = loiter_data->hdr.conn_count;
+  stats->host_authd_count = loiter_data->hdr.authd_count;
+  stats->host_nejects = loiter_data->hdr.nejects;
+  stats->host_failed_count = loiter_data->hdr.failed_count;
+
+  stats->host_npartitions = 0;
+  for (i = 0; i < LOITER_SHM_MAX_PARTITIONS; i++) {
+    if (loiter_data->partitions[i].name[0] != '\0') {
+      stats->host_npartitions++;
+    }
+  }
+
+  if (loiter_partition >= 0) {
+    struct loiter_shm_partition *part;
+
+    part = &(loiter_data->partitions[loiter_partition]);
+    stats->conn_count = part->conn_count;
+    stats->authd_count = part->authd_count;
+    stats->nejects = part->nejects;
+    stats->failed_count = part->failed_count;
+
+  } else {
+    stats->conn_count = loiter_data->hdr.conn_count;
+    stats->authd_count = loiter_data->hdr.authd_count;
+    stats->nejects = loiter_data->hdr.nejects;
+    stats->failed_count = loiter_data->hdr.failed_count;
+  }
+
+  stats->rules_low = loiter_data->hdr.rules_low;
+  stats->rules_high = loiter_data->hdr.rules_high;
+  stats->rules_rate = loiter_data->hdr.rules_rate;
+  stats->cluster_unauthd_count = loiter_data->hdr.cluster_unauthd_count;
+  stats->cluster_npeers = loiter_data->hdr.cluster_npeers;
+  stats->distinct_sources = loiter_data->distinct_prev_sources;
+  stats->distinct_conns = loiter_data->distinct_prev_conns;
+  stats->pressure = loiter_data->hdr.pressure;
+  stats->control_pct = loiter_data->hdr.control_pct;
+  stats->lock_nretries = loiter_data->hdr.lock_nretries;
+  stats->lock_nfailures = loiter_data->hdr.lock_nfailures;
+  stats->lock_backoff_nsecs = loiter_data->hdr.lock_backoff_nsecs;
+
+  stats->class_conn_count = stats->class_authd_count = 0;
+  stats->class_nejects = stats->class_reserve = 0;
+  stats->reserve_total = stats->reserve_used = 0;
+
+  for (i = 0; i < LOITER_SHM_MAX_CLASSES; i++) {
+    struct loiter_shm_class *cls;
+    unsigned int unauthd_count = 0;
+
+    cls = &(loiter_data->classes[i]);
+    if (cls->name[0] == '\0' ||
+        cls->reserve == 0) {
+      continue;
+    }
+
+    if (cls->conn_count > cls->authd_count) {
+      unauthd_count = cls->conn_count - cls->authd_count;
+    }
+
+    stats->reserve_total += cls->reserve;
+    stats->reserve_used += unauthd_count < cls->reserve ?
+      unauthd_count : cls->reserve;
+  }
+
+  if (loiter_class >= 0) {
+    struct loiter_shm_class *cls;
+
+    cls = &(loiter_data->classes[loiter_class]);
+    stats->class_conn_count = cls->conn_count;
+    stats->class_authd_count = cls->authd_count;
+    stats->class_nejects = cls->nejects;
+    stats->class_reserve = cls->reserve;
+  }
+}
+
+static unsigned int *get_field(unsigned int *conn_count,
+    unsigned int *authd_count, unsigned int *nejects,
+    unsigned int *failed_count, int field_id) {
+  switch (field_id) {
+    case LOITER_FIELD_ID_AUTHD_COUNT:
+      return authd_count;
+
+    case LOITER_FIELD_ID_NEJECTS:
+      return nejects;
+
+    case LOITER_FIELD_ID_FAILED_COUNT:
+      return failed_count;
+
+    default:
+      break;
+  }
+
+  return conn_count;
+}
+
+static void incr_field(unsigned int *field, int incr) {
+  /* Counters may have been cleared out from under us, e.g. via
+   * 'ftpdctl loiter shm remove'; don't let them wrap around.
+   */
+  if (incr < 0 &&
+      *field < (unsigned int) -incr) {
+    *field = 0;
+
+  } else {
+    *field += incr;
+  }
+}
+
 static struct loiter_shm_data *create_shm(pr_fh_t *fh) {
   int rem, shmid, xerrno = 0;
   int shm_existed = FALSE;
@@ -212,7 +720,7 @@ static struct loiter_shm_data *create_shm(pr_fh_t *fh) {
   xerrno = errno;
   PRIVS_RELINQUISH
 
-  if (data == NULL) {
+  if (data == (struct loiter_shm_data *) -1) {
     pr_trace_msg(trace_channel, 1,
       "unable to attach to shm ID %d: %s", shmid, strerror(xerrno));
     errno = xerrno;
@@ -252,9 +760,22 @@ static struct loiter_shm_data *create_shm(pr_fh_t *fh) {
          */
 
         pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
-          ": remove existing shm using 'ftpdctl loiter shm remove' "
+          ": replace existing shm using 'ftpdctl loiter shm resize' "
           "before using new size");
 
+        (void) detach_shm(data);
+        errno = EINVAL;
+        return NULL;
+      }
+
+      /* Same size, but possibly not the same layout. */
+      if (data->hdr.magic != LOITER_SHM_MAGIC ||
+          data->hdr.version != LOITER_SHM_VERSION) {
+        pr_log_pri(PR_LOG_NOTICE, MOD_LOITER_VERSION
+          ": existing shm has a different layout; resize it using "
+          "'ftpdctl loiter shm resize' before using it");
+
+        (void) detach_shm(data);
         errno = EINVAL;
         return NULL;
       }
@@ -273,6 +794,8 @@ static struct loiter_shm_data *create_shm(pr_fh_t *fh) {
     }
 
     memset(data, 0, shm_size);
+    data->hdr.magic = LOITER_SHM_MAGIC;
+    data->hdr.version = LOITER_SHM_VERSION;
 
     if (lock_shm(F_UNLCK) < 0) {
       pr_trace_msg(trace_channel, 1,
@@ -372,14 +895,8 @@ int loiter_shm_destroy(pool *p) {
     int res, xerrno = 0;
     struct shmid_ds ds;
 
-    PRIVS_ROOT
-#if !defined(_POSIX_SOURCE)
-    res = shmdt((char *) loiter_data);
-#else
-    res = shmdt((const char *) loiter_data);
-#endif
+    res = detach_shm(loiter_data);
     xerrno = errno;
-    PRIVS_RELINQUISH
 
     if (res < 0) {
       pr_log_debug(DEBUG1, MOD_LOITER_VERSION
@@ -394,6 +911,28 @@ int loiter_shm_destroy(pool *p) {
 
     memset(&ds, 0, sizeof(ds));
 
+    /* When the table is shared with other daemons, leave it for them. */
+    if (loiter_partition >= 0) {
+      PRIVS_ROOT
+      res = shmctl(loiter_shmid, IPC_STAT, &ds);
+      PRIVS_RELINQUISH
+
+      if (res == 0 &&
+          ds.shm_nattch > 0) {
+        pr_trace_msg(trace_channel, 9,
+          "shm ID %d still attached by %lu %s, not removing", loiter_shmid,
+          (unsigned long) ds.shm_nattch,
+          ds.shm_nattch != 1 ? "processes" : "process");
+
+        loiter_shmid = -1;
+        loiter_partition = -1;
+        loiter_partition_name[0] = '\0';
+        (void) pr_fsio_close(loiter_datafh);
+        loiter_datafh = NULL;
+        return 0;
+      }
+    }
+
     PRIVS_ROOT
     res = shmctl(loiter_shmid, IPC_RMID, &ds);
     xerrno = errno;
@@ -409,6 +948,8 @@ int loiter_shm_destroy(pool *p) {
     }
 
     loiter_shmid = -1;
+    loiter_partition = -1;
+    loiter_partition_name[0] = '\0';
   }
 
   (void) pr_fsio_close(loiter_datafh);
@@ -416,54 +957,393 @@ int loiter_shm_destroy(pool *p) {
   return 0;
 }
 
-int loiter_shm_get(pool *p, unsigned int *conn_count,
-    unsigned int *authd_count) {
-  if (p == NULL ||
-      (conn_count == NULL && authd_count == NULL)) {
+/* Copies the header of the given segment, whatever its size, provided that
+ * it has a header of the layout we know.
+ */
+static int read_header(int shmid, struct loiter_shm_header *hdr) {
+  int res, xerrno;
+  struct shmid_ds ds;
+  struct loiter_shm_data *data;
+
+  PRIVS_ROOT
+  res = shmctl(shmid, IPC_STAT, &ds);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  if (ds.shm_segsz < sizeof(struct loiter_shm_header)) {
     errno = EINVAL;
     return -1;
   }
 
+  PRIVS_ROOT
+  data = (struct loiter_shm_data *) shmat(shmid, NULL, SHM_RDONLY);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (data == (struct loiter_shm_data *) -1) {
+    errno = xerrno;
+    return -1;
+  }
+
+  res = 0;
+  if (data->hdr.magic == LOITER_SHM_MAGIC &&
+      data->hdr.version == LOITER_SHM_VERSION) {
+    memcpy(hdr, &(data->hdr), sizeof(struct loiter_shm_header));
+
+  } else {
+    res = -1;
+    xerrno = EINVAL;
+  }
+
+  (void) detach_shm(data);
+
+  errno = xerrno;
+  return res;
+}
+
+/* Claims the named partition, or else a free one.  If clear is TRUE, any
+ * counts left by a previous incarnation of this daemon are taken out of the
+ * host totals; otherwise, e.g. after a migration, they are those of our
+ * sessions, and are kept.
+ */
+static int claim_partition(const char *name, int clear) {
+  register unsigned int i;
+  int idx = -1;
+  struct loiter_shm_partition *part;
+
   if (lock_shm(F_WRLCK) < 0) {
     pr_trace_msg(trace_channel, 1,
       "error write-locking shm: %s", strerror(errno));
   }
 
-  if (conn_count != NULL) {
-    *conn_count = loiter_data->conn_count;
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
   }
 
-  if (authd_count != NULL) {
-    *authd_count = loiter_data->authd_count;
+  for (i = 0; i < LOITER_SHM_MAX_PARTITIONS; i++) {
+    part = &(loiter_data->partitions[i]);
+
+    if (strcmp(part->name, name) == 0) {
+      idx = i;
+      break;
+    }
+
+    if (idx < 0 &&
+        part->name[0] == '\0') {
+      idx = i;
+    }
+  }
+
+  if (idx < 0) {
+    (void) lock_shm(F_UNLCK);
+
+    pr_trace_msg(trace_channel, 1,
+      "no free partition for '%s' (all %u in use)", name,
+      LOITER_SHM_MAX_PARTITIONS);
+    errno = ENOSPC;
+    return -1;
+  }
+
+  part = &(loiter_data->partitions[idx]);
+
+  if (clear == TRUE ||
+      strcmp(part->name, name) != 0) {
+    begin_update();
+    incr_field(&(loiter_data->hdr.conn_count), -((int) part->conn_count));
+    incr_field(&(loiter_data->hdr.authd_count), -((int) part->authd_count));
+    incr_field(&(loiter_data->hdr.failed_count), -((int) part->failed_count));
+    memset(part, 0, sizeof(struct loiter_shm_partition));
+    sstrncpy(part->name, name, sizeof(part->name));
+    end_update();
   }
 
+  loiter_partition = idx;
+
   if (lock_shm(F_UNLCK) < 0) {
     pr_trace_msg(trace_channel, 1,
       "error unlocking shm: %s", strerror(errno));
   }
 
+  pr_trace_msg(trace_channel, 9, "using partition %d ('%s') of shm ID %d",
+    idx, name, loiter_shmid);
   return 0;
 }
 
-int loiter_shm_incr(pool *p, int field_id, int incr) {
-  if (p == NULL) {
-    errno = EINVAL;
+/* Removes the segment for the given path, whether or not we are attached
+ * to it, and creates a new one in its place.  If preserve is TRUE, the data
+ * are carried over into the new segment; otherwise, only the counts of the
+ * connections still open are, since those sessions will take themselves
+ * out of the counts when they end.
+ *
+ * Sessions attached to the old segment are pointed at the new one, and
+ * follow it the next time they touch the shm; the old segment itself is
+ * destroyed by the kernel once the last such session detaches.
+ */
+static int migrate_shm(pool *p, const char *path, int preserve) {
+  int old_shmid, res, xerrno;
+  struct loiter_shm_data *old_data, *new_data;
+  key_t key;
+
+  if (p == NULL ||
+      path == NULL) {
+    errno = EINVAL;
     return -1;
   }
 
-  switch (field_id) {
-    case LOITER_FIELD_ID_CONN_COUNT:
-    case LOITER_FIELD_ID_AUTHD_COUNT:
-      break;
+  if (loiter_data == NULL) {
+    int shmid, have_hdr = FALSE;
+    struct loiter_shm_header hdr;
+
+    /* Not attached, most likely because the segment has a different layout,
+     * e.g. one left by an older version.  Only its header can be carried
+     * over; its connections were never counted by our sessions, which have
+     * no segment to follow, so their counts stay behind.
+     */
+    key = ftok(path, LOITER_SHM_PROJ_ID);
+    if (key == (key_t) -1) {
+      xerrno = errno;
 
-    default:
-      errno = EINVAL;
+      pr_trace_msg(trace_channel, 1,
+        "unable to get key for path '%s': %s", path, strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+
+    PRIVS_ROOT
+    shmid = shmget(key, 0, 0);
+    PRIVS_RELINQUISH
+
+    if (shmid >= 0) {
+      if (preserve == TRUE) {
+        if (read_header(shmid, &hdr) == 0) {
+          have_hdr = TRUE;
+
+        } else {
+          pr_trace_msg(trace_channel, 3,
+            "unable to read header of shm ID %d, not preserving: %s", shmid,
+            strerror(errno));
+        }
+      }
+
+      PRIVS_ROOT
+      res = shmctl(shmid, IPC_RMID, NULL);
+      xerrno = errno;
+      PRIVS_RELINQUISH
+
+      if (res < 0) {
+        pr_trace_msg(trace_channel, 1,
+          "error removing shm ID %d: %s", shmid, strerror(xerrno));
+        errno = xerrno;
+        return -1;
+      }
+
+      pr_trace_msg(trace_channel, 9, "removed shm ID %d", shmid);
+    }
+
+    if (loiter_datafh != NULL) {
+      (void) pr_fsio_close(loiter_datafh);
+      loiter_datafh = NULL;
+    }
+
+    if (loiter_shm_create(p, path) < 0) {
+      return -1;
+    }
+
+    if (have_hdr == TRUE) {
+      hdr.conn_count = hdr.authd_count = hdr.failed_count = 0;
+
+      if (lock_shm(F_WRLCK) < 0) {
+        pr_trace_msg(trace_channel, 1,
+          "error write-locking shm: %s", strerror(errno));
+      }
+
+      begin_update();
+      memcpy(&(loiter_data->hdr), &hdr, sizeof(struct loiter_shm_header));
+      end_update();
+
+      if (lock_shm(F_UNLCK) < 0) {
+        pr_trace_msg(trace_channel, 1,
+          "error unlocking shm: %s", strerror(errno));
+      }
+    }
+
+  } else {
+    if (lock_shm(F_WRLCK) < 0) {
+      xerrno = errno;
+
+      pr_trace_msg(trace_channel, 1,
+        "error write-locking shm: %s", strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+
+    /* Another daemon sharing the table may have migrated it already. */
+    if (follow_shm() < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error following migrated shm: %s", strerror(errno));
+    }
+
+    old_data = loiter_data;
+    old_shmid = loiter_shmid;
+
+    PRIVS_ROOT
+    res = shmctl(old_shmid, IPC_RMID, NULL);
+    xerrno = errno;
+    PRIVS_RELINQUISH
+
+    if (res < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error removing shm ID %d: %s", old_shmid, strerror(xerrno));
+      (void) lock_shm(F_UNLCK);
+
+      errno = xerrno;
+      return -1;
+    }
+
+    new_data = create_shm(loiter_datafh);
+    if (new_data == NULL) {
+      xerrno = errno;
+
+      /* We're still attached to the old (now removed) segment, and can keep
+       * using it until the last process detaches.
+       */
+      pr_trace_msg(trace_channel, 1,
+        "unable to allocate new shm: %s", strerror(xerrno));
+      loiter_shmid = old_shmid;
+      (void) lock_shm(F_UNLCK);
+
+      errno = xerrno;
       return -1;
+    }
+
+    if (preserve == TRUE) {
+      memcpy(new_data, old_data, offsetof(struct loiter_shm_data, migrated));
+
+    } else {
+      register unsigned int i;
+
+      new_data->hdr.conn_count = old_data->hdr.conn_count;
+      new_data->hdr.authd_count = old_data->hdr.authd_count;
+      new_data->hdr.failed_count = old_data->hdr.failed_count;
+
+      /* Daemons sharing the table keep using their partitions, and sessions
+       * their classes and slots.
+       */
+      memcpy(new_data->partitions, old_data->partitions,
+        sizeof(new_data->partitions));
+      for (i = 0; i < LOITER_SHM_MAX_PARTITIONS; i++) {
+        new_data->partitions[i].nejects = 0;
+      }
+
+      memcpy(new_data->classes, old_data->classes,
+        sizeof(new_data->classes));
+      for (i = 0; i < LOITER_SHM_MAX_CLASSES; i++) {
+        new_data->classes[i].nejects = 0;
+      }
+
+      memcpy(new_data->users, old_data->users, sizeof(new_data->users));
+      memcpy(new_data->slots, old_data->slots, sizeof(new_data->slots));
+      memcpy(new_data->slot_partitions, old_data->slot_partitions,
+        sizeof(new_data->slot_partitions));
+
+      /* And keep counting against their shadow rules, afresh. */
+      for (i = 0; i < LOITER_SHM_MAX_SHADOWS; i++) {
+        memcpy(new_data->shadows[i].name, old_data->shadows[i].name,
+          sizeof(new_data->shadows[i].name));
+      }
+    }
+
+    /* Lock-free sessions may look for next_shmid as soon as migrated is
+     * set.
+     */
+    old_data->next_shmid = loiter_shmid;
+#if defined(LOITER_HAVE_ATOMICS)
+    loiter_shm_barrier();
+#endif /* LOITER_HAVE_ATOMICS */
+    old_data->migrated = TRUE;
+    loiter_data = new_data;
+
+    if (detach_shm(old_data) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error detaching shm ID %d: %s", old_shmid, strerror(errno));
+    }
+
+    pr_trace_msg(trace_channel, 9, "migrated shm ID %d to shm ID %d (%s)",
+      old_shmid, loiter_shmid, preserve ? "preserved data" : "cleared data");
+
+    if (lock_shm(F_UNLCK) < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error unlocking shm: %s", strerror(errno));
+    }
   }
 
-  /* If given an increment of zero for any reason, do nothing. */
-  if (incr == 0) {
-    return 0;
+  if (loiter_partition_name[0] != '\0' &&
+      claim_partition(loiter_partition_name, FALSE) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error claiming partition '%s' of shm ID %d: %s", loiter_partition_name,
+      loiter_shmid, strerror(errno));
+  }
+
+  return 0;
+}
+
+int loiter_shm_remove(pool *p, const char *path) {
+  return migrate_shm(p, path, FALSE);
+}
+
+int loiter_shm_resize(pool *p, const char *path) {
+  return migrate_shm(p, path, TRUE);
+}
+
+int loiter_shm_set_partition(pool *p, const char *name) {
+  if (p == NULL ||
+      name == NULL ||
+      *name == '\0' ||
+      strlen(name) >= LOITER_SHM_PARTITION_NAMESZ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Remembered even if we are not attached, so that the partition can be
+   * claimed once the segment is replaced; see migrate_shm().
+   */
+  sstrncpy(loiter_partition_name, name, sizeof(loiter_partition_name));
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Whatever was counted for a previous incarnation of this daemon is long
+   * gone; take those stale counts out of the host totals.
+   */
+  return claim_partition(name, TRUE);
+}
+
+int loiter_shm_set_class(pool *p, const char *name, unsigned int reserve) {
+  register unsigned int i;
+  int idx = -1, unused_idx = -1;
+  struct loiter_shm_class *cls;
+
+  if (p == NULL ||
+      name == NULL ||
+      *name == '\0' ||
+      strlen(name) >= LOITER_SHM_PARTITION_NAMESZ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
   }
 
   if (lock_shm(F_WRLCK) < 0) {
@@ -471,14 +1351,116 @@ int loiter_shm_incr(pool *p, int field_id, int incr) {
       "error write-locking shm: %s", strerror(errno));
   }
 
-  switch (field_id) {
-    case LOITER_FIELD_ID_CONN_COUNT:
-      loiter_data->conn_count += incr;
-      break;
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
 
-    case LOITER_FIELD_ID_AUTHD_COUNT:
-      loiter_data->authd_count += incr;
+  for (i = 0; i < LOITER_SHM_MAX_CLASSES; i++) {
+    cls = &(loiter_data->classes[i]);
+
+    if (strcmp(cls->name, name) == 0) {
+      idx = i;
       break;
+    }
+
+    /* Prefer an unclaimed entry; failing that, one which no session is
+     * using any more, e.g. for a class since removed from the config.
+     */
+    if (cls->name[0] == '\0') {
+      if (idx < 0) {
+        idx = i;
+      }
+
+    } else if (unused_idx < 0 &&
+               cls->conn_count == 0) {
+      unused_idx = i;
+    }
+  }
+
+  if (idx < 0) {
+    idx = unused_idx;
+  }
+
+  if (idx < 0) {
+    (void) lock_shm(F_UNLCK);
+
+    pr_trace_msg(trace_channel, 1,
+      "no free class entry for '%s' (all %u in use)", name,
+      LOITER_SHM_MAX_CLASSES);
+    errno = ENOSPC;
+    return -1;
+  }
+
+  cls = &(loiter_data->classes[idx]);
+
+  begin_update();
+  if (strcmp(cls->name, name) != 0) {
+    memset(cls, 0, sizeof(struct loiter_shm_class));
+    sstrncpy(cls->name, name, sizeof(cls->name));
+  }
+
+  /* The latest configuration wins, e.g. after a restart. */
+  cls->reserve = reserve;
+  end_update();
+
+  loiter_class = idx;
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  pr_trace_msg(trace_channel, 9, "using class %d ('%s') of shm ID %d",
+    idx, name, loiter_shmid);
+  return 0;
+}
+
+int loiter_shm_get_classes(pool *p, struct loiter_shm_class_stats **classes,
+    unsigned int *nclasses) {
+  register unsigned int i;
+  struct loiter_shm_class_stats *stats;
+  unsigned int n = 0;
+
+  if (p == NULL ||
+      classes == NULL ||
+      nclasses == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  stats = pcalloc(p,
+    sizeof(struct loiter_shm_class_stats) * LOITER_SHM_MAX_CLASSES);
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  for (i = 0; i < LOITER_SHM_MAX_CLASSES; i++) {
+    struct loiter_shm_class *cls;
+
+    cls = &(loiter_data->classes[i]);
+    if (cls->name[0] == '\0') {
+      continue;
+    }
+
+    stats[n].name = pstrdup(p, cls->name);
+    stats[n].conn_count = cls->conn_count;
+    stats[n].authd_count = cls->authd_count;
+    stats[n].nejects = cls->nejects;
+    stats[n].reserve = cls->reserve;
+    n++;
   }
 
   if (lock_shm(F_UNLCK) < 0) {
@@ -486,5 +1468,1312 @@ int loiter_shm_incr(pool *p, int field_id, int incr) {
       "error unlocking shm: %s", strerror(errno));
   }
 
+  *classes = stats;
+  *nclasses = n;
   return 0;
 }
+
+int loiter_shm_set_shadow(pool *p, const char *name) {
+  register unsigned int i;
+  int idx = -1;
+  struct loiter_shm_shadow *shadow;
+
+  if (p == NULL ||
+      name == NULL ||
+      *name == '\0' ||
+      strlen(name) >= LOITER_SHM_PARTITION_NAMESZ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  for (i = 0; i < LOITER_SHM_MAX_SHADOWS; i++) {
+    shadow = &(loiter_data->shadows[i]);
+
+    if (strcmp(shadow->name, name) == 0) {
+      idx = i;
+      break;
+    }
+
+    if (idx < 0 &&
+        shadow->name[0] == '\0') {
+      idx = i;
+    }
+  }
+
+  if (idx < 0) {
+    (void) lock_shm(F_UNLCK);
+
+    pr_trace_msg(trace_channel, 1,
+      "no free shadow entry for '%s' (all %u in use)", name,
+      LOITER_SHM_MAX_SHADOWS);
+    errno = ENOSPC;
+    return -1;
+  }
+
+  shadow = &(loiter_data->shadows[idx]);
+
+  if (strcmp(shadow->name, name) != 0) {
+    begin_update();
+    memset(shadow, 0, sizeof(struct loiter_shm_shadow));
+    sstrncpy(shadow->name, name, sizeof(shadow->name));
+    end_update();
+  }
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  pr_trace_msg(trace_channel, 9, "using shadow %d ('%s') of shm ID %d",
+    idx, name, loiter_shmid);
+  return idx;
+}
+
+int loiter_shm_shadow_incr(pool *p, int idx, int would_drop, int dropped) {
+  struct loiter_shm_shadow *shadow;
+
+  if (p == NULL ||
+      idx < 0 ||
+      idx >= LOITER_SHM_MAX_SHADOWS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  shadow = &(loiter_data->shadows[idx]);
+
+#if defined(LOITER_HAVE_ATOMICS)
+  (void) __sync_fetch_and_add(&(shadow->nevals), 1);
+
+  if (would_drop == TRUE) {
+    (void) __sync_fetch_and_add(&(shadow->ndrops), 1);
+
+    if (dropped == FALSE) {
+      (void) __sync_fetch_and_add(&(shadow->nextra), 1);
+    }
+
+  } else if (dropped == TRUE) {
+    (void) __sync_fetch_and_add(&(shadow->nspared), 1);
+  }
+#else
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  shadow->nevals++;
+
+  if (would_drop == TRUE) {
+    shadow->ndrops++;
+
+    if (dropped == FALSE) {
+      shadow->nextra++;
+    }
+
+  } else if (dropped == TRUE) {
+    shadow->nspared++;
+  }
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  return 0;
+}
+
+int loiter_shm_get_shadows(pool *p, struct loiter_shm_shadow_stats **shadows,
+    unsigned int *nshadows) {
+  register unsigned int i;
+  struct loiter_shm_shadow_stats *stats;
+  unsigned int n = 0;
+
+  if (p == NULL ||
+      shadows == NULL ||
+      nshadows == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  stats = pcalloc(p,
+    sizeof(struct loiter_shm_shadow_stats) * LOITER_SHM_MAX_SHADOWS);
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  for (i = 0; i < LOITER_SHM_MAX_SHADOWS; i++) {
+    struct loiter_shm_shadow *shadow;
+
+    shadow = &(loiter_data->shadows[i]);
+    if (shadow->name[0] == '\0') {
+      continue;
+    }
+
+    stats[n].name = pstrdup(p, shadow->name);
+    stats[n].nevals = shadow->nevals;
+    stats[n].ndrops = shadow->ndrops;
+    stats[n].nextra = shadow->nextra;
+    stats[n].nspared = shadow->nspared;
+    n++;
+  }
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  *shadows = stats;
+  *nshadows = n;
+  return 0;
+}
+
+int loiter_shm_get(pool *p, unsigned int *conn_count,
+    unsigned int *authd_count) {
+  struct loiter_shm_stats stats;
+
+  if (p == NULL ||
+      (conn_count == NULL && authd_count == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_shm_get_stats(p, &stats) < 0) {
+    return -1;
+  }
+
+  if (conn_count != NULL) {
+    *conn_count = stats.conn_count;
+  }
+
+  if (authd_count != NULL) {
+    *authd_count = stats.authd_count;
+  }
+
+  return 0;
+}
+
+int loiter_shm_get_lock_stats(pool *p, struct loiter_shm_lock_stats *stats) {
+  if (p == NULL ||
+      stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memcpy(stats, &loiter_lock_stats, sizeof(struct loiter_shm_lock_stats));
+  return 0;
+}
+
+int loiter_shm_timing_add(pool *p, int timing_id, uint64_t nsecs) {
+  if (p == NULL ||
+      timing_id < 0 ||
+      timing_id >= LOITER_SHM_NTIMINGS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+#if defined(LOITER_HAVE_ATOMICS)
+  loiter_histogram_add(&(loiter_data->timings[timing_id]), nsecs);
+#else
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  loiter_histogram_add(&(loiter_data->timings[timing_id]), nsecs);
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  return 0;
+}
+
+int loiter_shm_get_timing(pool *p, int timing_id,
+    struct loiter_histogram *hist) {
+  if (p == NULL ||
+      timing_id < 0 ||
+      timing_id >= LOITER_SHM_NTIMINGS ||
+      hist == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  /* Sessions may be adding to it as we copy; close enough for reporting. */
+  memcpy(hist, &(loiter_data->timings[timing_id]),
+    sizeof(struct loiter_histogram));
+  return 0;
+}
+
+const char *loiter_shm_get_timing_name(int timing_id) {
+  const char *name = NULL;
+
+  switch (timing_id) {
+    case LOITER_SHM_TIMING_SESS_INIT:
+      name = "sess_init";
+      break;
+
+    case LOITER_SHM_TIMING_SHM_LOCK:
+      name = "shm_lock";
+      break;
+
+    case LOITER_SHM_TIMING_SHM_READ:
+      name = "shm_read";
+      break;
+
+    case LOITER_SHM_TIMING_SHM_WRITE:
+      name = "shm_write";
+      break;
+
+    case LOITER_SHM_TIMING_POLICY:
+      name = "policy";
+      break;
+
+    case LOITER_SHM_TIMING_LOG:
+      name = "log";
+      break;
+
+    default:
+      errno = EINVAL;
+      break;
+  }
+
+  return name;
+}
+
+int loiter_shm_get_stats(pool *p, struct loiter_shm_stats *stats) {
+  if (p == NULL ||
+      stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  copy_stats(stats);
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  return 0;
+}
+
+int loiter_shm_get_snapshot(pool *p, struct loiter_shm_stats *stats) {
+#if defined(LOITER_HAVE_ATOMICS)
+  register unsigned int i;
+#endif /* LOITER_HAVE_ATOMICS */
+
+  if (p == NULL ||
+      stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+#if defined(LOITER_HAVE_ATOMICS)
+  /* Should the segment be migrated as we read, fall back to the lock. */
+  for (i = 0; i < LOITER_SHM_SNAPSHOT_MAX_ATTEMPTS &&
+      loiter_data->migrated == FALSE; i++) {
+    unsigned int seqno;
+
+    seqno = loiter_data->seqno;
+    loiter_shm_barrier();
+
+    if (seqno % 2 != 0) {
+      /* Update in progress. */
+      continue;
+    }
+
+    copy_stats(stats);
+    loiter_shm_barrier();
+
+    if (loiter_data->seqno == seqno) {
+      return 0;
+    }
+  }
+
+  pr_trace_msg(trace_channel, 9,
+    "unable to take lock-free snapshot after %u attempts, using lock", i);
+#endif /* LOITER_HAVE_ATOMICS */
+
+  return loiter_shm_get_stats(p, stats);
+}
+
+int loiter_shm_set_rules(pool *p, unsigned int low, unsigned int high,
+    unsigned int rate) {
+  if (p == NULL ||
+      rate > 100) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  begin_update();
+  loiter_data->hdr.rules_low = low;
+  loiter_data->hdr.rules_high = high;
+  loiter_data->hdr.rules_rate = rate;
+  end_update();
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  return 0;
+}
+
+int loiter_shm_set_cluster(pool *p, unsigned int unauthd_count,
+    unsigned int npeers) {
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  begin_update();
+  loiter_data->hdr.cluster_unauthd_count = unauthd_count;
+  loiter_data->hdr.cluster_npeers = npeers;
+  end_update();
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  return 0;
+}
+
+int loiter_shm_set_pressure(pool *p, unsigned int pressure) {
+  if (p == NULL ||
+      pressure > 100) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  loiter_data->hdr.pressure = pressure;
+  return 0;
+}
+
+unsigned int loiter_shm_get_pressure(pool *p) {
+  if (p == NULL ||
+      loiter_data == NULL) {
+    return 0;
+  }
+
+  (void) follow_shm();
+
+  return loiter_data->hdr.pressure;
+}
+
+int loiter_shm_set_control(pool *p, unsigned int drop_pct) {
+  if (p == NULL ||
+      drop_pct > 100) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  loiter_data->hdr.control_pct = drop_pct;
+  return 0;
+}
+
+unsigned int loiter_shm_get_control(pool *p) {
+  if (p == NULL ||
+      loiter_data == NULL) {
+    return 0;
+  }
+
+  (void) follow_shm();
+
+  return loiter_data->hdr.control_pct;
+}
+
+unsigned int loiter_shm_next_session(pool *p) {
+  unsigned int seq;
+
+  if (p == NULL ||
+      loiter_data == NULL) {
+    return 0;
+  }
+
+  (void) follow_shm();
+
+#if defined(LOITER_HAVE_ATOMICS)
+  seq = __sync_fetch_and_add(&(loiter_data->hdr.session_seq), 1);
+#else
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  seq = loiter_data->hdr.session_seq++;
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  return seq;
+}
+
+int loiter_shm_incr(pool *p, int field_id, int incr) {
+  unsigned int *field = NULL;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  switch (field_id) {
+    case LOITER_FIELD_ID_CONN_COUNT:
+    case LOITER_FIELD_ID_AUTHD_COUNT:
+    case LOITER_FIELD_ID_NEJECTS:
+    case LOITER_FIELD_ID_FAILED_COUNT:
+      break;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  /* If given an increment of zero for any reason, do nothing. */
+  if (incr == 0) {
+    return 0;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  begin_update();
+
+  field = get_field(&(loiter_data->hdr.conn_count),
+    &(loiter_data->hdr.authd_count), &(loiter_data->hdr.nejects),
+    &(loiter_data->hdr.failed_count), field_id);
+  incr_field(field, incr);
+
+  if (loiter_partition >= 0) {
+    struct loiter_shm_partition *part;
+
+    part = &(loiter_data->partitions[loiter_partition]);
+    field = get_field(&(part->conn_count), &(part->authd_count),
+      &(part->nejects), &(part->failed_count), field_id);
+    incr_field(field, incr);
+  }
+
+  /* Failed logins are not counted per class. */
+  if (loiter_class >= 0 &&
+      field_id != LOITER_FIELD_ID_FAILED_COUNT) {
+    struct loiter_shm_class *cls;
+
+    cls = &(loiter_data->classes[loiter_class]);
+    field = get_field(&(cls->conn_count), &(cls->authd_count),
+      &(cls->nejects), NULL, field_id);
+    incr_field(field, incr);
+  }
+
+  end_update();
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  return 0;
+}
+
+static uint64_t get_reputation_entry(uint64_t key, time_t now) {
+  uint64_t tag;
+
+  /* Never let a tag be zero, so that zero can mean an empty entry. */
+  tag = (key >> 32) | 1;
+  return (tag << 32) | (uint32_t) now;
+}
+
+int loiter_shm_reputation_add(pool *p, uint64_t key, time_t now) {
+  volatile uint64_t *entry;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  entry = &(loiter_data->reputation[key % LOITER_SHM_REPUTATION_SIZE]);
+  *entry = get_reputation_entry(key, now);
+
+  return 0;
+}
+
+int loiter_shm_reputation_check(pool *p, uint64_t key, time_t now,
+    unsigned int ttl) {
+  uint64_t entry, expected;
+  uint32_t last_seen;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  entry = ((volatile uint64_t *) loiter_data->reputation)[
+    key % LOITER_SHM_REPUTATION_SIZE];
+  expected = get_reputation_entry(key, now);
+
+  if ((entry >> 32) != (expected >> 32)) {
+    /* Never seen, or evicted by another source. */
+    return FALSE;
+  }
+
+  last_seen = (uint32_t) entry;
+  if ((uint32_t) now - last_seen > ttl) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+int loiter_shm_sketch_add(pool *p, const struct loiter_shm_source *src,
+    uint32_t window, unsigned int *count, unsigned int *prefix_count) {
+  unsigned int src_count, src_prefix_count;
+
+  if (p == NULL ||
+      src == NULL ||
+      src->name == NULL ||
+      src->prefix_name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  if (follow_shm() < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error following migrated shm: %s", strerror(errno));
+  }
+
+  src_count = loiter_sketch_add(&(loiter_data->sources), window, src->key,
+    src->name);
+  src_prefix_count = loiter_sketch_add(&(loiter_data->prefixes), window,
+    src->prefix_key, src->prefix_name);
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  if (count != NULL) {
+    *count = src_count;
+  }
+
+  if (prefix_count != NULL) {
+    *prefix_count = src_prefix_count;
+  }
+
+  return 0;
+}
+
+int loiter_shm_sketch_get_top(pool *p, struct loiter_sketch_heavy *top,
+    struct loiter_sketch_heavy *prefix_top) {
+  if (p == NULL ||
+      top == NULL ||
+      prefix_top == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  if (lock_shm(F_RDLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error read-locking shm: %s", strerror(errno));
+  }
+
+  memcpy(top, loiter_data->sources.top,
+    sizeof(struct loiter_sketch_heavy) * LOITER_SKETCH_TOPK);
+  memcpy(prefix_top, loiter_data->prefixes.top,
+    sizeof(struct loiter_sketch_heavy) * LOITER_SKETCH_TOPK);
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+
+  return 0;
+}
+
+int loiter_shm_distinct_add(pool *p, uint64_t key, uint32_t window) {
+  struct loiter_hll *hll;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  hll = &(loiter_data->distinct[window % 2]);
+
+  if (hll->window != window) {
+    /* The first connection of a new window starts its estimate afresh. */
+    if (lock_shm(F_WRLCK) < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error write-locking shm: %s", strerror(errno));
+    }
+
+    if (follow_shm() < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error following migrated shm: %s", strerror(errno));
+    }
+
+    hll = &(loiter_data->distinct[window % 2]);
+    if (hll->window != window) {
+      const struct loiter_hll *prev_hll;
+
+      /* Keep the final estimate of the previous window, for the stats. */
+      prev_hll = &(loiter_data->distinct[(window - 1) % 2]);
+
+      begin_update();
+      if (prev_hll->window == window - 1) {
+        loiter_data->distinct_prev_sources = loiter_hll_estimate(prev_hll);
+        loiter_data->distinct_prev_conns = prev_hll->nkeys;
+
+      } else {
+        loiter_data->distinct_prev_sources = 0;
+        loiter_data->distinct_prev_conns = 0;
+      }
+
+      loiter_hll_clear(hll, window);
+      end_update();
+    }
+
+    if (lock_shm(F_UNLCK) < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error unlocking shm: %s", strerror(errno));
+    }
+  }
+
+#if defined(LOITER_HAVE_ATOMICS)
+  loiter_hll_add(hll, key);
+#else
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+
+  loiter_hll_add(hll, key);
+
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  return 0;
+}
+
+int loiter_shm_distinct_get(pool *p, uint32_t window, unsigned int *count,
+    unsigned int *nconns) {
+  const struct loiter_hll *hll;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  /* Estimates are approximate anyway, so read without the lock. */
+  hll = &(loiter_data->distinct[window % 2]);
+  if (count != NULL) {
+    *count = hll->window == window ? loiter_hll_estimate(hll) : 0;
+  }
+
+  if (nconns != NULL) {
+    *nconns = hll->window == window ? hll->nkeys : 0;
+  }
+
+  return 0;
+}
+
+int loiter_shm_bucket_take(pool *p, const struct loiter_shm_source *src,
+    int prefix, unsigned int rate, unsigned int burst) {
+  int res, xerrno;
+  uint64_t key, *bucket;
+  uint32_t now_ms;
+
+  if (p == NULL ||
+      src == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  /* Not the wall clock, which may be stepped; see loiter_monotonic_now(). */
+  now_ms = (uint32_t) (loiter_monotonic_now() / 1000000);
+
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  if (prefix == TRUE) {
+    key = src->prefix_key;
+    bucket = &(loiter_data->prefix_buckets[key % LOITER_SHM_BUCKETS_SIZE]);
+
+  } else {
+    key = src->key;
+    bucket = &(loiter_data->buckets[key % LOITER_SHM_BUCKETS_SIZE]);
+  }
+
+  res = loiter_bucket_take(bucket, key, now_ms, rate, burst);
+  xerrno = errno;
+
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  errno = xerrno;
+  return res;
+}
+
+static int incr_counter(pool *p, uint64_t *counters,
+    const struct loiter_shm_source *src, unsigned int window) {
+  int res, xerrno;
+  uint64_t *counter;
+
+  if (p == NULL ||
+      src == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  counter = &(counters[src->key % LOITER_SHM_BUCKETS_SIZE]);
+  res = loiter_counter_incr(counter, src->key, (uint32_t) time(NULL), window);
+  xerrno = errno;
+
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  errno = xerrno;
+  return res;
+}
+
+int loiter_shm_offender_incr(pool *p, const struct loiter_shm_source *src,
+    unsigned int window) {
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  return incr_counter(p, loiter_data->offenders, src, window);
+}
+
+int loiter_shm_failure_incr(pool *p, const struct loiter_shm_source *src,
+    unsigned int window) {
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  return incr_counter(p, loiter_data->failures, src, window);
+}
+
+int loiter_shm_failure_get(pool *p, const struct loiter_shm_source *src,
+    unsigned int window) {
+  if (p == NULL ||
+      src == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  /* Approximate anyway, so read without the lock. */
+  return (int) loiter_counter_get(
+    &(loiter_data->failures[src->key % LOITER_SHM_BUCKETS_SIZE]), src->key,
+    (uint32_t) time(NULL), window);
+}
+
+int loiter_shm_user_incr(pool *p, uint64_t key, int incr) {
+  unsigned int *count, prev, next;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  count = &(loiter_data->users[key % LOITER_SHM_USERS_SIZE]);
+
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(F_WRLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error write-locking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  while (TRUE) {
+    prev = *((volatile unsigned int *) count);
+
+    /* The counts may have been cleared underneath us, e.g. by
+     * 'ftpdctl loiter shm remove'; don't let them wrap around.
+     */
+    if (incr < 0 &&
+        prev < (unsigned int) -incr) {
+      next = 0;
+
+    } else {
+      next = prev + incr;
+    }
+
+    if (cas_count(count, prev, next) == TRUE) {
+      break;
+    }
+  }
+
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(F_UNLCK) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error unlocking shm: %s", strerror(errno));
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+
+  return (int) next;
+}
+
+/* A slot whose time is zero has been asked to shed its session. */
+static uint64_t pack_slot(pid_t pid, uint32_t last_active) {
+  return ((uint64_t) (uint32_t) pid << 32) | last_active;
+}
+
+static void lock_slots(int lock_type) {
+#if !defined(LOITER_HAVE_ATOMICS)
+  if (lock_shm(lock_type) < 0) {
+    pr_trace_msg(trace_channel, 1,
+      "error %s shm: %s", lock_type == F_UNLCK ? "unlocking" : "locking",
+      strerror(errno));
+  }
+#else
+  (void) lock_type;
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+int loiter_shm_slot_claim(pool *p, pid_t pid) {
+  register unsigned int i;
+  int idx = -1;
+  uint64_t next;
+
+  if (p == NULL ||
+      pid <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  next = pack_slot(pid, (uint32_t) time(NULL));
+
+  lock_slots(F_WRLCK);
+  for (i = 0; i < LOITER_SHM_SLOTS_SIZE; i++) {
+    unsigned int j;
+
+    j = (pid + i) % LOITER_SHM_SLOTS_SIZE;
+    if (loiter_data->slots[j] == 0 &&
+        cas_slot(&(loiter_data->slots[j]), 0, next) == TRUE) {
+      loiter_data->slot_partitions[j] = (unsigned char) (loiter_partition + 1);
+      idx = (int) j;
+      break;
+    }
+  }
+  lock_slots(F_UNLCK);
+
+  if (idx < 0) {
+    errno = ENOSPC;
+  }
+
+  return idx;
+}
+
+int loiter_shm_slot_touch(pool *p, int idx, pid_t pid) {
+  uint64_t prev;
+
+  if (p == NULL ||
+      idx < 0 ||
+      idx >= LOITER_SHM_SLOTS_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  lock_slots(F_WRLCK);
+  prev = *((volatile uint64_t *) &(loiter_data->slots[idx]));
+  if ((pid_t) (prev >> 32) == pid) {
+    /* If another session asked us to shed in the meantime, our being
+     * active since then means we should not.
+     */
+    (void) cas_slot(&(loiter_data->slots[idx]), prev,
+      pack_slot(pid, (uint32_t) time(NULL)));
+  }
+  lock_slots(F_UNLCK);
+
+  return 0;
+}
+
+int loiter_shm_slot_release(pool *p, int idx, pid_t pid) {
+  uint64_t prev;
+
+  if (p == NULL ||
+      idx < 0 ||
+      idx >= LOITER_SHM_SLOTS_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  lock_slots(F_WRLCK);
+  prev = *((volatile uint64_t *) &(loiter_data->slots[idx]));
+  if ((pid_t) (prev >> 32) == pid) {
+    (void) cas_slot(&(loiter_data->slots[idx]), prev, 0);
+  }
+  lock_slots(F_UNLCK);
+
+  return 0;
+}
+
+int loiter_shm_slot_is_shed(pool *p, int idx, pid_t pid) {
+  uint64_t val;
+
+  if (p == NULL ||
+      idx < 0 ||
+      idx >= LOITER_SHM_SLOTS_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  val = *((volatile uint64_t *) &(loiter_data->slots[idx]));
+  if ((pid_t) (val >> 32) != pid) {
+    return FALSE;
+  }
+
+  return (uint32_t) val == 0 ? TRUE : FALSE;
+}
+
+int loiter_shm_slot_shed_idlest(pool *p, unsigned int min_idle,
+    pid_t *pid, unsigned int *idle) {
+  register unsigned int i;
+  uint32_t now;
+  int idx = -1;
+
+  if (p == NULL ||
+      pid == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (loiter_data == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  (void) follow_shm();
+
+  now = (uint32_t) time(NULL);
+
+  lock_slots(F_WRLCK);
+
+  /* Try the idlest sessions first, until one is marked for shedding; a
+   * competing session may mark the idlest one first.
+   */
+  while (idx < 0) {
+    int idlest = -1;
+    uint64_t prev = 0;
+    uint32_t max_idle = 0;
+
+    for (i = 0; i < LOITER_SHM_SLOTS_SIZE; i++) {
+      uint64_t val;
+      uint32_t last_active;
+
+      val = *((volatile uint64_t *) &(loiter_data->slots[i]));
+      last_active = (uint32_t) val;
+
+      /* Only our own daemon's sessions count against its MaxInstances. */
+      if (val == 0 ||
+          loiter_data->slot_partitions[i] != loiter_partition + 1) {
+        continue;
+      }
+
+      if (last_active == 0) {
+        /* A session asked to shed either does so, or is active and clears
+         * the mark, promptly.  Otherwise, it died without releasing its
+         * slot.
+         */
+        if (now - loiter_data->slot_marked[i] >=
+            LOITER_SHM_SLOT_SHED_TIMEOUT &&
+            cas_slot(&(loiter_data->slots[i]), val, 0) == TRUE) {
+          pr_trace_msg(trace_channel, 5,
+            "cleared slot %u of PID %lu, asked to shed %lu secs ago", i,
+            (unsigned long) (val >> 32),
+            (unsigned long) (now - loiter_data->slot_marked[i]));
+        }
+
+        continue;
+      }
+
+      if (now - last_active < min_idle) {
+        continue;
+      }
+
+      if (idlest < 0 ||
+          now - last_active > max_idle) {
+        idlest = (int) i;
+        prev = val;
+        max_idle = now - last_active;
+      }
+    }
+
+    if (idlest < 0) {
+      break;
+    }
+
+    /* Set before marking, so that the mark is never taken to be stale. */
+    loiter_data->slot_marked[idlest] = now;
+
+    if (cas_slot(&(loiter_data->slots[idlest]), prev,
+        pack_slot((pid_t) (prev >> 32), 0)) == TRUE) {
+      idx = idlest;
+      *pid = (pid_t) (prev >> 32);
+
+      if (idle != NULL) {
+        *idle = max_idle;
+      }
+    }
+  }
+
+  lock_slots(F_UNLCK);
+
+  if (idx < 0) {
+    errno = ENOENT;
+  }
+
+  return idx;
+}
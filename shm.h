@@ -26,15 +26,340 @@
 #define MOD_LOITER_SHM_H
 
 #include "mod_loiter.h"
+#include "sketch.h"
 
 int loiter_shm_create(pool *p, const char *path);
 int loiter_shm_destroy(pool *p);
 
+/* Several daemons on the same host may share one LoiterTable, each counting
+ * its own connections in a named partition; the host-wide totals are kept
+ * alongside.  Claims the partition of the given name (reusing it if it
+ * already exists, e.g. after a daemon restart), for this process and the
+ * sessions it forks.  Fails with EPERM if there is no segment, but the name
+ * is noted, and claimed by loiter_shm_remove() and loiter_shm_resize().
+ */
+#define LOITER_SHM_MAX_PARTITIONS		16
+#define LOITER_SHM_PARTITION_NAMESZ		32
+
+int loiter_shm_set_partition(pool *p, const char *name);
+
+/* Sessions of a <Class> with LoiterClassRules are also counted against
+ * that class, across all daemons sharing the table.  Claims the entry for
+ * the named class, recording the connections reserved for it, for this
+ * session.
+ */
+#define LOITER_SHM_MAX_CLASSES			16
+
+int loiter_shm_set_class(pool *p, const char *name, unsigned int reserve);
+
+struct loiter_shm_class_stats {
+  const char *name;
+  unsigned int conn_count;
+  unsigned int authd_count;
+  unsigned int nejects;
+  unsigned int reserve;
+};
+
+/* Provide the counts for each class in use, allocated from the given pool. */
+int loiter_shm_get_classes(pool *p, struct loiter_shm_class_stats **classes,
+  unsigned int *nclasses);
+
+/* Each LoiterShadowRules candidate counts the decisions it would have made,
+ * across all daemons sharing the table.  Claims the entry for the named
+ * rules, returning its index, for this session to count against.
+ */
+#define LOITER_SHM_MAX_SHADOWS			8
+
+int loiter_shm_set_shadow(pool *p, const char *name);
+
+/* Count a decision of the shadow rules in the given entry: whether those
+ * rules would have dropped the connection, and whether the active rules
+ * did.  This does not take the shm lock.
+ */
+int loiter_shm_shadow_incr(pool *p, int idx, int would_drop, int dropped);
+
+struct loiter_shm_shadow_stats {
+  const char *name;
+  unsigned int nevals;
+  unsigned int ndrops;
+  unsigned int nextra;
+  unsigned int nspared;
+};
+
+/* Provide the counts for each shadow in use, allocated from the given
+ * pool.
+ */
+int loiter_shm_get_shadows(pool *p, struct loiter_shm_shadow_stats **shadows,
+  unsigned int *nshadows);
+
+/* Replace the segment for the given path with a new one, either clearing
+ * (remove) or preserving (resize) the existing data; the counts of open
+ * connections are kept either way.  If we were not attached to the existing
+ * segment, e.g. because its layout differs, only its header is preserved.
+ * Sessions attached to the old segment move to the new one, and our
+ * partition, if any, is claimed again.
+ */
+int loiter_shm_remove(pool *p, const char *path);
+int loiter_shm_resize(pool *p, const char *path);
+
 #define LOITER_FIELD_ID_CONN_COUNT			1
 #define LOITER_FIELD_ID_AUTHD_COUNT			2
+#define LOITER_FIELD_ID_NEJECTS				3
+#define LOITER_FIELD_ID_FAILED_COUNT			4
+
+struct loiter_shm_stats {
+  /* The counts for our partition, if any; otherwise, the host-wide counts. */
+  unsigned int conn_count;
+  unsigned int authd_count;
+  unsigned int nejects;
+
+  /* The weighted failed logins of unauthenticated connections; see
+   * LoiterAuthFailures.
+   */
+  unsigned int failed_count;
+
+  /* The host-wide counts, across all partitions. */
+  unsigned int host_conn_count;
+  unsigned int host_authd_count;
+  unsigned int host_nejects;
+  unsigned int host_failed_count;
+  unsigned int host_npartitions;
+
+  /* Rules set at runtime; zero values are not set. */
+  unsigned int rules_low;
+  unsigned int rules_high;
+  unsigned int rules_rate;
+
+  /* Unauthenticated connections on the other nodes of the cluster. */
+  unsigned int cluster_unauthd_count;
+  unsigned int cluster_npeers;
+
+  /* Estimated distinct sources, and connections, in the last complete
+   * LoiterDistinctSources window.
+   */
+  unsigned int distinct_sources;
+  unsigned int distinct_conns;
+
+  /* The last sampled system pressure, as a percentage. */
+  unsigned int pressure;
+
+  /* The drop probability last computed by the LoiterController. */
+  unsigned int control_pct;
+
+  /* The counts for our class, if any, and the connections reserved for
+   * it.
+   */
+  unsigned int class_conn_count;
+  unsigned int class_authd_count;
+  unsigned int class_nejects;
+  unsigned int class_reserve;
+
+  /* The connections reserved across all classes, and the unauthenticated
+   * connections currently using those reservations.
+   */
+  unsigned int reserve_total;
+  unsigned int reserve_used;
+
+  /* Across all processes: how many times the shm lock was held by another
+   * process, so that it had to be retried, or was given up on, and the time
+   * spent backing off before retrying, in nsecs.
+   */
+  unsigned int lock_nretries;
+  unsigned int lock_nfailures;
+  uint64_t lock_backoff_nsecs;
+};
 
 int loiter_shm_get(pool *p, unsigned int *conn_count,
   unsigned int *authd_count);
+int loiter_shm_get_stats(pool *p, struct loiter_shm_stats *stats);
+
+/* Like loiter_shm_get_stats(), but without taking the shm lock, so as not
+ * to contend with sessions updating the counts.
+ */
+int loiter_shm_get_snapshot(pool *p, struct loiter_shm_stats *stats);
 int loiter_shm_incr(pool *p, int field_id, int incr);
 
+/* Locks of the shm taken by this process, how many times another process
+ * held the lock, so that it had to be retried, and how many times it was
+ * given up on after too many retries.
+ */
+struct loiter_shm_lock_stats {
+  unsigned long nlocks;
+  unsigned long nretries;
+  unsigned long nfailures;
+
+  /* Time spent taking the lock, including any backing off, in nsecs. */
+  uint64_t wait_nsecs;
+  uint64_t backoff_nsecs;
+};
+
+int loiter_shm_get_lock_stats(pool *p, struct loiter_shm_lock_stats *stats);
+
+/* Latencies of session setup, by part; see loiter_sess_init(). */
+#define LOITER_SHM_TIMING_SESS_INIT		0
+#define LOITER_SHM_TIMING_SHM_LOCK		1
+#define LOITER_SHM_TIMING_SHM_READ		2
+#define LOITER_SHM_TIMING_SHM_WRITE		3
+#define LOITER_SHM_TIMING_POLICY		4
+#define LOITER_SHM_TIMING_LOG			5
+#define LOITER_SHM_NTIMINGS			6
+
+/* Record the given latency, in nsecs, without taking the lock. */
+int loiter_shm_timing_add(pool *p, int timing_id, uint64_t nsecs);
+int loiter_shm_get_timing(pool *p, int timing_id,
+  struct loiter_histogram *hist);
+const char *loiter_shm_get_timing_name(int timing_id);
+
+/* Set the runtime rules, overriding any configured LoiterRules.  Zero values
+ * revert to the configured values.
+ */
+int loiter_shm_set_rules(pool *p, unsigned int low, unsigned int high,
+  unsigned int rate);
+
+/* Record the sum of unauthenticated connections across the other nodes of
+ * the cluster, as gathered by the agent process.
+ */
+int loiter_shm_set_cluster(pool *p, unsigned int unauthd_count,
+  unsigned int npeers);
+
+/* Publish the system pressure, as sampled by the daemon; see LoiterPressure.
+ * Sessions read it without taking the shm lock.
+ */
+int loiter_shm_set_pressure(pool *p, unsigned int pressure);
+unsigned int loiter_shm_get_pressure(pool *p);
+
+/* Publish the drop probability computed by the daemon's LoiterController,
+ * for sessions to read without taking the shm lock.
+ */
+int loiter_shm_set_control(pool *p, unsigned int drop_pct);
+unsigned int loiter_shm_get_control(pool *p);
+
+/* Returns the sequence number of a new session, counting from zero since the
+ * table was created.
+ */
+unsigned int loiter_shm_next_session(pool *p);
+
+/* Recently authenticated sources, keyed by a hash of the source address.
+ * The cache is direct-mapped, so both recording and checking a source are
+ * O(1), and neither takes the shm lock; a colliding source simply evicts
+ * the older entry.
+ */
+#define LOITER_SHM_REPUTATION_SIZE		4096
+
+int loiter_shm_reputation_add(pool *p, uint64_t key, time_t now);
+
+/* Returns TRUE if the given source authenticated within the last ttl
+ * seconds, FALSE otherwise.
+ */
+int loiter_shm_reputation_check(pool *p, uint64_t key, time_t now,
+  unsigned int ttl);
+
+/* A connecting source, and the prefix (e.g. /24) containing it. */
+struct loiter_shm_source {
+  uint64_t key;
+  const char *name;
+
+  uint64_t prefix_key;
+  const char *prefix_name;
+};
+
+/* Count a connection from the given source in the heavy hitter sketches,
+ * and get the estimated counts, for the current window, of connections from
+ * that source and its prefix.
+ */
+int loiter_shm_sketch_add(pool *p, const struct loiter_shm_source *src,
+  uint32_t window, unsigned int *count, unsigned int *prefix_count);
+
+/* Copy out the heaviest sources and prefixes; each array must hold
+ * LOITER_SKETCH_TOPK entries.
+ */
+int loiter_shm_sketch_get_top(pool *p, struct loiter_sketch_heavy *top,
+  struct loiter_sketch_heavy *prefix_top);
+
+/* Count a connection from the given source in the current window's
+ * distinct source estimate; see LoiterDistinctSources.  This does not take
+ * the shm lock, except once per window to start a new estimate.
+ */
+int loiter_shm_distinct_add(pool *p, uint64_t key, uint32_t window);
+
+/* Get the estimated number of distinct sources, and the number of
+ * connections, so far in the given window.
+ */
+int loiter_shm_distinct_get(pool *p, uint32_t window, unsigned int *count,
+  unsigned int *nconns);
+
+/* Take a token from the rate limiting bucket for the given source (or, if
+ * prefix is TRUE, its prefix); see LoiterRateLimit.  Returns TRUE if the
+ * connection is within its rate, FALSE if not.  The buckets are direct-mapped,
+ * and updated without the shm lock where supported.
+ */
+#define LOITER_SHM_BUCKETS_SIZE			4096
+
+int loiter_shm_bucket_take(pool *p, const struct loiter_shm_source *src,
+  int prefix, unsigned int rate, unsigned int burst);
+
+/* Count a dropped connection from the given source, and return the number
+ * of its connections dropped within the last window secs; see LoiterBan.
+ * Like the buckets, the counts are direct-mapped, so a colliding source
+ * may reset another's count.
+ */
+int loiter_shm_offender_incr(pool *p, const struct loiter_shm_source *src,
+  unsigned int window);
+
+/* Count a failed login from the given source, and return the number of its
+ * failed logins within the last window secs; see LoiterAuthFailures.  The
+ * counts are kept like those of the dropped connections.
+ */
+int loiter_shm_failure_incr(pool *p, const struct loiter_shm_source *src,
+  unsigned int window);
+
+/* Returns the number of failed logins from the given source within the
+ * last window secs, without counting another.
+ */
+int loiter_shm_failure_get(pool *p, const struct loiter_shm_source *src,
+  unsigned int window);
+
+/* Add the given increment (or decrement) to the count of unauthenticated
+ * connections attempting the user name with the given key, and return the new
+ * count; see LoiterUserRules.  Names whose keys collide share a count, so
+ * that a count may be over-, but never under-estimated.
+ */
+#define LOITER_SHM_USERS_SIZE			4096
+
+int loiter_shm_user_incr(pool *p, uint64_t key, int incr);
+
+/* Slots for authenticated sessions, tracking their last activity; see
+ * LoiterIdleSessions.  A session claims a slot once authenticated, touches
+ * it for each command, and releases it on exit.  The slots are updated
+ * without the shm lock where supported.
+ */
+#define LOITER_SHM_SLOTS_SIZE			4096
+
+/* How long, in secs, a session asked to shed has to do so, or to clear the
+ * mark by being active, before its slot is taken to be stale, and cleared.
+ */
+#define LOITER_SHM_SLOT_SHED_TIMEOUT		30
+
+/* Returns the index of the claimed slot, or -1 with ENOSPC if all are in
+ * use.
+ */
+int loiter_shm_slot_claim(pool *p, pid_t pid);
+int loiter_shm_slot_touch(pool *p, int idx, pid_t pid);
+int loiter_shm_slot_release(pool *p, int idx, pid_t pid);
+
+/* Returns TRUE if the session in the given slot has been asked to shed, and
+ * has not been active since.
+ */
+int loiter_shm_slot_is_shed(pool *p, int idx, pid_t pid);
+
+/* Mark the session of our daemon idle the longest, for at least min_idle
+ * secs, as asked to shed.  Returns the index of its slot, setting its PID,
+ * or -1 with ENOENT if there is none.  The caller should check that the PID
+ * is still one of its daemon's sessions before signalling it, and release
+ * the slot if not.  Slots marked more than LOITER_SHM_SLOT_SHED_TIMEOUT secs
+ * ago are cleared.
+ */
+int loiter_shm_slot_shed_idlest(pool *p, unsigned int min_idle,
+  pid_t *pid, unsigned int *idle);
+
 #endif /* MOD_LOITER_SHM_H */
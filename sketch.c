@@ -0,0 +1,579 @@
+/*
+ * ProFTPD - mod_loiter sketches
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_loiter.h"
+#include "sketch.h"
+
+uint64_t loiter_monotonic_now(void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    return ((uint64_t) ts.tv_sec * 1000000000) + (uint64_t) ts.tv_nsec;
+  }
+#endif /* CLOCK_MONOTONIC */
+
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((uint64_t) tv.tv_sec * 1000000000) + ((uint64_t) tv.tv_usec * 1000);
+  }
+}
+
+/* Spread the bits of the key, so that the per-row indices derived from it
+ * are independent enough (the splitmix64 finalizer).
+ */
+static uint64_t mix_key(uint64_t key) {
+  key ^= key >> 30;
+  key *= (uint64_t) 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= (uint64_t) 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+
+  return key;
+}
+
+static unsigned int get_index(uint64_t hash, unsigned int row) {
+  uint32_t h1, h2;
+
+  h1 = (uint32_t) hash;
+  h2 = (uint32_t) (hash >> 32) | 1;
+
+  return (h1 + (row * h2)) % LOITER_SKETCH_WIDTH;
+}
+
+/* Age the counts by half for every window which has passed. */
+static void decay_sketch(struct loiter_sketch *sketch, uint32_t window) {
+  register unsigned int i, j;
+  uint32_t nwindows;
+
+  nwindows = window - sketch->window;
+  sketch->window = window;
+
+  if (nwindows >= 32) {
+    memset(sketch->counts, 0, sizeof(sketch->counts));
+    memset(sketch->top, 0, sizeof(sketch->top));
+    return;
+  }
+
+  for (i = 0; i < LOITER_SKETCH_DEPTH; i++) {
+    for (j = 0; j < LOITER_SKETCH_WIDTH; j++) {
+      sketch->counts[i][j] >>= nwindows;
+    }
+  }
+
+  for (i = 0; i < LOITER_SKETCH_TOPK; i++) {
+    sketch->top[i].count >>= nwindows;
+    if (sketch->top[i].count == 0) {
+      memset(&(sketch->top[i]), 0, sizeof(struct loiter_sketch_heavy));
+    }
+  }
+}
+
+unsigned int loiter_sketch_add(struct loiter_sketch *sketch, uint32_t window,
+    uint64_t key, const char *name) {
+  register unsigned int i;
+  unsigned int count = (unsigned int) -1, min_idx = 0;
+  uint64_t hash;
+
+  if (sketch == NULL ||
+      name == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  if (window != sketch->window) {
+    decay_sketch(sketch, window);
+  }
+
+  hash = mix_key(key);
+
+  for (i = 0; i < LOITER_SKETCH_DEPTH; i++) {
+    unsigned int *counter;
+
+    counter = &(sketch->counts[i][get_index(hash, i)]);
+    if (*counter < (unsigned int) -1) {
+      (*counter)++;
+    }
+
+    if (*counter < count) {
+      count = *counter;
+    }
+  }
+
+  /* Keep the heaviest keys; there are few enough of them that a linear scan
+   * is cheaper than maintaining a heap.
+   */
+  for (i = 0; i < LOITER_SKETCH_TOPK; i++) {
+    struct loiter_sketch_heavy *heavy;
+
+    heavy = &(sketch->top[i]);
+    if (heavy->name[0] != '\0' &&
+        heavy->key == key) {
+      heavy->count = count;
+      return count;
+    }
+
+    if (heavy->count < sketch->top[min_idx].count) {
+      min_idx = i;
+    }
+  }
+
+  if (count > sketch->top[min_idx].count) {
+    struct loiter_sketch_heavy *heavy;
+
+    heavy = &(sketch->top[min_idx]);
+    heavy->key = key;
+    heavy->count = count;
+    sstrncpy(heavy->name, name, sizeof(heavy->name));
+  }
+
+  return count;
+}
+
+unsigned int loiter_sketch_estimate(const struct loiter_sketch *sketch,
+    uint64_t key) {
+  register unsigned int i;
+  unsigned int count = (unsigned int) -1;
+  uint64_t hash;
+
+  if (sketch == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  hash = mix_key(key);
+
+  for (i = 0; i < LOITER_SKETCH_DEPTH; i++) {
+    unsigned int counter;
+
+    counter = sketch->counts[i][get_index(hash, i)];
+    if (counter < count) {
+      count = counter;
+    }
+  }
+
+  return count;
+}
+
+void loiter_hll_add(struct loiter_hll *hll, uint64_t key) {
+  uint64_t hash, rest;
+  unsigned int idx;
+  unsigned char rank = 1;
+  volatile unsigned char *reg;
+
+  if (hll == NULL) {
+    return;
+  }
+
+  hash = mix_key(key);
+
+  /* The top bits pick the register; the rank is the position of the first
+   * set bit in the rest.
+   */
+  idx = (unsigned int) (hash >> (64 - LOITER_HLL_PRECISION));
+  rest = hash << LOITER_HLL_PRECISION;
+  while (rank <= (64 - LOITER_HLL_PRECISION) &&
+         (rest & ((uint64_t) 1 << 63)) == 0) {
+    rank++;
+    rest <<= 1;
+  }
+
+  reg = &(hll->registers[idx]);
+
+#if defined(LOITER_HAVE_ATOMICS)
+  (void) __sync_fetch_and_add(&(hll->nkeys), 1);
+
+  while (TRUE) {
+    unsigned char prev;
+
+    prev = *reg;
+    if (prev >= rank ||
+        __sync_bool_compare_and_swap(reg, prev, rank)) {
+      break;
+    }
+  }
+#else
+  hll->nkeys++;
+  if (*reg < rank) {
+    *reg = rank;
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+void loiter_hll_clear(struct loiter_hll *hll, uint32_t window) {
+  if (hll == NULL) {
+    return;
+  }
+
+  memset(hll, 0, sizeof(struct loiter_hll));
+  hll->window = window;
+}
+
+/* Natural logarithm, for the small range correction; not worth requiring
+ * libm for.
+ */
+static double hll_log(double x) {
+  register unsigned int i;
+  double y, y2, sum = 0.0, term;
+  int k = 0;
+
+  while (x >= 2.0) {
+    x /= 2.0;
+    k++;
+  }
+
+  while (x < 1.0) {
+    x *= 2.0;
+    k--;
+  }
+
+  /* ln(x) = 2 * atanh((x - 1) / (x + 1)), for x in [1, 2). */
+  y = (x - 1.0) / (x + 1.0);
+  y2 = y * y;
+  term = y;
+  for (i = 1; i < 30; i += 2) {
+    sum += term / i;
+    term *= y2;
+  }
+
+  return (2.0 * sum) + (k * 0.69314718055994530942);
+}
+
+unsigned int loiter_hll_estimate(const struct loiter_hll *hll) {
+  register unsigned int i;
+  double alpha, estimate, m, sum = 0.0;
+  unsigned int nzeros = 0;
+
+  if (hll == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  m = (double) LOITER_HLL_REGISTERS;
+  alpha = 0.7213 / (1.0 + (1.079 / m));
+
+  for (i = 0; i < LOITER_HLL_REGISTERS; i++) {
+    unsigned char reg;
+
+    reg = hll->registers[i];
+    if (reg == 0) {
+      nzeros++;
+    }
+
+    sum += 1.0 / (double) ((uint64_t) 1 << reg);
+  }
+
+  estimate = (alpha * m * m) / sum;
+
+  /* Small range correction, via linear counting. */
+  if (estimate <= (2.5 * m) &&
+      nzeros > 0) {
+    estimate = m * hll_log(m / (double) nzeros);
+  }
+
+  return (unsigned int) (estimate + 0.5);
+}
+
+#define LOITER_BUCKET_UNIT		64
+
+/* How far behind the refill time of a bucket a caller's clock may be, from
+ * reading it before another process does, before that bucket is instead
+ * taken to have wrapped around, idle.
+ */
+#define LOITER_BUCKET_MAX_SKEW_MS	60000
+
+static uint64_t pack_bucket(uint32_t tag, uint32_t tokens, uint32_t now_ms) {
+  return ((uint64_t) (tag & 0xffff) << 48) |
+    ((uint64_t) (tokens & 0xffff) << 32) | now_ms;
+}
+
+int loiter_bucket_take(uint64_t *bucket, uint64_t key, uint32_t now_ms,
+    unsigned int rate, unsigned int burst) {
+  uint32_t tag;
+
+  if (bucket == NULL ||
+      rate == 0 ||
+      burst == 0 ||
+      burst > LOITER_BUCKET_MAX_BURST) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Never let a tag be zero, so that zero can mean an unused bucket. */
+  tag = ((uint32_t) (mix_key(key) >> 48)) | 1;
+
+  while (TRUE) {
+    uint64_t prev, next;
+    uint32_t tokens, last_ms;
+    int allowed = FALSE;
+
+    prev = *((volatile uint64_t *) bucket);
+    tokens = (uint32_t) (prev >> 32) & 0xffff;
+    last_ms = (uint32_t) prev;
+
+    if (((uint32_t) (prev >> 48) & 0xffff) != tag) {
+      /* New to us; start with a full bucket. */
+      tokens = burst * LOITER_BUCKET_UNIT;
+      last_ms = now_ms;
+
+    } else {
+      int32_t elapsed;
+      uint64_t added;
+
+      /* Another process, reading the clock after us, may have refilled the
+       * bucket first; we have then earned nothing more since.  Otherwise, an
+       * unsigned difference would wrap, and fill the bucket.  Only a bucket
+       * left idle for weeks would be further behind than that; it has long
+       * since refilled.
+       */
+      elapsed = (int32_t) (now_ms - last_ms);
+      if (elapsed < 0) {
+        elapsed = elapsed < -LOITER_BUCKET_MAX_SKEW_MS ? INT32_MAX : 0;
+      }
+
+      added = ((uint64_t) elapsed * rate * LOITER_BUCKET_UNIT) / 60000;
+
+      /* Only move the refill time along by the time those tokens took to
+       * accrue (rounded up, so that we never credit more than was earned),
+       * so that frequent callers do not lose the fractions.
+       */
+      if (tokens + added >= burst * LOITER_BUCKET_UNIT) {
+        tokens = burst * LOITER_BUCKET_UNIT;
+        last_ms = now_ms;
+
+      } else if (added > 0) {
+        tokens += (uint32_t) added;
+        last_ms += (uint32_t) ((added * 60000 + (rate * LOITER_BUCKET_UNIT) - 1) /
+          (rate * LOITER_BUCKET_UNIT));
+      }
+    }
+
+    if (tokens >= LOITER_BUCKET_UNIT) {
+      tokens -= LOITER_BUCKET_UNIT;
+      allowed = TRUE;
+    }
+
+    next = pack_bucket(tag, tokens, last_ms);
+
+#if defined(LOITER_HAVE_ATOMICS)
+    if (prev != next &&
+        !__sync_bool_compare_and_swap(bucket, prev, next)) {
+      /* Another process updated this bucket first; try again. */
+      continue;
+    }
+#else
+    *bucket = next;
+#endif /* LOITER_HAVE_ATOMICS */
+
+    return allowed;
+  }
+}
+
+static uint32_t get_counter_tag(uint64_t key) {
+  /* Never let a tag be zero, so that zero can mean an unused counter. */
+  return ((uint32_t) (mix_key(key) >> 48)) | 1;
+}
+
+int loiter_counter_incr(uint64_t *counter, uint64_t key, uint32_t now,
+    unsigned int window) {
+  uint32_t tag;
+
+  if (counter == NULL ||
+      window == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  tag = get_counter_tag(key);
+
+  while (TRUE) {
+    uint64_t prev, next;
+    uint32_t count, start;
+
+    prev = *((volatile uint64_t *) counter);
+    count = (uint32_t) (prev >> 32) & 0xffff;
+    start = (uint32_t) prev;
+
+    if (((uint32_t) (prev >> 48) & 0xffff) != tag ||
+        (uint32_t) (now - start) >= window) {
+      count = 0;
+      start = now;
+    }
+
+    /* Saturate, rather than wrap back around to zero. */
+    if (count < 0xffff) {
+      count++;
+    }
+
+    next = pack_bucket(tag, count, start);
+
+#if defined(LOITER_HAVE_ATOMICS)
+    if (!__sync_bool_compare_and_swap(counter, prev, next)) {
+      continue;
+    }
+#else
+    *counter = next;
+#endif /* LOITER_HAVE_ATOMICS */
+
+    return (int) count;
+  }
+}
+
+unsigned int loiter_counter_get(const uint64_t *counter, uint64_t key,
+    uint32_t now, unsigned int window) {
+  uint64_t val;
+
+  if (counter == NULL) {
+    return 0;
+  }
+
+  val = *((const volatile uint64_t *) counter);
+  if (((uint32_t) (val >> 48) & 0xffff) != get_counter_tag(key) ||
+      (uint32_t) (now - (uint32_t) val) >= window) {
+    return 0;
+  }
+
+  return (unsigned int) (val >> 32) & 0xffff;
+}
+
+static unsigned int get_histogram_bucket(uint64_t value) {
+  unsigned int nbits = 0;
+
+  if (value < LOITER_HISTOGRAM_SUB_BUCKETS) {
+    return (unsigned int) value;
+  }
+
+  if (value >= ((uint64_t) 1 << LOITER_HISTOGRAM_MAX_BITS)) {
+    return LOITER_HISTOGRAM_BUCKETS - 1;
+  }
+
+  while ((value >> nbits) >= (LOITER_HISTOGRAM_SUB_BUCKETS * 2)) {
+    nbits++;
+  }
+
+  /* The leading bits pick the power of two; the next bits, the bucket
+   * within it.
+   */
+  return ((nbits + 1) * LOITER_HISTOGRAM_SUB_BUCKETS) +
+    ((unsigned int) (value >> nbits) - LOITER_HISTOGRAM_SUB_BUCKETS);
+}
+
+/* Returns the largest value which falls into the given bucket. */
+static uint64_t get_histogram_bucket_max(unsigned int idx) {
+  unsigned int nbits;
+  uint64_t base;
+
+  if (idx < LOITER_HISTOGRAM_SUB_BUCKETS) {
+    return idx;
+  }
+
+  nbits = (idx / LOITER_HISTOGRAM_SUB_BUCKETS) - 1;
+  base = LOITER_HISTOGRAM_SUB_BUCKETS + (idx % LOITER_HISTOGRAM_SUB_BUCKETS);
+
+  return ((base + 1) << nbits) - 1;
+}
+
+
+void loiter_histogram_add(struct loiter_histogram *hist, uint64_t value) {
+  unsigned int idx;
+
+  if (hist == NULL) {
+    return;
+  }
+
+  idx = get_histogram_bucket(value);
+
+#if defined(LOITER_HAVE_ATOMICS)
+  (void) __sync_fetch_and_add(&(hist->buckets[idx]), 1);
+  (void) __sync_fetch_and_add(&(hist->count), 1);
+  (void) __sync_fetch_and_add(&(hist->sum), value);
+
+  while (TRUE) {
+    uint64_t prev;
+
+    prev = *((volatile uint64_t *) &(hist->max));
+    if (prev >= value ||
+        __sync_bool_compare_and_swap(&(hist->max), prev, value)) {
+      break;
+    }
+  }
+#else
+  hist->buckets[idx]++;
+  hist->count++;
+  hist->sum += value;
+
+  if (hist->max < value) {
+    hist->max = value;
+  }
+#endif /* LOITER_HAVE_ATOMICS */
+}
+
+uint64_t loiter_histogram_percentile(const struct loiter_histogram *hist,
+    double pct) {
+  register unsigned int i;
+  uint64_t count = 0, rank;
+
+  if (hist == NULL ||
+      hist->count == 0) {
+    return 0;
+  }
+
+  if (pct > 100.0) {
+    pct = 100.0;
+  }
+
+  /* The buckets are updated without a lock, so may not quite add up to the
+   * count; use their own total.
+   */
+  for (i = 0; i < LOITER_HISTOGRAM_BUCKETS; i++) {
+    count += hist->buckets[i];
+  }
+
+  rank = (uint64_t) ((pct / 100.0) * count);
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  count = 0;
+  for (i = 0; i < LOITER_HISTOGRAM_BUCKETS; i++) {
+    count += hist->buckets[i];
+
+    if (count >= rank) {
+      uint64_t value;
+
+      if (i == LOITER_HISTOGRAM_BUCKETS - 1) {
+        /* The last bucket has no upper bound. */
+        return hist->max;
+      }
+
+      /* The largest value actually seen is more precise. */
+      value = get_histogram_bucket_max(i);
+      return value < hist->max ? value : hist->max;
+    }
+  }
+
+  return hist->max;
+}
@@ -0,0 +1,157 @@
+/*
+ * ProFTPD - mod_loiter sketches
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_SKETCH_H
+#define MOD_LOITER_SKETCH_H
+
+#include "mod_loiter.h"
+
+/* Fixed-size, probabilistic summaries of the connecting sources, suitable
+ * for keeping in the LoiterTable: their memory does not grow with the number
+ * of distinct sources.  The caller provides any locking.
+ */
+
+/* With LOITER_HAVE_ATOMICS, the HyperLogLog, token buckets and counters
+ * below are updated lock-free.  Otherwise, the caller must provide the
+ * locking.
+ */
+
+/* Returns the current time, in nsecs, for timing things and for refilling
+ * token buckets.  The clock is monotonic where possible: the wall clock may
+ * be stepped, backwards or forwards, which would make latencies negative or
+ * huge, and refill every bucket at once, or none for a long while.
+ */
+uint64_t loiter_monotonic_now(void);
+
+#define LOITER_SKETCH_DEPTH		4
+#define LOITER_SKETCH_WIDTH		4096
+#define LOITER_SKETCH_TOPK		16
+#define LOITER_SKETCH_NAMESZ		48
+
+struct loiter_sketch_heavy {
+  uint64_t key;
+  unsigned int count;
+
+  /* Empty for an unused entry. */
+  char name[LOITER_SKETCH_NAMESZ];
+};
+
+/* A count-min sketch, whose counts are halved at each new window, along with
+ * the heaviest keys seen.
+ */
+struct loiter_sketch {
+  uint32_t window;
+  unsigned int counts[LOITER_SKETCH_DEPTH][LOITER_SKETCH_WIDTH];
+  struct loiter_sketch_heavy top[LOITER_SKETCH_TOPK];
+};
+
+/* Count the given key, named e.g. by its address, and return its estimated
+ * (never under-estimated) count.  The window is e.g. the current time divided
+ * by the window length.
+ */
+unsigned int loiter_sketch_add(struct loiter_sketch *sketch, uint32_t window,
+  uint64_t key, const char *name);
+unsigned int loiter_sketch_estimate(const struct loiter_sketch *sketch,
+  uint64_t key);
+
+/* A HyperLogLog, for estimating the number of distinct keys seen in a
+ * window, using one byte per register.
+ */
+#define LOITER_HLL_PRECISION		12
+#define LOITER_HLL_REGISTERS		(1 << LOITER_HLL_PRECISION)
+
+struct loiter_hll {
+  uint32_t window;
+
+  /* Count of all keys added, distinct or not. */
+  unsigned int nkeys;
+
+  unsigned char registers[LOITER_HLL_REGISTERS];
+};
+
+void loiter_hll_add(struct loiter_hll *hll, uint64_t key);
+void loiter_hll_clear(struct loiter_hll *hll, uint32_t window);
+unsigned int loiter_hll_estimate(const struct loiter_hll *hll);
+
+/* Token buckets, for rate limiting, each packed into a single word: a tag
+ * of the key, the tokens left (in 1/64ths of a token), and the time of the
+ * last refill (in msecs), so that the refill and take can be done in one
+ * compare-and-swap.  A bucket found holding another key's tag is taken over,
+ * starting full.
+ */
+#define LOITER_BUCKET_MAX_BURST		1023
+
+/* Returns TRUE if a token was taken from the bucket for the given key, which
+ * refills at rate tokens per minute, up to burst tokens; FALSE otherwise.
+ * The now_ms time should come from loiter_monotonic_now().
+ */
+int loiter_bucket_take(uint64_t *bucket, uint64_t key, uint32_t now_ms,
+  unsigned int rate, unsigned int burst);
+
+/* Windowed counters, packed into a single word like the token buckets: a
+ * tag of the key, the count, and the time (in secs) at which the count
+ * started.  A counter found holding another key's tag, or whose window has
+ * passed, starts again from zero.
+ */
+
+/* Count an event for the given key, and return the number of events counted
+ * for it within the last window secs, or -1 on error.
+ */
+int loiter_counter_incr(uint64_t *counter, uint64_t key, uint32_t now,
+  unsigned int window);
+
+/* Returns the number of events counted for the given key within the last
+ * window secs, without counting another.
+ */
+unsigned int loiter_counter_get(const uint64_t *counter, uint64_t key,
+  uint32_t now, unsigned int window);
+
+/* Latency histograms, with log-linear buckets: each power of two is split
+ * into LOITER_HISTOGRAM_SUB_BUCKETS equal buckets, so that a value is known
+ * to within 1/8th, whatever its magnitude.  Values, in nsecs, of
+ * 2^LOITER_HISTOGRAM_MAX_BITS (about 68 secs) or more share the last bucket.
+ */
+#define LOITER_HISTOGRAM_SUB_BITS	3
+#define LOITER_HISTOGRAM_SUB_BUCKETS	(1 << LOITER_HISTOGRAM_SUB_BITS)
+#define LOITER_HISTOGRAM_MAX_BITS	36
+#define LOITER_HISTOGRAM_BUCKETS \
+  ((LOITER_HISTOGRAM_MAX_BITS - LOITER_HISTOGRAM_SUB_BITS + 1) * \
+   LOITER_HISTOGRAM_SUB_BUCKETS)
+
+struct loiter_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  unsigned int buckets[LOITER_HISTOGRAM_BUCKETS];
+};
+
+void loiter_histogram_add(struct loiter_histogram *hist, uint64_t value);
+
+/* Returns the largest value which falls into the same bucket as the given
+ * percentile (0-100) of the values added, or zero if there are none.
+ */
+uint64_t loiter_histogram_percentile(const struct loiter_histogram *hist,
+  double pct);
+
+#endif /* MOD_LOITER_SKETCH_H */
@@ -0,0 +1,219 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+/* CIDR prefix table API tests. */
+
+#include "tests.h"
+
+#include "cidr.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+static int match(struct loiter_cidr_table *tab, const char *text,
+    unsigned int *weight) {
+  unsigned char addr[16];
+  int family = AF_INET;
+
+  if (strchr(text, ':') != NULL) {
+    family = AF_INET6;
+  }
+
+  memset(addr, 0, sizeof(addr));
+  if (pr_inet_pton(family, text, addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return loiter_cidr_match(tab, family, addr, weight);
+}
+
+START_TEST (cidr_add_text_test) {
+  int res;
+  struct loiter_cidr_table *tab;
+
+  mark_point();
+  tab = loiter_cidr_create(NULL);
+  fail_unless(tab == NULL, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tab = loiter_cidr_create(p);
+  fail_unless(tab != NULL, "Failed to create table: %s", strerror(errno));
+
+  mark_point();
+  res = loiter_cidr_add_text(NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cidr_add_text(tab, "  # just a comment\n");
+  fail_unless(res == 0, "Failed to ignore comment: %s", strerror(errno));
+  fail_unless(loiter_cidr_count(tab) == 0, "Expected empty table");
+
+  mark_point();
+  res = loiter_cidr_add_text(tab, "10.0.0.0/8\n");
+  fail_unless(res < 0, "Failed to reject missing weight");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cidr_add_text(tab, "10.0.0.0/33 50\n");
+  fail_unless(res < 0, "Failed to reject invalid prefix length");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cidr_add_text(tab, "10.0.0.0/8 lots\n");
+  fail_unless(res < 0, "Failed to reject invalid weight");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cidr_add_text(tab, "10.0.0.0/8 50 extra\n");
+  fail_unless(res < 0, "Failed to reject trailing text");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cidr_add_text(tab, "10.0.0.0/8 50 # cloud\n");
+  fail_unless(res == 0, "Failed to add prefix: %s", strerror(errno));
+  fail_unless(loiter_cidr_count(tab) == 1, "Expected 1 prefix, got %u",
+    loiter_cidr_count(tab));
+
+  /* Re-adding a prefix replaces its weight. */
+  mark_point();
+  res = loiter_cidr_add_text(tab, "10.0.0.0/8 75\n");
+  fail_unless(res == 0, "Failed to add prefix: %s", strerror(errno));
+  fail_unless(loiter_cidr_count(tab) == 1, "Expected 1 prefix, got %u",
+    loiter_cidr_count(tab));
+}
+END_TEST
+
+START_TEST (cidr_match_test) {
+  int res;
+  unsigned int weight = 0;
+  struct loiter_cidr_table *tab;
+
+  tab = loiter_cidr_create(p);
+
+  mark_point();
+  res = loiter_cidr_match(NULL, AF_INET, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = match(tab, "10.1.2.3", &weight);
+  fail_unless(res < 0, "Failed to handle empty table");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  (void) loiter_cidr_add_text(tab, "10.0.0.0/8 50");
+  (void) loiter_cidr_add_text(tab, "10.1.0.0/16 200");
+  (void) loiter_cidr_add_text(tab, "10.1.2.0/24 deny");
+  (void) loiter_cidr_add_text(tab, "10.1.128.0/17 150");
+  (void) loiter_cidr_add_text(tab, "192.0.2.7 allow");
+  (void) loiter_cidr_add_text(tab, "2001:db8::/32 300");
+  (void) loiter_cidr_add_text(tab, "2001:db8:1::/48 allow");
+
+  mark_point();
+  res = match(tab, "10.1.2.3", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == LOITER_CIDR_WEIGHT_DENY, "Expected deny, got %u",
+    weight);
+
+  mark_point();
+  res = match(tab, "10.1.3.3", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 200, "Expected 200, got %u", weight);
+
+  mark_point();
+  res = match(tab, "10.1.200.1", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 150, "Expected 150, got %u", weight);
+
+  mark_point();
+  res = match(tab, "10.2.0.1", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 50, "Expected 50, got %u", weight);
+
+  mark_point();
+  res = match(tab, "192.0.2.7", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 0, "Expected 0, got %u", weight);
+
+  mark_point();
+  res = match(tab, "192.0.2.8", &weight);
+  fail_unless(res < 0, "Unexpectedly matched 192.0.2.8");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  res = match(tab, "2001:db8:1::5", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 0, "Expected 0, got %u", weight);
+
+  mark_point();
+  res = match(tab, "2001:db8:2::5", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 300, "Expected 300, got %u", weight);
+
+  /* IPv4-mapped IPv6 addresses match the IPv4 prefixes. */
+  mark_point();
+  res = match(tab, "::ffff:10.2.0.1", &weight);
+  fail_unless(res == 0, "Failed to match: %s", strerror(errno));
+  fail_unless(weight == 50, "Expected 50, got %u", weight);
+}
+END_TEST
+
+Suite *tests_get_cidr_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("cidr");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, cidr_add_text_test);
+  tcase_add_test(testcase, cidr_match_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
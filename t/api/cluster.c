@@ -0,0 +1,229 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Cluster API tests. */
+
+#include "tests.h"
+
+#include "agent.h"
+#include "cluster.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (cluster_encode_decode_test) {
+  int res;
+  unsigned char buf[LOITER_CLUSTER_MSG_SIZE];
+  unsigned char key[LOITER_CLUSTER_KEY_SIZE] = "0123456789abcdef";
+  uint32_t seqno = 0;
+  unsigned int conn_count = 0, authd_count = 0;
+
+  mark_point();
+  res = loiter_cluster_encode(NULL, 0, NULL, 0, 0, 0);
+  fail_unless(res < 0, "Failed to handle null buffer");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cluster_encode(buf, sizeof(buf)-1, NULL, 0, 0, 0);
+  fail_unless(res < 0, "Failed to handle short buffer");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cluster_decode(buf, sizeof(buf), NULL, NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_cluster_encode(buf, sizeof(buf), key, 42, 70000, 3);
+  fail_unless(res == LOITER_CLUSTER_MSG_SIZE, "Failed to encode report: %s",
+    strerror(errno));
+
+  mark_point();
+  res = loiter_cluster_decode(buf, sizeof(buf), key, &seqno, &conn_count,
+    &authd_count);
+  fail_unless(res == 0, "Failed to decode report: %s", strerror(errno));
+  fail_unless(seqno == 42, "Expected seqno 42, got %lu",
+    (unsigned long) seqno);
+  fail_unless(conn_count == 70000, "Expected conn_count 70000, got %u",
+    conn_count);
+  fail_unless(authd_count == 3, "Expected authd_count 3, got %u",
+    authd_count);
+
+  mark_point();
+  res = loiter_cluster_decode(buf, sizeof(buf)-1, key, &seqno, &conn_count,
+    &authd_count);
+  fail_unless(res < 0, "Failed to handle truncated report");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  /* Only a report tagged with the same key is accepted. */
+  mark_point();
+  res = loiter_cluster_decode(buf, sizeof(buf), NULL, &seqno, &conn_count,
+    &authd_count);
+  fail_unless(res < 0, "Failed to handle wrong key");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  buf[15] ^= 0x01;
+  res = loiter_cluster_decode(buf, sizeof(buf), key, &seqno, &conn_count,
+    &authd_count);
+  fail_unless(res < 0, "Failed to handle tampered report");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+  buf[15] ^= 0x01;
+
+  mark_point();
+  buf[0] ^= 0xff;
+  res = loiter_cluster_decode(buf, sizeof(buf), key, &seqno, &conn_count,
+    &authd_count);
+  fail_unless(res < 0, "Failed to handle bad magic");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  /* Without a key, reports are still tagged, with an all-zero key. */
+  mark_point();
+  res = loiter_cluster_encode(buf, sizeof(buf), NULL, 1, 2, 1);
+  fail_unless(res == LOITER_CLUSTER_MSG_SIZE, "Failed to encode report: %s",
+    strerror(errno));
+
+  res = loiter_cluster_decode(buf, sizeof(buf), NULL, &seqno, &conn_count,
+    &authd_count);
+  fail_unless(res == 0, "Failed to decode report: %s", strerror(errno));
+}
+END_TEST
+
+START_TEST (cluster_open_test) {
+  loiter_cluster_t *cluster;
+
+  mark_point();
+  cluster = loiter_cluster_open(NULL, NULL, NULL, 0, NULL, 0);
+  fail_unless(cluster == NULL, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  fail_unless(loiter_cluster_close(NULL) < 0, "Failed to handle null cluster");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  fail_unless(loiter_cluster_publish(p, NULL, 0) < 0,
+    "Failed to handle null cluster");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (cluster_recv_test) {
+  int fd, res;
+  unsigned char buf[LOITER_CLUSTER_MSG_SIZE];
+  unsigned char key[LOITER_CLUSTER_KEY_SIZE] = "0123456789abcdef";
+  struct sockaddr_storage peer_addr, addr;
+  socklen_t peer_addrlen, addrlen;
+  array_header *peers;
+  loiter_cluster_t *cluster;
+
+  peers = make_array(p, 1, sizeof(char *));
+  *((char **) push_array(peers)) = "127.0.0.1:39023";
+
+  mark_point();
+  cluster = loiter_cluster_open(p, "127.0.0.1:39022", peers, 1, key, 10);
+  fail_unless(cluster != NULL, "Failed to open cluster: %s", strerror(errno));
+
+  res = loiter_agent_resolve(p, "127.0.0.1:39022", SOCK_DGRAM, &addr,
+    &addrlen);
+  fail_unless(res == 0, "Failed to resolve address: %s", strerror(errno));
+
+  res = loiter_agent_resolve(p, "127.0.0.1:39023", SOCK_DGRAM, &peer_addr,
+    &peer_addrlen);
+  fail_unless(res == 0, "Failed to resolve peer: %s", strerror(errno));
+
+  /* Play the peer. */
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  fail_unless(fd >= 0, "Failed to create socket: %s", strerror(errno));
+
+  res = bind(fd, (struct sockaddr *) &peer_addr, peer_addrlen);
+  fail_unless(res == 0, "Failed to bind socket: %s", strerror(errno));
+
+  mark_point();
+  (void) loiter_cluster_encode(buf, sizeof(buf), key, 1, 5, 2);
+  (void) sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *) &addr, addrlen);
+  res = loiter_cluster_recv(p, cluster, time(NULL));
+  fail_unless(res == 0, "Failed to accept report: %s", strerror(errno));
+
+  /* A report from a peer without our key is dropped. */
+  mark_point();
+  (void) loiter_cluster_encode(buf, sizeof(buf), NULL, 2, 5, 2);
+  (void) sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *) &addr, addrlen);
+  res = loiter_cluster_recv(p, cluster, time(NULL));
+  fail_unless(res < 0, "Failed to drop unauthenticated report");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  /* As is one claiming more connections than allowed. */
+  mark_point();
+  (void) loiter_cluster_encode(buf, sizeof(buf), key, 3, 11, 2);
+  (void) sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *) &addr, addrlen);
+  res = loiter_cluster_recv(p, cluster, time(NULL));
+  fail_unless(res < 0, "Failed to drop report exceeding max count");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  (void) close(fd);
+  (void) loiter_cluster_close(cluster);
+}
+END_TEST
+
+Suite *tests_get_cluster_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("cluster");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, cluster_encode_decode_test);
+  tcase_add_test(testcase, cluster_open_test);
+  tcase_add_test(testcase, cluster_recv_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
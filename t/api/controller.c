@@ -0,0 +1,127 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+/* Controller API tests. */
+
+#include "tests.h"
+
+#include "controller.h"
+
+START_TEST (controller_init_test) {
+  int res;
+  struct loiter_controller ctl;
+
+  mark_point();
+  res = loiter_controller_init(NULL, 0, 0.0, 0.0, 0);
+  fail_unless(res < 0, "Failed to handle null controller");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_controller_init(&ctl, 0, 1.0, 1.0, 0);
+  fail_unless(res < 0, "Failed to handle zero setpoint");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_controller_init(&ctl, 10, 1.0, 1.0, 101);
+  fail_unless(res < 0, "Failed to handle invalid drop probability");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_controller_init(&ctl, 10, 2.0, 0.5, 40);
+  fail_unless(res == 0, "Failed to init controller: %s", strerror(errno));
+  fail_unless(ctl.integral == 40.0, "Expected seeded integral 40, got %f",
+    ctl.integral);
+}
+END_TEST
+
+START_TEST (controller_step_test) {
+  int res;
+  unsigned int drop_pct = 0;
+  struct loiter_controller ctl;
+
+  mark_point();
+  res = loiter_controller_step(NULL, 0, 0, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  (void) loiter_controller_init(&ctl, 10, 2.0, 0.5, 0);
+
+  /* Below the setpoint, nothing is dropped, and the integral stays put. */
+  mark_point();
+  res = loiter_controller_step(&ctl, 5, 1, &drop_pct);
+  fail_unless(res == 0, "Failed to step controller: %s", strerror(errno));
+  fail_unless(drop_pct == 0, "Expected 0, got %u", drop_pct);
+  fail_unless(ctl.integral == 0.0, "Expected integral 0, got %f",
+    ctl.integral);
+
+  /* 10 over: 2 * 10 proportional, plus 0.5 * 10 * 2 integral. */
+  mark_point();
+  res = loiter_controller_step(&ctl, 20, 2, &drop_pct);
+  fail_unless(res == 0, "Failed to step controller: %s", strerror(errno));
+  fail_unless(drop_pct == 30, "Expected 30, got %u", drop_pct);
+
+  /* Holding at the setpoint keeps the integral term. */
+  mark_point();
+  res = loiter_controller_step(&ctl, 10, 1, &drop_pct);
+  fail_unless(res == 0, "Failed to step controller: %s", strerror(errno));
+  fail_unless(drop_pct == 10, "Expected 10, got %u", drop_pct);
+
+  /* Far over the setpoint saturates, without winding the integral past
+   * 100.
+   */
+  mark_point();
+  res = loiter_controller_step(&ctl, 1000, 10, &drop_pct);
+  fail_unless(res == 0, "Failed to step controller: %s", strerror(errno));
+  fail_unless(drop_pct == 100, "Expected 100, got %u", drop_pct);
+  fail_unless(ctl.integral == 100.0, "Expected integral 100, got %f",
+    ctl.integral);
+
+  /* ...so that it recovers promptly once the flood subsides. */
+  mark_point();
+  res = loiter_controller_step(&ctl, 0, 20, &drop_pct);
+  fail_unless(res == 0, "Failed to step controller: %s", strerror(errno));
+  fail_unless(drop_pct == 0, "Expected 0, got %u", drop_pct);
+  fail_unless(ctl.integral == 0.0, "Expected integral 0, got %f",
+    ctl.integral);
+}
+END_TEST
+
+Suite *tests_get_controller_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("controller");
+  testcase = tcase_create("base");
+
+  tcase_add_test(testcase, controller_init_test);
+  tcase_add_test(testcase, controller_step_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
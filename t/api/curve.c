@@ -0,0 +1,244 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Drop curve API tests. */
+
+#include "tests.h"
+
+#include "curve.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+static struct loiter_curve *make_curve(int type, unsigned int low,
+    unsigned int high, unsigned int rate) {
+  struct loiter_curve *curve;
+
+  curve = pcalloc(p, sizeof(struct loiter_curve));
+  curve->type = type;
+  curve->low = low;
+  curve->high = high;
+  curve->rate = rate;
+
+  (void) loiter_curve_compile(p, curve);
+  return curve;
+}
+
+START_TEST (curve_get_type_test) {
+  int res;
+
+  mark_point();
+  res = loiter_curve_get_type(NULL);
+  fail_unless(res < 0, "Failed to handle null name");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_curve_get_type("cubic");
+  fail_unless(res < 0, "Failed to handle unknown name");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_curve_get_type("Exponential");
+  fail_unless(res == LOITER_CURVE_EXPONENTIAL,
+    "Expected LOITER_CURVE_EXPONENTIAL (%d), got %d",
+    LOITER_CURVE_EXPONENTIAL, res);
+}
+END_TEST
+
+START_TEST (curve_parse_points_test) {
+  int res;
+  struct loiter_curve curve;
+
+  mark_point();
+  res = loiter_curve_parse_points(NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  memset(&curve, 0, sizeof(curve));
+
+  mark_point();
+  res = loiter_curve_parse_points(p, &curve, "10:5,20");
+  fail_unless(res < 0, "Failed to handle missing percentage");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_curve_parse_points(p, &curve, "20:5,10:100");
+  fail_unless(res < 0, "Failed to handle decreasing counts");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_curve_parse_points(p, &curve, "10:50,20:40,30:100");
+  fail_unless(res < 0, "Failed to handle decreasing percentages");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_curve_parse_points(p, &curve, "10:5,20:50");
+  fail_unless(res < 0, "Failed to handle curve not ending at 100");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_curve_parse_points(p, &curve, "10:5,20:50,30:100");
+  fail_unless(res == 0, "Failed to parse points: %s", strerror(errno));
+  fail_unless(curve.type == LOITER_CURVE_POINTS,
+    "Expected LOITER_CURVE_POINTS, got %d", curve.type);
+  fail_unless(curve.npoints == 3, "Expected 3 points, got %u", curve.npoints);
+  fail_unless(curve.low == 10, "Expected low 10, got %u", curve.low);
+  fail_unless(curve.high == 30, "Expected high 30, got %u", curve.high);
+  fail_unless(curve.rate == 5, "Expected rate 5, got %u", curve.rate);
+}
+END_TEST
+
+START_TEST (curve_linear_test) {
+  unsigned int count, pct;
+  struct loiter_curve *curve;
+
+  curve = make_curve(LOITER_CURVE_LINEAR, 10, 30, 30);
+  fail_unless(curve->table != NULL, "Failed to tabulate curve");
+
+  /* The linear curve matches the MaxStartups-style formula exactly. */
+  for (count = 0; count < 40; count++) {
+    unsigned int expected;
+
+    if (count < 10) {
+      expected = 0;
+
+    } else if (count >= 30) {
+      expected = 100;
+
+    } else {
+      expected = (((100 - 30) * (count - 10)) / (30 - 10)) + 30;
+    }
+
+    mark_point();
+    pct = loiter_curve_pct(curve, count, 10, 30, 30);
+    fail_unless(pct == expected, "Expected %u for count %u, got %u", expected,
+      count, pct);
+  }
+}
+END_TEST
+
+START_TEST (curve_shapes_test) {
+  unsigned int pct;
+  struct loiter_curve *curve;
+
+  mark_point();
+  curve = make_curve(LOITER_CURVE_QUADRATIC, 10, 20, 10);
+  pct = loiter_curve_pct(curve, 15, 10, 20, 10);
+  fail_unless(pct == 32, "Expected 32, got %u", pct);
+
+  mark_point();
+  curve = make_curve(LOITER_CURVE_EXPONENTIAL, 10, 20, 10);
+  pct = loiter_curve_pct(curve, 10, 10, 20, 10);
+  fail_unless(pct == 10, "Expected 10, got %u", pct);
+  pct = loiter_curve_pct(curve, 15, 10, 20, 10);
+  fail_unless(pct == 20, "Expected 20, got %u", pct);
+  pct = loiter_curve_pct(curve, 19, 10, 20, 10);
+  fail_unless(pct == 69, "Expected 69, got %u", pct);
+
+  mark_point();
+  curve = make_curve(LOITER_CURVE_STEP, 10, 20, 10);
+  pct = loiter_curve_pct(curve, 19, 10, 20, 10);
+  fail_unless(pct == 10, "Expected 10, got %u", pct);
+  pct = loiter_curve_pct(curve, 20, 10, 20, 10);
+  fail_unless(pct == 100, "Expected 100, got %u", pct);
+
+  mark_point();
+  curve = pcalloc(p, sizeof(struct loiter_curve));
+  (void) loiter_curve_parse_points(p, curve, "10:5,20:50,30:100");
+  (void) loiter_curve_compile(p, curve);
+  pct = loiter_curve_pct(curve, 9, 10, 30, 5);
+  fail_unless(pct == 0, "Expected 0, got %u", pct);
+  pct = loiter_curve_pct(curve, 15, 10, 30, 5);
+  fail_unless(pct == 27, "Expected 27, got %u", pct);
+  pct = loiter_curve_pct(curve, 25, 10, 30, 5);
+  fail_unless(pct == 75, "Expected 75, got %u", pct);
+}
+END_TEST
+
+START_TEST (curve_changed_rules_test) {
+  unsigned int pct;
+  struct loiter_curve *curve;
+
+  curve = make_curve(LOITER_CURVE_LINEAR, 10, 20, 10);
+
+  /* Rules changed at runtime are computed, rather than looked up. */
+  mark_point();
+  pct = loiter_curve_pct(curve, 25, 10, 40, 10);
+  fail_unless(pct == 55, "Expected 55, got %u", pct);
+
+  /* Points are stretched onto the changed watermarks. */
+  mark_point();
+  curve = pcalloc(p, sizeof(struct loiter_curve));
+  (void) loiter_curve_parse_points(p, curve, "10:5,20:50,30:100");
+  (void) loiter_curve_compile(p, curve);
+  pct = loiter_curve_pct(curve, 30, 20, 60, 5);
+  fail_unless(pct == 27, "Expected 27, got %u", pct);
+
+  /* Too large a high watermark to tabulate is still computed. */
+  mark_point();
+  curve = make_curve(LOITER_CURVE_LINEAR, 10, LOITER_CURVE_MAX_TABLESZ, 10);
+  fail_unless(curve->table == NULL, "Expected no table");
+  pct = loiter_curve_pct(curve, LOITER_CURVE_MAX_TABLESZ, 10,
+    LOITER_CURVE_MAX_TABLESZ, 10);
+  fail_unless(pct == 100, "Expected 100, got %u", pct);
+}
+END_TEST
+
+Suite *tests_get_curve_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("curve");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, curve_get_type_test);
+  tcase_add_test(testcase, curve_parse_points_test);
+  tcase_add_test(testcase, curve_linear_test);
+  tcase_add_test(testcase, curve_shapes_test);
+  tcase_add_test(testcase, curve_changed_rules_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,137 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Metrics API tests. */
+
+#include "tests.h"
+
+#include "metrics.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (metrics_text_test) {
+  const char *text;
+  struct loiter_shm_stats stats;
+
+  mark_point();
+  text = loiter_metrics_text(NULL, NULL, 0);
+  fail_unless(text == NULL, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  memset(&stats, 0, sizeof(stats));
+
+  mark_point();
+  text = loiter_metrics_text(p, &stats, 101);
+  fail_unless(text == NULL, "Failed to handle invalid probability");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  stats.conn_count = 7;
+  stats.authd_count = 2;
+  stats.nejects = 11;
+  stats.failed_count = 6;
+  stats.pressure = 30;
+  stats.cluster_unauthd_count = 3;
+  stats.cluster_npeers = 2;
+  stats.distinct_sources = 4;
+
+  mark_point();
+  text = loiter_metrics_text(p, &stats, 45);
+  fail_unless(text != NULL, "Failed to format metrics: %s", strerror(errno));
+  fail_unless(strstr(text, "\nproftpd_loiter_conn_count 7\n") != NULL,
+    "Missing conn_count in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_authd_count 2\n") != NULL,
+    "Missing authd_count in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_unauthd_count 5\n") != NULL,
+    "Missing unauthd_count in '%s'", text);
+  fail_unless(
+    strstr(text, "# TYPE proftpd_loiter_dropped_total counter\n") != NULL,
+    "Missing dropped_total type in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_dropped_total 11\n") != NULL,
+    "Missing dropped_total in '%s'", text);
+  fail_unless(
+    strstr(text, "\nproftpd_loiter_failed_login_weight 6\n") != NULL,
+    "Missing failed_login_weight in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_system_pressure 30\n") != NULL,
+    "Missing system_pressure in '%s'", text);
+  fail_unless(
+    strstr(text, "\nproftpd_loiter_cluster_unauthd_count 3\n") != NULL,
+    "Missing cluster_unauthd_count in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_cluster_peers 2\n") != NULL,
+    "Missing cluster_peers in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_distinct_sources 4\n") != NULL,
+    "Missing distinct_sources in '%s'", text);
+  fail_unless(strstr(text, "proftpd_loiter_host_unauthd_count") == NULL,
+    "Unexpected host_unauthd_count in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_drop_probability 0.45\n") != NULL,
+    "Missing drop_probability in '%s'", text);
+
+  stats.host_conn_count = 20;
+  stats.host_authd_count = 8;
+  stats.host_npartitions = 3;
+
+  mark_point();
+  text = loiter_metrics_text(p, &stats, 45);
+  fail_unless(text != NULL, "Failed to format metrics: %s", strerror(errno));
+  fail_unless(strstr(text, "\nproftpd_loiter_host_unauthd_count 12\n") != NULL,
+    "Missing host_unauthd_count in '%s'", text);
+  fail_unless(strstr(text, "\nproftpd_loiter_host_partitions 3\n") != NULL,
+    "Missing host_partitions in '%s'", text);
+
+  mark_point();
+  text = loiter_metrics_text(p, &stats, 100);
+  fail_unless(text != NULL, "Failed to format metrics: %s", strerror(errno));
+  fail_unless(strstr(text, "\nproftpd_loiter_drop_probability 1.00\n") != NULL,
+    "Missing drop_probability in '%s'", text);
+}
+END_TEST
+
+Suite *tests_get_metrics_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("metrics");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, metrics_text_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
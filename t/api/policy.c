@@ -0,0 +1,536 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Admission policy API tests. */
+
+#include "tests.h"
+
+#include "policy.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+static server_rec *make_server(void) {
+  server_rec *s;
+
+  s = pcalloc(p, sizeof(server_rec));
+  s->pool = p;
+  s->ServerName = "test";
+  return s;
+}
+
+static config_rec *add_param(server_rec *s, const char *name,
+    unsigned int argc) {
+  config_rec *c;
+
+  c = pr_config_add_set(&(s->conf), name, 0);
+  c->config_type = CONF_PARAM;
+  c->argc = argc;
+  c->argv = pcalloc(c->pool, sizeof(void *) * (argc + 1));
+  return c;
+}
+
+static config_rec *add_rules(server_rec *s, const char *name,
+    unsigned int low, unsigned int high, unsigned int rate) {
+  config_rec *c;
+
+  c = add_param(s, name, 5);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = low;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = high;
+  c->argv[2] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = rate;
+
+  return c;
+}
+
+START_TEST (policy_adjust_rules_test) {
+  int res;
+  struct loiter_rules rules;
+
+  memset(&rules, 0, sizeof(rules));
+  rules.low = 20;
+  rules.high = 100;
+
+  mark_point();
+  res = loiter_policy_adjust_rules(&rules, 0);
+  fail_unless(res == FALSE, "Expected FALSE without MaxInstances");
+
+  res = loiter_policy_adjust_rules(&rules, 200);
+  fail_unless(res == FALSE, "Expected FALSE for MaxInstances above high");
+
+  mark_point();
+  res = loiter_policy_adjust_rules(&rules, 50);
+  fail_unless(res == TRUE, "Expected TRUE for MaxInstances below high");
+  fail_unless(rules.low == 10, "Expected low 10, got %u", rules.low);
+  fail_unless(rules.high == 50, "Expected high 50, got %u", rules.high);
+}
+END_TEST
+
+START_TEST (policy_compile_curve_test) {
+  int res;
+  unsigned int pct;
+  server_rec *s;
+  config_rec *c;
+  struct loiter_curve *curve;
+  struct loiter_policy *policy;
+  struct loiter_rules rules;
+
+  mark_point();
+  res = loiter_policy_compile_curve(NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  curve = pcalloc(p, sizeof(struct loiter_curve));
+  curve->type = LOITER_CURVE_QUADRATIC;
+  curve->low = 20;
+  curve->high = 100;
+  curve->rate = 30;
+  (void) loiter_curve_compile(p, curve);
+
+  memset(&rules, 0, sizeof(rules));
+  rules.low = 20;
+  rules.high = 100;
+  rules.rate = 30;
+  rules.curve = curve;
+
+  /* Rules already tabulated keep their curve. */
+  mark_point();
+  res = loiter_policy_compile_curve(p, &rules);
+  fail_unless(res == 0, "Failed to compile curve: %s", strerror(errno));
+  fail_unless(rules.curve == curve, "Expected the compiled curve");
+
+  /* Adjusted rules get a table of their own, which is then looked up. */
+  mark_point();
+  (void) loiter_policy_adjust_rules(&rules, 50);
+  res = loiter_policy_compile_curve(p, &rules);
+  fail_unless(res == 0, "Failed to compile curve: %s", strerror(errno));
+  fail_unless(rules.curve != curve, "Expected a new curve");
+  fail_unless(rules.curve->table != NULL, "Expected a table");
+  fail_unless(rules.curve->low == 10, "Expected low 10, got %u",
+    rules.curve->low);
+  fail_unless(rules.curve->high == 50, "Expected high 50, got %u",
+    rules.curve->high);
+
+  pct = loiter_policy_drop_pct(&rules, 30);
+  fail_unless(pct == rules.curve->table[30], "Expected %u, got %u",
+    rules.curve->table[30], pct);
+
+  ((struct loiter_curve *) rules.curve)->table[30] = 42;
+  pct = loiter_policy_drop_pct(&rules, 30);
+  fail_unless(pct == 42, "Expected table lookup 42, got %u", pct);
+
+  /* Likewise for rules adjusted when compiling the policy. */
+  mark_point();
+  s = make_server();
+  c = add_rules(s, "LoiterRules", 20, 100, 30);
+  c->argv[3] = curve;
+  c = add_rules(s, "LoiterShadowRules", 20, 100, 30);
+  c->argv[3] = curve;
+  c->argv[4] = pstrdup(c->pool, "quadratic");
+
+  policy = loiter_policy_compile(p, s, 50);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(policy->rules.curve->high == 50, "Expected high 50, got %u",
+    policy->rules.curve->high);
+  fail_unless(policy->rules.curve->table != NULL, "Expected a table");
+  fail_unless(policy->nshadows == 1, "Expected 1 shadow, got %u",
+    policy->nshadows);
+  fail_unless(policy->shadows[0].rules.curve->high == 50,
+    "Expected shadow high 50, got %u", policy->shadows[0].rules.curve->high);
+}
+END_TEST
+
+START_TEST (policy_drop_pct_test) {
+  unsigned int pct;
+  struct loiter_rules rules;
+
+  memset(&rules, 0, sizeof(rules));
+  rules.low = 20;
+  rules.high = 100;
+  rules.rate = 30;
+
+  mark_point();
+  pct = loiter_policy_drop_pct(&rules, 10);
+  fail_unless(pct == 0, "Expected 0, got %u", pct);
+
+  pct = loiter_policy_drop_pct(&rules, 20);
+  fail_unless(pct == 30, "Expected 30, got %u", pct);
+
+  pct = loiter_policy_drop_pct(&rules, 60);
+  fail_unless(pct == 65, "Expected 65, got %u", pct);
+
+  pct = loiter_policy_drop_pct(&rules, 100);
+  fail_unless(pct == 100, "Expected 100, got %u", pct);
+}
+END_TEST
+
+START_TEST (policy_effective_pct_test) {
+  unsigned int pct;
+  struct loiter_policy policy;
+  struct loiter_rules rules;
+
+  memset(&policy, 0, sizeof(policy));
+  memset(&rules, 0, sizeof(rules));
+  rules.low = 20;
+  rules.high = 100;
+  rules.rate = 30;
+
+  mark_point();
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 80, 0, 0);
+  fail_unless(pct == 0, "Expected 0 below low watermark, got %u", pct);
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 200, 0, 0, 0);
+  fail_unless(pct == 100, "Expected 100 above high watermark, got %u", pct);
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 0, 40, 0);
+  fail_unless(pct == 40, "Expected host rules 40, got %u", pct);
+
+  /* With a LoiterController, its output replaces the rules. */
+  policy.use_controller = TRUE;
+
+  mark_point();
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 80, 0, 0);
+  fail_unless(pct == 80, "Expected controller 80, got %u", pct);
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 200, 5, 0, 0);
+  fail_unless(pct == 5, "Expected controller 5, got %u", pct);
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 5, 40, 0);
+  fail_unless(pct == 40, "Expected host rules 40, got %u", pct);
+
+  /* System pressure raises the probability towards 100, even when nothing
+   * else would drop.
+   */
+  mark_point();
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 0, 0, 50);
+  fail_unless(pct == 50, "Expected pressure 50, got %u", pct);
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 40, 0, 50);
+  fail_unless(pct == 70, "Expected controller 40 under pressure 70, got %u",
+    pct);
+
+  policy.use_controller = FALSE;
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 10, 0, 0, 25);
+  fail_unless(pct == 25, "Expected pressure 25, got %u", pct);
+
+  pct = loiter_policy_effective_pct(&policy, &rules, 200, 0, 0, 25);
+  fail_unless(pct == 100, "Expected 100 above high watermark, got %u", pct);
+}
+END_TEST
+
+START_TEST (policy_distinct_pct_test) {
+  unsigned int pct;
+  struct loiter_rules rules;
+
+  mark_point();
+  pct = loiter_policy_distinct_pct(0, 4, 10, 400, 1000);
+  fail_unless(pct == 0, "Expected 0 when not dropping, got %u", pct);
+
+  pct = loiter_policy_distinct_pct(30, 4, 0, 400, 1000);
+  fail_unless(pct == 30, "Expected 30 without threshold, got %u", pct);
+
+  pct = loiter_policy_distinct_pct(30, 20, 10, 400, 1000);
+  fail_unless(pct == 30, "Expected 30 for many sources, got %u", pct);
+
+  mark_point();
+  pct = loiter_policy_distinct_pct(30, 4, 10, 400, 101);
+  fail_unless(pct == 100, "Expected 100 for source over its share, got %u",
+    pct);
+
+  pct = loiter_policy_distinct_pct(30, 4, 10, 400, 50);
+  fail_unless(pct == 30, "Expected 30 for source within its share, got %u",
+    pct);
+
+  /* A flood spread evenly over a few sources, above the high watermark. */
+  memset(&rules, 0, sizeof(rules));
+  rules.low = 20;
+  rules.high = 100;
+  rules.rate = 30;
+
+  mark_point();
+  pct = loiter_policy_drop_pct(&rules, 400);
+  pct = loiter_policy_distinct_pct(pct, 4, 10, 400, 100);
+  fail_unless(pct == 100, "Expected 100 for evenly spread flood, got %u",
+    pct);
+}
+END_TEST
+
+START_TEST (policy_compile_test) {
+  server_rec *s;
+  config_rec *c;
+  struct loiter_policy *policy;
+
+  mark_point();
+  policy = loiter_policy_compile(NULL, NULL, 0);
+  fail_unless(policy == NULL, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Without any configuration, the defaults apply. */
+  mark_point();
+  s = make_server();
+  policy = loiter_policy_compile(p, s, 0);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(policy->engine == FALSE, "Expected engine off");
+  fail_unless(policy->rules_configured == FALSE, "Expected default rules");
+  fail_unless(policy->rules.low == LOITER_RULES_DEFAULT_LOW,
+    "Expected low %u, got %u", LOITER_RULES_DEFAULT_LOW, policy->rules.low);
+  fail_unless(policy->message == NULL, "Expected no message");
+
+  mark_point();
+  s = make_server();
+
+  c = add_param(s, "LoiterEngine", 1);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = TRUE;
+
+  c = add_param(s, "LoiterMessage", 1);
+  c->argv[0] = pstrdup(c->pool, "Go away");
+
+  add_rules(s, "LoiterRules", 10, 50, 20);
+  add_rules(s, "LoiterHostRules", 40, 200, 30);
+
+  policy = loiter_policy_compile(p, s, 25);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(policy->server == s, "Expected server %p, got %p", s,
+    policy->server);
+  fail_unless(policy->engine == TRUE, "Expected engine on");
+  fail_unless(policy->message != NULL &&
+    strcmp(policy->message, "Go away") == 0, "Expected message 'Go away'");
+
+  /* The rules are adjusted for MaxInstances once, here. */
+  fail_unless(policy->rules_configured == TRUE, "Expected configured rules");
+  fail_unless(policy->rules_adjusted == TRUE, "Expected adjusted rules");
+  fail_unless(policy->rules.low == 5, "Expected low 5, got %u",
+    policy->rules.low);
+  fail_unless(policy->rules.high == 25, "Expected high 25, got %u",
+    policy->rules.high);
+  fail_unless(policy->rules.rate == 20, "Expected rate 20, got %u",
+    policy->rules.rate);
+
+  fail_unless(policy->use_host_rules == TRUE, "Expected host rules");
+  fail_unless(policy->host_rules.high == 200, "Expected host high 200, got %u",
+    policy->host_rules.high);
+  fail_unless(policy->use_user_rules == FALSE, "Expected no user rules");
+  fail_unless(policy->nclasses == 0, "Expected no classes, got %u",
+    policy->nclasses);
+  fail_unless(policy->nshadows == 0, "Expected no shadow rules, got %u",
+    policy->nshadows);
+}
+END_TEST
+
+START_TEST (policy_compile_daemon_test) {
+  server_rec *s;
+  config_rec *c;
+  struct loiter_policy *policy;
+
+  s = make_server();
+
+  mark_point();
+  policy = loiter_policy_compile(p, s, 0);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(policy->table_path == NULL, "Expected no LoiterTable");
+  fail_unless(policy->use_pressure == FALSE, "Expected no LoiterPressure");
+  fail_unless(policy->cluster_peers == NULL, "Expected no cluster peers");
+
+  c = add_param(s, "LoiterTable", 2);
+  c->argv[0] = pstrdup(c->pool, "/tmp/loiter.tab");
+
+  c = add_param(s, "LoiterMetricsFile", 2);
+  c->argv[0] = pstrdup(c->pool, "/tmp/loiter.prom");
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = 15;
+
+  c = add_param(s, "LoiterClusterListen", 2);
+  c->argv[0] = pstrdup(c->pool, "0.0.0.0:8842");
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = 5;
+
+  c = add_param(s, "LoiterClusterPeer", 2);
+  c->argv[0] = pstrdup(c->pool, "10.0.0.2:8842");
+  c->argv[1] = pstrdup(c->pool, "10.0.0.3:8842");
+
+  mark_point();
+  policy = loiter_policy_compile(p, s, 0);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(strcmp(policy->table_path, "/tmp/loiter.tab") == 0,
+    "Expected LoiterTable '/tmp/loiter.tab', got '%s'", policy->table_path);
+  fail_unless(policy->table_partition == NULL, "Expected no partition");
+  fail_unless(strcmp(policy->metrics_path, "/tmp/loiter.prom") == 0,
+    "Expected LoiterMetricsFile '/tmp/loiter.prom', got '%s'",
+    policy->metrics_path);
+  fail_unless(policy->metrics_interval == 15, "Expected interval 15, got %d",
+    policy->metrics_interval);
+  fail_unless(policy->cluster_interval == 5, "Expected interval 5, got %d",
+    policy->cluster_interval);
+  fail_unless(policy->cluster_peers->nelts == 2, "Expected 2 peers, got %d",
+    policy->cluster_peers->nelts);
+  fail_unless(policy->cluster_secret == NULL, "Expected no secret");
+}
+END_TEST
+
+START_TEST (policy_compile_shadows_test) {
+  server_rec *s;
+  config_rec *c;
+  struct loiter_policy *policy;
+
+  s = make_server();
+
+  add_rules(s, "LoiterRules", 20, 100, 30);
+
+  c = add_rules(s, "LoiterShadowRules", 40, 150, 10);
+  c->argv[4] = pstrdup(c->pool, "gentle");
+
+  mark_point();
+  policy = loiter_policy_compile(p, s, 0);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(policy->nshadows == 1, "Expected 1 shadow rule, got %u",
+    policy->nshadows);
+  fail_unless(strcmp(policy->shadows[0].name, "gentle") == 0,
+    "Expected shadow rules 'gentle', got '%s'", policy->shadows[0].name);
+  fail_unless(policy->shadows[0].rules.low == 40, "Expected low 40, got %u",
+    policy->shadows[0].rules.low);
+  fail_unless(policy->shadows[0].rules.high == 150,
+    "Expected high 150, got %u", policy->shadows[0].rules.high);
+
+  /* The active rules are unaffected by the shadows. */
+  fail_unless(policy->rules.low == 20, "Expected low 20, got %u",
+    policy->rules.low);
+
+  /* Shadow rules are adjusted for MaxInstances, like the active rules. */
+  mark_point();
+  policy = loiter_policy_compile(p, s, 75);
+  fail_unless(policy != NULL, "Failed to compile policy: %s",
+    strerror(errno));
+  fail_unless(policy->shadows[0].rules.low == 20, "Expected low 20, got %u",
+    policy->shadows[0].rules.low);
+  fail_unless(policy->shadows[0].rules.high == 75, "Expected high 75, got %u",
+    policy->shadows[0].rules.high);
+}
+END_TEST
+
+START_TEST (policy_get_test) {
+  server_rec *s1, *s2, *s3;
+  struct loiter_policy *policies;
+  const struct loiter_policy *policy;
+
+  s1 = make_server();
+  s2 = make_server();
+  s3 = make_server();
+
+  policies = loiter_policy_compile(p, s1, 0);
+  policies->next = loiter_policy_compile(p, s2, 0);
+
+  mark_point();
+  policy = loiter_policy_get(policies, s2);
+  fail_unless(policy != NULL, "Failed to get policy: %s", strerror(errno));
+  fail_unless(policy->server == s2, "Expected server %p, got %p", s2,
+    policy->server);
+
+  mark_point();
+  policy = loiter_policy_get(policies, s3);
+  fail_unless(policy == NULL, "Expected no policy for unknown server");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (policy_get_class_test) {
+  pr_class_t cls1, cls2, cls3;
+  struct loiter_policy *policy;
+  const struct loiter_policy_class *class;
+
+  mark_point();
+  class = loiter_policy_get_class(NULL, NULL);
+  fail_unless(class == NULL, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  policy = loiter_policy_compile(p, make_server(), 0);
+  policy->classes = pcalloc(p, sizeof(struct loiter_policy_class) * 2);
+  policy->classes[0].cls = &cls1;
+  policy->classes[0].reserve = 1;
+  policy->classes[1].cls = &cls2;
+  policy->classes[1].reserve = 2;
+  policy->nclasses = 2;
+
+  mark_point();
+  class = loiter_policy_get_class(policy, &cls2);
+  fail_unless(class != NULL, "Failed to get class: %s", strerror(errno));
+  fail_unless(class->reserve == 2, "Expected reserve 2, got %u",
+    class->reserve);
+
+  mark_point();
+  class = loiter_policy_get_class(policy, &cls3);
+  fail_unless(class == NULL, "Expected no rules for unknown class");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+}
+END_TEST
+
+Suite *tests_get_policy_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("policy");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, policy_adjust_rules_test);
+  tcase_add_test(testcase, policy_compile_curve_test);
+  tcase_add_test(testcase, policy_drop_pct_test);
+  tcase_add_test(testcase, policy_effective_pct_test);
+  tcase_add_test(testcase, policy_distinct_pct_test);
+  tcase_add_test(testcase, policy_compile_test);
+  tcase_add_test(testcase, policy_compile_daemon_test);
+  tcase_add_test(testcase, policy_compile_shadows_test);
+  tcase_add_test(testcase, policy_get_test);
+  tcase_add_test(testcase, policy_get_class_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
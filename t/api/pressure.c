@@ -0,0 +1,155 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+/* Pressure API tests. */
+
+#include "tests.h"
+
+#include "pressure.h"
+
+START_TEST (pressure_scale_test) {
+  unsigned int res;
+
+  mark_point();
+  res = loiter_pressure_scale(10, 0);
+  fail_unless(res == 0, "Expected 0 for disabled limit, got %u", res);
+
+  mark_point();
+  res = loiter_pressure_scale(50, 100);
+  fail_unless(res == 0, "Expected 0 at half the limit, got %u", res);
+
+  mark_point();
+  res = loiter_pressure_scale(75, 100);
+  fail_unless(res == 50, "Expected 50, got %u", res);
+
+  mark_point();
+  res = loiter_pressure_scale(100, 100);
+  fail_unless(res == 100, "Expected 100 at the limit, got %u", res);
+
+  mark_point();
+  res = loiter_pressure_scale(500, 100);
+  fail_unless(res == 100, "Expected 100 past the limit, got %u", res);
+}
+END_TEST
+
+START_TEST (pressure_parse_loadavg_test) {
+  int res;
+  unsigned int load = 0, nprocs = 0;
+
+  mark_point();
+  res = loiter_pressure_parse_loadavg(NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_pressure_parse_loadavg("", &load, &nprocs);
+  fail_unless(res < 0, "Failed to handle empty text");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_pressure_parse_loadavg("0.52 0.58 0.59 2/845 12345\n", &load,
+    &nprocs);
+  fail_unless(res == 0, "Failed to parse loadavg: %s", strerror(errno));
+  fail_unless(load == 52, "Expected load 52, got %u", load);
+  fail_unless(nprocs == 845, "Expected 845 procs, got %u", nprocs);
+
+  mark_point();
+  res = loiter_pressure_parse_loadavg("12.5 1.00 1.00 9/9 1\n", &load,
+    &nprocs);
+  fail_unless(res == 0, "Failed to parse loadavg: %s", strerror(errno));
+  fail_unless(load == 1250, "Expected load 1250, got %u", load);
+  fail_unless(nprocs == 9, "Expected 9 procs, got %u", nprocs);
+}
+END_TEST
+
+START_TEST (pressure_parse_meminfo_test) {
+  int res;
+  unsigned int used_pct = 0;
+  const char *text;
+
+  mark_point();
+  res = loiter_pressure_parse_meminfo(NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  text = "MemTotal:        8000000 kB\nMemFree:          100000 kB\n";
+  res = loiter_pressure_parse_meminfo(text, &used_pct);
+  fail_unless(res < 0, "Failed to handle missing MemAvailable");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  text = "MemTotal:        8000000 kB\nMemFree:          100000 kB\n"
+    "MemAvailable:    2000000 kB\n";
+  res = loiter_pressure_parse_meminfo(text, &used_pct);
+  fail_unless(res == 0, "Failed to parse meminfo: %s", strerror(errno));
+  fail_unless(used_pct == 75, "Expected 75%%, got %u", used_pct);
+}
+END_TEST
+
+START_TEST (pressure_parse_psi_test) {
+  int res;
+  unsigned int stall = 0;
+
+  mark_point();
+  res = loiter_pressure_parse_psi(NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_pressure_parse_psi("full avg10=1.00\n", &stall);
+  fail_unless(res < 0, "Failed to handle missing 'some' line");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_pressure_parse_psi(
+    "some avg10=1.23 avg60=0.50 avg300=0.10 total=12345\n"
+    "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n", &stall);
+  fail_unless(res == 0, "Failed to parse psi: %s", strerror(errno));
+  fail_unless(stall == 123, "Expected 123, got %u", stall);
+}
+END_TEST
+
+Suite *tests_get_pressure_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("pressure");
+  testcase = tcase_create("base");
+
+  tcase_add_test(testcase, pressure_scale_test);
+  tcase_add_test(testcase, pressure_parse_loadavg_test);
+  tcase_add_test(testcase, pressure_parse_meminfo_test);
+  tcase_add_test(testcase, pressure_parse_psi_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
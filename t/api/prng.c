@@ -0,0 +1,138 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Random number API tests. */
+
+#include "tests.h"
+
+#include "prng.h"
+
+START_TEST (prng_init_test) {
+  int res;
+
+  mark_point();
+  res = loiter_prng_init();
+  fail_unless(res == 0, "Failed to seed generator: %s", strerror(errno));
+}
+END_TEST
+
+START_TEST (prng_seed_test) {
+  register unsigned int i;
+  uint64_t a[8], b[8];
+  int same = TRUE;
+
+  /* The same seed and stream repeat the same sequence... */
+  mark_point();
+  (void) loiter_prng_seed(42, 7);
+  for (i = 0; i < 8; i++) {
+    a[i] = loiter_prng_next();
+  }
+
+  (void) loiter_prng_seed(42, 7);
+  for (i = 0; i < 8; i++) {
+    b[i] = loiter_prng_next();
+    fail_unless(a[i] == b[i], "Expected same value at %u for same seed", i);
+  }
+
+  /* ...while each stream has its own. */
+  mark_point();
+  (void) loiter_prng_seed(42, 8);
+  for (i = 0; i < 8; i++) {
+    b[i] = loiter_prng_next();
+    if (a[i] != b[i]) {
+      same = FALSE;
+    }
+  }
+
+  fail_unless(same == FALSE, "Expected different streams to differ");
+}
+END_TEST
+
+START_TEST (prng_uniform_test) {
+  register unsigned int i;
+  unsigned int counts[3] = { 0, 0, 0 };
+  uint32_t v;
+
+  (void) loiter_prng_seed(1, 0);
+
+  mark_point();
+  v = loiter_prng_uniform(0);
+  fail_unless(v == 0, "Expected 0 for bound 0, got %lu", (unsigned long) v);
+
+  v = loiter_prng_uniform(1);
+  fail_unless(v == 0, "Expected 0 for bound 1, got %lu", (unsigned long) v);
+
+  mark_point();
+  for (i = 0; i < 30000; i++) {
+    v = loiter_prng_uniform(3);
+    fail_unless(v < 3, "Expected value < 3, got %lu", (unsigned long) v);
+    counts[v]++;
+  }
+
+  for (i = 0; i < 3; i++) {
+    fail_unless(counts[i] > 9500 && counts[i] < 10500,
+      "Expected about 10000 of %u, got %u", i, counts[i]);
+  }
+}
+END_TEST
+
+START_TEST (prng_chance_test) {
+  register unsigned int i;
+  unsigned int hits = 0;
+
+  (void) loiter_prng_seed(1, 0);
+
+  mark_point();
+  fail_unless(loiter_prng_chance(0) == FALSE, "Expected FALSE for 0");
+  fail_unless(loiter_prng_chance(LOITER_PRNG_SCALE) == TRUE,
+    "Expected TRUE for 100%%");
+
+  /* Probabilities finer than a percent are honored. */
+  mark_point();
+  for (i = 0; i < 100000; i++) {
+    if (loiter_prng_chance(25) == TRUE) {
+      hits++;
+    }
+  }
+
+  fail_unless(hits > 150 && hits < 350,
+    "Expected about 250 hits for 0.25%%, got %u", hits);
+}
+END_TEST
+
+Suite *tests_get_prng_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("prng");
+  testcase = tcase_create("base");
+
+  tcase_add_test(testcase, prng_init_test);
+  tcase_add_test(testcase, prng_seed_test);
+  tcase_add_test(testcase, prng_uniform_test);
+  tcase_add_test(testcase, prng_chance_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -30,6 +30,8 @@
 
 static pool *p = NULL;
 
+static const char *shm_path = "/tmp/loiter-test.tab";
+
 static void set_up(void) {
   if (p == NULL) {
     p = make_sub_pool(NULL);
@@ -38,16 +40,717 @@ static void set_up(void) {
 
 static void tear_down(void) {
   if (p) {
+    (void) loiter_shm_destroy(p);
+    (void) unlink(shm_path);
+
     destroy_pool(p);
     p = NULL;
   }
 }
 
 START_TEST (shm_get_test) {
+  int res;
+  unsigned int conn_count, authd_count;
+
+  mark_point();
+  res = loiter_shm_get(NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_get(p, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null counts");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_get(p, &conn_count, &authd_count);
+  fail_unless(res < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  conn_count = authd_count = 7;
+
+  mark_point();
+  res = loiter_shm_get(p, &conn_count, &authd_count);
+  fail_unless(res == 0, "Failed to get counts: %s", strerror(errno));
+  fail_unless(conn_count == 0, "Expected conn count 0, got %u", conn_count);
+  fail_unless(authd_count == 0, "Expected authd count 0, got %u", authd_count);
+
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 3);
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_AUTHD_COUNT, 1);
+
+  mark_point();
+  res = loiter_shm_get(p, &conn_count, NULL);
+  fail_unless(res == 0, "Failed to get conn count: %s", strerror(errno));
+  fail_unless(conn_count == 3, "Expected conn count 3, got %u", conn_count);
+
+  mark_point();
+  res = loiter_shm_get(p, NULL, &authd_count);
+  fail_unless(res == 0, "Failed to get authd count: %s", strerror(errno));
+  fail_unless(authd_count == 1, "Expected authd count 1, got %u", authd_count);
 }
 END_TEST
 
 START_TEST (shm_incr_test) {
+  register unsigned int i;
+  int res;
+  unsigned int conn_count, nchildren = 4, nincrs = 250;
+  struct loiter_shm_lock_stats lock_stats;
+  unsigned long nlocks;
+
+  mark_point();
+  res = loiter_shm_incr(NULL, LOITER_FIELD_ID_CONN_COUNT, 1);
+  fail_unless(res < 0, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_incr(p, -1, 1);
+  fail_unless(res < 0, "Failed to handle invalid field ID");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1);
+  fail_unless(res < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  mark_point();
+  res = loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 0);
+  fail_unless(res == 0, "Failed to handle zero increment: %s",
+    strerror(errno));
+
+  /* Counts never wrap below zero. */
+  mark_point();
+  res = loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, -2);
+  fail_unless(res == 0, "Failed to decrement conn count: %s", strerror(errno));
+
+  res = loiter_shm_get(p, &conn_count, NULL);
+  fail_unless(res == 0, "Failed to get conn count: %s", strerror(errno));
+  fail_unless(conn_count == 0, "Expected conn count 0, got %u", conn_count);
+
+  res = loiter_shm_get_lock_stats(p, &lock_stats);
+  fail_unless(res == 0, "Failed to get lock stats: %s", strerror(errno));
+  nlocks = lock_stats.nlocks;
+
+  mark_point();
+  res = loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1);
+  fail_unless(res == 0, "Failed to increment conn count: %s", strerror(errno));
+
+  res = loiter_shm_get_lock_stats(p, &lock_stats);
+  fail_unless(res == 0, "Failed to get lock stats: %s", strerror(errno));
+  fail_unless(lock_stats.nlocks == nlocks + 1, "Expected %lu locks, got %lu",
+    nlocks + 1, lock_stats.nlocks);
+
+  /* Increments from several processes at once must not be lost. */
+  for (i = 0; i < nchildren; i++) {
+    pid_t pid;
+
+    pid = fork();
+    fail_unless(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+    if (pid == 0) {
+      register unsigned int j;
+
+      for (j = 0; j < nincrs; j++) {
+        if (loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1) < 0) {
+          _exit(1);
+        }
+      }
+
+      _exit(0);
+    }
+  }
+
+  for (i = 0; i < nchildren; i++) {
+    int status = 0;
+
+    res = wait(&status);
+    fail_unless(res > 0, "Failed to wait for child: %s", strerror(errno));
+    fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+      "Child failed to increment conn count");
+  }
+
+  res = loiter_shm_get(p, &conn_count, NULL);
+  fail_unless(res == 0, "Failed to get conn count: %s", strerror(errno));
+  fail_unless(conn_count == (nchildren * nincrs) + 1,
+    "Expected conn count %u, got %u", (nchildren * nincrs) + 1, conn_count);
+}
+END_TEST
+
+START_TEST (shm_slot_test) {
+  int idx, res;
+  pid_t pid = 0, session_pid = 4242;
+  unsigned int idle = 0;
+
+  mark_point();
+  idx = loiter_shm_slot_claim(p, session_pid);
+  fail_unless(idx < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  idx = loiter_shm_slot_claim(p, session_pid);
+  fail_unless(idx >= 0, "Failed to claim slot: %s", strerror(errno));
+
+  res = loiter_shm_slot_is_shed(p, idx, session_pid);
+  fail_unless(res == FALSE, "Expected FALSE for unmarked slot, got %d", res);
+
+  mark_point();
+  res = loiter_shm_slot_shed_idlest(p, 0, &pid, &idle);
+  fail_unless(res == idx, "Expected slot %d, got %d", idx, res);
+  fail_unless(pid == session_pid, "Expected PID %lu, got %lu",
+    (unsigned long) session_pid, (unsigned long) pid);
+
+  res = loiter_shm_slot_is_shed(p, idx, session_pid);
+  fail_unless(res == TRUE, "Expected TRUE for marked slot, got %d", res);
+
+  /* A marked slot is not marked again, but left for its session. */
+  mark_point();
+  res = loiter_shm_slot_shed_idlest(p, 0, &pid, &idle);
+  fail_unless(res < 0, "Failed to skip marked slot");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  res = loiter_shm_slot_is_shed(p, idx, session_pid);
+  fail_unless(res == TRUE, "Expected TRUE for marked slot, got %d", res);
+
+  /* A marked session's slot is still released, e.g. when it is not a
+   * session any longer.
+   */
+  mark_point();
+  res = loiter_shm_slot_release(p, idx, session_pid);
+  fail_unless(res == 0, "Failed to release slot: %s", strerror(errno));
+
+  res = loiter_shm_slot_is_shed(p, idx, session_pid);
+  fail_unless(res == FALSE, "Expected FALSE for released slot, got %d", res);
+}
+END_TEST
+
+START_TEST (shm_timing_test) {
+  int res;
+  struct loiter_histogram hist;
+  struct loiter_shm_stats stats;
+  const char *name;
+
+  mark_point();
+  res = loiter_shm_timing_add(NULL, LOITER_SHM_TIMING_SESS_INIT, 1000);
+  fail_unless(res < 0, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_timing_add(p, LOITER_SHM_NTIMINGS, 1000);
+  fail_unless(res < 0, "Failed to handle invalid timing ID");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_timing_add(p, LOITER_SHM_TIMING_SESS_INIT, 1000);
+  fail_unless(res < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_get_timing(p, LOITER_SHM_TIMING_SESS_INIT, NULL);
+  fail_unless(res < 0, "Failed to handle null histogram");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  (void) loiter_shm_timing_add(p, LOITER_SHM_TIMING_POLICY, 2000);
+  (void) loiter_shm_timing_add(p, LOITER_SHM_TIMING_POLICY, 4000);
+
+  mark_point();
+  res = loiter_shm_get_timing(p, LOITER_SHM_TIMING_POLICY, &hist);
+  fail_unless(res == 0, "Failed to get timing: %s", strerror(errno));
+  fail_unless(hist.count == 2, "Expected count 2, got %llu",
+    (unsigned long long) hist.count);
+  fail_unless(hist.sum == 6000, "Expected sum 6000, got %llu",
+    (unsigned long long) hist.sum);
+  fail_unless(hist.max == 4000, "Expected max 4000, got %llu",
+    (unsigned long long) hist.max);
+
+  res = loiter_shm_get_timing(p, LOITER_SHM_TIMING_LOG, &hist);
+  fail_unless(res == 0, "Failed to get timing: %s", strerror(errno));
+  fail_unless(hist.count == 0, "Expected count 0, got %llu",
+    (unsigned long long) hist.count);
+
+  name = loiter_shm_get_timing_name(LOITER_SHM_TIMING_SHM_LOCK);
+  fail_unless(name != NULL && strcmp(name, "shm_lock") == 0,
+    "Expected 'shm_lock', got '%s'", name);
+
+  name = loiter_shm_get_timing_name(-1);
+  fail_unless(name == NULL, "Failed to handle invalid timing ID");
+
+  /* Without contention, the lock is never retried. */
+  res = loiter_shm_get_stats(p, &stats);
+  fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+  fail_unless(stats.lock_nretries == 0, "Expected 0 lock retries, got %u",
+    stats.lock_nretries);
+  fail_unless(stats.lock_backoff_nsecs == 0,
+    "Expected no lock backoff, got %llu",
+    (unsigned long long) stats.lock_backoff_nsecs);
+}
+END_TEST
+
+START_TEST (shm_partition_test) {
+  register unsigned int i;
+  int res;
+
+  mark_point();
+  res = loiter_shm_set_partition(p, NULL);
+  fail_unless(res < 0, "Failed to handle null name");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_set_partition(p, "a");
+  fail_unless(res < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  /* Each name gets its own partition, reused when claimed again. */
+  for (i = 0; i < LOITER_SHM_MAX_PARTITIONS; i++) {
+    char name[LOITER_SHM_PARTITION_NAMESZ];
+    struct loiter_shm_stats stats;
+
+    snprintf(name, sizeof(name), "daemon%u", i);
+    res = loiter_shm_set_partition(p, name);
+    fail_unless(res == 0, "Failed to set partition '%s': %s", name,
+      strerror(errno));
+
+    res = loiter_shm_set_partition(p, name);
+    fail_unless(res == 0, "Failed to set partition '%s' again: %s", name,
+      strerror(errno));
+
+    res = loiter_shm_get_stats(p, &stats);
+    fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+    fail_unless(stats.host_npartitions == i + 1,
+      "Expected %u partitions, got %u", i + 1, stats.host_npartitions);
+  }
+
+  mark_point();
+  res = loiter_shm_set_partition(p, "extra");
+  fail_unless(res < 0, "Failed to handle all partitions in use");
+  fail_unless(errno == ENOSPC, "Expected ENOSPC (%d), got %s (%d)", ENOSPC,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (shm_partition_isolation_test) {
+  int idx, res, status = 0;
+  pid_t pid, shed_pid = 0;
+  unsigned int idle = 0;
+  struct loiter_shm_stats stats;
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  res = loiter_shm_set_partition(p, "a");
+  fail_unless(res == 0, "Failed to set partition: %s", strerror(errno));
+
+  /* Another daemon, sharing the table, with its own partition. */
+  pid = fork();
+  fail_unless(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+  if (pid == 0) {
+    if (loiter_shm_set_partition(p, "b") < 0 ||
+        loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 3) < 0 ||
+        loiter_shm_incr(p, LOITER_FIELD_ID_AUTHD_COUNT, 1) < 0 ||
+        loiter_shm_slot_claim(p, getpid()) < 0) {
+      _exit(1);
+    }
+
+    _exit(0);
+  }
+
+  res = waitpid(pid, &status, 0);
+  fail_unless(res == pid, "Failed to wait for child: %s", strerror(errno));
+  fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+    "Child failed to count in its partition");
+
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 2);
+
+  res = loiter_shm_get_stats(p, &stats);
+  fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+  fail_unless(stats.conn_count == 2, "Expected conn count 2, got %u",
+    stats.conn_count);
+  fail_unless(stats.authd_count == 0, "Expected authd count 0, got %u",
+    stats.authd_count);
+  fail_unless(stats.host_conn_count == 5,
+    "Expected host conn count 5, got %u", stats.host_conn_count);
+  fail_unless(stats.host_authd_count == 1,
+    "Expected host authd count 1, got %u", stats.host_authd_count);
+  fail_unless(stats.host_npartitions == 2, "Expected 2 partitions, got %u",
+    stats.host_npartitions);
+
+  /* Only our own sessions' slots are shed. */
+  mark_point();
+  res = loiter_shm_slot_shed_idlest(p, 0, &shed_pid, &idle);
+  fail_unless(res < 0, "Failed to skip other partition's slot");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  idx = loiter_shm_slot_claim(p, 4242);
+  fail_unless(idx >= 0, "Failed to claim slot: %s", strerror(errno));
+
+  res = loiter_shm_slot_shed_idlest(p, 0, &shed_pid, &idle);
+  fail_unless(res == idx, "Expected slot %d, got %d", idx, res);
+  fail_unless(shed_pid == 4242, "Expected PID 4242, got %lu",
+    (unsigned long) shed_pid);
+
+  /* Reclaiming our partition, as after a restart, only clears our counts. */
+  mark_point();
+  res = loiter_shm_set_partition(p, "a");
+  fail_unless(res == 0, "Failed to set partition: %s", strerror(errno));
+
+  res = loiter_shm_get_stats(p, &stats);
+  fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+  fail_unless(stats.conn_count == 0, "Expected conn count 0, got %u",
+    stats.conn_count);
+  fail_unless(stats.host_conn_count == 3,
+    "Expected host conn count 3, got %u", stats.host_conn_count);
+}
+END_TEST
+
+START_TEST (shm_remove_test) {
+  int res;
+  struct loiter_shm_stats stats;
+
+  mark_point();
+  res = loiter_shm_remove(NULL, shm_path);
+  fail_unless(res < 0, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  res = loiter_shm_set_partition(p, "test");
+  fail_unless(res == 0, "Failed to set partition: %s", strerror(errno));
+
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 3);
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_AUTHD_COUNT, 1);
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_NEJECTS, 2);
+  (void) loiter_shm_set_rules(p, 5, 10, 50);
+
+  mark_point();
+  res = loiter_shm_remove(p, shm_path);
+  fail_unless(res == 0, "Failed to remove shm: %s", strerror(errno));
+
+  /* The connections still open keep their counts, and partition. */
+  res = loiter_shm_get_stats(p, &stats);
+  fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+  fail_unless(stats.conn_count == 3, "Expected conn count 3, got %u",
+    stats.conn_count);
+  fail_unless(stats.authd_count == 1, "Expected authd count 1, got %u",
+    stats.authd_count);
+  fail_unless(stats.host_conn_count == 3,
+    "Expected host conn count 3, got %u", stats.host_conn_count);
+  fail_unless(stats.host_npartitions == 1, "Expected 1 partition, got %u",
+    stats.host_npartitions);
+  fail_unless(stats.nejects == 0, "Expected nejects 0, got %u",
+    stats.nejects);
+  fail_unless(stats.rules_low == 0, "Expected no runtime rules, got low %u",
+    stats.rules_low);
+
+  /* So that, as they end, their counts reach zero, and no lower. */
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, -2);
+
+  res = loiter_shm_get_stats(p, &stats);
+  fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+  fail_unless(stats.conn_count == 1, "Expected conn count 1, got %u",
+    stats.conn_count);
+}
+END_TEST
+
+START_TEST (shm_resize_test) {
+  int res;
+  struct loiter_histogram hist;
+  struct loiter_shm_stats stats;
+
+  mark_point();
+  res = loiter_shm_resize(p, NULL);
+  fail_unless(res < 0, "Failed to handle null path");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  res = loiter_shm_set_partition(p, "test");
+  fail_unless(res == 0, "Failed to set partition: %s", strerror(errno));
+
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 3);
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_NEJECTS, 2);
+  (void) loiter_shm_set_rules(p, 5, 10, 50);
+  (void) loiter_shm_timing_add(p, LOITER_SHM_TIMING_POLICY, 2000);
+
+  mark_point();
+  res = loiter_shm_resize(p, shm_path);
+  fail_unless(res == 0, "Failed to resize shm: %s", strerror(errno));
+
+  res = loiter_shm_get_stats(p, &stats);
+  fail_unless(res == 0, "Failed to get stats: %s", strerror(errno));
+  fail_unless(stats.conn_count == 3, "Expected conn count 3, got %u",
+    stats.conn_count);
+  fail_unless(stats.nejects == 2, "Expected nejects 2, got %u",
+    stats.nejects);
+  fail_unless(stats.host_npartitions == 1, "Expected 1 partition, got %u",
+    stats.host_npartitions);
+  fail_unless(stats.rules_low == 5 && stats.rules_high == 10 &&
+    stats.rules_rate == 50, "Expected rules 5/10/50, got %u/%u/%u",
+    stats.rules_low, stats.rules_high, stats.rules_rate);
+
+  res = loiter_shm_get_timing(p, LOITER_SHM_TIMING_POLICY, &hist);
+  fail_unless(res == 0, "Failed to get timing: %s", strerror(errno));
+  fail_unless(hist.count == 1, "Expected count 1, got %llu",
+    (unsigned long long) hist.count);
+}
+END_TEST
+
+START_TEST (shm_follow_test) {
+  int fds[2], res, status = 0;
+  pid_t pid;
+  unsigned int conn_count;
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1);
+
+  res = pipe(fds);
+  fail_unless(res == 0, "Failed to create pipe: %s", strerror(errno));
+
+  /* A session attached to the old segment counts in the new one. */
+  pid = fork();
+  fail_unless(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+  if (pid == 0) {
+    char ch;
+
+    (void) close(fds[1]);
+    if (read(fds[0], &ch, 1) != 1) {
+      _exit(1);
+    }
+
+    if (loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1) < 0 ||
+        loiter_shm_slot_claim(p, getpid()) < 0 ||
+        loiter_shm_timing_add(p, LOITER_SHM_TIMING_POLICY, 1000) < 0) {
+      _exit(1);
+    }
+
+    _exit(0);
+  }
+
+  (void) close(fds[0]);
+
+  mark_point();
+  res = loiter_shm_resize(p, shm_path);
+  fail_unless(res == 0, "Failed to resize shm: %s", strerror(errno));
+
+  res = write(fds[1], "x", 1);
+  fail_unless(res == 1, "Failed to signal child: %s", strerror(errno));
+  (void) close(fds[1]);
+
+  res = waitpid(pid, &status, 0);
+  fail_unless(res == pid, "Failed to wait for child: %s", strerror(errno));
+  fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+    "Child failed to use migrated shm");
+
+  res = loiter_shm_get(p, &conn_count, NULL);
+  fail_unless(res == 0, "Failed to get conn count: %s", strerror(errno));
+  fail_unless(conn_count == 2, "Expected conn count 2, got %u", conn_count);
+
+  /* The lock-free paths follow too. */
+  res = loiter_shm_slot_release(p, 0, pid);
+  fail_unless(res == 0, "Failed to release child's slot: %s",
+    strerror(errno));
+}
+END_TEST
+
+START_TEST (shm_snapshot_test) {
+  register unsigned int i;
+  int res, status = 0;
+  pid_t pid;
+  struct loiter_shm_stats stats;
+
+  mark_point();
+  res = loiter_shm_get_snapshot(p, &stats);
+  fail_unless(res < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  res = loiter_shm_set_partition(p, "test");
+  fail_unless(res == 0, "Failed to set partition: %s", strerror(errno));
+
+  /* Each increment updates both the partition and the host-wide counts; a
+   * snapshot must never see one without the other.
+   */
+  pid = fork();
+  fail_unless(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+  if (pid == 0) {
+    for (i = 0; i < 2000; i++) {
+      (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1);
+      (void) loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, -1);
+    }
+
+    _exit(0);
+  }
+
+  for (i = 0; i < 2000; i++) {
+    res = loiter_shm_get_snapshot(p, &stats);
+    fail_unless(res == 0, "Failed to get snapshot: %s", strerror(errno));
+    fail_unless(stats.conn_count == stats.host_conn_count,
+      "Inconsistent snapshot: conn count %u, host conn count %u",
+      stats.conn_count, stats.host_conn_count);
+  }
+
+  res = waitpid(pid, &status, 0);
+  fail_unless(res == pid, "Failed to wait for child: %s", strerror(errno));
+
+  res = loiter_shm_get_snapshot(p, &stats);
+  fail_unless(res == 0, "Failed to get snapshot: %s", strerror(errno));
+  fail_unless(stats.conn_count == 0, "Expected conn count 0, got %u",
+    stats.conn_count);
+}
+END_TEST
+
+START_TEST (shm_shadow_test) {
+  register unsigned int i;
+  int idx, res;
+  unsigned int nchildren = 4, nincrs = 250, nshadows = 0;
+  struct loiter_shm_shadow_stats *shadows = NULL;
+
+  mark_point();
+  res = loiter_shm_shadow_incr(p, -1, TRUE, FALSE);
+  fail_unless(res < 0, "Failed to handle invalid index");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  idx = loiter_shm_set_shadow(p, "candidate");
+  fail_unless(idx < 0, "Failed to handle missing shm");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_shm_create(p, shm_path);
+  fail_unless(res == 0, "Failed to create shm: %s", strerror(errno));
+
+  idx = loiter_shm_set_shadow(p, "candidate");
+  fail_unless(idx >= 0, "Failed to set shadow: %s", strerror(errno));
+
+  (void) loiter_shm_shadow_incr(p, idx, TRUE, FALSE);
+  (void) loiter_shm_shadow_incr(p, idx, FALSE, TRUE);
+  (void) loiter_shm_shadow_incr(p, idx, FALSE, FALSE);
+
+  mark_point();
+  res = loiter_shm_get_shadows(p, &shadows, &nshadows);
+  fail_unless(res == 0, "Failed to get shadows: %s", strerror(errno));
+  fail_unless(nshadows == 1, "Expected 1 shadow, got %u", nshadows);
+  fail_unless(strcmp(shadows[0].name, "candidate") == 0,
+    "Expected 'candidate', got '%s'", shadows[0].name);
+  fail_unless(shadows[0].nevals == 3, "Expected 3 evals, got %u",
+    shadows[0].nevals);
+  fail_unless(shadows[0].ndrops == 1, "Expected 1 drop, got %u",
+    shadows[0].ndrops);
+  fail_unless(shadows[0].nextra == 1, "Expected 1 extra, got %u",
+    shadows[0].nextra);
+  fail_unless(shadows[0].nspared == 1, "Expected 1 spared, got %u",
+    shadows[0].nspared);
+
+  /* Increments from several processes at once must not be lost. */
+  for (i = 0; i < nchildren; i++) {
+    pid_t pid;
+
+    pid = fork();
+    fail_unless(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+    if (pid == 0) {
+      register unsigned int j;
+
+      for (j = 0; j < nincrs; j++) {
+        if (loiter_shm_shadow_incr(p, idx, TRUE, TRUE) < 0) {
+          _exit(1);
+        }
+      }
+
+      _exit(0);
+    }
+  }
+
+  for (i = 0; i < nchildren; i++) {
+    int status = 0;
+
+    res = wait(&status);
+    fail_unless(res > 0, "Failed to wait for child: %s", strerror(errno));
+    fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+      "Child failed to count shadow decisions");
+  }
+
+  /* The counts survive a resize, and keep counting. */
+  mark_point();
+  res = loiter_shm_resize(p, shm_path);
+  fail_unless(res == 0, "Failed to resize shm: %s", strerror(errno));
+
+  (void) loiter_shm_shadow_incr(p, idx, TRUE, FALSE);
+
+  res = loiter_shm_get_shadows(p, &shadows, &nshadows);
+  fail_unless(res == 0, "Failed to get shadows: %s", strerror(errno));
+  fail_unless(nshadows == 1, "Expected 1 shadow, got %u", nshadows);
+  fail_unless(shadows[0].nevals == (nchildren * nincrs) + 4,
+    "Expected %u evals, got %u", (nchildren * nincrs) + 4, shadows[0].nevals);
+  fail_unless(shadows[0].ndrops == (nchildren * nincrs) + 2,
+    "Expected %u drops, got %u", (nchildren * nincrs) + 2, shadows[0].ndrops);
+  fail_unless(shadows[0].nextra == 2, "Expected 2 extra, got %u",
+    shadows[0].nextra);
+
+  /* A remove starts the comparison afresh, for the same rules. */
+  mark_point();
+  res = loiter_shm_remove(p, shm_path);
+  fail_unless(res == 0, "Failed to remove shm: %s", strerror(errno));
+
+  (void) loiter_shm_shadow_incr(p, idx, FALSE, TRUE);
+
+  res = loiter_shm_get_shadows(p, &shadows, &nshadows);
+  fail_unless(res == 0, "Failed to get shadows: %s", strerror(errno));
+  fail_unless(nshadows == 1, "Expected 1 shadow, got %u", nshadows);
+  fail_unless(shadows[0].nevals == 1, "Expected 1 eval, got %u",
+    shadows[0].nevals);
+  fail_unless(shadows[0].nspared == 1, "Expected 1 spared, got %u",
+    shadows[0].nspared);
 }
 END_TEST
 
@@ -62,6 +765,15 @@ Suite *tests_get_shm_suite(void) {
 
   tcase_add_test(testcase, shm_get_test);
   tcase_add_test(testcase, shm_incr_test);
+  tcase_add_test(testcase, shm_slot_test);
+  tcase_add_test(testcase, shm_timing_test);
+  tcase_add_test(testcase, shm_partition_test);
+  tcase_add_test(testcase, shm_partition_isolation_test);
+  tcase_add_test(testcase, shm_remove_test);
+  tcase_add_test(testcase, shm_resize_test);
+  tcase_add_test(testcase, shm_follow_test);
+  tcase_add_test(testcase, shm_snapshot_test);
+  tcase_add_test(testcase, shm_shadow_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
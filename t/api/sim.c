@@ -0,0 +1,178 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Traffic simulator tests. */
+
+#include "tests.h"
+
+#include "sim/sim.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (sim_get_attack_type_test) {
+  int res;
+
+  mark_point();
+  res = loiter_sim_get_attack_type(NULL);
+  fail_unless(res < 0, "Failed to handle null name");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = loiter_sim_get_attack_type("foo");
+  fail_unless(res < 0, "Failed to handle unknown attack type");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  res = loiter_sim_get_attack_type("SlowLoris");
+  fail_unless(res == LOITER_SIM_ATTACK_SLOWLORIS,
+    "Expected slowloris (%d), got %d", LOITER_SIM_ATTACK_SLOWLORIS, res);
+}
+END_TEST
+
+START_TEST (sim_run_test) {
+  int res;
+  struct loiter_sim_config cfg;
+  struct loiter_sim_result sim_res;
+
+  mark_point();
+  res = loiter_sim_run(NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  loiter_sim_init(&cfg);
+  cfg.rules.low = cfg.rules.high;
+
+  mark_point();
+  res = loiter_sim_run(p, &cfg, &sim_res);
+  fail_unless(res < 0, "Failed to handle low watermark >= high watermark");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Without an attack, the default rules never drop a legitimate login. */
+  loiter_sim_init(&cfg);
+  cfg.duration = 600.0;
+
+  mark_point();
+  res = loiter_sim_run(p, &cfg, &sim_res);
+  fail_unless(res == 0, "Failed to run simulation: %s", strerror(errno));
+  fail_unless(sim_res.legit_attempts > 0, "Expected legitimate logins");
+  fail_unless(sim_res.legit_logins == sim_res.legit_attempts,
+    "Expected %u logins, got %u", sim_res.legit_attempts,
+    sim_res.legit_logins);
+  fail_unless(sim_res.legit_dropped == 0, "Expected no drops, got %u",
+    sim_res.legit_dropped);
+  fail_unless(sim_res.attack_attempts == 0, "Expected no attack, got %u",
+    sim_res.attack_attempts);
+}
+END_TEST
+
+START_TEST (sim_run_seed_test) {
+  int res;
+  struct loiter_sim_config cfg;
+  struct loiter_sim_result res1, res2;
+
+  loiter_sim_init(&cfg);
+  cfg.duration = 600.0;
+  cfg.attack_type = LOITER_SIM_ATTACK_BURSTY;
+  cfg.seed = 7;
+
+  /* The same seed replays the same traffic, and the same drops. */
+  mark_point();
+  res = loiter_sim_run(p, &cfg, &res1);
+  fail_unless(res == 0, "Failed to run simulation: %s", strerror(errno));
+
+  res = loiter_sim_run(p, &cfg, &res2);
+  fail_unless(res == 0, "Failed to run simulation: %s", strerror(errno));
+
+  fail_unless(res1.legit_attempts == res2.legit_attempts,
+    "Expected %u legitimate logins, got %u", res1.legit_attempts,
+    res2.legit_attempts);
+  fail_unless(res1.legit_logins == res2.legit_logins,
+    "Expected %u successful logins, got %u", res1.legit_logins,
+    res2.legit_logins);
+  fail_unless(res1.attack_dropped == res2.attack_dropped,
+    "Expected %u dropped attack connections, got %u", res1.attack_dropped,
+    res2.attack_dropped);
+}
+END_TEST
+
+START_TEST (sim_run_slowloris_test) {
+  int res;
+  struct loiter_sim_config cfg;
+  struct loiter_sim_result sim_res;
+
+  /* Rules which never engage leave MaxInstances to the attacker. */
+  loiter_sim_init(&cfg);
+  cfg.duration = 600.0;
+  cfg.max_instances = 50;
+  cfg.rules.low = 1000;
+  cfg.rules.high = 2000;
+  cfg.attack_type = LOITER_SIM_ATTACK_SLOWLORIS;
+  cfg.slowloris_conns = 100;
+
+  mark_point();
+  res = loiter_sim_run(p, &cfg, &sim_res);
+  fail_unless(res == 0, "Failed to run simulation: %s", strerror(errno));
+  fail_unless(sim_res.legit_refused > 0,
+    "Expected legitimate logins refused for MaxInstances");
+  fail_unless(sim_res.attack_dropped == 0, "Expected no drops, got %u",
+    sim_res.attack_dropped);
+  fail_unless(sim_res.attack_occupancy > 0.9,
+    "Expected attack occupancy > 0.9, got %f", sim_res.attack_occupancy);
+  fail_unless(loiter_sim_success_pct(&sim_res) < 10.0,
+    "Expected success < 10%%, got %f", loiter_sim_success_pct(&sim_res));
+}
+END_TEST
+
+Suite *tests_get_sim_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("sim");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, sim_get_attack_type_test);
+  tcase_add_test(testcase, sim_run_test);
+  tcase_add_test(testcase, sim_run_seed_test);
+  tcase_add_test(testcase, sim_run_slowloris_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,318 @@
+/*
+ * ProFTPD - mod_loiter testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Sketch API tests. */
+
+#include "tests.h"
+
+#include "sketch.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (sketch_add_test) {
+  register unsigned int i;
+  unsigned int count;
+  struct loiter_sketch *sketch;
+
+  mark_point();
+  count = loiter_sketch_add(NULL, 0, 0, NULL);
+  fail_unless(count == 0, "Failed to handle null sketch");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  sketch = pcalloc(p, sizeof(struct loiter_sketch));
+
+  /* Many light sources, and one heavy one. */
+  for (i = 0; i < 1000; i++) {
+    (void) loiter_sketch_add(sketch, 1, i, "light");
+
+    if (i % 10 == 0) {
+      count = loiter_sketch_add(sketch, 1, 424242, "heavy");
+    }
+  }
+
+  fail_unless(count >= 100, "Expected estimate >= 100, got %u", count);
+  fail_unless(loiter_sketch_estimate(sketch, 424242) == count,
+    "Expected estimate %u, got %u", count,
+    loiter_sketch_estimate(sketch, 424242));
+
+  for (i = 0; i < LOITER_SKETCH_TOPK; i++) {
+    if (strcmp(sketch->top[i].name, "heavy") == 0) {
+      break;
+    }
+  }
+
+  fail_unless(i < LOITER_SKETCH_TOPK, "Heavy source missing from top");
+  fail_unless(sketch->top[i].key == 424242, "Expected key 424242, got %lu",
+    (unsigned long) sketch->top[i].key);
+
+  /* Counts halve with each new window. */
+  mark_point();
+  count = loiter_sketch_add(sketch, 2, 424242, "heavy");
+  fail_unless(count >= 51 && count <= 60, "Expected estimate ~51, got %u",
+    count);
+
+  /* And are forgotten, eventually. */
+  mark_point();
+  count = loiter_sketch_add(sketch, 100, 424242, "heavy");
+  fail_unless(count == 1, "Expected estimate 1, got %u", count);
+}
+END_TEST
+
+START_TEST (hll_estimate_test) {
+  register unsigned int i;
+  unsigned int estimate;
+  struct loiter_hll *hll;
+
+  mark_point();
+  estimate = loiter_hll_estimate(NULL);
+  fail_unless(estimate == 0, "Failed to handle null hll");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  hll = pcalloc(p, sizeof(struct loiter_hll));
+  loiter_hll_clear(hll, 7);
+  fail_unless(hll->window == 7, "Expected window 7, got %lu",
+    (unsigned long) hll->window);
+
+  estimate = loiter_hll_estimate(hll);
+  fail_unless(estimate == 0, "Expected estimate 0, got %u", estimate);
+
+  /* Repeated sources are not distinct. */
+  for (i = 0; i < 1000; i++) {
+    loiter_hll_add(hll, i % 10);
+  }
+
+  estimate = loiter_hll_estimate(hll);
+  fail_unless(estimate == 10, "Expected estimate 10, got %u", estimate);
+  fail_unless(hll->nkeys == 1000, "Expected 1000 keys, got %u", hll->nkeys);
+
+  for (i = 0; i < 50000; i++) {
+    loiter_hll_add(hll, i);
+  }
+
+  /* The standard error, with 4096 registers, is about 1.6%. */
+  estimate = loiter_hll_estimate(hll);
+  fail_unless(estimate >= 47500 && estimate <= 52500,
+    "Expected estimate ~50000, got %u", estimate);
+}
+END_TEST
+
+START_TEST (bucket_take_test) {
+  register unsigned int i;
+  int res;
+  uint64_t bucket = 0;
+  uint32_t now_ms = 1000;
+
+  mark_point();
+  res = loiter_bucket_take(NULL, 0, 0, 0, 0);
+  fail_unless(res < 0, "Failed to handle null bucket");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = loiter_bucket_take(&bucket, 42, now_ms, 60, LOITER_BUCKET_MAX_BURST+1);
+  fail_unless(res < 0, "Failed to handle too large burst");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* A new source starts with a full burst... */
+  for (i = 0; i < 3; i++) {
+    res = loiter_bucket_take(&bucket, 42, now_ms, 60, 3);
+    fail_unless(res == TRUE, "Expected TRUE, got %d", res);
+  }
+
+  res = loiter_bucket_take(&bucket, 42, now_ms, 60, 3);
+  fail_unless(res == FALSE, "Expected FALSE, got %d", res);
+
+  /* ...and then gets one token a second, at 60 per minute, even when asking
+   * more often than that.
+   */
+  for (i = 0; i < 9; i++) {
+    now_ms += 100;
+    res = loiter_bucket_take(&bucket, 42, now_ms, 60, 3);
+    fail_unless(res == FALSE, "Expected FALSE at %lu ms, got %d",
+      (unsigned long) now_ms, res);
+  }
+
+  /* Allow a little for the millisecond rounding, which never favors the
+   * caller.
+   */
+  now_ms += 200;
+  res = loiter_bucket_take(&bucket, 42, now_ms, 60, 3);
+  fail_unless(res == TRUE, "Expected TRUE, got %d", res);
+
+  /* A colliding source takes the bucket over. */
+  res = loiter_bucket_take(&bucket, 43, now_ms, 60, 3);
+  fail_unless(res == TRUE, "Expected TRUE, got %d", res);
+
+  for (i = 0; i < 2; i++) {
+    res = loiter_bucket_take(&bucket, 43, now_ms, 60, 3);
+    fail_unless(res == TRUE, "Expected TRUE, got %d", res);
+  }
+
+  res = loiter_bucket_take(&bucket, 43, now_ms, 60, 3);
+  fail_unless(res == FALSE, "Expected FALSE, got %d", res);
+
+  /* A caller whose clock reading is older than the bucket's last refill,
+   * e.g. from reading it just before another process, earns nothing.
+   */
+  mark_point();
+  res = loiter_bucket_take(&bucket, 43, now_ms - 5, 60, 3);
+  fail_unless(res == FALSE, "Expected FALSE for earlier time, got %d", res);
+
+  res = loiter_bucket_take(&bucket, 43, now_ms - 1000, 60, 3);
+  fail_unless(res == FALSE, "Expected FALSE for earlier time, got %d", res);
+
+  /* A bucket idle for long enough for the clock to wrap is full again. */
+  mark_point();
+  res = loiter_bucket_take(&bucket, 43, now_ms + 0x90000000UL, 60, 3);
+  fail_unless(res == TRUE, "Expected TRUE after wrapping, got %d", res);
+}
+END_TEST
+
+START_TEST (counter_incr_test) {
+  int res;
+  uint64_t counter = 0;
+  uint32_t now = 1000;
+
+  mark_point();
+  res = loiter_counter_incr(NULL, 0, 0, 0);
+  fail_unless(res < 0, "Failed to handle null counter");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = loiter_counter_incr(&counter, 42, now, 60);
+  fail_unless(res == 1, "Expected 1, got %d", res);
+
+  res = loiter_counter_incr(&counter, 42, now + 30, 60);
+  fail_unless(res == 2, "Expected 2, got %d", res);
+
+  res = (int) loiter_counter_get(&counter, 42, now + 30, 60);
+  fail_unless(res == 2, "Expected 2, got %d", res);
+
+  res = (int) loiter_counter_get(&counter, 43, now + 30, 60);
+  fail_unless(res == 0, "Expected 0, got %d", res);
+
+  /* Once the window has passed, the count starts again. */
+  res = loiter_counter_incr(&counter, 42, now + 60, 60);
+  fail_unless(res == 1, "Expected 1, got %d", res);
+
+  /* As it does for a colliding key. */
+  res = loiter_counter_incr(&counter, 43, now + 60, 60);
+  fail_unless(res == 1, "Expected 1, got %d", res);
+}
+END_TEST
+
+START_TEST (histogram_add_test) {
+  register unsigned int i;
+  struct loiter_histogram hist;
+  uint64_t value, t1, t2;
+
+  memset(&hist, 0, sizeof(hist));
+
+  mark_point();
+  loiter_histogram_add(NULL, 1);
+
+  value = loiter_histogram_percentile(NULL, 50.0);
+  fail_unless(value == 0, "Expected 0, got %llu", (unsigned long long) value);
+
+  value = loiter_histogram_percentile(&hist, 50.0);
+  fail_unless(value == 0, "Expected 0, got %llu", (unsigned long long) value);
+
+  /* Small values are kept exactly. */
+  loiter_histogram_add(&hist, 5);
+  value = loiter_histogram_percentile(&hist, 50.0);
+  fail_unless(value == 5, "Expected 5, got %llu", (unsigned long long) value);
+
+  memset(&hist, 0, sizeof(hist));
+  for (i = 1; i <= 1000; i++) {
+    loiter_histogram_add(&hist, i * 1000);
+  }
+
+  fail_unless(hist.count == 1000, "Expected count 1000, got %llu",
+    (unsigned long long) hist.count);
+  fail_unless(hist.sum == 500500000, "Expected sum 500500000, got %llu",
+    (unsigned long long) hist.sum);
+  fail_unless(hist.max == 1000000, "Expected max 1000000, got %llu",
+    (unsigned long long) hist.max);
+
+  /* Larger values are known to within an eighth. */
+  value = loiter_histogram_percentile(&hist, 50.0);
+  fail_unless(value >= 500000 && value <= 562500,
+    "Expected p50 of about 500000, got %llu", (unsigned long long) value);
+
+  value = loiter_histogram_percentile(&hist, 99.0);
+  fail_unless(value >= 990000 && value <= 1000000,
+    "Expected p99 of about 990000, got %llu", (unsigned long long) value);
+
+  value = loiter_histogram_percentile(&hist, 100.0);
+  fail_unless(value == 1000000, "Expected p100 of 1000000, got %llu",
+    (unsigned long long) value);
+
+  /* Values too large for the buckets are still counted. */
+  loiter_histogram_add(&hist, (uint64_t) 1 << 40);
+  fail_unless(hist.max == ((uint64_t) 1 << 40), "Failed to record max");
+
+  value = loiter_histogram_percentile(&hist, 100.0);
+  fail_unless(value == ((uint64_t) 1 << 40), "Expected p100 of 2^40, got %llu",
+    (unsigned long long) value);
+
+  t1 = loiter_monotonic_now();
+  t2 = loiter_monotonic_now();
+  fail_unless(t2 >= t1, "Expected monotonic clock");
+}
+END_TEST
+
+Suite *tests_get_sketch_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("sketch");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, sketch_add_test);
+  tcase_add_test(testcase, hll_estimate_test);
+  tcase_add_test(testcase, bucket_take_test);
+  tcase_add_test(testcase, counter_incr_test);
+  tcase_add_test(testcase, histogram_add_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
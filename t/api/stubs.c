@@ -198,6 +198,18 @@ const char *pr_session_get_protocol(int flags) {
 }
 
 void pr_signals_handle(void) {
+  /* Like the core, delay briefly after an interrupted call, so that e.g. the
+   * lock retries in shm.c do not simply spin.
+   */
+  if (errno == EINTR) {
+    struct timeval tv;
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 10000;
+
+    errno = 0;
+    (void) select(0, NULL, NULL, NULL, &tv);
+  }
 }
 
 /* Module-specific stubs */
@@ -30,7 +30,17 @@ struct testsuite_info {
 };
 
 static struct testsuite_info suites[] = {
+  { "cidr",		tests_get_cidr_suite },
+  { "cluster",		tests_get_cluster_suite },
+  { "controller",	tests_get_controller_suite },
+  { "curve",		tests_get_curve_suite },
+  { "metrics",		tests_get_metrics_suite },
+  { "policy",		tests_get_policy_suite },
+  { "pressure",		tests_get_pressure_suite },
+  { "prng",		tests_get_prng_suite },
   { "shm",		tests_get_shm_suite },
+  { "sim",		tests_get_sim_suite },
+  { "sketch",		tests_get_sketch_suite },
 
   { NULL, NULL }
 };
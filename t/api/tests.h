@@ -35,7 +35,17 @@
 # error "Missing Check installation; necessary for ProFTPD testsuite"
 #endif
 
+Suite *tests_get_cidr_suite(void);
+Suite *tests_get_cluster_suite(void);
+Suite *tests_get_controller_suite(void);
+Suite *tests_get_curve_suite(void);
+Suite *tests_get_metrics_suite(void);
+Suite *tests_get_policy_suite(void);
+Suite *tests_get_pressure_suite(void);
+Suite *tests_get_prng_suite(void);
 Suite *tests_get_shm_suite(void);
+Suite *tests_get_sim_suite(void);
+Suite *tests_get_sketch_suite(void);
 
 extern volatile unsigned int recvd_signal_flags;
 extern pid_t mpid;
@@ -0,0 +1,724 @@
+/*
+ * ProFTPD - mod_loiter connection flood generator
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Usage: loiter-flood [options] host:port
+ *
+ * Drives a mix of loitering attackers, which connect and then sit idle
+ * without logging in (like doc/sshext.c), and real clients, which connect,
+ * log in, and quit, against an FTP server, using epoll(7).  Reports, as
+ * key=value lines, how many of the real logins succeeded, the times to the
+ * greeting and to login, and how many connections were dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#ifndef TRUE
+# define TRUE	1
+#endif
+
+#ifndef FALSE
+# define FALSE	0
+#endif
+
+#define FLOOD_KIND_ATTACKER		1
+#define FLOOD_KIND_CLIENT		2
+
+#define FLOOD_STATE_IDLE		0
+#define FLOOD_STATE_CONNECTING		1
+#define FLOOD_STATE_GREETING		2
+#define FLOOD_STATE_USER		3
+#define FLOOD_STATE_PASS		4
+#define FLOOD_STATE_LOITERING		5
+
+#define FLOOD_BUFSZ			1024
+
+struct flood_conn {
+  int kind;
+  int state;
+  int fd;
+
+  /* When this slot next connects, if idle, and when its current connection
+   * started.
+   */
+  double next_start;
+  double started;
+
+  char buf[FLOOD_BUFSZ];
+  size_t buflen;
+};
+
+/* Samples, in milliseconds, for the percentiles. */
+struct flood_samples {
+  double *values;
+  unsigned int nvalues;
+  unsigned int size;
+};
+
+struct flood_stats {
+  unsigned long client_attempts;
+  unsigned long client_logins;
+  unsigned long client_failed;
+  unsigned long client_dropped;
+  unsigned long client_refused;
+  unsigned long client_timed_out;
+
+  unsigned long attacker_attempts;
+  unsigned long attacker_dropped;
+  unsigned long attacker_refused;
+  unsigned long attacker_closed;
+
+  struct flood_samples greeting_ms;
+  struct flood_samples login_ms;
+};
+
+static struct addrinfo *flood_addr = NULL;
+static int flood_epfd = -1;
+static struct flood_stats stats;
+
+static unsigned int nattackers = 100;
+static unsigned int nclients = 10;
+static double duration = 30.0;
+static double client_pause = 0.1;
+static double client_timeout = 10.0;
+static double attacker_ramp = 1.0;
+static const char *user = "loiter";
+static const char *passwd = "loiter";
+
+static struct option opts[] = {
+  { "attackers",	1, NULL, 'a' },
+  { "clients",		1, NULL, 'c' },
+  { "duration",		1, NULL, 'd' },
+  { "help",		0, NULL, 'h' },
+  { "pass",		1, NULL, 'p' },
+  { "pause",		1, NULL, 'P' },
+  { "ramp",		1, NULL, 'r' },
+  { "timeout",		1, NULL, 't' },
+  { "user",		1, NULL, 'u' },
+  { NULL,		0, NULL, 0 }
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [options] host:port\n\n", prog);
+  fprintf(stderr,
+    "  --attackers N     loitering connections to hold open (default 100)\n"
+    "  --clients N       concurrent logging-in clients (default 10)\n"
+    "  --duration SECS   length of the run (default 30)\n"
+    "  --ramp SECS       time over which to open the attackers (default 1)\n"
+    "  --pause SECS      pause between each client's logins (default 0.1)\n"
+    "  --timeout SECS    time allowed for each client login (default 10)\n"
+    "  --user NAME       user name for the clients (default loiter)\n"
+    "  --pass PASSWORD   password for the clients (default loiter)\n");
+}
+
+static double now_secs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+}
+
+static void add_sample(struct flood_samples *samples, double v) {
+  if (samples->nvalues == samples->size) {
+    double *values;
+    unsigned int size;
+
+    size = samples->size > 0 ? samples->size * 2 : 1024;
+    values = realloc(samples->values, sizeof(double) * size);
+    if (values == NULL) {
+      return;
+    }
+
+    samples->values = values;
+    samples->size = size;
+  }
+
+  samples->values[samples->nvalues++] = v;
+}
+
+static int sample_cmp(const void *a, const void *b) {
+  double da = *((const double *) a), db = *((const double *) b);
+
+  if (da < db) {
+    return -1;
+  }
+
+  return da > db ? 1 : 0;
+}
+
+/* Returns the given percentile, by the nearest rank. */
+static double get_percentile(struct flood_samples *samples, double pct) {
+  unsigned int idx;
+
+  if (samples->nvalues == 0) {
+    return 0.0;
+  }
+
+  idx = (unsigned int) ((pct / 100.0) * samples->nvalues);
+  if (idx >= samples->nvalues) {
+    idx = samples->nvalues - 1;
+  }
+
+  return samples->values[idx];
+}
+
+static void close_conn(struct flood_conn *conn, double now) {
+  if (conn->fd >= 0) {
+    (void) close(conn->fd);
+    conn->fd = -1;
+  }
+
+  conn->state = FLOOD_STATE_IDLE;
+  conn->buflen = 0;
+
+  if (conn->kind == FLOOD_KIND_CLIENT) {
+    conn->next_start = now + client_pause;
+
+  } else {
+    conn->next_start = now;
+  }
+}
+
+static void start_conn(struct flood_conn *conn, double now) {
+  struct epoll_event ev;
+  int fd, res;
+
+  fd = socket(flood_addr->ai_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    /* e.g. out of descriptors; try again shortly. */
+    conn->next_start = now + 0.1;
+    return;
+  }
+
+  (void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  conn->fd = fd;
+  conn->started = now;
+  conn->buflen = 0;
+  conn->state = FLOOD_STATE_CONNECTING;
+
+  if (conn->kind == FLOOD_KIND_CLIENT) {
+    stats.client_attempts++;
+
+  } else {
+    stats.attacker_attempts++;
+  }
+
+  res = connect(fd, flood_addr->ai_addr, flood_addr->ai_addrlen);
+  if (res < 0 &&
+      errno != EINPROGRESS) {
+    if (conn->kind == FLOOD_KIND_CLIENT) {
+      stats.client_refused++;
+
+    } else {
+      stats.attacker_refused++;
+    }
+
+    close_conn(conn, now);
+    return;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP;
+  ev.data.ptr = conn;
+  (void) epoll_ctl(flood_epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void send_cmd(struct flood_conn *conn, const char *cmd,
+    const char *arg) {
+  char buf[256];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "%s %s\r\n", cmd, arg);
+  if (len > 0) {
+    /* Small enough to never block on a fresh connection. */
+    (void) write(conn->fd, buf, (size_t) len);
+  }
+}
+
+/* The connection was closed, or refused, without the server saying why. */
+static void handle_eof(struct flood_conn *conn, double now) {
+  switch (conn->state) {
+    case FLOOD_STATE_CONNECTING:
+    case FLOOD_STATE_GREETING:
+      if (conn->kind == FLOOD_KIND_CLIENT) {
+        stats.client_refused++;
+
+      } else {
+        stats.attacker_refused++;
+      }
+      break;
+
+    case FLOOD_STATE_LOITERING:
+      stats.attacker_closed++;
+      break;
+
+    default:
+      stats.client_failed++;
+      break;
+  }
+
+  close_conn(conn, now);
+}
+
+static void handle_reply(struct flood_conn *conn, int code, double now) {
+  int attacker;
+
+  attacker = (conn->kind == FLOOD_KIND_ATTACKER);
+
+  switch (conn->state) {
+    case FLOOD_STATE_GREETING:
+      if (code == 220) {
+        if (attacker) {
+          conn->state = FLOOD_STATE_LOITERING;
+
+        } else {
+          add_sample(&(stats.greeting_ms), (now - conn->started) * 1000.0);
+          send_cmd(conn, "USER", user);
+          conn->state = FLOOD_STATE_USER;
+        }
+
+        return;
+      }
+
+      /* mod_loiter sends its LoiterMessage, if configured, as a 530 rather
+       * than the greeting; anything else is a refusal.
+       */
+      if (code == 530) {
+        if (attacker) {
+          stats.attacker_dropped++;
+
+        } else {
+          stats.client_dropped++;
+        }
+
+      } else {
+        if (attacker) {
+          stats.attacker_refused++;
+
+        } else {
+          stats.client_refused++;
+        }
+      }
+      break;
+
+    case FLOOD_STATE_USER:
+      if (code == 331) {
+        send_cmd(conn, "PASS", passwd);
+        conn->state = FLOOD_STATE_PASS;
+        return;
+      }
+
+      if (code == 230) {
+        stats.client_logins++;
+        add_sample(&(stats.login_ms), (now - conn->started) * 1000.0);
+
+      } else {
+        stats.client_failed++;
+      }
+      break;
+
+    case FLOOD_STATE_PASS:
+      if (code == 230) {
+        stats.client_logins++;
+        add_sample(&(stats.login_ms), (now - conn->started) * 1000.0);
+
+      } else {
+        stats.client_failed++;
+      }
+      break;
+
+    case FLOOD_STATE_LOITERING:
+      /* e.g. 421 for TimeoutLogin; the server closes the connection. */
+      stats.attacker_closed++;
+      break;
+
+    default:
+      return;
+  }
+
+  if (conn->state == FLOOD_STATE_USER ||
+      conn->state == FLOOD_STATE_PASS) {
+    send_cmd(conn, "QUIT", "");
+  }
+
+  close_conn(conn, now);
+}
+
+static void handle_input(struct flood_conn *conn, double now) {
+  ssize_t n;
+
+  n = read(conn->fd, conn->buf + conn->buflen,
+    sizeof(conn->buf) - conn->buflen - 1);
+  if (n < 0) {
+    if (errno == EAGAIN ||
+        errno == EINTR) {
+      return;
+    }
+
+    handle_eof(conn, now);
+    return;
+  }
+
+  if (n == 0) {
+    handle_eof(conn, now);
+    return;
+  }
+
+  conn->buflen += n;
+  conn->buf[conn->buflen] = '\0';
+
+  /* Only the last line of a reply, "NNN text", completes it. */
+  while (conn->fd >= 0) {
+    char *eol;
+    size_t linelen;
+
+    eol = strchr(conn->buf, '\n');
+    if (eol == NULL) {
+      if (conn->buflen == sizeof(conn->buf) - 1) {
+        /* An overlong line; discard it. */
+        conn->buflen = 0;
+      }
+
+      break;
+    }
+
+    linelen = (eol - conn->buf) + 1;
+
+    if (linelen >= 4 &&
+        conn->buf[0] >= '1' && conn->buf[0] <= '5' &&
+        conn->buf[1] >= '0' && conn->buf[1] <= '9' &&
+        conn->buf[2] >= '0' && conn->buf[2] <= '9' &&
+        conn->buf[3] == ' ') {
+      int code;
+
+      code = ((conn->buf[0] - '0') * 100) + ((conn->buf[1] - '0') * 10) +
+        (conn->buf[2] - '0');
+
+      memmove(conn->buf, conn->buf + linelen, conn->buflen - linelen + 1);
+      conn->buflen -= linelen;
+
+      handle_reply(conn, code, now);
+      continue;
+    }
+
+    memmove(conn->buf, conn->buf + linelen, conn->buflen - linelen + 1);
+    conn->buflen -= linelen;
+  }
+}
+
+static void handle_event(struct flood_conn *conn, unsigned int events,
+    double now) {
+  if (conn->state == FLOOD_STATE_CONNECTING &&
+      (events & (EPOLLOUT|EPOLLERR|EPOLLHUP))) {
+    struct epoll_event ev;
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 ||
+        err != 0) {
+      handle_eof(conn, now);
+      return;
+    }
+
+    conn->state = FLOOD_STATE_GREETING;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN|EPOLLRDHUP;
+    ev.data.ptr = conn;
+    (void) epoll_ctl(flood_epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+
+  if (events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) {
+    handle_input(conn, now);
+  }
+}
+
+static int resolve(const char *target) {
+  struct addrinfo hints;
+  char *host, *port;
+  int res;
+
+  host = strdup(target);
+  if (host == NULL) {
+    return -1;
+  }
+
+  port = strrchr(host, ':');
+  if (port == NULL) {
+    free(host);
+    errno = EINVAL;
+    return -1;
+  }
+
+  *port++ = '\0';
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  res = getaddrinfo(host, port, &hints, &flood_addr);
+  free(host);
+
+  if (res != 0) {
+    fprintf(stderr, "error resolving '%s': %s\n", target, gai_strerror(res));
+    errno = ENOENT;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void report(double elapsed) {
+  double success_pct = 100.0;
+  unsigned long drops;
+
+  if (stats.client_attempts > 0) {
+    success_pct = (100.0 * stats.client_logins) / stats.client_attempts;
+  }
+
+  qsort(stats.greeting_ms.values, stats.greeting_ms.nvalues, sizeof(double),
+    sample_cmp);
+  qsort(stats.login_ms.values, stats.login_ms.nvalues, sizeof(double),
+    sample_cmp);
+
+  drops = stats.client_dropped + stats.attacker_dropped;
+
+  printf("duration_secs=%.1f\n", elapsed);
+  printf("attackers=%u\n", nattackers);
+  printf("clients=%u\n", nclients);
+  printf("client_attempts=%lu\n", stats.client_attempts);
+  printf("client_logins=%lu\n", stats.client_logins);
+  printf("client_success_pct=%.2f\n", success_pct);
+  printf("client_dropped=%lu\n", stats.client_dropped);
+  printf("client_refused=%lu\n", stats.client_refused);
+  printf("client_failed=%lu\n", stats.client_failed);
+  printf("client_timed_out=%lu\n", stats.client_timed_out);
+  printf("greeting_p50_ms=%.2f\n", get_percentile(&(stats.greeting_ms), 50.0));
+  printf("greeting_p99_ms=%.2f\n", get_percentile(&(stats.greeting_ms), 99.0));
+  printf("login_p50_ms=%.2f\n", get_percentile(&(stats.login_ms), 50.0));
+  printf("login_p99_ms=%.2f\n", get_percentile(&(stats.login_ms), 99.0));
+  printf("attacker_attempts=%lu\n", stats.attacker_attempts);
+  printf("attacker_dropped=%lu\n", stats.attacker_dropped);
+  printf("attacker_refused=%lu\n", stats.attacker_refused);
+  printf("attacker_closed=%lu\n", stats.attacker_closed);
+  printf("drops=%lu\n", drops);
+  printf("drops_per_sec=%.2f\n", elapsed > 0.0 ? drops / elapsed : 0.0);
+}
+
+static int parse_double(const char *text, double *v) {
+  char *ptr = NULL;
+
+  *v = strtod(text, &ptr);
+  if (ptr == text ||
+      (ptr && *ptr) ||
+      *v < 0.0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static int parse_uint(const char *text, unsigned int *v) {
+  char *ptr = NULL;
+  unsigned long n;
+
+  n = strtoul(text, &ptr, 10);
+  if (ptr == text ||
+      (ptr && *ptr)) {
+    return -1;
+  }
+
+  *v = (unsigned int) n;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  register unsigned int i;
+  struct flood_conn *conns;
+  struct epoll_event *events;
+  struct rlimit rlim;
+  unsigned int nconns;
+  double start, now, end;
+  int c, idx = 0;
+
+  while ((c = getopt_long(argc, argv, "", opts, &idx)) != -1) {
+    int bad = FALSE;
+
+    switch (c) {
+      case 'a':
+        bad = parse_uint(optarg, &nattackers) < 0;
+        break;
+
+      case 'c':
+        bad = parse_uint(optarg, &nclients) < 0;
+        break;
+
+      case 'd':
+        bad = parse_double(optarg, &duration) < 0;
+        break;
+
+      case 'p':
+        passwd = optarg;
+        break;
+
+      case 'P':
+        bad = parse_double(optarg, &client_pause) < 0;
+        break;
+
+      case 'r':
+        bad = parse_double(optarg, &attacker_ramp) < 0;
+        break;
+
+      case 't':
+        bad = parse_double(optarg, &client_timeout) < 0;
+        break;
+
+      case 'u':
+        user = optarg;
+        break;
+
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (bad) {
+      fprintf(stderr, "%s: invalid value for --%s: %s\n", argv[0],
+        opts[idx].name, optarg);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (resolve(argv[optind]) < 0) {
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  /* Each connection needs a descriptor. */
+  nconns = nattackers + nclients;
+  if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+      rlim.rlim_cur < nconns + 16) {
+    rlim.rlim_cur = rlim.rlim_max;
+    (void) setrlimit(RLIMIT_NOFILE, &rlim);
+  }
+
+  flood_epfd = epoll_create1(0);
+  if (flood_epfd < 0) {
+    perror("epoll_create1");
+    return 1;
+  }
+
+  conns = calloc(nconns, sizeof(struct flood_conn));
+  events = calloc(nconns + 1, sizeof(struct epoll_event));
+  if (conns == NULL ||
+      events == NULL) {
+    perror("calloc");
+    return 1;
+  }
+
+  start = now_secs();
+  end = start + duration;
+
+  /* The attackers are opened over the ramp time, the clients at once. */
+  for (i = 0; i < nconns; i++) {
+    conns[i].fd = -1;
+
+    if (i < nattackers) {
+      conns[i].kind = FLOOD_KIND_ATTACKER;
+      conns[i].next_start = start + ((attacker_ramp * i) / nattackers);
+
+    } else {
+      conns[i].kind = FLOOD_KIND_CLIENT;
+      conns[i].next_start = start;
+    }
+  }
+
+  now = start;
+  while (now < end) {
+    int nevents, timeout_ms = 10;
+
+    for (i = 0; i < nconns; i++) {
+      struct flood_conn *conn;
+
+      conn = &(conns[i]);
+
+      if (conn->state == FLOOD_STATE_IDLE) {
+        if (conn->next_start <= now) {
+          start_conn(conn, now);
+        }
+
+      } else if (conn->kind == FLOOD_KIND_CLIENT &&
+                 now - conn->started >= client_timeout) {
+        stats.client_timed_out++;
+        close_conn(conn, now);
+      }
+    }
+
+    nevents = epoll_wait(flood_epfd, events, nconns + 1, timeout_ms);
+    now = now_secs();
+
+    for (c = 0; c < nevents; c++) {
+      handle_event(events[c].data.ptr, events[c].events, now);
+    }
+  }
+
+  /* Logins still in progress at the end are left out of the counts. */
+  for (i = 0; i < nconns; i++) {
+    if (conns[i].fd >= 0) {
+      if (conns[i].kind == FLOOD_KIND_CLIENT) {
+        stats.client_attempts--;
+      }
+
+      (void) close(conns[i].fd);
+    }
+  }
+
+  report(now - start);
+
+  free(conns);
+  free(events);
+  freeaddrinfo(flood_addr);
+  (void) close(flood_epfd);
+  return 0;
+}
@@ -0,0 +1,292 @@
+#!/usr/bin/env perl
+
+# End-to-end benchmark for mod_loiter: starts proftpd on localhost, floods it
+# with loitering attackers and logging-in clients using t/loiter-flood, and
+# reports the client login success rate, time to greeting, drops per second,
+# and the daemon's CPU time, as one key=value line per result.  With
+# --output, each run is also appended as a row to a TSV file, labelled with
+# the git revision, so that runs against different revisions can be compared.
+
+use strict;
+
+use Cwd qw(abs_path);
+use File::Path qw(rmtree);
+use File::Spec;
+use Getopt::Long;
+use POSIX qw(sysconf _SC_CLK_TCK);
+use Time::HiRes qw(gettimeofday tv_interval);
+
+my $opts = {
+  attackers => 200,
+  clients => 10,
+  duration => 30,
+  'max-instances' => 100,
+  rules => 'low 10 high 100',
+  'timeout-login' => 30,
+};
+
+GetOptions($opts, 'h|help', 'attackers=i', 'clients=i', 'duration=i',
+  'extra-config=s%', 'flood=s', 'label=s', 'max-instances=i', 'output=s',
+  'rules=s', 'timeout-login=i', 'K|keep-tmpfiles', 'V|verbose');
+
+if ($opts->{h}) {
+  usage();
+}
+
+if ($opts->{K}) {
+  $ENV{KEEP_TMPFILES} = 1;
+}
+
+if ($opts->{V}) {
+  $ENV{TEST_VERBOSE} = 1;
+}
+
+if ($ENV{PROFTPD_TEST_DIR}) {
+  push(@INC, "$ENV{PROFTPD_TEST_DIR}/tests/t/lib");
+}
+
+my $bench_dir = (File::Spec->splitpath(abs_path(__FILE__)))[1];
+my $top_dir = File::Spec->catdir($bench_dir, '..', '..');
+push(@INC, "$top_dir/t/lib");
+
+require ProFTPD::TestSuite::Utils;
+import ProFTPD::TestSuite::Utils qw(:config :running :test :testsuite);
+
+unless (defined($ENV{PROFTPD_TEST_BIN})) {
+  $ENV{PROFTPD_TEST_BIN} = File::Spec->catfile($top_dir, '..', 'proftpd');
+}
+
+my $flood_bin = $opts->{flood};
+unless (defined($flood_bin)) {
+  $flood_bin = File::Spec->catfile($top_dir, 't', 'loiter-flood');
+}
+
+unless (-x $flood_bin) {
+  die("Can't find executable $flood_bin (build it using 'make bench')\n");
+}
+
+$| = 1;
+
+my $tmpdir = testsuite_get_tmp_dir();
+my $setup = test_setup($tmpdir, 'loiter');
+
+my $config = {
+  PidFile => $setup->{pid_file},
+  ScoreboardFile => $setup->{scoreboard_file},
+  SystemLog => $setup->{log_file},
+
+  AuthUserFile => $setup->{auth_user_file},
+  AuthGroupFile => $setup->{auth_group_file},
+  AuthOrder => 'mod_auth_file.c',
+
+  SocketBindTight => 'on',
+  MaxInstances => $opts->{'max-instances'},
+  TimeoutLogin => $opts->{'timeout-login'},
+  UseReverseDNS => 'off',
+
+  IfModules => {
+    'mod_delay.c' => {
+      DelayEngine => 'off',
+    },
+
+    'mod_ident.c' => {
+      IdentLookups => 'off',
+    },
+
+    'mod_loiter.c' => {
+      LoiterEngine => 'on',
+
+      # Without a LoiterMessage, loiter-flood cannot tell a dropped
+      # connection from one refused for MaxInstances.
+      LoiterMessage => '"Too many loitering connections"',
+      LoiterRules => $opts->{rules},
+      LoiterTable => File::Spec->rel2abs("$tmpdir/loiter.tab"),
+    },
+  },
+};
+
+# e.g. --extra-config LoiterMessage='"Go away"'
+if (defined($opts->{'extra-config'})) {
+  foreach my $key (keys(%{ $opts->{'extra-config'} })) {
+    $config->{IfModules}->{'mod_loiter.c'}->{$key} =
+      $opts->{'extra-config'}->{$key};
+  }
+}
+
+my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+  $config);
+
+server_start($setup->{config_file}, $setup->{pid_file});
+
+my $daemon_pid;
+if (open(my $fh, "< $setup->{pid_file}")) {
+  $daemon_pid = <$fh>;
+  chomp($daemon_pid);
+  close($fh);
+}
+
+my $result = {};
+my $ex;
+
+eval {
+  die("Can't read daemon PID from $setup->{pid_file}\n")
+    unless $daemon_pid;
+
+  # Let the daemon settle before taking the first CPU sample.
+  sleep(1);
+
+  my $cpu_start = get_cpu_secs($daemon_pid);
+  my $start = [gettimeofday()];
+
+  my @cmd = ($flood_bin,
+    '--attackers', $opts->{attackers},
+    '--clients', $opts->{clients},
+    '--duration', $opts->{duration},
+    '--user', $setup->{user},
+    '--pass', $setup->{passwd},
+    "127.0.0.1:$port",
+  );
+
+  if ($ENV{TEST_VERBOSE}) {
+    print STDOUT "# Executing: ", join(' ', @cmd), "\n";
+  }
+
+  open(my $flood, '-|', @cmd) or die("Can't execute $flood_bin: $!\n");
+  while (my $line = <$flood>) {
+    chomp($line);
+
+    if ($line =~ /^(\w+)=(.*)$/) {
+      $result->{$1} = $2;
+    }
+  }
+  close($flood);
+
+  die("$flood_bin failed (exit status ", ($? >> 8), ")\n") if $?;
+
+  # The daemon only accounts for its sessions' CPU time once it has reaped
+  # them, so give it a moment after the flood has closed its connections.
+  sleep(2);
+
+  my $elapsed = tv_interval($start);
+  my $cpu_secs = get_cpu_secs($daemon_pid) - $cpu_start;
+
+  $result->{daemon_cpu_secs} = sprintf("%.2f", $cpu_secs);
+  $result->{daemon_cpu_pct} = sprintf("%.2f", (100.0 * $cpu_secs) / $elapsed);
+};
+
+if ($@) {
+  $ex = $@;
+}
+
+server_stop($setup->{pid_file});
+
+if ($ex) {
+  if (open(my $fh, "< $setup->{log_file}")) {
+    print STDERR <$fh>;
+    close($fh);
+  }
+
+  print STDERR $ex;
+}
+
+unless ($ENV{KEEP_TMPFILES}) {
+  rmtree($tmpdir);
+}
+
+exit 1 if $ex;
+
+$result->{revision} = get_revision();
+$result->{label} = $opts->{label} || '';
+$result->{rules} = $opts->{rules};
+$result->{max_instances} = $opts->{'max-instances'};
+
+my @keys = qw(
+  revision
+  label
+  rules
+  max_instances
+  attackers
+  clients
+  duration_secs
+  client_attempts
+  client_logins
+  client_success_pct
+  greeting_p50_ms
+  greeting_p99_ms
+  login_p50_ms
+  login_p99_ms
+  client_dropped
+  client_refused
+  client_timed_out
+  attacker_attempts
+  attacker_dropped
+  attacker_refused
+  attacker_closed
+  drops
+  drops_per_sec
+  daemon_cpu_secs
+  daemon_cpu_pct
+);
+
+foreach my $key (@keys) {
+  print STDOUT "$key=$result->{$key}\n";
+}
+
+if (defined($opts->{output})) {
+  my $need_header = (! -s $opts->{output});
+
+  open(my $fh, ">> $opts->{output}") or
+    die("Can't open $opts->{output}: $!\n");
+
+  if ($need_header) {
+    print $fh join("\t", @keys), "\n";
+  }
+
+  print $fh join("\t", map { $result->{$_} } @keys), "\n";
+  close($fh);
+}
+
+exit 0;
+
+# Returns the user and system CPU time used by the daemon and by the session
+# processes it has reaped, in seconds.
+sub get_cpu_secs {
+  my $pid = shift;
+
+  open(my $fh, "< /proc/$pid/stat") or die("Can't read /proc/$pid/stat: $!\n");
+  my $stat = <$fh>;
+  close($fh);
+
+  # Skip past the command name, which may itself contain spaces.
+  $stat =~ s/^.*\)\s+//;
+  my @fields = split(/\s+/, $stat);
+
+  # utime, stime, cutime, and cstime, counting from the state field.
+  my $ticks = $fields[11] + $fields[12] + $fields[13] + $fields[14];
+  return $ticks / sysconf(_SC_CLK_TCK);
+}
+
+sub get_revision {
+  my $rev = `git -C $top_dir describe --always --dirty 2>/dev/null`;
+  chomp($rev);
+
+  return $rev || 'unknown';
+}
+
+sub usage {
+  print STDOUT <<EOH;
+
+$0: [--help] [--attackers N] [--clients N] [--duration SECS]
+  [--rules RULES] [--max-instances N] [--timeout-login SECS]
+  [--extra-config Directive=value ...] [--label LABEL] [--output FILE]
+  [--flood PATH] [--keep-tmpfiles] [--verbose]
+
+Examples:
+
+  perl $0
+  perl $0 --attackers 500 --clients 20 --duration 60 --output bench.tsv
+  perl $0 --rules 'low 5 high 50 rate 50' --label steeper --output bench.tsv
+
+EOH
+  exit 0;
+}
@@ -0,0 +1,456 @@
+/*
+ * ProFTPD - mod_loiter shm contention benchmark
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Usage: loiter-shm-bench [options]
+ *
+ * Forks 1, 2, 4, ... up to the given number of workers, each hammering the
+ * same LoiterTable segment with one kind of operation, and reports the
+ * operations per second, the latency percentiles, and how often the shm lock
+ * had to be retried.  Checks that no increments were lost, and exits
+ * non-zero if any were.
+ */
+
+#include "mod_loiter.h"
+#include "shm.h"
+
+#include <getopt.h>
+#include <sys/mman.h>
+
+#define BENCH_OP_INCR		1
+#define BENCH_OP_GET		2
+#define BENCH_OP_SNAPSHOT	3
+#define BENCH_OP_ATOMIC		4
+#define BENCH_OP_MIXED		5
+
+struct bench_op {
+  const char *name;
+  int op;
+};
+
+static struct bench_op bench_ops[] = {
+  { "incr",	BENCH_OP_INCR },
+  { "get",	BENCH_OP_GET },
+  { "snapshot",	BENCH_OP_SNAPSHOT },
+  { "atomic",	BENCH_OP_ATOMIC },
+  { "mixed",	BENCH_OP_MIXED },
+  { NULL,	0 }
+};
+
+/* Filled in by each worker, in memory shared with the parent. */
+struct bench_worker {
+  struct loiter_shm_lock_stats lock_stats;
+  unsigned long nerrors;
+
+  /* Snapshots which went backwards, in the mixed workload. */
+  unsigned long nbackwards;
+};
+
+static const char *table_path = "/tmp/loiter-shm-bench.tab";
+static unsigned int max_workers = 8;
+static unsigned int nops = 100000;
+
+static struct option opts[] = {
+  { "help",	0, NULL, 'h' },
+  { "op",	1, NULL, 'o' },
+  { "ops",	1, NULL, 'n' },
+  { "table",	1, NULL, 't' },
+  { "workers",	1, NULL, 'w' },
+  { NULL,	0, NULL, 0 }
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [options]\n\n", prog);
+  fprintf(stderr,
+    "  --workers N    run with 1, 2, 4, ... up to N workers (default 8)\n"
+    "  --ops N        operations per worker (default 100000)\n"
+    "  --op NAME      only run the named operation: incr (fcntl lock),\n"
+    "                 get (fcntl lock), snapshot (seqlock), atomic, or\n"
+    "                 mixed (incr and snapshot); default all\n"
+    "  --table PATH   LoiterTable path (default /tmp/loiter-shm-bench.tab)\n");
+}
+
+static uint64_t now_nsecs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static int parse_uint(const char *text, unsigned int *v) {
+  char *ptr = NULL;
+  unsigned long n;
+
+  n = strtoul(text, &ptr, 10);
+  if (ptr == text ||
+      (ptr && *ptr)) {
+    return -1;
+  }
+
+  *v = (unsigned int) n;
+  return 0;
+}
+
+static int latency_cmp(const void *a, const void *b) {
+  uint32_t la = *((const uint32_t *) a), lb = *((const uint32_t *) b);
+
+  if (la < lb) {
+    return -1;
+  }
+
+  return la > lb ? 1 : 0;
+}
+
+static double get_percentile_usecs(uint32_t *latencies, size_t nlatencies,
+    double pct) {
+  size_t idx;
+
+  idx = (size_t) ((pct / 100.0) * nlatencies);
+  if (idx >= nlatencies) {
+    idx = nlatencies - 1;
+  }
+
+  return latencies[idx] / 1000.0;
+}
+
+static void run_worker(pool *p, int op, int start_fd,
+    struct bench_worker *worker, uint32_t *latencies) {
+  register unsigned int i;
+  struct loiter_shm_lock_stats lock_stats;
+  unsigned int last_count = 0;
+  char c;
+
+  /* Our lock counts start with those inherited from the parent. */
+  (void) loiter_shm_get_lock_stats(p, &lock_stats);
+
+  /* Wait for the parent to start all of the workers at once. */
+  (void) read(start_fd, &c, 1);
+
+  for (i = 0; i < nops; i++) {
+    struct loiter_shm_stats stats;
+    unsigned int conn_count;
+    uint64_t start, elapsed;
+    int res = 0;
+
+    start = now_nsecs();
+
+    switch (op) {
+      case BENCH_OP_INCR:
+        res = loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1);
+        break;
+
+      case BENCH_OP_GET:
+        res = loiter_shm_get(p, &conn_count, NULL);
+        break;
+
+      case BENCH_OP_SNAPSHOT:
+        res = loiter_shm_get_snapshot(p, &stats);
+        break;
+
+      case BENCH_OP_ATOMIC:
+        (void) loiter_shm_next_session(p);
+        break;
+
+      case BENCH_OP_MIXED:
+        if (i % 2 == 0) {
+          res = loiter_shm_incr(p, LOITER_FIELD_ID_CONN_COUNT, 1);
+
+        } else {
+          res = loiter_shm_get_snapshot(p, &stats);
+          if (res == 0) {
+            if (stats.conn_count < last_count) {
+              worker->nbackwards++;
+            }
+
+            last_count = stats.conn_count;
+          }
+        }
+        break;
+    }
+
+    elapsed = now_nsecs() - start;
+    latencies[i] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t) elapsed;
+
+    if (res < 0) {
+      worker->nerrors++;
+    }
+  }
+
+  (void) loiter_shm_get_lock_stats(p, &(worker->lock_stats));
+  worker->lock_stats.nlocks -= lock_stats.nlocks;
+  worker->lock_stats.nretries -= lock_stats.nretries;
+  worker->lock_stats.nfailures -= lock_stats.nfailures;
+}
+
+/* Returns the number of increments of the conn count, or of the session
+ * sequence, which the given run must add.
+ */
+static unsigned long get_expected_incrs(int op, unsigned int nworkers) {
+  switch (op) {
+    case BENCH_OP_INCR:
+    case BENCH_OP_ATOMIC:
+      return (unsigned long) nworkers * nops;
+
+    case BENCH_OP_MIXED:
+      return (unsigned long) nworkers * ((nops + 1) / 2);
+
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+static int run(pool *p, struct bench_op *bench_op, unsigned int nworkers,
+    struct bench_worker *workers, uint32_t *latencies) {
+  register unsigned int i;
+  struct loiter_shm_lock_stats lock_stats;
+  unsigned int conn_count = 0, start_count = 0, start_seq, end_seq;
+  unsigned long expected, nerrors = 0, nbackwards = 0;
+  size_t nlatencies;
+  uint64_t start, elapsed;
+  double secs;
+  int fds[2], exact;
+
+  memset(workers, 0, sizeof(struct bench_worker) * nworkers);
+  memset(&lock_stats, 0, sizeof(lock_stats));
+
+  if (loiter_shm_get(p, &start_count, NULL) < 0) {
+    return -1;
+  }
+
+  start_seq = loiter_shm_next_session(p) + 1;
+
+  if (pipe(fds) < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < nworkers; i++) {
+    pid_t pid;
+
+    pid = fork();
+    if (pid < 0) {
+      int xerrno = errno;
+
+      (void) close(fds[0]);
+      (void) close(fds[1]);
+
+      errno = xerrno;
+      return -1;
+    }
+
+    if (pid == 0) {
+      (void) close(fds[1]);
+
+      run_worker(p, bench_op->op, fds[0], &(workers[i]),
+        latencies + ((size_t) i * nops));
+      _exit(0);
+    }
+  }
+
+  /* Closing the pipe releases all of the waiting workers at once. */
+  (void) close(fds[0]);
+  start = now_nsecs();
+  (void) close(fds[1]);
+
+  for (i = 0; i < nworkers; i++) {
+    int status = 0;
+
+    if (wait(&status) < 0 ||
+        !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      nerrors++;
+    }
+  }
+
+  elapsed = now_nsecs() - start;
+
+  if (loiter_shm_get(p, &conn_count, NULL) < 0) {
+    return -1;
+  }
+
+  end_seq = loiter_shm_next_session(p);
+
+  for (i = 0; i < nworkers; i++) {
+    lock_stats.nlocks += workers[i].lock_stats.nlocks;
+    lock_stats.nretries += workers[i].lock_stats.nretries;
+    lock_stats.nfailures += workers[i].lock_stats.nfailures;
+    nerrors += workers[i].nerrors;
+    nbackwards += workers[i].nbackwards;
+  }
+
+  expected = get_expected_incrs(bench_op->op, nworkers);
+  if (bench_op->op == BENCH_OP_ATOMIC) {
+    exact = (end_seq - start_seq == expected);
+
+  } else {
+    exact = (conn_count - start_count == expected);
+  }
+
+  exact = exact && nerrors == 0 && nbackwards == 0;
+
+  nlatencies = (size_t) nworkers * nops;
+  qsort(latencies, nlatencies, sizeof(uint32_t), latency_cmp);
+
+  secs = elapsed / 1000000000.0;
+
+  printf("op=%s workers=%u ops=%lu secs=%.3f ops_per_sec=%.0f "
+    "p50_us=%.2f p90_us=%.2f p99_us=%.2f p999_us=%.2f max_us=%.2f "
+    "locks=%lu lock_retries=%lu lock_failures=%lu errors=%lu exact=%s\n",
+    bench_op->name, nworkers, (unsigned long) nlatencies, secs,
+    secs > 0.0 ? nlatencies / secs : 0.0,
+    get_percentile_usecs(latencies, nlatencies, 50.0),
+    get_percentile_usecs(latencies, nlatencies, 90.0),
+    get_percentile_usecs(latencies, nlatencies, 99.0),
+    get_percentile_usecs(latencies, nlatencies, 99.9),
+    latencies[nlatencies - 1] / 1000.0, lock_stats.nlocks,
+    lock_stats.nretries, lock_stats.nfailures, nerrors,
+    exact ? "yes" : "no");
+
+  if (!exact) {
+    fprintf(stderr, "op=%s workers=%u: expected %lu increments, got %u "
+      "(%lu backwards snapshots)\n", bench_op->name, nworkers, expected,
+      bench_op->op == BENCH_OP_ATOMIC ? end_seq - start_seq :
+        conn_count - start_count, nbackwards);
+  }
+
+  return exact ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  register unsigned int i;
+  struct bench_worker *workers;
+  uint32_t *latencies;
+  size_t workers_len, latencies_len;
+  const char *op_name = NULL;
+  pool *p;
+  int c, idx = 0, res_code = 0;
+
+  while ((c = getopt_long(argc, argv, "", opts, &idx)) != -1) {
+    int bad = FALSE;
+
+    switch (c) {
+      case 'n':
+        bad = parse_uint(optarg, &nops) < 0 || nops == 0;
+        break;
+
+      case 'o':
+        op_name = optarg;
+        break;
+
+      case 't':
+        table_path = optarg;
+        break;
+
+      case 'w':
+        bad = parse_uint(optarg, &max_workers) < 0 || max_workers == 0;
+        break;
+
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (bad) {
+      fprintf(stderr, "%s: invalid value for --%s: %s\n", argv[0],
+        opts[idx].name, optarg);
+      return 1;
+    }
+  }
+
+  if (op_name != NULL) {
+    for (i = 0; bench_ops[i].name != NULL; i++) {
+      if (strcmp(bench_ops[i].name, op_name) == 0) {
+        break;
+      }
+    }
+
+    if (bench_ops[i].name == NULL) {
+      fprintf(stderr, "%s: unknown operation: %s\n", argv[0], op_name);
+      return 1;
+    }
+  }
+
+  /* The workers report back via memory shared with the parent. */
+  workers_len = sizeof(struct bench_worker) * max_workers;
+  latencies_len = sizeof(uint32_t) * max_workers * (size_t) nops;
+
+  workers = mmap(NULL, workers_len, PROT_READ|PROT_WRITE,
+    MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  latencies = mmap(NULL, latencies_len, PROT_READ|PROT_WRITE,
+    MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (workers == MAP_FAILED ||
+      latencies == MAP_FAILED) {
+    fprintf(stderr, "%s: error mapping memory: %s\n", argv[0],
+      strerror(errno));
+    return 1;
+  }
+
+  p = make_sub_pool(NULL);
+  pr_pool_tag(p, "Loiter shm benchmark");
+
+  if (loiter_shm_create(p, table_path) < 0) {
+    fprintf(stderr, "%s: error creating shm for '%s': %s\n", argv[0],
+      table_path, strerror(errno));
+    destroy_pool(p);
+    return 1;
+  }
+
+  for (i = 0; bench_ops[i].name != NULL; i++) {
+    unsigned int nworkers = 1;
+
+    if (op_name != NULL &&
+        strcmp(bench_ops[i].name, op_name) != 0) {
+      continue;
+    }
+
+    while (TRUE) {
+      int res;
+
+      res = run(p, &(bench_ops[i]), nworkers, workers, latencies);
+      if (res < 0) {
+        fprintf(stderr, "%s: error running %s with %u workers: %s\n", argv[0],
+          bench_ops[i].name, nworkers, strerror(errno));
+      }
+
+      if (res != 0) {
+        res_code = 1;
+      }
+
+      if (nworkers == max_workers) {
+        break;
+      }
+
+      /* Always finish with the given maximum, even if not a power of two. */
+      nworkers = nworkers * 2 < max_workers ? nworkers * 2 : max_workers;
+    }
+  }
+
+  (void) loiter_shm_destroy(p);
+  (void) unlink(table_path);
+  destroy_pool(p);
+
+  (void) munmap(workers, workers_len);
+  (void) munmap(latencies, latencies_len);
+  return res_code;
+}
@@ -29,6 +29,31 @@ my $TESTS = {
     test_class => [qw(forking)],
   },
 
+  loiter_agent_check => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  loiter_ctrls_rules_stats => {
+    order => ++$order,
+    test_class => [qw(forking mod_ctrls)],
+  },
+
+  loiter_reputation => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  loiter_user_rules => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  loiter_class_rules_reserve => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
   # XXX loiter_sftp
 };
 
@@ -40,6 +65,31 @@ sub list_tests {
   return testsuite_get_runnable_tests($TESTS);
 }
 
+sub ftpdctl {
+  my $sock_file = shift;
+  my $ctrl_cmd = shift;
+
+  my $ftpdctl_bin;
+  if ($ENV{PROFTPD_TEST_PATH}) {
+    $ftpdctl_bin = "$ENV{PROFTPD_TEST_PATH}/ftpdctl";
+
+  } else {
+    $ftpdctl_bin = '../ftpdctl';
+  }
+
+  my $cmd = "$ftpdctl_bin -s $sock_file $ctrl_cmd";
+  if ($ENV{TEST_VERBOSE}) {
+    print STDERR "Executing ftpdctl: $cmd\n";
+  }
+
+  my @lines = `$cmd`;
+  if ($ENV{TEST_VERBOSE}) {
+    print STDERR "# ftpdctl output:\n", @lines;
+  }
+
+  return \@lines;
+}
+
 sub loiter_ftp {
   my $self = shift;
   my $tmpdir = $self->{tmpdir};
@@ -328,4 +378,622 @@ sub loiter_ftp_maxinstances {
   test_cleanup($setup->{log_file}, $ex);
 }
 
+sub loiter_agent_check {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'loiter');
+
+  my $loiter_tab = File::Spec->rel2abs("$tmpdir/loiter.tab");
+  my $agent_port = ProFTPD::TestSuite::Utils::get_high_numbered_port();
+
+  my $low_watermark = 2;
+  my $high_watermark = 4;
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'DEFAULT:10 lock:0 scoreboard:0 signal:0 loiter:20 loiter.agent:20 loiter.shm:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_loiter.c' => {
+        LoiterEngine => 'on',
+        LoiterLog => $setup->{log_file},
+        LoiterAgentCheck => "127.0.0.1:$agent_port drain 100",
+        LoiterRules => "low $low_watermark high $high_watermark rate 30",
+        LoiterTable => $loiter_tab,
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      # Allow server to start up
+      sleep(2);
+
+      # Act as the load balancer, asking for our agent status.
+      my $agent_check = sub {
+        my $agent = IO::Socket::INET->new(
+          PeerHost => '127.0.0.1',
+          PeerPort => $agent_port,
+          Proto => 'tcp',
+          Type => SOCK_STREAM,
+          Timeout => 5,
+        );
+        unless ($agent) {
+          die("Can't connect to 127.0.0.1:$agent_port: $!");
+        }
+
+        my $status = <$agent>;
+        $agent->close();
+
+        chomp($status) if defined($status);
+        if ($ENV{TEST_VERBOSE}) {
+          print STDOUT "# Received agent status: $status\n";
+        }
+
+        return $status;
+      };
+
+      my $status = $agent_check->();
+      $self->assert($status eq 'ready 100%',
+        test_msg("Expected 'ready 100%', got '$status'"));
+
+      # Now loiter, with a connection that never authenticates.
+      my $client = IO::Socket::INET->new(
+        PeerHost => '127.0.0.1',
+        PeerPort => $port,
+        Proto => 'tcp',
+        Type => SOCK_STREAM,
+        Timeout => 30,
+      );
+      unless ($client) {
+        die("Can't connect to 127.0.0.1:$port: $!");
+      }
+
+      my $banner = <$client>;
+
+      # One of the high watermark's four unauthenticated connections is now
+      # in use, so our weight should drop by a quarter.
+      $status = $agent_check->();
+      $self->assert($status eq 'ready 75%',
+        test_msg("Expected 'ready 75%', got '$status'"));
+
+      $client->close();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub loiter_ctrls_rules_stats {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'loiter');
+
+  my $loiter_tab = File::Spec->rel2abs("$tmpdir/loiter.tab");
+  my $ctrls_sock = File::Spec->rel2abs("$tmpdir/ctrls.sock");
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'DEFAULT:10 ctrls:20 lock:0 scoreboard:0 signal:0 loiter:20 loiter.shm:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_ctrls.c' => {
+        ControlsEngine => 'on',
+        ControlsLog => $setup->{log_file},
+        ControlsSocket => $ctrls_sock,
+        ControlsACLs => 'all allow user root',
+        ControlsSocketACL => 'allow user root',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_loiter.c' => {
+        LoiterEngine => 'on',
+        LoiterLog => $setup->{log_file},
+        LoiterControlsACLs => 'loiter allow user root',
+        LoiterRules => 'low 10 high 50 rate 20',
+        LoiterTable => $loiter_tab,
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      # Allow server to start up
+      sleep(2);
+
+      my $lines = ftpdctl($ctrls_sock, 'loiter rules');
+      my $expected = 'LoiterRules low 10 high 50 rate 20 \(configured\)';
+      $self->assert(grep { /$expected/ } @$lines,
+        test_msg("Expected '$expected' in ftpdctl output"));
+
+      $lines = ftpdctl($ctrls_sock, 'loiter rules high 40 rate 60');
+      $expected = 'LoiterRules set to low 10 high 40 rate 60';
+      $self->assert(grep { /$expected/ } @$lines,
+        test_msg("Expected '$expected' in ftpdctl output"));
+
+      # Invalid rules must be rejected, leaving the current rules in place.
+      $lines = ftpdctl($ctrls_sock, 'loiter rules low 45');
+      $expected = 'must be less than high watermark';
+      $self->assert(grep { /$expected/ } @$lines,
+        test_msg("Expected '$expected' in ftpdctl output"));
+
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      $lines = ftpdctl($ctrls_sock, 'loiter stats');
+      $expected = 'authd_count: 1';
+      $self->assert(grep { /$expected/ } @$lines,
+        test_msg("Expected '$expected' in ftpdctl output"));
+
+      $client->quit();
+
+      $lines = ftpdctl($ctrls_sock, 'loiter rules reset');
+      $expected = 'LoiterRules reset to low 10 high 50 rate 20';
+      $self->assert(grep { /$expected/ } @$lines,
+        test_msg("Expected '$expected' in ftpdctl output"));
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub loiter_reputation {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'loiter');
+
+  my $loiter_tab = File::Spec->rel2abs("$tmpdir/loiter.tab");
+
+  # Any second unauthenticated connection is always dropped...
+  my $low_watermark = 2;
+  my $high_watermark = 3;
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'DEFAULT:10 lock:0 scoreboard:0 signal:0 loiter:20 loiter.shm:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_loiter.c' => {
+        LoiterEngine => 'on',
+        LoiterLog => $setup->{log_file},
+        LoiterRules => "low $low_watermark high $high_watermark rate 100",
+        LoiterReputation => 'ttl 60 factor 0',
+        LoiterTable => $loiter_tab,
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      # Allow server to start up
+      sleep(2);
+
+      # ...unless, as here, its source has recently authenticated.
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+      $client->quit();
+
+      # Give the session time to exit.
+      sleep(1);
+
+      my $client_opts = {
+        PeerHost => '127.0.0.1',
+        PeerPort => $port,
+        Proto => 'tcp',
+        Type => SOCK_STREAM,
+        Timeout => 30,
+      };
+
+      my $loiterer = IO::Socket::INET->new(%$client_opts);
+      unless ($loiterer) {
+        die("Can't connect to 127.0.0.1:$port: $!");
+      }
+
+      my $banner = <$loiterer>;
+      if ($ENV{TEST_VERBOSE}) {
+        print STDOUT "# Received banner:\n$banner";
+      }
+
+      my $other = IO::Socket::INET->new(%$client_opts);
+      unless ($other) {
+        die("Can't connect to 127.0.0.1:$port: $!");
+      }
+
+      $banner = <$other>;
+      if ($ENV{TEST_VERBOSE}) {
+        print STDOUT "# Received banner:\n$banner";
+      }
+
+      $self->assert($banner !~ /^530/,
+        test_msg("Expected connection to be allowed, got '$banner'"));
+
+      $other->close();
+      $loiterer->close();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub loiter_user_rules {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'loiter');
+
+  my $loiter_tab = File::Spec->rel2abs("$tmpdir/loiter.tab");
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'DEFAULT:10 lock:0 scoreboard:0 signal:0 loiter:20 loiter.shm:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_loiter.c' => {
+        LoiterEngine => 'on',
+        LoiterLog => $setup->{log_file},
+        LoiterTable => $loiter_tab,
+
+        # Any second unauthenticated connection for the same user is always
+        # dropped.
+        LoiterUserRules => 'low 2 high 2 rate 100',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      # Allow server to start up
+      sleep(2);
+
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->user('admin');
+
+      # A second connection for the same user is dropped...
+      my $dropped = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      eval { $dropped->user('admin') };
+      unless ($@) {
+        die("USER admin succeeded unexpectedly");
+      }
+
+      # ...while one for another user is not.
+      my $other = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $other->login($setup->{user}, $setup->{passwd});
+      $other->quit();
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub loiter_class_rules_reserve {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'loiter');
+
+  my $loiter_tab = File::Spec->rel2abs("$tmpdir/loiter.tab");
+  my $reserve = 3;
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'DEFAULT:10 lock:0 scoreboard:0 signal:0 loiter:20 loiter.shm:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_loiter.c' => {
+        LoiterEngine => 'on',
+        LoiterLog => $setup->{log_file},
+        LoiterTable => $loiter_tab,
+
+        # Any unauthenticated connection is always dropped, other than those
+        # reserved for the partners class.
+        LoiterRules => 'low 1 high 1 rate 100',
+        LoiterClassRules => "partners reserve $reserve low 1 high 1 rate 100",
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  if (open(my $fh, ">> $setup->{config_file}")) {
+    print $fh <<EOC;
+<Class partners>
+  From 127.0.0.1
+</Class>
+EOC
+    unless (close($fh)) {
+      die("Can't write $setup->{config_file}: $!");
+    }
+
+  } else {
+    die("Can't open $setup->{config_file}: $!");
+  }
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      # Allow server to start up
+      sleep(2);
+
+      my $client_opts = {
+        PeerHost => '127.0.0.1',
+        PeerPort => $port,
+        Proto => 'tcp',
+        Type => SOCK_STREAM,
+        Timeout => 30,
+      };
+
+      my $clients = [];
+      my $dropped = 0;
+
+      for (my $i = 0; $i <= $reserve; $i++) {
+        my $client = IO::Socket::INET->new(%$client_opts);
+        unless ($client) {
+          die("Can't connect to 127.0.0.1:$port: $!");
+        }
+
+        # Read the banner
+        my $banner = <$client>;
+        if ($ENV{TEST_VERBOSE}) {
+          print STDOUT "# Received banner:\n$banner";
+        }
+
+        if (defined($banner) &&
+            $banner !~ /^530/) {
+          push(@$clients, $client);
+
+        } else {
+          $dropped++;
+        }
+      }
+
+      # The reserved connections are all admitted; the next one is not.
+      my $client_count = scalar(@$clients);
+      $self->assert($client_count == $reserve,
+        test_msg("Expected $reserve clients, got $client_count"));
+      $self->assert($dropped == 1,
+        test_msg("Expected 1 dropped client, got $dropped"));
+
+      foreach my $client (@$clients) {
+        $client->print("QUIT\r\n");
+        $client->flush();
+        my $resp = <$client>;
+        $client->close();
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
 1;
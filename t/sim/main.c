@@ -0,0 +1,525 @@
+/*
+ * ProFTPD - mod_loiter traffic simulator
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Usage: loiter-sim [options]
+ *
+ * Simulates a server, with the given LoiterRules, under the given mix of
+ * legitimate and attack traffic, and reports how many legitimate logins
+ * succeeded and how many slots the attackers held.  With --grid, searches
+ * the given ranges of low, high, and rate for the best rules.
+ */
+
+#include "sim/sim.h"
+#include "curve.h"
+
+#include <getopt.h>
+
+struct grid_range {
+  unsigned int from;
+  unsigned int to;
+  unsigned int step;
+};
+
+struct grid_result {
+  struct loiter_rules rules;
+  struct loiter_sim_result res;
+};
+
+static const char *curve_name = NULL;
+static unsigned int nruns = 1;
+static unsigned int top = 10;
+
+static struct option opts[] = {
+  { "attack",		1, NULL, 'A' },
+  { "attack-rate",	1, NULL, 'a' },
+  { "auth-time",	1, NULL, 'u' },
+  { "burst",		1, NULL, 'b' },
+  { "controller",	1, NULL, 'C' },
+  { "curve",		1, NULL, 'c' },
+  { "duration",		1, NULL, 'd' },
+  { "grid",		1, NULL, 'g' },
+  { "help",		0, NULL, '?' },
+  { "high",		1, NULL, 'H' },
+  { "legit-rate",	1, NULL, 'L' },
+  { "login-timeout",	1, NULL, 'T' },
+  { "low",		1, NULL, 'l' },
+  { "max-instances",	1, NULL, 'm' },
+  { "rate",		1, NULL, 'r' },
+  { "runs",		1, NULL, 'n' },
+  { "seed",		1, NULL, 'S' },
+  { "session-time",	1, NULL, 's' },
+  { "slowloris-conns",	1, NULL, 'N' },
+  { "top",		1, NULL, 't' },
+  { "trace",		1, NULL, 'f' },
+  { NULL,		0, NULL, 0 }
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [options]\n\n", prog);
+  fprintf(stderr, "Server:\n"
+    "  --max-instances N      MaxInstances (default 200; 0 for none)\n"
+    "  --login-timeout SECS   TimeoutLogin (default 300)\n"
+    "  --low N --high N --rate PCT\n"
+    "                         LoiterRules (default low 20 high 100 rate 30)\n"
+    "  --curve NAME           linear, quadratic, exponential, or step\n"
+    "  --controller SETPOINT  use a LoiterController, rather than the rules\n");
+  fprintf(stderr, "Traffic:\n"
+    "  --duration SECS        length of the run (default 3600)\n"
+    "  --legit-rate N         legitimate logins per sec (default 1)\n"
+    "  --auth-time SECS       mean time to authenticate (default 5)\n"
+    "  --session-time SECS    mean time logged in (default 60)\n"
+    "  --attack TYPE          none, poisson, bursty, or slowloris\n"
+    "  --attack-rate N        attack connections per sec (default 10)\n"
+    "  --burst ON:OFF         bursty on/off periods, in secs (default 10:50)\n"
+    "  --slowloris-conns N    slowloris connections (default 500)\n"
+    "  --trace PATH           replay a recorded trace instead\n"
+    "  --seed N               random seed (default 0)\n"
+    "  --runs N               average over N seeds (default 1)\n");
+  fprintf(stderr, "Tuning:\n"
+    "  --grid SPEC            e.g. low=10:40:10,high=50:200:50,rate=10:50:20\n"
+    "  --top N                show the N best rules (default 10)\n");
+}
+
+static int parse_uint(const char *text, unsigned int *v) {
+  char *ptr = NULL;
+  unsigned long n;
+
+  n = strtoul(text, &ptr, 10);
+  if (ptr == text ||
+      (ptr && *ptr)) {
+    return -1;
+  }
+
+  *v = (unsigned int) n;
+  return 0;
+}
+
+static int parse_double(const char *text, double *v) {
+  char *ptr = NULL;
+
+  *v = strtod(text, &ptr);
+  if (ptr == text ||
+      (ptr && *ptr) ||
+      *v < 0.0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Parse "from:to:step", or a single value. */
+static int parse_range(const char *text, struct grid_range *range) {
+  int n;
+
+  n = sscanf(text, "%u:%u:%u", &(range->from), &(range->to), &(range->step));
+  if (n == 1) {
+    range->to = range->from;
+    range->step = 1;
+    return 0;
+  }
+
+  if (n != 3 ||
+      range->from > range->to ||
+      range->step == 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static int parse_grid(pool *p, const char *spec, struct grid_range *low,
+    struct grid_range *high, struct grid_range *rate) {
+  char *text, *ptr;
+
+  text = pstrdup(p, spec);
+
+  for (ptr = strtok(text, ","); ptr != NULL; ptr = strtok(NULL, ",")) {
+    char *value;
+    struct grid_range *range;
+
+    value = strchr(ptr, '=');
+    if (value == NULL) {
+      return -1;
+    }
+
+    *value++ = '\0';
+
+    if (strcasecmp(ptr, "low") == 0) {
+      range = low;
+
+    } else if (strcasecmp(ptr, "high") == 0) {
+      range = high;
+
+    } else if (strcasecmp(ptr, "rate") == 0) {
+      range = rate;
+
+    } else {
+      return -1;
+    }
+
+    if (parse_range(value, range) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Set the rules, adjusted for MaxInstances and along the curve, as
+ * mod_loiter would.
+ */
+static int set_rules(pool *p, struct loiter_sim_config *cfg, unsigned int low,
+    unsigned int high, unsigned int rate) {
+  cfg->rules.low = low;
+  cfg->rules.high = high;
+  cfg->rules.rate = rate;
+  cfg->rules.curve = NULL;
+
+  if (curve_name != NULL) {
+    struct loiter_curve *curve;
+
+    curve = pcalloc(p, sizeof(struct loiter_curve));
+    curve->type = loiter_curve_get_type(curve_name);
+    curve->low = low;
+    curve->high = high;
+    curve->rate = rate;
+
+    if (loiter_curve_compile(p, curve) < 0) {
+      return -1;
+    }
+
+    cfg->rules.curve = curve;
+  }
+
+  (void) loiter_policy_adjust_rules(&(cfg->rules),
+    (unsigned long) cfg->max_instances);
+  return 0;
+}
+
+/* Run the configuration with each of the seeds, and average the results. */
+static int run(pool *p, struct loiter_sim_config *cfg,
+    struct loiter_sim_result *res) {
+  register unsigned int i;
+  uint64_t seed;
+  double legit[5] = { 0.0 }, attack[3] = { 0.0 };
+  double slots = 0.0, unauthd = 0.0, occupancy = 0.0;
+
+  seed = cfg->seed;
+
+  for (i = 0; i < nruns; i++) {
+    struct loiter_sim_result r;
+
+    cfg->seed = seed + i;
+    if (loiter_sim_run(p, cfg, &r) < 0) {
+      cfg->seed = seed;
+      return -1;
+    }
+
+    legit[0] += r.legit_attempts;
+    legit[1] += r.legit_logins;
+    legit[2] += r.legit_dropped;
+    legit[3] += r.legit_refused;
+    legit[4] += r.legit_timed_out;
+    attack[0] += r.attack_attempts;
+    attack[1] += r.attack_dropped;
+    attack[2] += r.attack_refused;
+    slots += r.attack_slots;
+    unauthd += r.unauthd_count;
+    occupancy += r.attack_occupancy;
+  }
+
+  cfg->seed = seed;
+
+  res->legit_attempts = (unsigned int) (legit[0] / nruns + 0.5);
+  res->legit_logins = (unsigned int) (legit[1] / nruns + 0.5);
+  res->legit_dropped = (unsigned int) (legit[2] / nruns + 0.5);
+  res->legit_refused = (unsigned int) (legit[3] / nruns + 0.5);
+  res->legit_timed_out = (unsigned int) (legit[4] / nruns + 0.5);
+  res->attack_attempts = (unsigned int) (attack[0] / nruns + 0.5);
+  res->attack_dropped = (unsigned int) (attack[1] / nruns + 0.5);
+  res->attack_refused = (unsigned int) (attack[2] / nruns + 0.5);
+  res->attack_slots = slots / nruns;
+  res->unauthd_count = unauthd / nruns;
+  res->attack_occupancy = occupancy / nruns;
+
+  return 0;
+}
+
+static void print_result(const struct loiter_sim_config *cfg,
+    const struct loiter_sim_result *res) {
+  if (cfg->use_controller) {
+    printf("LoiterController setpoint %u kp %.2f ki %.2f\n", cfg->setpoint,
+      cfg->kp, cfg->ki);
+
+  } else {
+    printf("LoiterRules low %u high %u rate %u%s%s\n", cfg->rules.low,
+      cfg->rules.high, cfg->rules.rate, curve_name ? " curve " : "",
+      curve_name ? curve_name : "");
+  }
+
+  printf("legitimate logins: %u/%u (%.2f%%)\n", res->legit_logins,
+    res->legit_attempts, loiter_sim_success_pct(res));
+  printf("  dropped: %u, refused (MaxInstances): %u, timed out: %u\n",
+    res->legit_dropped, res->legit_refused, res->legit_timed_out);
+  printf("attack connections: %u\n", res->attack_attempts);
+  printf("  dropped: %u, refused (MaxInstances): %u\n", res->attack_dropped,
+    res->attack_refused);
+  printf("attack slots: mean %.1f", res->attack_slots);
+  if (cfg->max_instances > 0) {
+    printf(" (%.1f%% of MaxInstances)", res->attack_occupancy * 100.0);
+  }
+  printf("\n");
+  printf("unauthenticated connections: mean %.1f\n", res->unauthd_count);
+}
+
+/* The best rules let the most legitimate logins through; of those, the
+ * best let the attackers hold the fewest slots.
+ */
+static int grid_cmp(const void *a, const void *b) {
+  const struct grid_result *ga = a, *gb = b;
+  double pa, pb;
+
+  pa = loiter_sim_success_pct(&(ga->res));
+  pb = loiter_sim_success_pct(&(gb->res));
+
+  if (pa != pb) {
+    return pa > pb ? -1 : 1;
+  }
+
+  if (ga->res.attack_slots != gb->res.attack_slots) {
+    return ga->res.attack_slots < gb->res.attack_slots ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static int grid_search(pool *p, struct loiter_sim_config *cfg,
+    const struct grid_range *low, const struct grid_range *high,
+    const struct grid_range *rate) {
+  register unsigned int i;
+  unsigned int l, h, r, n = 0, size;
+  struct grid_result *results;
+
+  size = ((low->to - low->from) / low->step + 1) *
+    ((high->to - high->from) / high->step + 1) *
+    ((rate->to - rate->from) / rate->step + 1);
+  results = pcalloc(p, sizeof(struct grid_result) * size);
+
+  for (l = low->from; l <= low->to; l += low->step) {
+    for (h = high->from; h <= high->to; h += high->step) {
+      if (l >= h) {
+        continue;
+      }
+
+      for (r = rate->from; r <= rate->to; r += rate->step) {
+        if (r < 1 ||
+            r > 100) {
+          continue;
+        }
+
+        if (set_rules(p, cfg, l, h, r) < 0 ||
+            run(p, cfg, &(results[n].res)) < 0) {
+          fprintf(stderr, "error simulating low %u high %u rate %u: %s\n",
+            l, h, r, strerror(errno));
+          return -1;
+        }
+
+        /* Shown as configured, rather than as adjusted for MaxInstances. */
+        results[n].rules.low = l;
+        results[n].rules.high = h;
+        results[n].rules.rate = r;
+        n++;
+      }
+    }
+  }
+
+  qsort(results, n, sizeof(struct grid_result), grid_cmp);
+
+  printf("%-6s %-6s %-6s %10s %10s %10s %12s\n", "low", "high", "rate",
+    "success%", "legit_drop", "atk_drop", "atk_slots");
+  for (i = 0; i < n && i < top; i++) {
+    printf("%-6u %-6u %-6u %10.2f %10u %10u %12.1f\n", results[i].rules.low,
+      results[i].rules.high, results[i].rules.rate,
+      loiter_sim_success_pct(&(results[i].res)),
+      results[i].res.legit_dropped, results[i].res.attack_dropped,
+      results[i].res.attack_slots);
+  }
+
+  printf("(%u of %u rules shown)\n", i, n);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct loiter_sim_config cfg;
+  struct loiter_sim_result res;
+  struct grid_range low, high, rate;
+  const char *grid = NULL;
+  unsigned int rules_low, rules_high, rules_rate, seed;
+  pool *p;
+  int c, idx = 0, res_code = 0;
+
+  loiter_sim_init(&cfg);
+  rules_low = cfg.rules.low;
+  rules_high = cfg.rules.high;
+  rules_rate = cfg.rules.rate;
+
+  while ((c = getopt_long(argc, argv, "", opts, &idx)) != -1) {
+    int bad = FALSE;
+
+    switch (c) {
+      case 'A':
+        cfg.attack_type = loiter_sim_get_attack_type(optarg);
+        bad = cfg.attack_type < 0;
+        break;
+
+      case 'a':
+        bad = parse_double(optarg, &cfg.attack_rate) < 0;
+        break;
+
+      case 'u':
+        bad = parse_double(optarg, &cfg.legit_auth_time) < 0;
+        break;
+
+      case 'b':
+        bad = sscanf(optarg, "%lf:%lf", &cfg.burst_on, &cfg.burst_off) != 2;
+        break;
+
+      case 'C':
+        cfg.use_controller = TRUE;
+        bad = parse_uint(optarg, &cfg.setpoint) < 0;
+        break;
+
+      case 'c': {
+        int type;
+
+        type = loiter_curve_get_type(optarg);
+        bad = type < 0 || type == LOITER_CURVE_POINTS;
+        curve_name = optarg;
+        break;
+      }
+
+      case 'd':
+        bad = parse_double(optarg, &cfg.duration) < 0;
+        break;
+
+      case 'g':
+        grid = optarg;
+        break;
+
+      case 'H':
+        bad = parse_uint(optarg, &rules_high) < 0;
+        break;
+
+      case 'L':
+        bad = parse_double(optarg, &cfg.legit_rate) < 0;
+        break;
+
+      case 'T':
+        bad = parse_double(optarg, &cfg.login_timeout) < 0;
+        break;
+
+      case 'l':
+        bad = parse_uint(optarg, &rules_low) < 0;
+        break;
+
+      case 'm':
+        bad = parse_uint(optarg, &cfg.max_instances) < 0;
+        break;
+
+      case 'r':
+        bad = parse_uint(optarg, &rules_rate) < 0;
+        break;
+
+      case 'n':
+        bad = parse_uint(optarg, &nruns) < 0 || nruns == 0;
+        break;
+
+      case 'S':
+        bad = parse_uint(optarg, &seed) < 0;
+        cfg.seed = seed;
+        break;
+
+      case 's':
+        bad = parse_double(optarg, &cfg.legit_session_time) < 0;
+        break;
+
+      case 'N':
+        bad = parse_uint(optarg, &cfg.slowloris_conns) < 0;
+        break;
+
+      case 't':
+        bad = parse_uint(optarg, &top) < 0;
+        break;
+
+      case 'f':
+        cfg.trace_path = optarg;
+        break;
+
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (bad) {
+      fprintf(stderr, "%s: invalid value for --%s: %s\n", argv[0],
+        opts[idx].name, optarg);
+      return 1;
+    }
+  }
+
+  p = make_sub_pool(NULL);
+  pr_pool_tag(p, "Loiter simulator");
+
+  if (grid != NULL) {
+    low.from = low.to = rules_low;
+    high.from = high.to = rules_high;
+    rate.from = rate.to = rules_rate;
+    low.step = high.step = rate.step = 1;
+
+    if (parse_grid(p, grid, &low, &high, &rate) < 0) {
+      fprintf(stderr, "%s: invalid grid: %s\n", argv[0], grid);
+      destroy_pool(p);
+      return 1;
+    }
+
+    if (grid_search(p, &cfg, &low, &high, &rate) < 0) {
+      res_code = 1;
+    }
+
+    destroy_pool(p);
+    return res_code;
+  }
+
+  if (set_rules(p, &cfg, rules_low, rules_high, rules_rate) < 0 ||
+      run(p, &cfg, &res) < 0) {
+    fprintf(stderr, "%s: error simulating: %s\n", argv[0], strerror(errno));
+    destroy_pool(p);
+    return 1;
+  }
+
+  print_result(&cfg, &res);
+
+  destroy_pool(p);
+  return 0;
+}
@@ -0,0 +1,680 @@
+/*
+ * ProFTPD - mod_loiter traffic simulator
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "sim/sim.h"
+#include "controller.h"
+#include "prng.h"
+
+#include <math.h>
+
+#define SIM_EV_LEGIT_ARRIVAL		1
+#define SIM_EV_ATTACK_ARRIVAL		2
+#define SIM_EV_AUTH			3
+#define SIM_EV_CLOSE			4
+#define SIM_EV_CONTROL			5
+
+struct sim_event {
+  double t;
+  int type;
+
+  /* For arrivals, whether it was replayed from a trace, rather than
+   * generated; for closes, whether the connection was authenticated.
+   */
+  int flag;
+
+  /* For replayed arrivals, the times taken to authenticate, and then spent
+   * logged in (or, for attackers, the time held); for authentications, the
+   * time to be spent logged in.
+   */
+  double auth_time;
+  double session_time;
+
+  int attacker;
+};
+
+/* A binary min-heap of pending events, ordered by time. */
+struct sim_queue {
+  pool *pool;
+  struct sim_event *events;
+  unsigned int nevents;
+  unsigned int size;
+};
+
+struct sim_state {
+  const struct loiter_sim_config *cfg;
+  struct loiter_sim_result *res;
+  struct sim_queue queue;
+
+  /* The generator for the traffic; the drops are rolled using mod_loiter's
+   * own generator, on a separate stream.
+   */
+  uint64_t rng;
+
+  unsigned int conn_count;
+  unsigned int authd_count;
+  unsigned int attack_count;
+
+  struct loiter_controller ctl;
+  unsigned int control_pct;
+
+  double now;
+  double attack_area;
+  double unauthd_area;
+};
+
+static const char *trace_channel = "loiter.sim";
+
+static void queue_push(struct sim_queue *q, const struct sim_event *ev) {
+  unsigned int i;
+
+  if (q->nevents == q->size) {
+    struct sim_event *events;
+    unsigned int size;
+
+    size = q->size > 0 ? q->size * 2 : 64;
+    events = palloc(q->pool, sizeof(struct sim_event) * size);
+    if (q->nevents > 0) {
+      memcpy(events, q->events, sizeof(struct sim_event) * q->nevents);
+    }
+
+    q->events = events;
+    q->size = size;
+  }
+
+  i = q->nevents++;
+  while (i > 0) {
+    unsigned int parent;
+
+    parent = (i - 1) / 2;
+    if (q->events[parent].t <= ev->t) {
+      break;
+    }
+
+    q->events[i] = q->events[parent];
+    i = parent;
+  }
+
+  q->events[i] = *ev;
+}
+
+static int queue_pop(struct sim_queue *q, struct sim_event *ev) {
+  struct sim_event last;
+  unsigned int i = 0;
+
+  if (q->nevents == 0) {
+    return -1;
+  }
+
+  *ev = q->events[0];
+  last = q->events[--q->nevents];
+
+  while (TRUE) {
+    unsigned int child;
+
+    child = (2 * i) + 1;
+    if (child >= q->nevents) {
+      break;
+    }
+
+    if (child + 1 < q->nevents &&
+        q->events[child + 1].t < q->events[child].t) {
+      child++;
+    }
+
+    if (last.t <= q->events[child].t) {
+      break;
+    }
+
+    q->events[i] = q->events[child];
+    i = child;
+  }
+
+  if (q->nevents > 0) {
+    q->events[i] = last;
+  }
+
+  return 0;
+}
+
+static void schedule(struct sim_state *st, double t, int type, int attacker) {
+  struct sim_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.t = t;
+  ev.type = type;
+  ev.attacker = attacker;
+  queue_push(&(st->queue), &ev);
+}
+
+/* splitmix64; the traffic need not be of the same quality as the drops. */
+static uint64_t next_rand(struct sim_state *st) {
+  uint64_t z;
+
+  st->rng += (uint64_t) 0x9e3779b97f4a7c15ULL;
+  z = st->rng;
+  z = (z ^ (z >> 30)) * (uint64_t) 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * (uint64_t) 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* Returns an exponentially distributed time, of the given mean. */
+static double next_exp(struct sim_state *st, double mean) {
+  double u;
+
+  u = (double) (next_rand(st) >> 11) / 9007199254740992.0;
+  return -mean * log(1.0 - u);
+}
+
+static double next_legit_arrival(struct sim_state *st) {
+  return st->now + next_exp(st, 1.0 / st->cfg->legit_rate);
+}
+
+static double next_attack_arrival(struct sim_state *st) {
+  const struct loiter_sim_config *cfg;
+  double t, period, phase;
+
+  cfg = st->cfg;
+  t = st->now + next_exp(st, 1.0 / cfg->attack_rate);
+
+  if (cfg->attack_type != LOITER_SIM_ATTACK_BURSTY) {
+    return t;
+  }
+
+  /* Arrivals are memoryless, so one falling in an "off" period simply moves
+   * to the next "on" period.
+   */
+  period = cfg->burst_on + cfg->burst_off;
+  phase = fmod(t, period);
+  if (phase >= cfg->burst_on) {
+    t += period - phase;
+  }
+
+  return t;
+}
+
+/* Returns TRUE if a new connection is admitted, FALSE if it was refused
+ * (for MaxInstances) or dropped, counting it accordingly.
+ */
+static int admit(struct sim_state *st, int attacker) {
+  const struct loiter_sim_config *cfg;
+  unsigned int unauthd_count, pct = 0;
+
+  cfg = st->cfg;
+
+  if (cfg->max_instances > 0 &&
+      st->conn_count >= cfg->max_instances) {
+    if (attacker) {
+      st->res->attack_refused++;
+
+    } else {
+      st->res->legit_refused++;
+    }
+
+    return FALSE;
+  }
+
+  unauthd_count = st->conn_count - st->authd_count;
+
+  if (cfg->use_controller) {
+    pct = st->control_pct;
+
+  } else if (unauthd_count >= cfg->rules.low) {
+    pct = loiter_policy_drop_pct(&(cfg->rules), unauthd_count);
+  }
+
+  if (loiter_prng_chance(pct * LOITER_PRNG_PCT) == TRUE) {
+    if (attacker) {
+      st->res->attack_dropped++;
+
+    } else {
+      st->res->legit_dropped++;
+    }
+
+    return FALSE;
+  }
+
+  st->conn_count++;
+  if (attacker) {
+    st->attack_count++;
+  }
+
+  return TRUE;
+}
+
+static void handle_legit_arrival(struct sim_state *st,
+    const struct sim_event *ev) {
+  const struct loiter_sim_config *cfg;
+  double auth_time, session_time;
+  struct sim_event next;
+
+  cfg = st->cfg;
+
+  if (ev->flag == FALSE) {
+    double t;
+
+    t = next_legit_arrival(st);
+    if (t < cfg->duration) {
+      schedule(st, t, SIM_EV_LEGIT_ARRIVAL, FALSE);
+    }
+
+    auth_time = next_exp(st, cfg->legit_auth_time);
+    session_time = next_exp(st, cfg->legit_session_time);
+
+  } else {
+    auth_time = ev->auth_time;
+    session_time = ev->session_time;
+  }
+
+  st->res->legit_attempts++;
+
+  if (admit(st, FALSE) == FALSE) {
+    return;
+  }
+
+  memset(&next, 0, sizeof(next));
+
+  if (auth_time >= cfg->login_timeout) {
+    st->res->legit_timed_out++;
+
+    next.t = st->now + cfg->login_timeout;
+    next.type = SIM_EV_CLOSE;
+
+  } else {
+    /* Counted now, rather than when it happens, so that logins still in
+     * progress at the end of the run are not counted as failures.
+     */
+    st->res->legit_logins++;
+
+    next.t = st->now + auth_time;
+    next.type = SIM_EV_AUTH;
+    next.session_time = session_time;
+  }
+
+  queue_push(&(st->queue), &next);
+}
+
+static void handle_attack_arrival(struct sim_state *st,
+    const struct sim_event *ev) {
+  const struct loiter_sim_config *cfg;
+  double hold;
+
+  cfg = st->cfg;
+  hold = cfg->login_timeout;
+
+  if (ev->flag == TRUE) {
+    if (ev->auth_time > 0.0 &&
+        ev->auth_time < hold) {
+      hold = ev->auth_time;
+    }
+
+  } else if (cfg->attack_type != LOITER_SIM_ATTACK_SLOWLORIS) {
+    double t;
+
+    t = next_attack_arrival(st);
+    if (t < cfg->duration) {
+      schedule(st, t, SIM_EV_ATTACK_ARRIVAL, TRUE);
+    }
+  }
+
+  st->res->attack_attempts++;
+
+  if (admit(st, TRUE) == FALSE) {
+    /* A slowloris attacker simply tries again. */
+    if (ev->flag == FALSE &&
+        cfg->attack_type == LOITER_SIM_ATTACK_SLOWLORIS) {
+      schedule(st, st->now + cfg->slowloris_retry, SIM_EV_ATTACK_ARRIVAL,
+        TRUE);
+    }
+
+    return;
+  }
+
+  schedule(st, st->now + hold, SIM_EV_CLOSE, TRUE);
+}
+
+static void handle_auth(struct sim_state *st, const struct sim_event *ev) {
+  struct sim_event next;
+
+  st->authd_count++;
+
+  memset(&next, 0, sizeof(next));
+  next.t = st->now + ev->session_time;
+  next.type = SIM_EV_CLOSE;
+  next.flag = TRUE;
+  queue_push(&(st->queue), &next);
+}
+
+static void handle_close(struct sim_state *st, const struct sim_event *ev) {
+  st->conn_count--;
+
+  if (ev->flag == TRUE) {
+    st->authd_count--;
+  }
+
+  if (ev->attacker) {
+    st->attack_count--;
+
+    /* Only the synthetic slowloris reconnects; a replayed trace already
+     * records any reconnects.
+     */
+    if (st->cfg->attack_type == LOITER_SIM_ATTACK_SLOWLORIS &&
+        st->cfg->trace_path == NULL) {
+      schedule(st, st->now + st->cfg->slowloris_retry, SIM_EV_ATTACK_ARRIVAL,
+        TRUE);
+    }
+  }
+}
+
+static void handle_control(struct sim_state *st) {
+  const struct loiter_sim_config *cfg;
+
+  cfg = st->cfg;
+
+  (void) loiter_controller_step(&(st->ctl),
+    st->conn_count - st->authd_count, cfg->interval, &(st->control_pct));
+  schedule(st, st->now + cfg->interval, SIM_EV_CONTROL, FALSE);
+}
+
+static int load_trace(struct sim_state *st, const char *path) {
+  FILE *fp;
+  char buf[256];
+  unsigned int lineno = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    struct sim_event ev;
+    char kind[16];
+    double t, auth_time = 0.0, session_time = 0.0;
+    int n;
+
+    lineno++;
+
+    if (buf[0] == '#' ||
+        buf[strspn(buf, " \t\r\n")] == '\0') {
+      continue;
+    }
+
+    n = sscanf(buf, "%lf %15s %lf %lf", &t, kind, &auth_time,
+      &session_time);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.t = t;
+    ev.flag = TRUE;
+    ev.auth_time = auth_time;
+    ev.session_time = session_time;
+
+    if (n == 4 &&
+        strcasecmp(kind, "legit") == 0) {
+      ev.type = SIM_EV_LEGIT_ARRIVAL;
+
+    } else if (n >= 2 &&
+               strcasecmp(kind, "attack") == 0) {
+      ev.type = SIM_EV_ATTACK_ARRIVAL;
+      ev.attacker = TRUE;
+
+    } else {
+      pr_trace_msg(trace_channel, 1, "%s:%u: malformed trace line", path,
+        lineno);
+      fclose(fp);
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (t < 0.0 ||
+        t >= st->cfg->duration) {
+      continue;
+    }
+
+    queue_push(&(st->queue), &ev);
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+static void schedule_traffic(struct sim_state *st) {
+  const struct loiter_sim_config *cfg;
+  register unsigned int i;
+
+  cfg = st->cfg;
+
+  if (cfg->legit_rate > 0.0) {
+    double t;
+
+    t = next_legit_arrival(st);
+    if (t < cfg->duration) {
+      schedule(st, t, SIM_EV_LEGIT_ARRIVAL, FALSE);
+    }
+  }
+
+  switch (cfg->attack_type) {
+    case LOITER_SIM_ATTACK_POISSON:
+    case LOITER_SIM_ATTACK_BURSTY:
+      if (cfg->attack_rate > 0.0) {
+        double t;
+
+        t = next_attack_arrival(st);
+        if (t < cfg->duration) {
+          schedule(st, t, SIM_EV_ATTACK_ARRIVAL, TRUE);
+        }
+      }
+      break;
+
+    case LOITER_SIM_ATTACK_SLOWLORIS:
+      /* Open the connections over the first second. */
+      for (i = 0; i < cfg->slowloris_conns; i++) {
+        schedule(st, (double) i / cfg->slowloris_conns,
+          SIM_EV_ATTACK_ARRIVAL, TRUE);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void loiter_sim_init(struct loiter_sim_config *cfg) {
+  if (cfg == NULL) {
+    return;
+  }
+
+  memset(cfg, 0, sizeof(struct loiter_sim_config));
+  cfg->duration = 3600.0;
+  cfg->max_instances = 200;
+  cfg->login_timeout = 300.0;
+
+  cfg->rules.low = LOITER_RULES_DEFAULT_LOW;
+  cfg->rules.high = LOITER_RULES_DEFAULT_HIGH;
+  cfg->rules.rate = LOITER_RULES_DEFAULT_RATE;
+
+  cfg->kp = LOITER_CONTROLLER_DEFAULT_KP;
+  cfg->ki = LOITER_CONTROLLER_DEFAULT_KI;
+  cfg->interval = LOITER_CONTROLLER_DEFAULT_INTERVAL;
+
+  cfg->legit_rate = 1.0;
+  cfg->legit_auth_time = 5.0;
+  cfg->legit_session_time = 60.0;
+
+  cfg->attack_type = LOITER_SIM_ATTACK_NONE;
+  cfg->attack_rate = 10.0;
+  cfg->burst_on = 10.0;
+  cfg->burst_off = 50.0;
+  cfg->slowloris_conns = 500;
+  cfg->slowloris_retry = 0.1;
+}
+
+int loiter_sim_run(pool *p, const struct loiter_sim_config *cfg,
+    struct loiter_sim_result *res) {
+  struct sim_state st;
+  struct sim_event ev;
+  pool *tmp_pool;
+
+  if (p == NULL ||
+      cfg == NULL ||
+      res == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (cfg->duration <= 0.0 ||
+      cfg->login_timeout <= 0.0 ||
+      cfg->legit_rate < 0.0 ||
+      cfg->rules.low >= cfg->rules.high ||
+      (cfg->use_controller && cfg->interval == 0) ||
+      ((cfg->attack_type == LOITER_SIM_ATTACK_POISSON ||
+        cfg->attack_type == LOITER_SIM_ATTACK_BURSTY) &&
+       cfg->attack_rate < 0.0) ||
+      (cfg->attack_type == LOITER_SIM_ATTACK_BURSTY &&
+       cfg->burst_on <= 0.0) ||
+      (cfg->attack_type == LOITER_SIM_ATTACK_SLOWLORIS &&
+       cfg->slowloris_retry <= 0.0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(res, 0, sizeof(struct loiter_sim_result));
+  memset(&st, 0, sizeof(st));
+  st.cfg = cfg;
+  st.res = res;
+  st.rng = cfg->seed ^ (uint64_t) 0x6a09e667f3bcc909ULL;
+
+  tmp_pool = make_sub_pool(p);
+  pr_pool_tag(tmp_pool, "Loiter simulator pool");
+  st.queue.pool = tmp_pool;
+
+  (void) loiter_prng_seed(cfg->seed, 0);
+
+  if (cfg->use_controller) {
+    (void) loiter_controller_init(&(st.ctl), cfg->setpoint, cfg->kp, cfg->ki,
+      0);
+    schedule(&st, (double) cfg->interval, SIM_EV_CONTROL, FALSE);
+  }
+
+  if (cfg->trace_path != NULL) {
+    if (load_trace(&st, cfg->trace_path) < 0) {
+      int xerrno = errno;
+
+      destroy_pool(tmp_pool);
+      errno = xerrno;
+      return -1;
+    }
+
+  } else {
+    schedule_traffic(&st);
+  }
+
+  while (queue_pop(&(st.queue), &ev) == 0) {
+    double dt;
+
+    if (ev.t > cfg->duration) {
+      break;
+    }
+
+    dt = ev.t - st.now;
+    st.attack_area += dt * st.attack_count;
+    st.unauthd_area += dt * (st.conn_count - st.authd_count);
+    st.now = ev.t;
+
+    switch (ev.type) {
+      case SIM_EV_LEGIT_ARRIVAL:
+        handle_legit_arrival(&st, &ev);
+        break;
+
+      case SIM_EV_ATTACK_ARRIVAL:
+        handle_attack_arrival(&st, &ev);
+        break;
+
+      case SIM_EV_AUTH:
+        handle_auth(&st, &ev);
+        break;
+
+      case SIM_EV_CLOSE:
+        handle_close(&st, &ev);
+        break;
+
+      case SIM_EV_CONTROL:
+        handle_control(&st);
+        break;
+    }
+  }
+
+  /* Account for the time from the last event to the end of the run. */
+  st.attack_area += (cfg->duration - st.now) * st.attack_count;
+  st.unauthd_area += (cfg->duration - st.now) *
+    (st.conn_count - st.authd_count);
+
+  res->attack_slots = st.attack_area / cfg->duration;
+  res->unauthd_count = st.unauthd_area / cfg->duration;
+  if (cfg->max_instances > 0) {
+    res->attack_occupancy = res->attack_slots / cfg->max_instances;
+  }
+
+  pr_trace_msg(trace_channel, 9,
+    "simulated %.0f secs: %u/%u legitimate logins, %u attack connections "
+    "(%u dropped), %.1f attack slots", cfg->duration, res->legit_logins,
+    res->legit_attempts, res->attack_attempts, res->attack_dropped,
+    res->attack_slots);
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
+
+double loiter_sim_success_pct(const struct loiter_sim_result *res) {
+  if (res == NULL ||
+      res->legit_attempts == 0) {
+    return 100.0;
+  }
+
+  return (100.0 * res->legit_logins) / res->legit_attempts;
+}
+
+int loiter_sim_get_attack_type(const char *name) {
+  if (name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (strcasecmp(name, "none") == 0) {
+    return LOITER_SIM_ATTACK_NONE;
+  }
+
+  if (strcasecmp(name, "poisson") == 0) {
+    return LOITER_SIM_ATTACK_POISSON;
+  }
+
+  if (strcasecmp(name, "bursty") == 0) {
+    return LOITER_SIM_ATTACK_BURSTY;
+  }
+
+  if (strcasecmp(name, "slowloris") == 0) {
+    return LOITER_SIM_ATTACK_SLOWLORIS;
+  }
+
+  errno = ENOENT;
+  return -1;
+}
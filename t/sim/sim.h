@@ -0,0 +1,131 @@
+/*
+ * ProFTPD - mod_loiter traffic simulator
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_LOITER_SIM_H
+#define MOD_LOITER_SIM_H
+
+#include "mod_loiter.h"
+#include "policy.h"
+
+/* The attack traffic, if any, mixed with the legitimate logins. */
+#define LOITER_SIM_ATTACK_NONE			0
+
+/* Connections arriving at a constant average rate, each holding its slot
+ * until the login timeout.
+ */
+#define LOITER_SIM_ATTACK_POISSON		1
+
+/* Likewise, but only during the "on" period of each on/off cycle. */
+#define LOITER_SIM_ATTACK_BURSTY		2
+
+/* A fixed number of connections kept open, each reconnecting as soon as it
+ * is dropped or timed out, like doc/sshext.c.
+ */
+#define LOITER_SIM_ATTACK_SLOWLORIS		3
+
+struct loiter_sim_config {
+  /* How long to simulate, in seconds. */
+  double duration;
+
+  /* The server: its MaxInstances (zero for no limit), TimeoutLogin, and
+   * LoiterRules (already adjusted for MaxInstances).
+   */
+  unsigned int max_instances;
+  double login_timeout;
+  struct loiter_rules rules;
+
+  /* If set, the drop probability is driven by a LoiterController, updated
+   * every interval secs, rather than by the rules.
+   */
+  int use_controller;
+  unsigned int setpoint;
+  double kp;
+  double ki;
+  unsigned int interval;
+
+  /* Legitimate clients: their arrival rate (per sec), and the mean times
+   * taken to authenticate, and then spent logged in; both exponentially
+   * distributed.
+   */
+  double legit_rate;
+  double legit_auth_time;
+  double legit_session_time;
+
+  /* The attack; see above. */
+  int attack_type;
+  double attack_rate;
+  double burst_on;
+  double burst_off;
+  unsigned int slowloris_conns;
+  double slowloris_retry;
+
+  /* A recorded trace to replay, in place of the synthetic traffic.  Each
+   * line is either "time legit auth-secs session-secs" or "time attack
+   * [hold-secs]"; blank lines and lines starting with '#' are ignored.
+   */
+  const char *trace_path;
+
+  /* Runs with the same seed see the same traffic and rolls of the dice, so
+   * that e.g. different rules can be compared like for like.
+   */
+  uint64_t seed;
+};
+
+struct loiter_sim_result {
+  unsigned int legit_attempts;
+  unsigned int legit_logins;
+  unsigned int legit_dropped;
+  unsigned int legit_refused;
+  unsigned int legit_timed_out;
+
+  unsigned int attack_attempts;
+  unsigned int attack_dropped;
+  unsigned int attack_refused;
+
+  /* The mean number of connections held by attackers, and the mean number
+   * of unauthenticated connections, over the run.
+   */
+  double attack_slots;
+  double unauthd_count;
+
+  /* The mean fraction of MaxInstances held by attackers, if limited. */
+  double attack_occupancy;
+};
+
+/* Fill in the defaults: an hour of 1 login/sec, against MaxInstances 200,
+ * TimeoutLogin 300, and the default LoiterRules; no attack.
+ */
+void loiter_sim_init(struct loiter_sim_config *cfg);
+
+/* Run the simulation, using the same drop policy code as mod_loiter. */
+int loiter_sim_run(pool *p, const struct loiter_sim_config *cfg,
+  struct loiter_sim_result *res);
+
+/* Returns the percentage of legitimate logins which succeeded. */
+double loiter_sim_success_pct(const struct loiter_sim_result *res);
+
+/* Returns the attack type of the given name, or -1 if unknown. */
+int loiter_sim_get_attack_type(const char *name);
+
+#endif /* MOD_LOITER_SIM_H */